@@ -50,11 +50,62 @@
 #define ntohs(x)    uip_ntohs(x)
 #endif
 
+// MARK: -
+// MARK: Option Header Table
+
+// Number of extended delta bytes (bits 0-1) and extended length
+// bytes (bits 2-3) that follow the first byte of an option, indexed
+// by that first byte. Either nibble being 15 makes the byte invalid,
+// which includes the 0xFF start-of-content marker.
+#define COAP_OPTION_EXT_NIBBLE(n)	(((n) == 13) ? 1 : ((n) == 14) ? 2 : 0)
+#define COAP_OPTION_EXT(b)	\
+	((((b) >> 4) == 15 || ((b) & 0x0F) == 15)	\
+		? COAP_OPTION_EXT_INVALID	\
+		: (COAP_OPTION_EXT_NIBBLE((b) >> 4) | (COAP_OPTION_EXT_NIBBLE((b) & 0x0F) << 2)))
+#define COAP_OPTION_EXT_ROW(h)	\
+	COAP_OPTION_EXT(h+0x0), COAP_OPTION_EXT(h+0x1), COAP_OPTION_EXT(h+0x2), COAP_OPTION_EXT(h+0x3),	\
+	COAP_OPTION_EXT(h+0x4), COAP_OPTION_EXT(h+0x5), COAP_OPTION_EXT(h+0x6), COAP_OPTION_EXT(h+0x7),	\
+	COAP_OPTION_EXT(h+0x8), COAP_OPTION_EXT(h+0x9), COAP_OPTION_EXT(h+0xA), COAP_OPTION_EXT(h+0xB),	\
+	COAP_OPTION_EXT(h+0xC), COAP_OPTION_EXT(h+0xD), COAP_OPTION_EXT(h+0xE), COAP_OPTION_EXT(h+0xF)
+#define COAP_OPTION_EXT_INVALID		(0x80)
+
+static const uint8_t coap_option_ext[256] = {
+	COAP_OPTION_EXT_ROW(0x00), COAP_OPTION_EXT_ROW(0x10), COAP_OPTION_EXT_ROW(0x20), COAP_OPTION_EXT_ROW(0x30),
+	COAP_OPTION_EXT_ROW(0x40), COAP_OPTION_EXT_ROW(0x50), COAP_OPTION_EXT_ROW(0x60), COAP_OPTION_EXT_ROW(0x70),
+	COAP_OPTION_EXT_ROW(0x80), COAP_OPTION_EXT_ROW(0x90), COAP_OPTION_EXT_ROW(0xA0), COAP_OPTION_EXT_ROW(0xB0),
+	COAP_OPTION_EXT_ROW(0xC0), COAP_OPTION_EXT_ROW(0xD0), COAP_OPTION_EXT_ROW(0xE0), COAP_OPTION_EXT_ROW(0xF0),
+};
+
+// Decodes an extended option delta or length, given its nibble and
+// a pointer to its extension bytes.
+static inline coap_size_t
+coap_option_ext_value(uint8_t nibble, const uint8_t* ext) {
+	if (nibble == 13) {
+		return 13 + ext[0];
+	}
+	if (nibble == 14) {
+		return (coap_size_t)(269 + ext[1] + (ext[0] << 8));
+	}
+	return nibble;
+}
+
+// MARK: -
+// MARK: Option Decoding
+
 uint8_t*
 coap_decode_option(const uint8_t* buffer, coap_option_key_t* key, const uint8_t** value, coap_size_t* lenP) {
 	coap_size_t len;
 
-again:
+	// Fast path: short delta and short length, which is
+	// by far the most common case.
+	if (coap_option_ext[*buffer] == 0) {
+		len = (*buffer & 0x0F);
+		if (key) *key += (*buffer >> 4);
+		buffer += 1;
+		if (lenP) *lenP = len;
+		if (value) *value = buffer;
+		return (uint8_t*)buffer + len;
+	}
 
 	len = (*buffer & 0x0F);
 
@@ -162,7 +213,8 @@ coap_encode_option(
 
 	buffer += value_offset;
 
-	memcpy(buffer, value, len);
+	// The value may overlap the buffer when options are re-encoded in place.
+	memmove(buffer, value, len);
 
 	buffer += len;
 
@@ -274,8 +326,8 @@ coap_decode_block(struct coap_block_info_s* block_info, uint32_t block)
 bool
 coap_verify_packet(const char* packet,coap_size_t packet_size) {
 	const struct coap_header_s* const header = (const void*)packet;
-	coap_option_key_t key = 0;
-	const uint8_t* option_ptr = header->token + header->token_len;
+	const uint8_t* const bytes = (const uint8_t*)packet;
+	unsigned offset;
 
 	if (packet_size < 4) {
 		// Packet too small
@@ -306,31 +358,48 @@ coap_verify_packet(const char* packet,coap_size_t packet_size) {
 		return false;
 	}
 
-	for(;option_ptr && (unsigned)(option_ptr-(uint8_t*)header)<packet_size && option_ptr[0]!=0xFF;) {
-		option_ptr = coap_decode_option(option_ptr, &key, NULL, NULL);
-		if(!option_ptr) {
+	offset = 4 + header->token_len;
+
+	// Skip from option to option using the header table. Every
+	// extension byte is checked to be inside of the packet
+	// before it is read.
+	while (offset < packet_size && bytes[offset] != 0xFF) {
+		const uint8_t first = bytes[offset];
+		const uint8_t ext = coap_option_ext[first];
+		unsigned header_len;
+
+		if (ext == COAP_OPTION_EXT_INVALID) {
 			DEBUG_PRINTF("PACKET CORRUPTED: Premature end of options");
 			return false;
 		}
-		if((unsigned)(option_ptr-(uint8_t*)header)>packet_size) {
+
+		header_len = 1 + (ext & 3) + (ext >> 2);
+
+		if (offset + header_len > packet_size) {
+			DEBUG_PRINTF("PACKET CORRUPTED: Premature end of options");
+			return false;
+		}
+
+		offset += header_len + coap_option_ext_value(
+			first & 0x0F,
+			bytes + offset + 1 + (ext & 3)
+		);
+
+		if (offset > packet_size) {
 			DEBUG_PRINTF("PACKET CORRUPTED: Premature end of options");
 			return false;
 		}
 	}
 
-	if((unsigned)(option_ptr-(uint8_t*)header)>packet_size) {
+	if (offset > packet_size) {
 		// Option too large
 		DEBUG_PRINTF("PACKET CORRUPTED: Options overflow packet size");
 		return false;
 	}
 
-	if((unsigned)(option_ptr-(uint8_t*)header)<packet_size) {
-		if(option_ptr && option_ptr[0]==0xFF) {
-		} else {
-			DEBUG_PRINTF("PACKET CORRUPTED: Missing content marker");
-			return false;
-		}
-	}
+	// If anything follows the options, it has to start
+	// with the start-of-content marker, which the loop
+	// above stops on.
 
 	return true;
 }
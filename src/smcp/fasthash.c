@@ -14,18 +14,22 @@
 // MARK: -
 // MARK: Fasthash
 
+#define FASTHASH_ROTL32(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
+
 static void
 fasthash_feed_block(struct fasthash_state_s* state, uint32_t blk) {
-	// XOR the block count into the block.
-	blk ^= (state->bytes >> 2);
+	// Scramble the block and fold it into the hash state. These are
+	// the same steps as MurmurHash3, which mixes every input bit into
+	// every output bit. The linear congruential generator this used to
+	// use left the low bits of the hash depending only on the low bits
+	// of the input, which made it collide badly on addresses.
+	blk *= 0xcc9e2d51;
+	blk = FASTHASH_ROTL32(blk, 15);
+	blk *= 0x1b873593;
 
-	// XOR the previous result into the hash state.
 	state->hash ^= blk;
-
-	// Mix up the hash state using a linear congruential generator.
-	state->hash = state->hash * 1664525 + 1013904223;
-
-	state->hash ^= blk * 1103515245;
+	state->hash = FASTHASH_ROTL32(state->hash, 13);
+	state->hash = state->hash * 5 + 0xe6546b64;
 }
 
 void
@@ -53,11 +57,23 @@ fasthash_feed(struct fasthash_state_s* state, const uint8_t* data, uint8_t len)
 
 fasthash_hash_t
 fasthash_finish(struct fasthash_state_s* state) {
+	fasthash_hash_t hash;
+
 	if (state->bytes & 3) {
 		fasthash_feed_block(state, state->next);
-		state->bytes = 0;
+		state->next = 0;
+		state->bytes = (state->bytes + 3) & ~3;
 	}
-	return state->hash;
+
+	// Final avalanche, so that short inputs are well mixed too.
+	hash = state->hash ^ state->bytes;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash;
 }
 
 uint32_t
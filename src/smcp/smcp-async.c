@@ -40,21 +40,28 @@
 #include "smcp-internal.h"
 #include "smcp-logging.h"
 
+#include <stdlib.h>
+
 smcp_status_t
-smcp_outbound_begin_async_response(coap_code_t code, struct smcp_async_response_s* x) {
+smcp_outbound_begin_stashed_response(
+	coap_code_t code,
+	const struct coap_header_s* request,
+	coap_size_t request_len,
+	const smcp_sockaddr_t* remote,
+	const smcp_sockaddr_t* local
+) {
 	smcp_status_t ret = 0;
 	smcp_t const self = smcp_get_current_instance();
 
-	assert(NULL != x);
+	assert(NULL != request);
 
-	self->inbound.packet = &x->request.header;
-	self->inbound.packet_len = x->request_len;
-	self->inbound.content_ptr = (char*)x->request.header.token + x->request.header.token_len;
-	self->inbound.last_option_key = 0;
-	self->inbound.this_option = x->request.header.token;
+	self->inbound.packet = request;
+	self->inbound.packet_len = request_len;
+	self->inbound.content_ptr = (char*)request->token + request->token_len;
 	self->inbound.is_fake = true;
-	smcp_plat_set_remote_sockaddr(&x->sockaddr_remote);
-	smcp_plat_set_local_sockaddr(&x->sockaddr_local);
+	smcp_inbound_index_options(self);
+	smcp_plat_set_remote_sockaddr(remote);
+	smcp_plat_set_local_sockaddr(local);
 
 	self->is_processing_message = true;
 	self->did_respond = false;
@@ -62,43 +69,126 @@ smcp_outbound_begin_async_response(coap_code_t code, struct smcp_async_response_
 	ret = smcp_outbound_begin_response(code);
 	require_noerr(ret, bail);
 
-	self->outbound.packet->msg_id = self->current_transaction->msg_id;
+	if (self->current_transaction != NULL) {
+		self->outbound.packet->msg_id = self->current_transaction->msg_id;
+	} else {
+		// Sent once, without a transaction.
+		self->outbound.packet->msg_id = smcp_get_next_msg_id(self);
+	}
 
-	self->outbound.packet->tt = x->request.header.tt;
+	self->outbound.packet->tt = request->tt;
 
-	ret = smcp_outbound_set_token(x->request.header.token, x->request.header.token_len);
+	ret = smcp_outbound_set_token(request->token, request->token_len);
 	require_noerr(ret, bail);
 
-	assert(coap_verify_packet((const char*)x->request.bytes, x->request_len));
+	assert(coap_verify_packet((const char*)request, request_len));
 bail:
 	return ret;
 }
 
 smcp_status_t
-smcp_start_async_response(struct smcp_async_response_s* x, int flags) {
-	smcp_status_t ret = 0;
-	smcp_t const self = smcp_get_current_instance();
+smcp_outbound_begin_async_response(coap_code_t code, struct smcp_async_response_s* x) {
+	const struct coap_header_s* request = &x->request.header;
 
-	require_action_string(x!=NULL,bail,ret=SMCP_STATUS_INVALID_ARGUMENT,"NULL async_response arg");
+	assert(NULL != x);
 
-	require_action_string(
-		smcp_inbound_get_packet_length()-smcp_inbound_get_content_len()<=sizeof(x->request),
-		bail,
-		(smcp_outbound_quick_response(COAP_RESULT_413_REQUEST_ENTITY_TOO_LARGE,NULL),ret=SMCP_STATUS_FAILURE),
-		"Request too big for async response"
+#if !SMCP_AVOID_MALLOC
+	if (x->full_request != NULL) {
+		request = (const struct coap_header_s*)x->full_request;
+	}
+#endif
+
+	return smcp_outbound_begin_stashed_response(
+		code,
+		request,
+		x->request_len,
+		&x->sockaddr_remote,
+		&x->sockaddr_local
 	);
+}
+
+//! Keeps just the header, the token, and the Uri-Path and Uri-Query options.
+static smcp_status_t
+smcp_async_response_capture_(smcp_t self, struct smcp_async_response_s* x)
+{
+	const struct coap_header_s* const packet = self->inbound.packet;
+	const uint8_t* iter = packet->token + packet->token_len;
+	const uint8_t* const end = (const uint8_t*)packet + self->inbound.packet_len - self->inbound.content_len;
+	const coap_size_t header_len = (coap_size_t)(iter - (const uint8_t*)packet);
+	uint8_t* const out_end = x->request.bytes + sizeof(x->request);
+	uint8_t* out = x->request.bytes + header_len;
+	coap_option_key_t key = 0;
+	coap_option_key_t last_key = 0;
 
-	x->request_len = smcp_inbound_get_packet_length()-smcp_inbound_get_content_len();
-	check(x->request_len <= sizeof(x->request));
-	if (x->request_len > sizeof(x->request)) {
-		x->request_len = sizeof(x->request);
-		require_action(coap_verify_packet((const char*)x->request.bytes, x->request_len), bail, ret = SMCP_STATUS_MESSAGE_TOO_BIG);
+	if (header_len > sizeof(x->request)) {
+		return SMCP_STATUS_MESSAGE_TOO_BIG;
 	}
-	memcpy(x->request.bytes,smcp_inbound_get_packet(),x->request_len);
 
+	memcpy(x->request.bytes, packet, header_len);
 
-	x->sockaddr_remote = *smcp_plat_get_remote_sockaddr();
-	x->sockaddr_local = *smcp_plat_get_local_sockaddr();
+	while ((iter < end) && (*iter != 0xFF)) {
+		const uint8_t* value;
+		coap_size_t len;
+
+		iter = coap_decode_option(iter, &key, &value, &len);
+
+		if ((key != COAP_OPTION_URI_PATH) && (key != COAP_OPTION_URI_QUERY)) {
+			continue;
+		}
+
+		// Worst case for the option header is five bytes.
+		if (out + 5 + len > out_end) {
+			return SMCP_STATUS_MESSAGE_TOO_BIG;
+		}
+
+		out = coap_encode_option(out, last_key, key, value, len);
+		last_key = key;
+	}
+
+	x->request_len = (coap_size_t)(out - x->request.bytes);
+
+	return SMCP_STATUS_OK;
+}
+
+//! Keeps all of the request except for its content.
+static smcp_status_t
+smcp_async_response_copy_(smcp_t self, struct smcp_async_response_s* x)
+{
+	const struct coap_header_s* const packet = self->inbound.packet;
+	const coap_size_t request_len = self->inbound.packet_len - self->inbound.content_len;
+	uint8_t* buffer = x->request.bytes;
+
+	if (request_len > sizeof(x->request)) {
+#if SMCP_AVOID_MALLOC
+		return SMCP_STATUS_MESSAGE_TOO_BIG;
+#else
+		buffer = malloc(request_len);
+
+		if (buffer == NULL) {
+			return SMCP_STATUS_MALLOC_FAILURE;
+		}
+
+		x->full_request = buffer;
+
+		memcpy(
+			x->request.bytes,
+			packet,
+			MIN(sizeof(x->request), (coap_size_t)(packet->token - (const uint8_t*)packet) + packet->token_len)
+		);
+#endif
+	}
+
+	memcpy(buffer, packet, request_len);
+	x->request_len = request_len;
+
+	return SMCP_STATUS_OK;
+}
+
+//! Acknowledges the request, unless it is non-confirmable or the caller asked us not to.
+static smcp_status_t
+smcp_async_response_ack_(smcp_t self, int flags)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
 
 	if(	!(flags & SMCP_ASYNC_RESPONSE_FLAG_DONT_ACK)
 		&& self->inbound.packet->tt==COAP_TRANS_TYPE_CONFIRMABLE
@@ -117,17 +207,65 @@ smcp_start_async_response(struct smcp_async_response_s* x, int flags) {
 		require_noerr(ret, bail);
 	}
 
+bail:
+	return ret;
+}
+
+smcp_status_t
+smcp_start_async_response(struct smcp_async_response_s* x, int flags) {
+	smcp_status_t ret = SMCP_STATUS_MESSAGE_TOO_BIG;
+	smcp_t const self = smcp_get_current_instance();
+
+	require_action_string(x!=NULL,bail,ret=SMCP_STATUS_INVALID_ARGUMENT,"NULL async_response arg");
+
 	if(self->inbound.is_dupe) {
+		// The original was already captured, most likely into `x`,
+		// which has to be left alone. It only needs another ACK.
+		ret = smcp_async_response_ack_(self, flags);
+		require_noerr(ret, bail);
+
 		ret = SMCP_STATUS_DUPE;
 		goto bail;
 	}
 
+#if !SMCP_AVOID_MALLOC
+	// Never freed here, since `x` may not have been initialized.
+	x->full_request = NULL;
+#endif
+
+	if (!(flags & SMCP_ASYNC_RESPONSE_FLAG_FULL_REQUEST)) {
+		ret = smcp_async_response_capture_(self, x);
+	}
+
+	if (ret == SMCP_STATUS_MESSAGE_TOO_BIG) {
+		ret = smcp_async_response_copy_(self, x);
+	}
+
+	require_action_string(
+		ret != SMCP_STATUS_MESSAGE_TOO_BIG,
+		bail,
+		(smcp_outbound_quick_response(COAP_RESULT_413_REQUEST_ENTITY_TOO_LARGE,NULL),ret=SMCP_STATUS_FAILURE),
+		"Request too big for async response"
+	);
+
+	require_noerr(ret, bail);
+
+
+	x->sockaddr_remote = *smcp_plat_get_remote_sockaddr();
+	x->sockaddr_local = *smcp_plat_get_local_sockaddr();
+
+	ret = smcp_async_response_ack_(self, flags);
+
 bail:
 	return ret;
 }
 
 smcp_status_t
 smcp_finish_async_response(struct smcp_async_response_s* x) {
+#if !SMCP_AVOID_MALLOC
+	free(x->full_request);
+	x->full_request = NULL;
+#endif
 	x->request_len = 0;
 	return SMCP_STATUS_OK;
 }
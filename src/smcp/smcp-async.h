@@ -46,11 +46,35 @@ __BEGIN_DECLS
 
 #define SMCP_ASYNC_RESPONSE_FLAG_DONT_ACK		(1<<0)
 
+//!	Keep every option of the request, not just the Uri-Path and Uri-Query.
+#define SMCP_ASYNC_RESPONSE_FLAG_FULL_REQUEST	(1<<1)
+
+/*!	Everything needed to send a response to a request later on.
+**
+**	Normally only the header, the token and the Uri-Path and Uri-Query
+**	options of the request are kept. If the request was captured with
+**	SMCP_ASYNC_RESPONSE_FLAG_FULL_REQUEST, or its path and query don't
+**	fit, all of its options are kept, on the heap if needed.
+**
+**	Once the response has been sent, or the request given up on, it
+**	must be released with smcp_finish_async_response(). Capturing
+**	another request into it does not release the previous one, so it
+**	must be finished before it is started again. A duplicate of a
+**	request that was already captured is acknowledged again, but not
+**	captured, and smcp_start_async_response() returns
+**	SMCP_STATUS_DUPE without touching the struct. */
 struct smcp_async_response_s {
 	smcp_sockaddr_t sockaddr_local;
 	smcp_sockaddr_t sockaddr_remote;
 
 	coap_size_t request_len;
+
+#if !SMCP_AVOID_MALLOC
+	//! The captured request, if it didn't fit in `request`.
+	uint8_t* full_request;
+#endif
+
+	//! The header is always here, even if the rest isn't.
 	union {
 		struct coap_header_s header;
 		uint8_t bytes[SMCP_ASYNC_RESPONSE_MAX_LENGTH];
@@ -42,6 +42,7 @@
 #include "smcp-helpers.h"
 #include "smcp-logging.h"
 #include "smcp-missing.h"
+#include "smcp-internal.h"
 #include "coap.h"
 #include "smcp-curl_proxy.h"
 #include <stdio.h>
@@ -62,12 +63,14 @@ void
 smcp_curl_request_release(smcp_curl_request_t x) {
 	if(x->curl)
 		curl_easy_cleanup(x->curl);
-	free(x);
+	smcp_slab_free(x);
 }
 
 smcp_curl_request_t
 smcp_curl_request_create(void) {
-	smcp_curl_request_t ret = calloc(1,sizeof(*ret));
+	smcp_curl_request_t ret = smcp_slab_alloc(smcp_get_current_instance(), sizeof(*ret));
+	if(!ret)
+		return NULL;
 	ret->curl = curl_easy_init();
 	if(!ret->curl) {
 		smcp_curl_request_release(ret);
@@ -201,10 +204,11 @@ smcp_curl_proxy_request_handler(
 	smcp_inbound_reset_next_option();
 
 	request = smcp_curl_request_create();
-	request->proxy_node = node;
 
 	require_action(request!=NULL,bail,ret = SMCP_STATUS_MALLOC_FAILURE);
 
+	request->proxy_node = node;
+
 	switch(method) {
 		case COAP_METHOD_GET: curl_easy_setopt(request->curl, CURLOPT_CUSTOMREQUEST, "GET"); break;
 		case COAP_METHOD_PUT: curl_easy_setopt(request->curl, CURLOPT_PUT, 1L); break;
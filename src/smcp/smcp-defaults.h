@@ -59,6 +59,22 @@
 #define SMCP_USE_UIP			!SMCP_USE_BSD_SOCKETS
 #endif
 
+//!	@define SMCP_CONF_TIMESTAMP_64BIT
+/*!	If set, `smcp_timestamp_t` is a 64-bit count of microseconds
+**	that never wraps around. Otherwise it is a 32-bit platform-specific
+**	value that wraps around roughly every 24 days, and timestamps can
+**	only be compared with each other using smcp_plat_timestamp_diff().
+**	Only the BSD sockets platform supports 64-bit timestamps.
+**
+**	Off by default, because it changes the size of `smcp_timestamp_t`
+**	and with it the ABI: everything that includes the installed
+**	headers must see the same setting as the library. To turn it on,
+**	define it in smcp-opts.h before building and installing.
+*/
+#ifndef SMCP_CONF_TIMESTAMP_64BIT
+#define SMCP_CONF_TIMESTAMP_64BIT	0
+#endif
+
 #ifndef SMCP_DEFAULT_PORT
 #define SMCP_DEFAULT_PORT           COAP_DEFAULT_PORT
 #endif
@@ -142,6 +158,97 @@
 #define SMCP_CONF_MAX_TRANSACTIONS				4
 #endif
 
+//!	@define SMCP_CONF_TRANSACTION_INDEX_SIZE
+/*!	Number of buckets in the hash index used to look up active
+**	transactions by message id and by token. Must be a power of two.
+**	Unless SMCP_AVOID_MALLOC is set, this is only the initial size,
+**	and the index grows along with the number of active transactions.
+*/
+#ifndef SMCP_CONF_TRANSACTION_INDEX_SIZE
+#if SMCP_AVOID_MALLOC
+#define SMCP_CONF_TRANSACTION_INDEX_SIZE		(8)
+#else
+#define SMCP_CONF_TRANSACTION_INDEX_SIZE		(64)
+#endif
+#endif
+
+//!	@define SMCP_CONF_TRANSACTION_TOKEN_LENGTH
+/*!	Length in bytes of the tokens given to new transactions. Must
+**	be between 4 and 8. The first four bytes are a per-instance counter
+**	that starts at a random value, so tokens are not reused until four
+**	billion transactions later. The remaining bytes are random, which
+**	makes the tokens hard for an off-path attacker to guess.
+*/
+#ifndef SMCP_CONF_TRANSACTION_TOKEN_LENGTH
+#define SMCP_CONF_TRANSACTION_TOKEN_LENGTH		COAP_MAX_TOKEN_SIZE
+#endif
+
+//!	@define SMCP_CONF_SUBMIT_QUEUE
+/*!	If set, other threads can start requests on an instance with
+**	smcp_submit(), which hands them to the thread running its event
+**	loop without taking a lock. Needs atomics, heap-allocated
+**	transactions and file descriptors to wake the event loop with.
+*/
+#ifndef SMCP_CONF_SUBMIT_QUEUE
+#define SMCP_CONF_SUBMIT_QUEUE		(SMCP_MULTITHREAD && SMCP_USE_BSD_SOCKETS && !SMCP_AVOID_MALLOC)
+#endif
+
+//!	@define SMCP_CONF_SLAB
+/*!	If set, each instance has a slab allocator that transactions
+**	and offloaded requests are allocated from while it is handling
+**	traffic, instead of calling malloc() for each one.
+**
+**	Requires GCC-style atomic builtins, so that other threads can
+**	free what the event loop allocated.
+**
+**	@sa smcp-slab.h
+*/
+#ifndef SMCP_CONF_SLAB
+#if defined(__GNUC__)
+#define SMCP_CONF_SLAB				(SMCP_USE_BSD_SOCKETS && !SMCP_AVOID_MALLOC && !SMCP_EMBEDDED)
+#else
+#define SMCP_CONF_SLAB				0
+#endif
+#endif
+
+//!	@define SMCP_CONF_SLAB_HUGEPAGES
+/*!	If set, the slab allocator asks for huge pages for its chunks,
+**	falling back to normal pages if there aren't any. This also makes
+**	each chunk 2MB, which is a lot of memory per size class, so it is
+**	only worth it for instances that handle heavy traffic.
+*/
+#ifndef SMCP_CONF_SLAB_HUGEPAGES
+#define SMCP_CONF_SLAB_HUGEPAGES	0
+#endif
+
+//!	@define SMCP_CONF_SLAB_CHUNK_SIZE
+/*!	How many bytes the slab allocator reserves at a time for a size
+**	class whose free list has run dry.
+*/
+#ifndef SMCP_CONF_SLAB_CHUNK_SIZE
+#if SMCP_CONF_SLAB_HUGEPAGES
+#define SMCP_CONF_SLAB_CHUNK_SIZE	(2*1024*1024)
+#else
+#define SMCP_CONF_SLAB_CHUNK_SIZE	(32*1024)
+#endif
+#endif
+
+//!	@define SMCP_CONF_TIMER_BUDGET
+/*!	Maximum number of expired timers that a single call to
+**	smcp_handle_timers() will fire. Zero means that every timer that
+**	was due when the call started is fired. Larger values let bursts
+**	of retransmissions go out together instead of one per trip through
+**	the event loop, while smaller values bound how long the call can
+**	hold up the processing of inbound packets.
+*/
+#ifndef SMCP_CONF_TIMER_BUDGET
+#if SMCP_EMBEDDED
+#define SMCP_CONF_TIMER_BUDGET					1
+#else
+#define SMCP_CONF_TIMER_BUDGET					64
+#endif
+#endif
+
 //!	@define SMCP_CONF_MAX_TIMEOUT
 /*! The maximum timeout (in seconds) returned form `smcp_get_timeout()`
 */
@@ -151,9 +258,74 @@
 
 //! @define SMCP_CONF_DUPE_BUFFER_SIZE
 /*! Number of previous packets to keep track of for duplicate detection.
+**	Must be a power of two. Packets are remembered for
+**	`COAP_EXCHANGE_LIFETIME`, or until they are pushed out by newer
+**	packets. Unless SMCP_AVOID_MALLOC is set, this is only the initial
+**	capacity, which can be changed with smcp_set_dupe_capacity().
 */
 #ifndef SMCP_CONF_DUPE_BUFFER_SIZE
+#if SMCP_AVOID_MALLOC
 #define SMCP_CONF_DUPE_BUFFER_SIZE				(16)
+#else
+#define SMCP_CONF_DUPE_BUFFER_SIZE				(256)
+#endif
+#endif
+
+//! @define SMCP_CONF_DUPE_BUFFER_MAX_SIZE
+/*! Largest that the duplicate detection table will grow to on its own.
+**	Unless SMCP_AVOID_MALLOC is set, the table doubles in size instead
+**	of forgetting a packet that is still within `COAP_EXCHANGE_LIFETIME`,
+**	up to this many entries. Past that, the oldest packet is forgotten.
+**	Must be a power of two.
+*/
+#ifndef SMCP_CONF_DUPE_BUFFER_MAX_SIZE
+#define SMCP_CONF_DUPE_BUFFER_MAX_SIZE			(262144)
+#endif
+
+//! @define SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE
+/*! Number of responses to keep around for replaying to duplicate
+**	confirmable messages. When a duplicate arrives for a message whose
+**	response is still cached, the response is sent again without
+**	calling the request handler. Each entry takes up
+**	`SMCP_MAX_PACKET_LENGTH` bytes. Set to zero to disable.
+*/
+#ifndef SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE
+#if SMCP_AVOID_MALLOC
+#define SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE		(0)
+#else
+#define SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE		(32)
+#endif
+#endif
+
+//! @define SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+/*! Number of inbound options that are decoded up front into a
+**	per-packet index, so that smcp_inbound_next_option() and friends
+**	don't have to decode them again every time they are walked. Options
+**	beyond this count are still decoded on demand. Each entry takes up
+**	six bytes. Set to zero to disable. Must be no larger than 255.
+*/
+#ifndef SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+#if SMCP_EMBEDDED
+#define SMCP_CONF_INBOUND_OPTION_INDEX_SIZE		(8)
+#else
+#define SMCP_CONF_INBOUND_OPTION_INDEX_SIZE		(16)
+#endif
+#endif
+
+//! @define SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+/*! Number of out-of-order outbound options that can be held back
+**	until the content is started, instead of being inserted into the
+**	middle of the options right away. Their values are kept at the
+**	far end of the packet buffer, so this is disabled when
+**	SMCP_AVOID_MALLOC is set, since smcp_outbound_set_uri() may be
+**	using that space for its own purposes. Set to zero to disable.
+*/
+#ifndef SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+#if SMCP_AVOID_MALLOC
+#define SMCP_CONF_OUTBOUND_STAGED_OPTIONS		(0)
+#else
+#define SMCP_CONF_OUTBOUND_STAGED_OPTIONS		(16)
+#endif
 #endif
 
 //! @define SMCP_CONF_ENABLE_VHOSTS
@@ -188,12 +360,82 @@
 #define SMCP_TRANSACTIONS_USE_BTREE				!SMCP_EMBEDDED
 #endif
 
+//! @define SMCP_TIMERS_USE_HEAP
+/*! Determines if scheduled timers should be kept in a sorted linked
+**	list or in a 4-ary heap. Scheduling and invalidating a timer is
+**	O(n) with the list and O(log n) with the heap, but the heap needs
+**	to allocate memory as it grows.
+*/
+#ifndef SMCP_TIMERS_USE_HEAP
+#define SMCP_TIMERS_USE_HEAP					!SMCP_AVOID_MALLOC
+#endif
+
+//!	@define SMCP_ASYNC_RESPONSE_MAX_LENGTH
+/*!	Bytes of a request that are kept for an asynchronous response.
+**	This has to hold the header, the token, and the Uri-Path and
+**	Uri-Query options. Requests that don't fit are copied to the
+**	heap instead, unless SMCP_AVOID_MALLOC is set.
+*/
 #ifndef SMCP_ASYNC_RESPONSE_MAX_LENGTH
 #if SMCP_EMBEDDED
 #define SMCP_ASYNC_RESPONSE_MAX_LENGTH		80
 #else
-#define SMCP_ASYNC_RESPONSE_MAX_LENGTH		SMCP_MAX_PACKET_LENGTH
+#define SMCP_ASYNC_RESPONSE_MAX_LENGTH		64
+#endif
+#endif
+
+/*****************************************************************************/
+// MARK: - BSD Sockets Platform
+
+//!	@define SMCP_CONF_RECV_BATCH_SIZE
+/*!	Maximum number of datagrams drained per socket by a single call
+**	to `smcp_plat_process()`.
+**
+**	When greater than one and `recvmmsg()` is available, this many
+**	packet slots are preallocated in each instance and filled with a
+**	single system call. The effective batch size can be lowered at
+**	runtime with `smcp_plat_set_recv_batch_size()`.
+*/
+#ifndef SMCP_CONF_RECV_BATCH_SIZE
+#if SMCP_EMBEDDED
+#define SMCP_CONF_RECV_BATCH_SIZE				(1)
+#else
+#define SMCP_CONF_RECV_BATCH_SIZE				(16)
+#endif
+#endif
+
+//!	@define SMCP_CONF_SEND_QUEUE_SIZE
+/*!	Maximum number of outbound packets that can be held in the
+**	deferred-send queue.
+**
+**	The queue is disabled by default and is enabled at runtime with
+**	`smcp_plat_set_send_queue_size()`. Queued packets are sent with a
+**	single `sendmmsg()` call by `smcp_plat_flush()`.
+*/
+#ifndef SMCP_CONF_SEND_QUEUE_SIZE
+#if SMCP_EMBEDDED
+#define SMCP_CONF_SEND_QUEUE_SIZE				(0)
+#else
+#define SMCP_CONF_SEND_QUEUE_SIZE				(16)
+#endif
 #endif
+
+//!	@define SMCP_CONF_URING_RECV_BUFFERS
+/*!	Number of packet buffers handed to the kernel for receiving
+**	when io_uring is in use (see `--enable-io-uring`). Must be a
+**	power of two.
+*/
+#ifndef SMCP_CONF_URING_RECV_BUFFERS
+#define SMCP_CONF_URING_RECV_BUFFERS			(64)
+#endif
+
+//!	@define SMCP_CONF_URING_SEND_SLOTS
+/*!	Number of outbound packets that can be in flight at once
+**	when io_uring is in use. When every slot is busy, packets
+**	are sent synchronously instead.
+*/
+#ifndef SMCP_CONF_URING_SEND_SLOTS
+#define SMCP_CONF_URING_SEND_SLOTS				(32)
 #endif
 
 /*****************************************************************************/
@@ -210,14 +452,34 @@
 /*****************************************************************************/
 // MARK: - Observation Options
 
+//!	@define SMCP_CONF_MAX_OBSERVERS
+/*!	Maximum number of observers per instance. When SMCP_AVOID_MALLOC
+**	is set, this is the size of a statically allocated pool. Otherwise
+**	observers are allocated as they register and this only puts a
+**	limit on how much memory they can take up.
+*/
 #ifdef SMCP_CONF_MAX_OBSERVERS
 #define SMCP_MAX_OBSERVERS			(SMCP_CONF_MAX_OBSERVERS)
 #else
 #if SMCP_EMBEDDED
 #define SMCP_MAX_OBSERVERS			(2)
-#else
+#elif SMCP_AVOID_MALLOC
 #define SMCP_MAX_OBSERVERS			(8)
+#else
+#define SMCP_MAX_OBSERVERS			(65536)
+#endif
 #endif
+
+//! @define SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+/*!	If set, observables that have `share_notifications` set only call
+**	the request handler once per trigger for all of the observers that
+**	registered with identical requests. The rendered notification is
+**	kept around and each observer gets a copy with its own token,
+**	message id and Observe sequence number. Otherwise, every observer
+**	calls the request handler.
+*/
+#ifndef SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+#define SMCP_OBSERVABLE_SHARE_NOTIFICATIONS		!SMCP_AVOID_MALLOC
 #endif
 
 #ifndef SMCP_OBSERVATION_KEEPALIVE_INTERVAL
@@ -247,6 +509,25 @@
 #define SMCP_NODE_ROUTER_USE_BTREE				!SMCP_EMBEDDED
 #endif
 
+//!	@define SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+/*!	If set, smcp_node_route() compiles the tree below the node it routes
+**	from into a read-only table the first time it is used, and looks up
+**	every path segment in it with a single hash probe. The table is
+**	thrown away whenever a node is added to or removed from that part
+**	of the tree, and built again on the next request. Otherwise every
+**	segment is looked up in the children of the current node.
+**
+**	Requires GCC-style atomic builtins, so that several threads can
+**	route through the same tree.
+*/
+#ifndef SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+#if defined(__GNUC__)
+#define SMCP_NODE_ROUTER_USE_ROUTE_TABLE		!SMCP_AVOID_MALLOC
+#else
+#define SMCP_NODE_ROUTER_USE_ROUTE_TABLE		0
+#endif
+#endif
+
 //!	@define SMCP_CONF_MAX_ALLOCED_NODES
 /*!	Node Router: Maximum number of allocated nodes
 **
@@ -277,6 +558,16 @@
 #define SMCP_VARIABLE_MAX_KEY_LENGTH		(23)
 #endif
 
+//!	@define SMCP_CONF_OFFLOAD_NODE
+/*!	If set, smcp_offload_node_init() is available for running slow
+**	request handlers on a pool of worker threads.
+**
+**	@sa SMCP_CONF_SUBMIT_QUEUE
+*/
+#ifndef SMCP_CONF_OFFLOAD_NODE
+#define SMCP_CONF_OFFLOAD_NODE		(SMCP_CONF_NODE_ROUTER && SMCP_CONF_SUBMIT_QUEUE && HAVE_PTHREAD)
+#endif
+
 #ifndef SMCP_DTLS
 #define SMCP_DTLS							HAVE_OPENSSL
 #endif
@@ -347,4 +638,17 @@
 #endif
 #endif
 
+//! @define SMCP_THREAD_LOCAL
+/*! Storage class for variables that have a separate copy in each
+**	thread. Left undefined if the compiler doesn't have one, in which
+**	case multithreaded builds fall back to pthread keys.
+*/
+#ifndef SMCP_THREAD_LOCAL
+#if defined(__GNUC__) || defined(__clang__)
+#define SMCP_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define SMCP_THREAD_LOCAL _Thread_local
+#endif
+#endif
+
 #endif
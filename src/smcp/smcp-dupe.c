@@ -31,48 +31,305 @@
 #include <config.h>
 #endif
 
+#include "assert-macros.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include "smcp-internal.h"
+#include "smcp-logging.h"
 #include "smcp-dupe.h"
 #include "fasthash.h"
 
-// TODO: This code could use some optimization.
+// Entries live in a window of this many slots starting at their
+// hash, so that looking one up never takes more than this many
+// comparisons. When the window is full, the table is grown, and
+// the oldest entry in it is replaced only if that isn't possible.
+#define SMCP_DUPE_PROBE_LIMIT		(8)
+
+#if (SMCP_CONF_DUPE_BUFFER_SIZE & (SMCP_CONF_DUPE_BUFFER_SIZE - 1)) != 0
+#error SMCP_CONF_DUPE_BUFFER_SIZE must be a power of two
+#endif
+
+static uint32_t
+smcp_dupe_hash(const smcp_sockaddr_t* from, coap_msg_id_t msg_id)
+{
+	struct fasthash_state_s fasthash;
+
+	// Calculate the message-id hash (address+port+message_id)
+	fasthash_start(&fasthash, 0);
+	fasthash_feed(&fasthash, (const void*)from, sizeof(smcp_sockaddr_t));
+	fasthash_feed(&fasthash, (const uint8_t*)&msg_id, sizeof(msg_id));
+	return fasthash_finish_uint32(&fasthash);
+}
+
+static bool
+smcp_dupe_is_live(const struct smcp_dupe_s* entry, smcp_timestamp_t now)
+{
+	return (entry->expires != 0)
+		&& (smcp_plat_timestamp_diff(entry->expires, now) > 0);
+}
+
+//!	Returns the slot that an entry for `hash` should go into.
+/*!	If every slot in the window is still live, returns the oldest
+**	of them if `evict` is set, or NULL if it isn't. */
+static struct smcp_dupe_s*
+smcp_dupe_slot_for_insert(
+	struct smcp_dupe_info_s* info,
+	uint32_t hash,
+	smcp_timestamp_t now,
+	bool evict
+) {
+	struct smcp_dupe_s* victim = NULL;
+	uint32_t limit = MIN(SMCP_DUPE_PROBE_LIMIT, info->mask + 1);
+	uint32_t i;
+
+	for (i = 0; i < limit; i++) {
+		struct smcp_dupe_s* entry = &info->table[(hash + i) & info->mask];
+
+		if (!smcp_dupe_is_live(entry, now)) {
+			return entry;
+		}
+
+		// Everything expires after the same amount of time,
+		// so the oldest entry is the one that expires first.
+		if ((victim == NULL)
+			|| ((int32_t)(entry->serial - victim->serial) < 0)
+		) {
+			victim = entry;
+		}
+	}
+
+	return evict ? victim : NULL;
+}
+
+#if !SMCP_AVOID_MALLOC
+smcp_status_t
+smcp_set_dupe_capacity(smcp_t self, uint32_t capacity)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_status_t ret = SMCP_STATUS_OK;
+	struct smcp_dupe_info_s new_info = { };
+	const smcp_timestamp_t now = smcp_plat_cms_to_timestamp(0);
+	uint32_t size = 1;
+	uint32_t i;
+
+	require_action(capacity > 0, bail, ret = SMCP_STATUS_INVALID_ARGUMENT);
+	require_action(capacity <= (1u << 31), bail, ret = SMCP_STATUS_INVALID_ARGUMENT);
+
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+retry:
+	new_info.table = calloc(size, sizeof(struct smcp_dupe_s));
+	require_action(new_info.table != NULL, bail, ret = SMCP_STATUS_MALLOC_FAILURE);
+	new_info.mask = size - 1;
+	new_info.next_serial = self->dupe_info.next_serial;
+
+	// Carry over what we remember.
+	if (self->dupe_info.table != NULL) {
+		for (i = 0; i <= self->dupe_info.mask; i++) {
+			const struct smcp_dupe_s* entry = &self->dupe_info.table[i];
+			struct smcp_dupe_s* slot;
+
+			if (!smcp_dupe_is_live(entry, now)) {
+				continue;
+			}
+
+			slot = smcp_dupe_slot_for_insert(&new_info, entry->hash, now, false);
+
+			if (slot == NULL) {
+				// Too crowded to keep everything, so try a bigger table.
+				free(new_info.table);
+				require_action(size < (1u << 31), bail, ret = SMCP_STATUS_MALLOC_FAILURE);
+				size <<= 1;
+				goto retry;
+			}
+
+			*slot = *entry;
+		}
+	}
+
+	smcp_dupe_finalize(self);
+
+	self->dupe_info.table = new_info.table;
+	self->dupe_info.mask = new_info.mask;
+
+bail:
+	return ret;
+}
+#endif // !SMCP_AVOID_MALLOC
+
+void
+smcp_dupe_finalize(smcp_t self)
+{
+#if !SMCP_AVOID_MALLOC
+	free(self->dupe_info.table);
+	self->dupe_info.table = NULL;
+	self->dupe_info.mask = 0;
+#endif
+	self->dupe_info.current = NULL;
+}
 
 bool
 smcp_inbound_dupe_check(void)
 {
 	smcp_t const self = smcp_get_current_instance();
-	bool is_dupe = false;
-	struct fasthash_state_s fasthash;
+	struct smcp_dupe_info_s* const info = &self->dupe_info;
+	const smcp_sockaddr_t* const from = smcp_plat_get_remote_sockaddr();
+	const coap_msg_id_t msg_id = self->inbound.packet->msg_id;
+	smcp_timestamp_t now;
+	struct smcp_dupe_s* entry;
 	uint32_t hash;
+	uint32_t limit;
+	uint32_t i;
 
-	// Calculate the message-id hash (address+port+message_id)
-	fasthash_start(&fasthash, 0);
-	fasthash_feed(&fasthash, (const void*)smcp_plat_get_remote_sockaddr(), sizeof(smcp_sockaddr_t));
-	fasthash_feed(&fasthash, (const uint8_t*)&self->inbound.packet->msg_id,sizeof(self->inbound.packet->msg_id));
-	hash = fasthash_finish_uint32(&fasthash);
+	info->current = NULL;
+
+#if SMCP_AVOID_MALLOC
+	info->mask = SMCP_CONF_DUPE_BUFFER_SIZE - 1;
+#else
+	if (info->table == NULL) {
+		require(smcp_set_dupe_capacity(self, SMCP_CONF_DUPE_BUFFER_SIZE) == SMCP_STATUS_OK, bail);
+	}
+#endif
+
+	now = smcp_plat_cms_to_timestamp(0);
+	hash = smcp_dupe_hash(from, msg_id);
+	limit = MIN(SMCP_DUPE_PROBE_LIMIT, info->mask + 1);
 
 	// Check to see if this packet is a duplicate.
-	unsigned int i = SMCP_CONF_DUPE_BUFFER_SIZE;
-	while (i--) {
-		if (self->dupe_info.dupe[i].hash == hash) {
-			if ((0 == memcmp(&self->dupe_info.dupe[i].from, (const void*)smcp_plat_get_remote_sockaddr(), sizeof(smcp_sockaddr_t)))
-				&& (self->dupe_info.dupe[i].msg_id == self->inbound.packet->msg_id)
-			) {
-				is_dupe = true;
-				break;
-			}
+	for (i = 0; i < limit; i++) {
+		entry = &info->table[(hash + i) & info->mask];
+
+		if ((entry->hash == hash)
+			&& (entry->msg_id == msg_id)
+			&& smcp_dupe_is_live(entry, now)
+			&& (0 == memcmp(&entry->from, (const void*)from, sizeof(smcp_sockaddr_t)))
+		) {
+			info->current = entry;
+			return true;
 		}
 	}
 
-	if (!is_dupe) {
-		// This is not a dupe, add it to the list.
-		self->dupe_info.dupe[self->dupe_info.dupe_index].hash = hash;
-		self->dupe_info.dupe[self->dupe_info.dupe_index].msg_id = self->inbound.packet->msg_id;
-		memcpy(&self->dupe_info.dupe[self->dupe_info.dupe_index].from, (const void*)smcp_plat_get_remote_sockaddr(), sizeof(smcp_sockaddr_t));
-		self->dupe_info.dupe_index++;
-		self->dupe_info.dupe_index %= SMCP_CONF_DUPE_BUFFER_SIZE;
+	// This is not a dupe, remember it.
+	entry = smcp_dupe_slot_for_insert(info, hash, now, false);
+
+#if !SMCP_AVOID_MALLOC
+	// Forgetting a live entry would let a retransmission of it through.
+	while ( entry == NULL
+	     && info->mask + 1 < SMCP_CONF_DUPE_BUFFER_MAX_SIZE
+	     && smcp_set_dupe_capacity(self, (info->mask + 1) * 2) == SMCP_STATUS_OK
+	) {
+		entry = smcp_dupe_slot_for_insert(info, hash, now, false);
+	}
+#endif
+
+	if (entry == NULL) {
+		entry = smcp_dupe_slot_for_insert(info, hash, now, true);
+	}
+	entry->hash = hash;
+	entry->msg_id = msg_id;
+	entry->serial = info->next_serial++;
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+	entry->response = 0;
+#endif
+	entry->expires = smcp_plat_cms_to_timestamp((smcp_cms_t)(COAP_EXCHANGE_LIFETIME*MSEC_PER_SEC));
+	memcpy(&entry->from, (const void*)from, sizeof(smcp_sockaddr_t));
+
+	if (entry->expires == 0) {
+		// Zero means unused.
+		entry->expires++;
+	}
+
+	info->current = entry;
+
+#if !SMCP_AVOID_MALLOC
+bail:
+#endif
+	return false;
+}
+
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+static struct smcp_dupe_response_s*
+smcp_dupe_get_response(struct smcp_dupe_info_s* info, const struct smcp_dupe_s* entry)
+{
+	struct smcp_dupe_response_s* response;
+
+	if ((entry == NULL) || (entry->response == 0)) {
+		return NULL;
 	}
 
-	return is_dupe;
+	response = &info->responses[entry->response - 1];
+
+	// The slot may have been given to another entry since.
+	if ((response->len == 0) || (response->serial != entry->serial)) {
+		return NULL;
+	}
+
+	return response;
+}
+
+void
+smcp_dupe_remember_response(smcp_t self, const uint8_t* packet, coap_size_t len)
+{
+	struct smcp_dupe_info_s* const info = &self->dupe_info;
+	struct smcp_dupe_s* const entry = info->current;
+	const struct coap_header_s* const header = (const struct coap_header_s*)packet;
+	struct smcp_dupe_response_s* response;
+
+	require_quiet(entry != NULL, bail);
+	require_quiet(self->inbound.packet != NULL, bail);
+	require_quiet(self->inbound.packet->tt == COAP_TRANS_TYPE_CONFIRMABLE, bail);
+	require_quiet(!self->inbound.is_dupe, bail);
+
+	// Only the ACK (or reset) for the inbound message needs to be
+	// replayed. Separate responses are retransmitted on their own.
+	require_quiet(
+		(header->tt == COAP_TRANS_TYPE_ACK) || (header->tt == COAP_TRANS_TYPE_RESET),
+		bail
+	);
+	require_quiet(header->msg_id == self->inbound.packet->msg_id, bail);
+	require_quiet(len <= sizeof(response->packet), bail);
+
+	response = smcp_dupe_get_response(info, entry);
+
+	if (response == NULL) {
+		// Slots are handed out in order, so this replaces the oldest.
+		entry->response = info->next_response + 1;
+		info->next_response = (info->next_response + 1) % SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE;
+		response = &info->responses[entry->response - 1];
+	}
+
+	response->serial = entry->serial;
+	response->len = len;
+	memcpy(response->packet, packet, len);
+
+bail:
+	return;
+}
+
+smcp_status_t
+smcp_dupe_replay_response(smcp_t self)
+{
+	smcp_status_t ret = SMCP_STATUS_NOT_FOUND;
+	const struct smcp_dupe_response_s* response;
+	uint8_t* data_ptr = NULL;
+	coap_size_t data_len = 0;
+
+	response = smcp_dupe_get_response(&self->dupe_info, self->dupe_info.current);
+	require_quiet(response != NULL, bail);
+
+	DEBUG_PRINTF("Replaying cached response to duplicate packet");
+
+	ret = smcp_plat_outbound_start(self, &data_ptr, &data_len);
+	require_noerr(ret, bail);
+	require_action(response->len <= data_len, bail, ret = SMCP_STATUS_FAILURE);
+
+	memcpy(data_ptr, response->packet, response->len);
+
+	ret = smcp_plat_outbound_finish(self, data_ptr, response->len, 0);
+
+bail:
+	return ret;
 }
+#endif // SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
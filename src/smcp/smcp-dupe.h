@@ -32,20 +32,55 @@
 
 #include "smcp.h"
 
+struct smcp_dupe_s {
+	uint32_t hash;
+	coap_msg_id_t msg_id;
+	smcp_timestamp_t expires;	//!< Unused if equal to zero.
+	uint32_t serial;			//!< Insertion order, for picking what to replace.
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+	uint16_t response;			//!< Index of the cached response plus one, or zero.
+#endif
+	smcp_sockaddr_t from;
+};
+
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+//!	The response that was sent for a confirmable message.
+struct smcp_dupe_response_s {
+	uint32_t serial;			//!< Serial of the entry this belongs to.
+	coap_size_t len;			//!< Zero if unused.
+	uint8_t packet[SMCP_MAX_PACKET_LENGTH];
+};
+#endif
+
+//!	Open-addressed hash table of recently seen (peer, msg_id) pairs.
 struct smcp_dupe_info_s {
-	struct {
-		uint32_t hash;
-		smcp_sockaddr_t from;
-		coap_msg_id_t msg_id;
-		coap_code_t code;
-	} dupe[SMCP_CONF_DUPE_BUFFER_SIZE];
-#if SMCP_CONF_DUPE_BUFFER_SIZE<=256
-	uint8_t dupe_index;
+#if SMCP_AVOID_MALLOC
+	struct smcp_dupe_s table[SMCP_CONF_DUPE_BUFFER_SIZE];
 #else
-	uint16_t dupe_index;
+	struct smcp_dupe_s* table;
+#endif
+	uint32_t mask;	//!< Capacity minus one, or zero if there is no table yet.
+	uint32_t next_serial;
+
+	//! Entry for the inbound packet being processed, if any.
+	struct smcp_dupe_s* current;
+
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+	struct smcp_dupe_response_s responses[SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE];
+	uint16_t next_response;
 #endif
 };
 
-bool smcp_inbound_dupe_check(void);
+SMCP_INTERNAL_EXTERN bool smcp_inbound_dupe_check(void);
+SMCP_INTERNAL_EXTERN void smcp_dupe_finalize(smcp_t self);
+
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+//!	Remembers `packet` if it is the response to the current inbound packet.
+SMCP_INTERNAL_EXTERN void smcp_dupe_remember_response(smcp_t self, const uint8_t* packet, coap_size_t len);
+
+//!	Sends the cached response for the current (duplicate) inbound packet.
+/*!	Returns SMCP_STATUS_NOT_FOUND if there isn't one. */
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_dupe_replay_response(smcp_t self);
+#endif
 
 #endif
@@ -98,16 +98,82 @@ smcp_inbound_is_fake() {
 // MARK: -
 // MARK: Option Parsing
 
-void
-smcp_inbound_reset_next_option() {
-	smcp_t const self = smcp_get_current_instance();
+static void
+smcp_inbound_reset_next_option_(smcp_t self) {
 	self->inbound.last_option_key = 0;
 	self->inbound.this_option = self->inbound.packet->token + self->inbound.packet->token_len;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	self->inbound.option_next = 0;
+#endif
 }
 
-coap_option_key_t
-smcp_inbound_next_option(const uint8_t** value, coap_size_t* len) {
-	smcp_t const self = smcp_get_current_instance();
+void
+smcp_inbound_index_options(smcp_t self) {
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	const uint8_t* const packet = (const uint8_t*)self->inbound.packet;
+	const uint8_t* const end = packet + self->inbound.packet_len;
+	const uint8_t* iter = self->inbound.packet->token + self->inbound.packet->token_len;
+	coap_option_key_t key = 0;
+
+	self->inbound.option_count = 0;
+	self->inbound.option_mask = 0;
+
+	while ( iter    <  end
+	     && iter[0] != 0xFF
+	     && self->inbound.option_count < SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	) {
+		const uint8_t* value;
+		coap_size_t len;
+
+		iter = coap_decode_option(iter, &key, &value, &len);
+
+		if (iter == NULL) {
+			break;
+		}
+
+		self->inbound.options[self->inbound.option_count].key = key;
+		self->inbound.options[self->inbound.option_count].offset = (coap_size_t)(value - packet);
+		self->inbound.options[self->inbound.option_count].len = len;
+		self->inbound.option_count++;
+
+		if (key < 64) {
+			self->inbound.option_mask |= (uint64_t)1 << key;
+		}
+	}
+#endif
+
+	smcp_inbound_reset_next_option_(self);
+}
+
+void
+smcp_inbound_reset_next_option() {
+	smcp_inbound_reset_next_option_(smcp_get_current_instance());
+}
+
+static coap_option_key_t
+smcp_inbound_next_option_(smcp_t self, const uint8_t** value, coap_size_t* len) {
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	if (self->inbound.option_next < self->inbound.option_count) {
+		const uint8_t* const packet = (const uint8_t*)self->inbound.packet;
+		const coap_option_key_t key = self->inbound.options[self->inbound.option_next].key;
+		const coap_size_t offset = self->inbound.options[self->inbound.option_next].offset;
+		const coap_size_t option_len = self->inbound.options[self->inbound.option_next].len;
+
+		self->inbound.last_option_key = key;
+		self->inbound.this_option = packet + offset + option_len;
+		self->inbound.option_next++;
+
+		if (value) {
+			*value = packet + offset;
+		}
+		if (len) {
+			*len = option_len;
+		}
+		return key;
+	}
+
+	// Anything that didn't fit into the index gets decoded below.
+#endif
 
 	if ( self->inbound.this_option    <  ((uint8_t*)self->inbound.packet+self->inbound.packet_len)
 	  && self->inbound.this_option[0] != 0xFF
@@ -125,11 +191,29 @@ smcp_inbound_next_option(const uint8_t** value, coap_size_t* len) {
 	return self->inbound.last_option_key;
 }
 
+coap_option_key_t
+smcp_inbound_next_option(const uint8_t** value, coap_size_t* len) {
+	return smcp_inbound_next_option_(smcp_get_current_instance(), value, len);
+}
+
 coap_option_key_t
 smcp_inbound_peek_option(const uint8_t** value, coap_size_t* len) {
 	smcp_t const self = smcp_get_current_instance();
 	coap_option_key_t ret = self->inbound.last_option_key;
 
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	if (self->inbound.option_next < self->inbound.option_count) {
+		if (value) {
+			*value = (const uint8_t*)self->inbound.packet
+				+ self->inbound.options[self->inbound.option_next].offset;
+		}
+		if (len) {
+			*len = self->inbound.options[self->inbound.option_next].len;
+		}
+		return self->inbound.options[self->inbound.option_next].key;
+	}
+#endif
+
 	if ( self->inbound.last_option_key != COAP_OPTION_INVALID
 	  && self->inbound.this_option     <  ((uint8_t*)self->inbound.packet+self->inbound.packet_len)
 	  && self->inbound.this_option[0]  != 0xFF
@@ -148,20 +232,80 @@ smcp_inbound_peek_option(const uint8_t** value, coap_size_t* len) {
 }
 
 bool
-smcp_inbound_option_strequal(coap_option_key_t key,const char* cstr) {
+smcp_inbound_find_option(coap_option_key_t key, const uint8_t** value, coap_size_t* len) {
 	smcp_t const self = smcp_get_current_instance();
-	coap_option_key_t curr_key = self->inbound.last_option_key;
-	const char* value;
-	coap_size_t value_len;
-	coap_size_t i;
+	const uint8_t* iter = self->inbound.packet->token + self->inbound.packet->token_len;
+	const uint8_t* const end = (const uint8_t*)self->inbound.packet + self->inbound.packet_len;
+	coap_option_key_t iter_key = 0;
+
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	uint8_t i;
+
+	if ( key < 64
+	  && self->inbound.option_count < SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	  && (self->inbound.option_mask & ((uint64_t)1 << key)) == 0
+	) {
+		// Every option is in the index, and this one isn't.
+		return false;
+	}
+
+	// Options are sorted by key, so we can stop early.
+	for (i = 0; i < self->inbound.option_count; i++) {
+		if (self->inbound.options[i].key >= key) {
+			if (self->inbound.options[i].key != key) {
+				return false;
+			}
+			if (value) {
+				*value = (const uint8_t*)self->inbound.packet + self->inbound.options[i].offset;
+			}
+			if (len) {
+				*len = self->inbound.options[i].len;
+			}
+			return true;
+		}
+	}
 
-	if (!self->inbound.this_option) {
+	if (self->inbound.option_count < SMCP_CONF_INBOUND_OPTION_INDEX_SIZE) {
 		return false;
 	}
 
-	coap_decode_option(self->inbound.this_option, &curr_key, (const uint8_t**)&value, &value_len);
+	// Continue after the last option in the index.
+	iter = (const uint8_t*)self->inbound.packet
+		+ self->inbound.options[i - 1].offset
+		+ self->inbound.options[i - 1].len;
+	iter_key = self->inbound.options[i - 1].key;
+#endif
+
+	while (iter != NULL && iter < end && iter[0] != 0xFF) {
+		const uint8_t* iter_value;
+		coap_size_t iter_len;
+
+		iter = coap_decode_option(iter, &iter_key, &iter_value, &iter_len);
+
+		if (iter_key >= key) {
+			if (iter_key != key) {
+				break;
+			}
+			if (value) {
+				*value = iter_value;
+			}
+			if (len) {
+				*len = iter_len;
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool
+smcp_inbound_option_strequal(coap_option_key_t key,const char* cstr) {
+	const char* value;
+	coap_size_t value_len;
+	coap_size_t i;
 
-	if (curr_key != key) {
+	if (smcp_inbound_peek_option((const uint8_t**)&value, &value_len) != key) {
 		return false;
 	}
 
@@ -198,6 +342,9 @@ smcp_inbound_get_path(char* where, uint8_t flags)
 
 	coap_option_key_t		last_option_key = self->inbound.last_option_key;
 	const uint8_t*			this_option = self->inbound.this_option;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	uint8_t					option_next = self->inbound.option_next;
+#endif
 
 	char* filename;
 	coap_size_t filename_len;
@@ -215,16 +362,16 @@ smcp_inbound_get_path(char* where, uint8_t flags)
 	iter = where;
 
 	if ((flags & SMCP_GET_PATH_REMAINING) != SMCP_GET_PATH_REMAINING) {
-		smcp_inbound_reset_next_option();
+		smcp_inbound_reset_next_option_(self);
 	}
 
 	while ((key = smcp_inbound_peek_option(NULL,NULL))!=COAP_OPTION_URI_PATH
 		&& key!=COAP_OPTION_INVALID
 	) {
-		smcp_inbound_next_option(NULL,NULL);
+		smcp_inbound_next_option_(self, NULL, NULL);
 	}
 
-	while (smcp_inbound_next_option((const uint8_t**)&filename, &filename_len)==COAP_OPTION_URI_PATH) {
+	while (smcp_inbound_next_option_(self, (const uint8_t**)&filename, &filename_len)==COAP_OPTION_URI_PATH) {
 		char old_end = filename[filename_len];
 		if(iter!=where || (flags&SMCP_GET_PATH_LEADING_SLASH))
 			*iter++='/';
@@ -234,15 +381,15 @@ smcp_inbound_get_path(char* where, uint8_t flags)
 	}
 
 	if (flags & SMCP_GET_PATH_INCLUDE_QUERY) {
-		smcp_inbound_reset_next_option();
+		smcp_inbound_reset_next_option_(self);
 		while((key = smcp_inbound_peek_option((const uint8_t**)&filename, &filename_len))!=COAP_OPTION_URI_QUERY
 			&& key!=COAP_OPTION_INVALID
 		) {
-			smcp_inbound_next_option(NULL,NULL);
+			smcp_inbound_next_option_(self, NULL, NULL);
 		}
 		if (key == COAP_OPTION_URI_QUERY) {
 			*iter++='?';
-			while (smcp_inbound_next_option((const uint8_t**)&filename, &filename_len)==COAP_OPTION_URI_QUERY) {
+			while (smcp_inbound_next_option_(self, (const uint8_t**)&filename, &filename_len)==COAP_OPTION_URI_QUERY) {
 				char old_end = filename[filename_len];
 				char* equal_sign;
 
@@ -273,6 +420,9 @@ smcp_inbound_get_path(char* where, uint8_t flags)
 
 	self->inbound.last_option_key = last_option_key;
 	self->inbound.this_option = this_option;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+	self->inbound.option_next = option_next;
+#endif
 
 bail:
 	return where;
@@ -360,6 +510,21 @@ smcp_inbound_packet_process(
 
 	if (!self->inbound.is_fake) {
 		self->inbound.is_dupe = smcp_inbound_dupe_check();
+
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+		// If we still have what we sent back the first time,
+		// send it again without bothering the handler.
+		if (self->inbound.is_dupe && (packet->tt == COAP_TRANS_TYPE_CONFIRMABLE)) {
+			ret = smcp_dupe_replay_response(self);
+
+			if (ret == SMCP_STATUS_OK) {
+				self->did_respond = true;
+				goto bail;
+			}
+
+			ret = SMCP_STATUS_OK;
+		}
+#endif
 	}
 
 	{	// Initial scan thru all of the options.
@@ -367,10 +532,11 @@ smcp_inbound_packet_process(
 		coap_size_t value_len;
 		coap_option_key_t key;
 
-		// Reset option scanner for initial option scan.
-		smcp_inbound_reset_next_option();
+		// Decode all of the options once, and reset the
+		// option scanner for the initial option scan.
+		smcp_inbound_index_options(self);
 
-		while((key = smcp_inbound_next_option(&value,&value_len)) != COAP_OPTION_INVALID) {
+		while((key = smcp_inbound_next_option_(self, &value, &value_len)) != COAP_OPTION_INVALID) {
 			switch(key) {
 			case COAP_OPTION_CONTENT_TYPE:
 				self->inbound.content_type = (coap_content_type_t)coap_decode_uint32(value,(uint8_t)value_len);
@@ -419,7 +585,7 @@ smcp_inbound_packet_process(
 	}
 
 	// Be nice and reset the option scanner for the handler.
-	smcp_inbound_reset_next_option();
+	smcp_inbound_reset_next_option_(self);
 
 	// Dispatch the packet to the appropriate handler.
 	if (COAP_CODE_IS_REQUEST(packet->code)) {
@@ -493,6 +659,7 @@ smcp_inbound_packet_process(
 	}
 
 bail:
+	self->dupe_info.current = NULL;
 	self->is_processing_message = false;
 	self->force_current_outbound_code = false;
 	self->inbound.packet = NULL;
@@ -534,7 +701,7 @@ smcp_handle_request() {
 
 	require_action(NULL!=request_handler,bail,ret=SMCP_STATUS_NOT_IMPLEMENTED);
 
-	smcp_inbound_reset_next_option();
+	smcp_inbound_reset_next_option_(self);
 
 	return (*request_handler)(context);
 
@@ -67,6 +67,26 @@ __BEGIN_DECLS
 #define smcp_set_current_instance(x)
 #else
 SMCP_INTERNAL_EXTERN void smcp_set_current_instance(smcp_t x);
+
+#if SMCP_MULTITHREAD && defined(SMCP_THREAD_LOCAL)
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(PIC)
+// Keeps accesses from calling __tls_get_addr() every time. Only
+// for the static library: initial-exec TLS in a shared library can
+// make dlopen() of it fail, and libtool defines PIC when building one.
+#define SMCP_CURRENT_INSTANCE_STORAGE		SMCP_THREAD_LOCAL __attribute__((tls_model("initial-exec")))
+#else
+#define SMCP_CURRENT_INSTANCE_STORAGE		SMCP_THREAD_LOCAL
+#endif
+#elif !SMCP_MULTITHREAD || !HAVE_PTHREAD
+#define SMCP_CURRENT_INSTANCE_STORAGE
+#endif
+
+#ifdef SMCP_CURRENT_INSTANCE_STORAGE
+// Inside of the library the current instance is read directly,
+// rather than through a function call.
+SMCP_INTERNAL_EXTERN SMCP_CURRENT_INSTANCE_STORAGE smcp_t smcp_current_instance;
+#define smcp_get_current_instance()		(smcp_current_instance)
+#endif
 #endif
 
 
@@ -85,6 +105,20 @@ SMCP_INTERNAL_EXTERN void smcp_set_current_instance(smcp_t x);
 
 #include "smcp-dupe.h"
 
+//! Hash index of the active transactions, by message id and by token.
+/*!	Each active transaction is on exactly one chain of each table. */
+struct smcp_transaction_index_s {
+#if SMCP_AVOID_MALLOC
+	smcp_transaction_t		by_msg_id[SMCP_CONF_TRANSACTION_INDEX_SIZE];
+	smcp_transaction_t		by_token[SMCP_CONF_TRANSACTION_INDEX_SIZE];
+#else
+	smcp_transaction_t*		by_msg_id;
+	smcp_transaction_t*		by_token;
+	uint32_t				mask;
+#endif
+	uint32_t				count;
+};
+
 #if SMCP_CONF_ENABLE_VHOSTS
 struct smcp_vhost_s {
 	char name[64];
@@ -94,16 +128,40 @@ struct smcp_vhost_s {
 #endif
 
 // Consider members of this struct to be private!
+#if SMCP_CONF_SUBMIT_QUEUE
+//! List of submissions that any thread can push onto. See smcp-submit.c.
+struct smcp_submit_queue_s {
+	struct smcp_submission_s* head;
+	int fd_read;
+	int fd_write;
+};
+#endif
+
 struct smcp_s {
 	smcp_request_handler_func	request_handler;
 	void*						request_handler_context;
 
 	struct smcp_plat_s		plat;
 
+#if SMCP_TIMERS_USE_HEAP
+	smcp_timer_t*			timer_heap;
+	uint32_t				timer_count;
+	uint32_t				timer_capacity;
+	uint32_t				timer_serial;
+#else
 	smcp_timer_t			timers;
+#endif
 
 	smcp_transaction_t		transactions;
 	smcp_transaction_t		current_transaction;
+	struct smcp_transaction_index_s transaction_index;
+
+	struct smcp_observer_s*	observers;
+	uint32_t				observer_count;
+#if !SMCP_AVOID_MALLOC
+	struct smcp_observer_s** observer_hash;
+	uint32_t				observer_hash_mask;
+#endif
 
 	// Operational Flags
 	uint8_t					is_responding:1,
@@ -113,6 +171,7 @@ struct smcp_s {
 							force_current_outbound_code:1;
 
 	coap_msg_id_t			last_msg_id;
+	uint32_t				last_token_counter;
 
 	//! Inbound packet variables.
 	struct {
@@ -122,6 +181,20 @@ struct smcp_s {
 		coap_option_key_t		last_option_key;
 		const uint8_t*			this_option;
 
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+		//! Options decoded by smcp_inbound_index_options().
+		struct {
+			coap_option_key_t	key;
+			coap_size_t			offset;	//!< Offset of the value from the start of the packet.
+			coap_size_t			len;
+		} options[SMCP_CONF_INBOUND_OPTION_INDEX_SIZE];
+		uint8_t					option_count;
+		uint8_t					option_next;
+
+		//! One bit for every option key below 64 that is in the index.
+		uint64_t				option_mask;
+#endif
+
 		const char*				content_ptr;
 		coap_size_t				content_len;
 		coap_content_type_t		content_type;
@@ -149,6 +222,20 @@ struct smcp_s {
 		coap_msg_id_t           next_tid;
 
 		coap_option_key_t		last_option_key;
+
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+		//! Out-of-order options that haven't been written into the packet yet.
+		/*!	Sorted by key. Their values are stored at the end of
+		**	the packet buffer, `offset` bytes from its end. */
+		struct {
+			coap_option_key_t	key;
+			coap_size_t			offset;
+			coap_size_t			len;
+		} staged[SMCP_CONF_OUTBOUND_STAGED_OPTIONS];
+		uint8_t					staged_count;
+		uint8_t					staged_limit;	//!< How much of `staged` may be used.
+		coap_size_t				staged_bytes;
+#endif
 	} outbound;
 
 	struct smcp_dupe_info_s dupe_info;
@@ -162,6 +249,14 @@ struct smcp_s {
 	uint8_t					cascade_count;
 #endif
 
+#if SMCP_CONF_SUBMIT_QUEUE
+	struct smcp_submit_queue_s	submit_queue;
+#endif
+
+#if SMCP_CONF_SLAB
+	struct smcp_slab_s*		slab;
+#endif
+
 	const char* proxy_url;
 };
 
@@ -172,8 +267,77 @@ SMCP_API_EXTERN smcp_t smcp_init(smcp_t self);
 
 SMCP_INTERNAL_EXTERN smcp_status_t smcp_handle_request();
 
+//! Decodes the options of the inbound packet and resets the option scanner.
+/*!	Must be called whenever `inbound.packet` changes, before any of the
+**	inbound option accessors are used. */
+SMCP_INTERNAL_EXTERN void smcp_inbound_index_options(smcp_t self);
+
+#if SMCP_CONF_SUBMIT_QUEUE
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_submit_init(smcp_t self);
+SMCP_INTERNAL_EXTERN void smcp_submit_finalize(smcp_t self);
+
+//! Returns the file descriptor that becomes readable when something is submitted.
+SMCP_INTERNAL_EXTERN int smcp_submit_get_fd(smcp_t self);
+
+//! Must be called after the descriptor from smcp_submit_get_fd() is seen to be readable.
+SMCP_INTERNAL_EXTERN void smcp_submit_clear_wakeup(smcp_t self);
+
+//! Begins transactions for everything that has been submitted.
+SMCP_INTERNAL_EXTERN void smcp_submit_process(smcp_t self);
+#endif
+
+#if SMCP_CONF_SLAB
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_slab_init(smcp_t self);
+
+//! Frees the slab, unless some of its objects are still allocated.
+SMCP_INTERNAL_EXTERN void smcp_slab_finalize(smcp_t self);
+
+//!	Allocates `size` zeroed bytes from the slab of `self`.
+/*!	Comes from the heap instead if `self` is NULL or isn't the
+**	current instance. Either way, the memory must be freed
+**	with smcp_slab_free(), which may be called from any thread. */
+SMCP_INTERNAL_EXTERN void* smcp_slab_alloc(smcp_t self, size_t size);
+
+SMCP_INTERNAL_EXTERN void smcp_slab_free(void* ptr);
+#else
+#define smcp_slab_alloc(self, size)		calloc(1, size)
+#define smcp_slab_free(ptr)				free(ptr)
+#endif
+
 SMCP_INTERNAL_EXTERN smcp_status_t smcp_handle_response();
 
+//! Cancels all scheduled timers and frees the timer queue.
+SMCP_INTERNAL_EXTERN void smcp_timers_finalize(smcp_t self);
+
+//! Frees every observer of the instance.
+SMCP_INTERNAL_EXTERN void smcp_observers_finalize(smcp_t self);
+
+//! Returns how many bytes an unsigned integer option value takes up.
+SMCP_INTERNAL_EXTERN uint8_t smcp_calc_uint32_option_size(uint32_t big_endian_value);
+
+//! Begins a response to a request that was saved earlier.
+/*!	Sets up the inbound state as if `request` had just been received
+**	from `remote` on `local`, so that request handlers can be run
+**	again to generate the response. `request` must not include the
+**	payload. */
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_outbound_begin_stashed_response(
+	coap_code_t code,
+	const struct coap_header_s* request,
+	coap_size_t request_len,
+	const smcp_sockaddr_t* remote,
+	const smcp_sockaddr_t* local
+);
+
+//! Frees the transaction index. Called after all transactions have ended.
+SMCP_INTERNAL_EXTERN void smcp_transaction_index_finalize(smcp_t self);
+
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+//! Holds back at most `count` out-of-order outbound options.
+/*!	Clamped to SMCP_CONF_OUTBOUND_STAGED_OPTIONS, which is the default.
+**	Only meant for testing what happens when the table fills up. */
+SMCP_INTERNAL_EXTERN void smcp_outbound_set_staged_limit(smcp_t self, int count);
+#endif
+
 SMCP_INTERNAL_EXTERN smcp_t smcp_plat_init(smcp_t self);
 SMCP_INTERNAL_EXTERN void smcp_plat_finalize(smcp_t self);
 
@@ -52,6 +52,7 @@
 #include "smcp-helpers.h"
 #include "smcp-logging.h"
 #include "smcp-internal.h"
+#include "fasthash.h"
 
 // MARK: -
 // MARK: Globals
@@ -60,6 +61,238 @@
 static struct smcp_node_s smcp_node_pool[SMCP_CONF_MAX_ALLOCED_NODES];
 #endif
 
+#if SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+// MARK: -
+// MARK: Route Tables
+
+// A route table is a trie over path segments: every node of the
+// subtree is an entry, and the edges from an entry to its children
+// are all kept in a single open-addressed hash table, keyed on the
+// index of the parent entry and the name of the child. The table is
+// never changed after it has been built, so any number of threads
+// may look things up in it at the same time.
+
+struct smcp_node_route_entry_s {
+	smcp_node_t node;
+	uint32_t parent;	//!< Index of the parent entry.
+	uint32_t hash;
+	uint8_t name_len;
+};
+
+struct smcp_node_route_table_s {
+	uint32_t count;
+	uint32_t mask;
+	uint32_t* slots;	//!< One past the index of an entry, zero if empty.
+
+	// Entry zero is the node the table was built for.
+	struct smcp_node_route_entry_s entries[];
+};
+
+//! Stands in for a table that some thread is still building.
+#define ROUTE_TABLE_BUILDING	((struct smcp_node_route_table_s*)(uintptr_t)1)
+
+static uint32_t
+route_table_hash(uint32_t parent, const char* name, uint8_t name_len)
+{
+	struct fasthash_state_s state;
+
+	fasthash_start(&state, parent);
+	fasthash_feed(&state, (const uint8_t*)name, name_len);
+
+	return fasthash_finish_uint32(&state);
+}
+
+static smcp_node_t
+first_child(smcp_node_t node)
+{
+#if SMCP_NODE_ROUTER_USE_BTREE
+	return (smcp_node_t)bt_first(node->children);
+#else
+	return node->children;
+#endif
+}
+
+static smcp_node_t
+next_sibling(smcp_node_t node)
+{
+#if SMCP_NODE_ROUTER_USE_BTREE
+	return (smcp_node_t)bt_next(node);
+#else
+	return (smcp_node_t)ll_next(node);
+#endif
+}
+
+static uint32_t
+count_subtree(smcp_node_t node)
+{
+	uint32_t count = 1;
+
+	for (node = first_child(node); node != NULL; node = next_sibling(node)) {
+		count += count_subtree(node);
+	}
+
+	return count;
+}
+
+//! Adds the edge to `entry` from its parent, unless a sibling already has its name.
+static void
+route_table_link(struct smcp_node_route_table_s* table, uint32_t index)
+{
+	const struct smcp_node_route_entry_s* const entry = &table->entries[index];
+	uint32_t slot;
+
+	for (slot = entry->hash & table->mask;
+		table->slots[slot] != 0;
+		slot = (slot + 1) & table->mask
+	) {
+		const struct smcp_node_route_entry_s* const other = &table->entries[table->slots[slot] - 1];
+
+		if ((other->hash == entry->hash)
+			&& (other->parent == entry->parent)
+			&& (other->name_len == entry->name_len)
+			&& (0 == memcmp(other->node->name, entry->node->name, entry->name_len))
+		) {
+			// The one that comes first wins, just like with smcp_node_find().
+			return;
+		}
+	}
+
+	table->slots[slot] = index + 1;
+}
+
+static struct smcp_node_route_table_s*
+build_route_table(smcp_node_t root)
+{
+	struct smcp_node_route_table_s* table;
+	const uint32_t count = count_subtree(root);
+	uint32_t size = 16;
+	uint32_t i;
+
+	// Keep the table at most half full.
+	while (size < count * 2) {
+		size *= 2;
+	}
+
+	table = (struct smcp_node_route_table_s*)calloc(
+		1,
+		sizeof(*table)
+		+ count * sizeof(table->entries[0])
+		+ size * sizeof(table->slots[0])
+	);
+
+	require(table != NULL, bail);
+
+	table->mask = size - 1;
+	table->slots = (uint32_t*)&table->entries[count];
+	table->entries[0].node = root;
+	table->count = 1;
+
+	// The entries double as the queue for a breadth-first walk.
+	for (i = 0; i < table->count; i++) {
+		smcp_node_t child;
+
+		for (child = first_child(table->entries[i].node); child != NULL; child = next_sibling(child)) {
+			struct smcp_node_route_entry_s* const entry = &table->entries[table->count];
+			const size_t name_len = child->name ? strlen(child->name) : 0;
+
+			entry->node = child;
+			entry->parent = i;
+
+			// Path segments can't be longer than this, so
+			// there is no need to be able to look it up.
+			if (child->name && (name_len <= 255)) {
+				entry->name_len = (uint8_t)name_len;
+				entry->hash = route_table_hash(i, child->name, entry->name_len);
+				route_table_link(table, table->count);
+			}
+
+			table->count++;
+		}
+	}
+
+	check(table->count == count);
+
+bail:
+	return table;
+}
+
+//! Returns the route table for the subtree below `node`, building it if needed.
+/*!	Returns NULL if the table couldn't be built right now, in which
+**	case the caller has to look up each segment in the tree itself. */
+static const struct smcp_node_route_table_s*
+get_route_table(smcp_node_t node)
+{
+	struct smcp_node_route_table_s* table = __atomic_load_n(&node->route_table, __ATOMIC_ACQUIRE);
+
+	if (table == NULL) {
+		// Only one thread gets to build it. The others fall
+		// back to the tree until it is ready.
+		if (__atomic_compare_exchange_n(
+			&node->route_table, &table, ROUTE_TABLE_BUILDING,
+			false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED
+		)) {
+			table = build_route_table(node);
+			__atomic_store_n(&node->route_table, table, __ATOMIC_RELEASE);
+		}
+	}
+
+	if (table == ROUTE_TABLE_BUILDING) {
+		table = NULL;
+	}
+
+	return table;
+}
+
+//! Finds the child of entry `*index` named `name` and moves `*index` to it.
+static smcp_node_t
+route_table_find(
+	const struct smcp_node_route_table_s* table,
+	uint32_t* index,
+	const char* name,
+	coap_size_t name_len
+) {
+	uint32_t hash;
+	uint32_t slot;
+
+	if (name_len > 255) {
+		return NULL;
+	}
+
+	hash = route_table_hash(*index, name, (uint8_t)name_len);
+
+	for (slot = hash & table->mask;
+		table->slots[slot] != 0;
+		slot = (slot + 1) & table->mask
+	) {
+		const struct smcp_node_route_entry_s* const entry = &table->entries[table->slots[slot] - 1];
+
+		if ((entry->hash == hash)
+			&& (entry->parent == *index)
+			&& (entry->name_len == name_len)
+			&& (0 == memcmp(entry->node->name, name, name_len))
+		) {
+			*index = table->slots[slot] - 1;
+			return entry->node;
+		}
+	}
+
+	return NULL;
+}
+
+//! Throws away the route tables that include `node`.
+static void
+invalidate_route_tables(smcp_node_t node)
+{
+	for (; node != NULL; node = node->parent) {
+		struct smcp_node_route_table_s* const table = __atomic_exchange_n(&node->route_table, NULL, __ATOMIC_ACQ_REL);
+
+		if (table != ROUTE_TABLE_BUILDING) {
+			free(table);
+		}
+	}
+}
+#endif // SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+
 // MARK: -
 
 smcp_status_t
@@ -87,13 +320,19 @@ smcp_status_t
 smcp_node_route(smcp_node_t node, smcp_request_handler_func* func, void** context) {
 	smcp_status_t ret = 0;
 	smcp_t const self = smcp_get_current_instance();
+#if SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+	const struct smcp_node_route_table_s* const table = get_route_table(node);
+	uint32_t index = 0;
+#endif
 
 	smcp_inbound_reset_next_option();
 
 	{
-		// TODO: Rewrite this to be more efficient.
 		const uint8_t* prev_option_ptr = self->inbound.this_option;
 		coap_option_key_t prev_key = 0;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+		uint8_t prev_option_next = 0;
+#endif
 		coap_option_key_t key;
 		const uint8_t* value;
 		coap_size_t value_len;
@@ -101,18 +340,32 @@ smcp_node_route(smcp_node_t node, smcp_request_handler_func* func, void** contex
 			if (key > COAP_OPTION_URI_PATH) {
 				self->inbound.this_option = prev_option_ptr;
 				self->inbound.last_option_key = prev_key;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+				self->inbound.option_next = prev_option_next;
+#endif
 				break;
 			} else if (key == COAP_OPTION_URI_PATH) {
-				smcp_node_t next = smcp_node_find(
-					node,
-					(const char*)value,
-					(int)value_len
-				);
+				smcp_node_t next;
+#if SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+				if (table != NULL) {
+					next = route_table_find(table, &index, (const char*)value, value_len);
+				} else
+#endif
+				{
+					next = smcp_node_find(
+						node,
+						(const char*)value,
+						(int)value_len
+					);
+				}
 				if (next) {
 					node = next;
 				} else {
 					self->inbound.this_option = prev_option_ptr;
 					self->inbound.last_option_key = prev_key;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+					self->inbound.option_next = prev_option_next;
+#endif
 					break;
 				}
 			} else if(key==COAP_OPTION_URI_HOST) {
@@ -137,6 +390,9 @@ smcp_node_route(smcp_node_t node, smcp_request_handler_func* func, void** contex
 			}
 			prev_option_ptr = self->inbound.this_option;
 			prev_key = self->inbound.last_option_key;
+#if SMCP_CONF_INBOUND_OPTION_INDEX_SIZE
+			prev_option_next = self->inbound.option_next;
+#endif
 		}
 	}
 
@@ -248,6 +504,9 @@ smcp_node_init(
 	if (node) {
 		require(name, bail);
 		ret->name = name;
+#if SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+		invalidate_route_tables(node);
+#endif
 #if SMCP_NODE_ROUTER_USE_BTREE
 		bt_insert(
 			(void**)&((smcp_node_t)node)->children,
@@ -277,6 +536,10 @@ smcp_node_delete(smcp_node_t node) {
 
 	DEBUG_PRINTF("%s: %p",__func__,node);
 
+#if SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+	invalidate_route_tables(node);
+#endif
+
 	if (node->parent) {
 		owner = (void**)&((smcp_node_t)node->parent)->children;
 	}
@@ -98,6 +98,11 @@ __BEGIN_DECLS
 **	node handles a GET for "/mydevice/blah/a", the first option it fetches
 **	will be the urlpath option "a".
 **
+**	When SMCP_NODE_ROUTER_USE_ROUTE_TABLE is set, routing only reads from
+**	the node tree, so several threads may route through the same tree at
+**	once. Adding or deleting nodes must still not happen while any thread
+**	is routing.
+**
 **	@sa @ref smcp-example-3
 */
 
@@ -123,6 +128,10 @@ struct smcp_node_s {
 								is_observable:1,
 								should_free_name:1;
 
+#if SMCP_NODE_ROUTER_USE_ROUTE_TABLE
+	// Private: Routes compiled by smcp_node_route() for this subtree.
+	struct smcp_node_route_table_s* route_table;
+#endif
 };
 
 SMCP_API_EXTERN bt_compare_result_t smcp_node_compare(smcp_node_t lhs, smcp_node_t rhs);
@@ -33,89 +33,702 @@
 #include "assert-macros.h"
 #include "smcp-internal.h"
 #include "smcp-logging.h"
-
-#define INVALID_OBSERVER_INDEX		(SMCP_MAX_OBSERVERS)
+#include "fasthash.h"
 
 #define SHOULD_CONFIRM_EVENT_FOR_OBSERVER(obs)		(!((obs)->seq&0x7))
 
 struct smcp_observer_s {
 	/**** All of this is private. Don't touch. ****/
 
+	struct ll_item_s ll;	//!< Every observer of the instance.
+	struct smcp_observer_s *next;	//!< Next observer of the same observable.
+	struct smcp_observer_s *prev;	//!< Previous observer of the same observable.
 	struct smcp_observable_s *observable;
-	int8_t next;	// always n+1, zero is end of list
 	uint8_t key;
 	uint32_t seq;
-	struct smcp_async_response_s async_response;
 	struct smcp_transaction_s transaction;
+
+	// Rate limiting. The timer fires the pending notification once
+	// `pmin` is up, or a keepalive notification once `pmax` is up.
+	struct smcp_timer_s timer;
+	smcp_timestamp_t last_sent;
+	smcp_cms_t pmin;
+	smcp_cms_t pmax;
+	bool pending;
+
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+	//! The rendered notification this observer is currently being sent.
+	struct smcp_notification_s *notification;
+#endif
+
+#if !SMCP_AVOID_MALLOC
+	struct smcp_observer_s *hash_next;	//!< Next observer in the same bucket.
+	uint32_t hash;
+#endif
+
+	// What we need to replay the request when sending an event:
+	// the header, token and options (but not the payload) of the
+	// request and the addresses it was exchanged on.
+	smcp_sockaddr_t sockaddr_local;
+	smcp_sockaddr_t sockaddr_remote;
+	coap_size_t request_len;
+#if SMCP_AVOID_MALLOC
+	uint8_t request[SMCP_ASYNC_RESPONSE_MAX_LENGTH];
+#else
+	uint8_t *request;
+#endif
 };
 
-static struct smcp_observer_s observer_table[SMCP_MAX_OBSERVERS];
+#if SMCP_AVOID_MALLOC
+static struct smcp_observer_s observer_pool[SMCP_MAX_OBSERVERS];
+#define OBSERVER_FIND_NEXT(observer)	((observer)->next)
+#else
+#define OBSERVER_FIND_NEXT(observer)	((observer)->hash_next)
+#endif
+
+static smcp_t
+get_observable_instance(smcp_observable_t context) {
+#if SMCP_EMBEDDED
+	return smcp_get_current_instance();
+#else
+	return context->interface;
+#endif
+}
+
+#if !SMCP_AVOID_MALLOC
+// MARK: -
+// MARK: Observer Lookup
+
+// Observers are found again by the address of the remote endpoint and
+// the token of its request. On hosted builds, every observer of the
+// instance is also kept in a hash table on those, so that a new
+// registration doesn't have to be compared against every other
+// observer of the same resource.
+
+#define OBSERVER_HASH_MIN_SIZE		(64)
+
+static uint32_t
+calc_observer_hash(const smcp_sockaddr_t* remote, const uint8_t* token, uint8_t token_len)
+{
+	struct fasthash_state_s state;
+
+	fasthash_start(&state, 0);
+	fasthash_feed(&state, (const uint8_t*)&remote->smcp_addr, sizeof(smcp_addr_t));
+	fasthash_feed(&state, (const uint8_t*)&remote->smcp_port, sizeof(remote->smcp_port));
+	fasthash_feed(&state, token, token_len);
+
+	return fasthash_finish_uint32(&state);
+}
+
+static void
+link_observer_hash(smcp_t interface, struct smcp_observer_s *observer)
+{
+	struct smcp_observer_s **bucket = &interface->observer_hash[observer->hash & interface->observer_hash_mask];
+
+	observer->hash_next = *bucket;
+	*bucket = observer;
+}
+
+static void
+unlink_observer_hash(smcp_t interface, struct smcp_observer_s *observer)
+{
+	struct smcp_observer_s **iter;
+
+	if (interface->observer_hash == NULL) {
+		return;
+	}
+
+	iter = &interface->observer_hash[observer->hash & interface->observer_hash_mask];
+
+	for (; *iter != NULL; iter = &(*iter)->hash_next) {
+		if (*iter == observer) {
+			*iter = observer->hash_next;
+			break;
+		}
+	}
+}
+
+//! Makes sure the hash table has room for one more observer.
+static smcp_status_t
+reserve_observer_hash(smcp_t interface)
+{
+	struct smcp_observer_s **table;
+	struct smcp_observer_s *observer;
+	uint32_t size;
+
+	if (interface->observer_hash == NULL) {
+		size = OBSERVER_HASH_MIN_SIZE;
+	} else if (interface->observer_count > interface->observer_hash_mask) {
+		size = (interface->observer_hash_mask + 1) * 2;
+	} else {
+		return SMCP_STATUS_OK;
+	}
+
+	table = (struct smcp_observer_s**)calloc(size, sizeof(*table));
+
+	if (table == NULL) {
+		// Failing to grow only makes the chains longer.
+		return interface->observer_hash ? SMCP_STATUS_OK : SMCP_STATUS_MALLOC_FAILURE;
+	}
+
+	free(interface->observer_hash);
+	interface->observer_hash = table;
+	interface->observer_hash_mask = size - 1;
+
+	for (observer = interface->observers; observer != NULL; observer = ll_next(observer)) {
+		link_observer_hash(interface, observer);
+	}
+
+	return SMCP_STATUS_OK;
+}
+#endif // !SMCP_AVOID_MALLOC
+
+static bool
+inbound_is_from_observer(struct smcp_observer_s *observer)
+{
+	const struct coap_header_s* const request = (const struct coap_header_s*)observer->request;
+	const struct coap_header_s* const packet = smcp_inbound_get_packet();
+	const smcp_sockaddr_t* const remote = smcp_plat_get_remote_sockaddr();
+
+	return (observer->sockaddr_remote.smcp_port == remote->smcp_port)
+		&& (0 == memcmp(&observer->sockaddr_remote.smcp_addr, &remote->smcp_addr, sizeof(smcp_addr_t)))
+		&& (request->code == packet->code)
+		&& (request->token_len == packet->token_len)
+		&& (0 == memcmp(request->token, packet->token, packet->token_len));
+}
+
+//! Finds the observer that the current inbound request came from.
+static struct smcp_observer_s*
+find_observer(smcp_t interface, smcp_observable_t context, uint8_t key)
+{
+	struct smcp_observer_s *observer;
+
+#if SMCP_AVOID_MALLOC
+	observer = context->first_observer;
+#else
+	const uint32_t hash = calc_observer_hash(
+		smcp_plat_get_remote_sockaddr(),
+		smcp_inbound_get_packet()->token,
+		smcp_inbound_get_packet()->token_len
+	);
+
+	if (interface->observer_hash == NULL) {
+		return NULL;
+	}
+
+	observer = interface->observer_hash[hash & interface->observer_hash_mask];
+#endif
+
+	for (; observer != NULL; observer = OBSERVER_FIND_NEXT(observer)) {
+#if !SMCP_AVOID_MALLOC
+		if ((observer->hash != hash) || (observer->observable != context)) {
+			continue;
+		}
+#endif
+		assert(observer->observable == context);
+		if (observer->key != key) {
+			continue;
+		}
+		if (inbound_is_from_observer(observer)) {
+			break;
+		}
+	}
+
+	return observer;
+}
+
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+// MARK: -
+// MARK: Shared Notifications
+
+// When an observable is triggered, the first observer to be notified
+// calls the request handler and the notification it renders is kept
+// around. Every other observer that registered with the same request
+// is then sent a copy of it: only the token, message id and Observe
+// option differ, so the options are stored in two parts around the
+// Observe option and the notification is pieced back together for
+// each observer without calling the request handler again.
+
+struct smcp_notification_s {
+	struct smcp_notification_s *next;
+	struct smcp_notification_s *prev;
+	smcp_observable_t observable;	//!< NULL once a trigger has made this stale.
+	uint32_t refs;	//!< Number of observers that are being sent this.
+	uint8_t key;
+	uint8_t request_code;
+	coap_code_t code;
+	coap_option_key_t before_observe_key;	//!< Key of the option just before Observe.
+	coap_option_key_t last_key;
+	coap_size_t request_len;	//!< Length of the request options.
+	coap_size_t before_len;	//!< Length of the options before Observe.
+	coap_size_t after_len;	//!< Length of the options after Observe.
+	coap_size_t content_len;
+
+	// The request options, followed by the notification's options
+	// before Observe and after it, followed by the content.
+	uint8_t data[];
+};
+
+static const uint8_t*
+get_request_options(const struct smcp_observer_s *observer, coap_size_t* len)
+{
+	const struct coap_header_s* const request = (const struct coap_header_s*)observer->request;
+	const uint8_t* const options = request->token + request->token_len;
+
+	*len = (coap_size_t)(observer->request + observer->request_len - options);
+
+	return options;
+}
+
+static void
+release_notification(struct smcp_observer_s *observer)
+{
+	struct smcp_notification_s* const notification = observer->notification;
+
+	if (notification == NULL) {
+		return;
+	}
+
+	observer->notification = NULL;
+
+	if (--notification->refs != 0) {
+		return;
+	}
+
+	if (notification->observable != NULL) {
+		if (notification->prev) {
+			notification->prev->next = notification->next;
+		} else {
+			notification->observable->notifications = notification->next;
+		}
+
+		if (notification->next) {
+			notification->next->prev = notification->prev;
+		}
+	}
+
+	free(notification);
+}
+
+//! Makes the notifications rendered so far unavailable to observers that haven't been sent one yet.
+static void
+detach_notifications(smcp_observable_t context)
+{
+	struct smcp_notification_s *notification;
+
+	for (notification = context->notifications; notification != NULL; notification = notification->next) {
+		notification->observable = NULL;
+	}
+
+	context->notifications = NULL;
+}
 
-static int8_t
-get_unused_observer_index() {
-	int8_t ret = 0;
-	for (; ret < SMCP_MAX_OBSERVERS; ret++) {
-		if ( observer_table[ret].async_response.request_len == 0
-		  && observer_table[ret].next == 0
-		  && observer_table[ret].transaction.active == 0
+//! Finds a notification that was rendered for an identical request.
+static struct smcp_notification_s*
+find_notification(struct smcp_observer_s *observer)
+{
+	struct smcp_notification_s *notification;
+	coap_size_t request_len;
+	const uint8_t* const request = get_request_options(observer, &request_len);
+
+	for (notification = observer->observable->notifications;
+		notification != NULL;
+		notification = notification->next
+	) {
+		if ((notification->key == observer->key)
+			&& (notification->request_code == ((const struct coap_header_s*)observer->request)->code)
+			&& (notification->request_len == request_len)
+			&& (0 == memcmp(notification->data, request, request_len))
 		) {
+			notification->refs++;
 			break;
 		}
 	}
-	if (ret==SMCP_MAX_OBSERVERS) {
-		ret = -1;
+
+	return notification;
+}
+
+//! Keeps a copy of the notification that was just sent to `observer`.
+static void
+capture_notification(struct smcp_observer_s *observer)
+{
+	smcp_t const self = smcp_get_current_instance();
+	const struct coap_header_s* const packet = self->outbound.packet;
+	const uint8_t* const options = packet->token + packet->token_len;
+	const uint8_t* const options_end = (const uint8_t*)self->outbound.content_ptr - 1;
+	const uint8_t* iter = options;
+	const uint8_t* observe = NULL;
+	const uint8_t* after_observe = NULL;
+	coap_option_key_t key = 0;
+	coap_option_key_t before_observe_key = 0;
+	coap_size_t request_len;
+	const uint8_t* const request = get_request_options(observer, &request_len);
+	struct smcp_notification_s *notification;
+	uint8_t* data;
+
+	while (iter < options_end) {
+		const coap_option_key_t prev_key = key;
+		const uint8_t* const next = coap_decode_option(iter, &key, NULL, NULL);
+
+		require_quiet(next != NULL, bail);
+
+		if ((key == COAP_OPTION_OBSERVE) && (observe == NULL)) {
+			observe = iter;
+			after_observe = next;
+			before_observe_key = prev_key;
+		}
+
+		iter = next;
 	}
+
+	// The handler took the Observe option out, so it's
+	// not something we know how to send to someone else.
+	require_quiet(observe != NULL, bail);
+
+	notification = (struct smcp_notification_s*)malloc(
+		sizeof(*notification)
+		+ request_len
+		+ (coap_size_t)(observe - options)
+		+ (coap_size_t)(options_end - after_observe)
+		+ self->outbound.content_len
+	);
+
+	require_quiet(notification != NULL, bail);
+
+	notification->observable = observer->observable;
+	notification->refs = 1;
+	notification->key = observer->key;
+	notification->request_code = ((const struct coap_header_s*)observer->request)->code;
+	notification->code = packet->code;
+	notification->before_observe_key = before_observe_key;
+	notification->last_key = key;
+	notification->request_len = request_len;
+	notification->before_len = (coap_size_t)(observe - options);
+	notification->after_len = (coap_size_t)(options_end - after_observe);
+	notification->content_len = self->outbound.content_len;
+
+	data = notification->data;
+	memcpy(data, request, request_len);
+	data += request_len;
+	memcpy(data, options, notification->before_len);
+	data += notification->before_len;
+	memcpy(data, after_observe, notification->after_len);
+	data += notification->after_len;
+	memcpy(data, self->outbound.content_ptr, notification->content_len);
+
+	notification->prev = NULL;
+	notification->next = observer->observable->notifications;
+	if (notification->next) {
+		notification->next->prev = notification;
+	}
+	observer->observable->notifications = notification;
+
+	observer->notification = notification;
+
+bail:
+	return;
+}
+
+//! Sends the notification `observer` shares with others.
+/*!	The outbound packet must have already been begun. */
+static smcp_status_t
+send_shared_notification(struct smcp_observer_s *observer)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	smcp_t const self = smcp_get_current_instance();
+	const struct smcp_notification_s* const notification = observer->notification;
+	const uint8_t* data = notification->data + notification->request_len;
+	uint8_t* ptr = self->outbound.packet->token + self->outbound.packet->token_len;
+	const uint32_t seq = htonl(observer->seq);
+	const uint8_t seq_size = smcp_calc_uint32_option_size(seq);
+
+	// Observe takes up at most 5 bytes, plus one for the payload marker.
+	require_action(
+		(coap_size_t)(ptr - (uint8_t*)self->outbound.packet)
+			+ notification->before_len + 5
+			+ notification->after_len + 1
+			+ notification->content_len
+			<= self->outbound.max_packet_len,
+		bail,
+		ret = SMCP_STATUS_MESSAGE_TOO_BIG
+	);
+
+	self->outbound.packet->code = notification->code;
+
+	memcpy(ptr, data, notification->before_len);
+	ptr += notification->before_len;
+	data += notification->before_len;
+
+	ptr = coap_encode_option(
+		ptr,
+		notification->before_observe_key,
+		COAP_OPTION_OBSERVE,
+		(const uint8_t*)&seq + 4 - seq_size,
+		seq_size
+	);
+
+	memcpy(ptr, data, notification->after_len);
+	ptr += notification->after_len;
+	data += notification->after_len;
+
+	*ptr++ = 0xFF;
+
+	self->outbound.content_ptr = (char*)ptr;
+	self->outbound.last_option_key = notification->last_key;
+
+	memcpy(ptr, data, notification->content_len);
+	self->outbound.content_len = notification->content_len;
+
+	ret = smcp_outbound_send();
+
+bail:
 	return ret;
 }
+#endif // SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+
+// MARK: -
+// MARK: Observers
+
+static struct smcp_observer_s*
+alloc_observer(smcp_t interface) {
+	struct smcp_observer_s *observer = NULL;
+
+	require_quiet(interface->observer_count < SMCP_MAX_OBSERVERS, bail);
+
+#if !SMCP_AVOID_MALLOC
+	require_noerr(reserve_observer_hash(interface), bail);
+#endif
+
+#if SMCP_AVOID_MALLOC
+	{
+		uint8_t i;
+		for (i = 0; i < SMCP_MAX_OBSERVERS; i++) {
+			if (observer_pool[i].observable == NULL) {
+				observer = &observer_pool[i];
+				memset(observer, 0, sizeof(*observer));
+				break;
+			}
+		}
+	}
+#else
+	observer = (struct smcp_observer_s*)calloc(1, sizeof(*observer));
+#endif
+
+	require(observer != NULL, bail);
+
+	ll_prepend((void**)&interface->observers, observer);
+	interface->observer_count++;
+
+#if !SMCP_AVOID_MALLOC
+	observer->hash = calc_observer_hash(
+		smcp_plat_get_remote_sockaddr(),
+		smcp_inbound_get_packet()->token,
+		smcp_inbound_get_packet()->token_len
+	);
+	link_observer_hash(interface, observer);
+#endif
+
+bail:
+	return observer;
+}
 
 static void
-free_observer(struct smcp_observer_s *observer)
+release_observer(smcp_t interface, struct smcp_observer_s *observer) {
+	if (smcp_timer_is_scheduled(interface, &observer->timer)) {
+		smcp_invalidate_timer(interface, &observer->timer);
+	}
+
+	smcp_transaction_end(interface, &observer->transaction);
+
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+	release_notification(observer);
+#endif
+
+	ll_remove((void**)&interface->observers, observer);
+	interface->observer_count--;
+
+#if SMCP_AVOID_MALLOC
+	observer->observable = NULL;
+#else
+	unlink_observer_hash(interface, observer);
+	free(observer->request);
+	free(observer);
+#endif
+}
+
+//! Takes the observer off of its observable's list of observers.
+static void
+unlink_observer(struct smcp_observer_s *observer)
 {
 	smcp_observable_t const context = observer->observable;
-	int8_t i = (int8_t)(observer - observer_table);
 
-#if !SMCP_EMBEDDED
-	if (!observer->observable) {
-		goto bail;
+	if (observer->prev) {
+		observer->prev->next = observer->next;
+	} else {
+		context->first_observer = observer->next;
+	}
+
+	if (observer->next) {
+		observer->next->prev = observer->prev;
+	} else {
+		context->last_observer = observer->prev;
 	}
-	smcp_t const interface = observer->observable->interface;
+
+	observer->next = observer->prev = NULL;
+}
+
+static void
+free_observer(struct smcp_observer_s *observer)
+{
+	smcp_t const interface = get_observable_instance(observer->observable);
+
+	unlink_observer(observer);
+	release_observer(interface, observer);
+}
+
+void
+smcp_observers_finalize(smcp_t self) {
+	// The observables belong to the application, which must keep
+	// them around for as long as they have observers. Unlinking the
+	// observers leaves them empty, so they can be used again.
+	while (self->observers) {
+		unlink_observer(self->observers);
+		release_observer(self, self->observers);
+	}
+
+#if !SMCP_AVOID_MALLOC
+	free(self->observer_hash);
+	self->observer_hash = NULL;
+	self->observer_hash_mask = 0;
 #endif
+}
 
-	smcp_transaction_end(interface, &observer->transaction);
+//! Saves a compact copy of the current inbound request for replaying later.
+static smcp_status_t
+stash_request(struct smcp_observer_s *observer)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	const coap_size_t request_len = smcp_inbound_get_packet_length() - smcp_inbound_get_content_len();
 
+#if SMCP_AVOID_MALLOC
+	require_action(
+		request_len <= sizeof(observer->request),
+		bail,
+		(smcp_outbound_quick_response(COAP_RESULT_413_REQUEST_ENTITY_TOO_LARGE, NULL), ret = SMCP_STATUS_MESSAGE_TOO_BIG)
+	);
+#else
+	if (observer->request_len != request_len) {
+		uint8_t* request = (uint8_t*)realloc(observer->request, request_len);
+		require_action(request != NULL, bail, ret = SMCP_STATUS_MALLOC_FAILURE);
+		observer->request = request;
+	}
+#endif
 
-	if ((context->first_observer==i+1) && (context->last_observer==i+1)) {
-		context->first_observer = context->last_observer = 0;
+	memcpy(observer->request, smcp_inbound_get_packet(), request_len);
+	observer->request_len = request_len;
 
-	} else if (context->first_observer == i+1) {
-		context->first_observer = observer_table[i].next;
+	observer->sockaddr_remote = *smcp_plat_get_remote_sockaddr();
+	observer->sockaddr_local = *smcp_plat_get_local_sockaddr();
 
-	} else {
-		int8_t prev;
-		for (prev = context->first_observer-1; prev>=0; i = observer_table[i].next - 1) {
-			if (observer_table[prev].next == i) {
-				break;
-			}
+bail:
+	return ret;
+}
+
+// MARK: -
+// MARK: Notification Periods
+
+//! Parses the value of a `pmin=` or `pmax=` query into milliseconds.
+static smcp_cms_t
+parse_period(const uint8_t* value, coap_size_t len)
+{
+	smcp_cms_t seconds = 0;
+
+	for (; len != 0; value++, len--) {
+		if ((*value < '0') || (*value > '9')) {
+			break;
+		}
+		if (seconds < INT32_MAX / MSEC_PER_SEC / 10) {
+			seconds = seconds * 10 + (*value - '0');
 		}
+	}
 
-		observer_table[prev].next = observer_table[i].next;
+	return seconds * MSEC_PER_SEC;
+}
 
-		if (context->last_observer == i+1) {
-			context->last_observer = prev;
+//! Works out the notification periods from the observable and the stashed request.
+static void
+update_observer_periods(struct smcp_observer_s *observer)
+{
+	const struct coap_header_s* const request = (const struct coap_header_s*)observer->request;
+	const uint8_t* iter = request->token + request->token_len;
+	const uint8_t* const end = observer->request + observer->request_len;
+	coap_option_key_t key = 0;
+	const uint8_t* value;
+	coap_size_t value_len;
+
+	observer->pmin = observer->observable->pmin;
+	observer->pmax = observer->observable->pmax;
+
+	// The request was already verified when it came in.
+	while ((iter < end) && (*iter != 0xFF)) {
+		iter = coap_decode_option(iter, &key, &value, &value_len);
+
+		if (iter == NULL) {
+			break;
+		}
+
+		if (key != COAP_OPTION_URI_QUERY) {
+			continue;
+		}
+
+		if ((value_len > 5) && (0 == memcmp(value, "pmin=", 5))) {
+			smcp_cms_t pmin = parse_period(value + 5, value_len - 5);
+			if (pmin > observer->pmin) {
+				observer->pmin = pmin;
+			}
+		} else if ((value_len > 5) && (0 == memcmp(value, "pmax=", 5))) {
+			smcp_cms_t pmax = parse_period(value + 5, value_len - 5);
+			// Only ever less often, or any client could have us send
+			// keepalives to it as fast as it likes. Zero is never.
+			if ((observer->pmax != 0) && ((pmax == 0) || (pmax > observer->pmax))) {
+				observer->pmax = pmax;
+			}
 		}
 	}
 
-bail:
+	if ((observer->pmax != 0) && (observer->pmax < observer->pmin)) {
+		observer->pmax = observer->pmin;
+	}
+}
 
-	smcp_finish_async_response(&observer->async_response);
-	return;
+//! Schedules the next pending or keepalive notification, if any.
+static void
+schedule_observer_timer(struct smcp_observer_s *observer)
+{
+	smcp_t const interface = get_observable_instance(observer->observable);
+	smcp_cms_t cms = observer->pending ? observer->pmin : observer->pmax;
+
+	if (smcp_timer_is_scheduled(interface, &observer->timer)) {
+		smcp_invalidate_timer(interface, &observer->timer);
+	}
+
+	if (cms == 0) {
+		return;
+	}
+
+	// Count from the last notification rather than from now.
+	cms += smcp_plat_timestamp_to_cms(observer->last_sent);
+
+	smcp_schedule_timer(interface, &observer->timer, cms > 0 ? cms : 0);
 }
 
+static void observer_timer_fired(smcp_t interface, struct smcp_observer_s *observer);
+
 smcp_status_t
 smcp_observable_update(smcp_observable_t context, uint8_t key) {
 	smcp_status_t ret = SMCP_STATUS_OK;
 	smcp_t const interface = smcp_get_current_instance();
-	int8_t i;
+	struct smcp_observer_s *observer;
 
 #if !SMCP_EMBEDDED
 	context->interface = interface;
@@ -125,48 +738,54 @@ smcp_observable_update(smcp_observable_t context, uint8_t key) {
 		goto bail;
 	}
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		if (observer_table[i].key != key) {
-			continue;
-		}
-		if (smcp_inbound_is_related_to_async_response(&observer_table[i].async_response)) {
-			break;
-		}
-	}
+	observer = find_observer(interface, context, key);
 
 	if (interface->inbound.has_observe_option) {
-		if (i == -1) {
-			i = get_unused_observer_index();
-			if (i == -1) {
+		if (observer == NULL) {
+			observer = alloc_observer(interface);
+			if (observer == NULL) {
 				goto bail;
 			}
 
-			if (context->last_observer == 0) {
-				context->first_observer = context->last_observer = i + 1;
+			observer->key = key;
+			observer->seq = 0;
+			observer->observable = context;
+			smcp_timer_init(
+				&observer->timer,
+				(smcp_timer_callback_t)&observer_timer_fired,
+				NULL,
+				(void*)observer
+			);
+			observer->next = NULL;
+			observer->prev = context->last_observer;
+
+			if (context->last_observer == NULL) {
+				context->first_observer = observer;
 			} else {
-				observer_table[context->last_observer-1].next = i +1;
-				context->last_observer = i + 1;
+				context->last_observer->next = observer;
 			}
-
-			observer_table[i].key = key;
-			observer_table[i].seq = 0;
-			observer_table[i].observable = context;
+			context->last_observer = observer;
 		}
 
 		require_noerr_action(
-			ret = smcp_start_async_response(&observer_table[i].async_response,SMCP_ASYNC_RESPONSE_FLAG_DONT_ACK),
+			ret = stash_request(observer),
 			bail,
-			free_observer(&observer_table[i])
+			free_observer(observer)
 		);
 
 		require_noerr_action(
-			ret = smcp_outbound_add_option_uint(COAP_OPTION_OBSERVE,observer_table[i].seq),
+			ret = smcp_outbound_add_option_uint(COAP_OPTION_OBSERVE,observer->seq),
 			bail,
-			free_observer(&observer_table[i])
+			free_observer(observer)
 		);
-	} else if(i != -1) {
-		free_observer(&observer_table[i]);
+
+		// The response to the registration counts as a notification.
+		update_observer_periods(observer);
+		observer->last_sent = smcp_plat_cms_to_timestamp(0);
+		observer->pending = false;
+		schedule_observer_timer(observer);
+	} else if(observer != NULL) {
+		free_observer(observer);
 	}
 
 bail:
@@ -204,16 +823,33 @@ retry_sending_event(struct smcp_observer_s* observer)
 	smcp_status_t status;
 	smcp_t const self = smcp_get_current_instance();
 
-	status = smcp_outbound_begin_async_response(COAP_RESULT_205_CONTENT, &observer->async_response);
-	require_noerr(status,bail);
-
-	status = smcp_outbound_add_option_uint(COAP_OPTION_OBSERVE, observer->seq);
+	status = smcp_outbound_begin_stashed_response(
+		COAP_RESULT_205_CONTENT,
+		(const struct coap_header_s*)observer->request,
+		observer->request_len,
+		&observer->sockaddr_remote,
+		&observer->sockaddr_local
+	);
 	require_noerr(status,bail);
 
 	self->outbound.packet->tt = SHOULD_CONFIRM_EVENT_FOR_OBSERVER(observer)
 		?COAP_TRANS_TYPE_CONFIRMABLE
 		:COAP_TRANS_TYPE_NONCONFIRMABLE;
 
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+	if ((observer->notification == NULL) && observer->observable->share_notifications) {
+		observer->notification = find_notification(observer);
+	}
+
+	if (observer->notification != NULL) {
+		status = send_shared_notification(observer);
+		goto bail;
+	}
+#endif
+
+	status = smcp_outbound_add_option_uint(COAP_OPTION_OBSERVE, observer->seq);
+	require_noerr(status,bail);
+
 	self->inbound.has_observe_option = true;
 	self->is_responding = true;
 	self->force_current_outbound_code = true;
@@ -236,6 +872,11 @@ retry_sending_event(struct smcp_observer_s* observer)
 		smcp_outbound_set_content_len(0);
 		smcp_outbound_send();
 	}
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+	else if (self->did_respond && observer->observable->share_notifications) {
+		capture_notification(observer);
+	}
+#endif
 
 bail:
 	self->is_processing_message = false;
@@ -243,11 +884,68 @@ bail:
 	return status;
 }
 
+static smcp_status_t
+send_event(struct smcp_observer_s *observer)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	smcp_t const interface = get_observable_instance(observer->observable);
+	smcp_cms_t expiration;
+
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+	// The new notification needs to be rendered, or found, again.
+	release_notification(observer);
+#endif
+
+	observer->seq++;
+	observer->pending = false;
+	observer->last_sent = smcp_plat_cms_to_timestamp(0);
+
+	expiration = SHOULD_CONFIRM_EVENT_FOR_OBSERVER(observer)
+		? SMCP_OBSERVER_CON_EVENT_EXPIRATION
+		: SMCP_OBSERVER_NON_EVENT_EXPIRATION;
+
+	if (observer->transaction.active) {
+		// Make sure the new notification gets at least its own lifetime,
+		// otherwise it is dropped if the previous one is about to expire.
+		// A confirmable notification that is still unacknowledged keeps
+		// its longer lifetime, so that a dead observer still times out.
+		smcp_timestamp_t expires = smcp_plat_cms_to_timestamp(expiration);
+
+		if (smcp_plat_timestamp_diff(expires, observer->transaction.expiration) > 0) {
+			observer->transaction.expiration = expires;
+		}
+
+		smcp_transaction_new_msg_id(interface, &observer->transaction, smcp_get_next_msg_id(interface));
+		smcp_transaction_tickle(interface, &observer->transaction);
+	} else {
+		smcp_transaction_init(
+			&observer->transaction,
+			0, // Flags
+			(void*)&retry_sending_event,
+			(void*)&event_response_handler,
+			(void*)observer
+		);
+
+		ret = smcp_transaction_begin(interface, &observer->transaction, expiration);
+	}
+
+	schedule_observer_timer(observer);
+
+	return ret;
+}
+
+static void
+observer_timer_fired(smcp_t interface, struct smcp_observer_s *observer)
+{
+	// Either the pending notification or a keepalive is due.
+	send_event(observer);
+}
+
 smcp_status_t
 smcp_observable_trigger(smcp_observable_t context, uint8_t key, uint8_t flags)
 {
 	smcp_status_t ret = SMCP_STATUS_OK;
-	int8_t i;
+	struct smcp_observer_s *observer;
 #if !SMCP_EMBEDDED
 	smcp_t const interface = context->interface;
 
@@ -256,42 +954,40 @@ smcp_observable_trigger(smcp_observable_t context, uint8_t key, uint8_t flags)
 	}
 #endif
 
-
 	if (!context->first_observer) {
 		goto bail;
 	}
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		assert((i != context->last_observer-1) || observer_table[i].next == 0);
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+	// Whatever has been rendered so far is out of date now.
+	detach_notifications(context);
+#endif
 
-		if ((observer_table[i].key != SMCP_OBSERVABLE_BROADCAST_KEY)
+	for (observer = context->first_observer; observer != NULL; observer = observer->next) {
+		assert(observer->observable == context);
+		assert((observer != context->last_observer) || observer->next == NULL);
+
+		if ((observer->key != SMCP_OBSERVABLE_BROADCAST_KEY)
 			&& (key != SMCP_OBSERVABLE_BROADCAST_KEY)
-			&& (observer_table[i].key != key)
+			&& (observer->key != key)
 		) {
 			continue;
 		}
 
-		observer_table[i].seq++;
-
-		if (observer_table[i].transaction.active) {
-			smcp_transaction_new_msg_id(interface, &observer_table[i].transaction, smcp_get_next_msg_id(interface));
-			smcp_transaction_tickle(interface, &observer_table[i].transaction);
-		} else {
-			smcp_transaction_init(
-				&observer_table[i].transaction,
-				0, // Flags
-				(void*)&retry_sending_event,
-				(void*)&event_response_handler,
-				(void*)&observer_table[i]
-			);
+		if (observer->pending) {
+			// Already coalesced into the notification the timer will send.
+			continue;
+		}
 
-			ret = smcp_transaction_begin(
-				interface,
-				&observer_table[i].transaction,
-				SHOULD_CONFIRM_EVENT_FOR_OBSERVER(&observer_table[i])?SMCP_OBSERVER_CON_EVENT_EXPIRATION:SMCP_OBSERVER_NON_EVENT_EXPIRATION
-			);
+		if ((observer->pmin != 0)
+			&& (observer->pmin + smcp_plat_timestamp_to_cms(observer->last_sent) > 0)
+		) {
+			observer->pending = true;
+			schedule_observer_timer(observer);
+			continue;
 		}
+
+		ret = send_event(observer);
 	}
 
 bail:
@@ -302,25 +998,19 @@ int
 smcp_observable_observer_count(smcp_observable_t context, uint8_t key)
 {
 	int count = 0;
-	int i;
+	struct smcp_observer_s *observer;
 
-	if (!context->first_observer) {
-		goto bail;
-	}
+	for (observer = context->first_observer; observer != NULL; observer = observer->next) {
+		assert(observer->observable == context);
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		assert((i != context->last_observer-1) || observer_table[i].next == 0);
-
-		if ((observer_table[i].key != SMCP_OBSERVABLE_BROADCAST_KEY)
+		if ((observer->key != SMCP_OBSERVABLE_BROADCAST_KEY)
 			&& (key != SMCP_OBSERVABLE_BROADCAST_KEY)
-			&& (observer_table[i].key != key)
+			&& (observer->key != key)
 		) {
 			continue;
 		}
 		count++;
 	}
 
-bail:
 	return count;
 }
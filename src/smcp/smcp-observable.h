@@ -44,11 +44,19 @@ __BEGIN_DECLS
 **	@sa @ref smcp-example-4
 */
 
+struct smcp_observer_s;
+struct smcp_notification_s;
+
 //! Observable context.
 /*!	The observable context is a datastructure that keeps track of
 **	who is observing which resources. You may have as many or as few as
 **	you like.
 **
+**	An observable belongs to the application, but must stay valid for
+**	as long as it has observers: until smcp_observable_observer_count()
+**	is zero, or until the instance is released with smcp_release(),
+**	which removes all of them.
+**
 **	@sa smcp_observable_update(), smcp_observable_trigger()
 */
 struct smcp_observable_s {
@@ -56,10 +64,40 @@ struct smcp_observable_s {
 	smcp_t interface;
 #endif
 
+	//! Minimum time between notifications, in milliseconds.
+	/*!	Triggers that happen sooner than this after the last
+	**	notification are coalesced into a single notification that
+	**	is sent once the period is up. Observers may ask for a longer
+	**	period with the `pmin` query parameter (in seconds), but
+	**	never a shorter one. Zero means no limit. */
+	smcp_cms_t pmin;
+
+	//! Maximum time between notifications, in milliseconds.
+	/*!	If nothing has triggered a notification for this long, one
+	**	is sent anyway. Observers may ask for a longer period with the
+	**	`pmax` query parameter (in seconds), but never a shorter one,
+	**	nor one shorter than their minimum period. Zero means never. */
+	smcp_cms_t pmax;
+
+	//! Whether observers may share notifications.
+	/*!	If set, the request handler is only called once per trigger
+	**	for all of the observers that registered with identical
+	**	requests, and the others are sent a copy of what it sent to
+	**	the first one. Only set this if what the handler sends doesn't
+	**	depend on the remote address or session of the request.
+	**	Ignored unless SMCP_OBSERVABLE_SHARE_NOTIFICATIONS is set. */
+	bool share_notifications;
+
 	// Consider all members below this line as private!
 
-	int8_t first_observer; //!^ always +1, zero is end of list
-	int8_t last_observer;  //!^ always +1, zero is end of list
+	struct smcp_observer_s* first_observer;
+	struct smcp_observer_s* last_observer;
+
+	//! Notifications rendered since the last trigger.
+	/*!	Always present, so that the layout of this struct doesn't
+	**	depend on SMCP_OBSERVABLE_SHARE_NOTIFICATIONS. Unused if it
+	**	isn't set. */
+	struct smcp_notification_s* notifications;
 };
 
 //! Key to trigger all observers using the given observable context.
@@ -88,6 +126,10 @@ SMCP_API_EXTERN smcp_status_t smcp_observable_update(
 /*!
 **	You may use SMCP_OBSERVABLE_BROADCAST_KEY for the key to trigger
 **	all resources associated with this observable context to update.
+**
+**	Observers that were notified less than their minimum period ago
+**	are only marked as pending; they get a single notification with
+**	whatever the state is once the period is up.
 */
 SMCP_API_EXTERN smcp_status_t smcp_observable_trigger(
 	smcp_observable_t context, //!< [IN] Pointer to observable context
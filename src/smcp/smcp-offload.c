@@ -0,0 +1,323 @@
+/*!	@file smcp-offload.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Offloaded Request Handlers
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "assert-macros.h"
+#include "smcp.h"
+
+#if SMCP_CONF_OFFLOAD_NODE
+
+#include "smcp-internal.h"
+#include "smcp-logging.h"
+#include "smcp-offload.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*	Requests get to the workers through a plain mutex-protected FIFO.
+**	The event loop only holds the lock for long enough to append to
+**	it, so it never waits on a handler. Responses go back through the
+**	submission queue of the instance, which doesn't lock at all.
+*/
+
+struct smcp_worker_pool_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct smcp_offload_request_s* head;
+	struct smcp_offload_request_s** tail;
+	bool should_exit;
+	int thread_count;
+	pthread_t threads[];
+};
+
+// MARK: -
+// MARK: Worker Side
+
+static void
+smcp_offload_request_finished_(struct smcp_submission_s* submission)
+{
+	// Called on the event loop once the response is out.
+	struct smcp_offload_request_s* const request = submission->context;
+
+	check_noerr(submission->status);
+
+	smcp_finish_async_response(&request->async_response);
+	smcp_slab_free(request);
+}
+
+static void
+smcp_offload_request_perform_(struct smcp_offload_request_s* request)
+{
+	struct smcp_submission_s* const submission = &request->submission;
+	smcp_status_t status;
+
+	status = (*request->node->handler)(request->node, request);
+
+	if (status != SMCP_STATUS_OK) {
+		request->response_code = smcp_convert_status_to_result_code(status);
+		request->response_len = 0;
+	}
+
+	if (request->response_code == 0) {
+		if (request->packet->code == COAP_METHOD_GET) {
+			request->response_code = COAP_RESULT_205_CONTENT;
+		} else {
+			request->response_code = COAP_RESULT_204_CHANGED;
+		}
+	}
+
+	memset(submission, 0, sizeof(*submission));
+	submission->method = request->response_code;
+	submission->async_response = &request->async_response;
+	submission->content = request->response;
+	submission->content_len = request->response_len;
+	submission->content_type = request->response_content_type;
+	submission->callback = &smcp_offload_request_finished_;
+	submission->context = request;
+
+	if (smcp_submit(request->interface, submission) != SMCP_STATUS_OK) {
+		// The response can't be sent, and the client
+		// will eventually give up on it.
+		smcp_finish_async_response(&request->async_response);
+		smcp_slab_free(request);
+	}
+}
+
+static void*
+smcp_worker_pool_thread_(void* context)
+{
+	smcp_worker_pool_t const pool = context;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for (;;) {
+		struct smcp_offload_request_s* request;
+
+		while (pool->head == NULL && !pool->should_exit) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+
+		// Whatever is already queued still gets done.
+		request = pool->head;
+
+		if (request == NULL) {
+			break;
+		}
+
+		pool->head = request->next;
+
+		if (pool->head == NULL) {
+			pool->tail = &pool->head;
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		smcp_offload_request_perform_(request);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+smcp_worker_pool_t
+smcp_worker_pool_create(int thread_count)
+{
+	smcp_worker_pool_t ret = NULL;
+
+	require(thread_count > 0, bail);
+
+	ret = calloc(1, sizeof(*ret) + sizeof(pthread_t) * thread_count);
+
+	require(ret != NULL, bail);
+
+	pthread_mutex_init(&ret->mutex, NULL);
+	pthread_cond_init(&ret->cond, NULL);
+	ret->tail = &ret->head;
+
+	for (; ret->thread_count < thread_count; ret->thread_count++) {
+		if (0 != pthread_create(
+			&ret->threads[ret->thread_count],
+			NULL,
+			&smcp_worker_pool_thread_,
+			(void*)ret
+		)) {
+			break;
+		}
+	}
+
+	if (ret->thread_count == 0) {
+		smcp_worker_pool_release(ret);
+		ret = NULL;
+	}
+
+bail:
+	return ret;
+}
+
+void
+smcp_worker_pool_release(smcp_worker_pool_t pool)
+{
+	int i;
+
+	require(pool != NULL, bail);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->should_exit = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_count; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+
+bail:
+	return;
+}
+
+// MARK: -
+// MARK: Event Loop Side
+
+smcp_status_t
+smcp_offload_node_request_handler(
+	smcp_offload_node_t	node
+) {
+	smcp_status_t ret = SMCP_STATUS_MALLOC_FAILURE;
+	smcp_worker_pool_t const pool = node->pool;
+	struct smcp_offload_request_s* request;
+	const coap_size_t packet_len = smcp_inbound_get_packet_length();
+	char* buffer;
+
+	request = smcp_slab_alloc(
+		smcp_get_current_instance(),
+		sizeof(*request) + packet_len + SMCP_MAX_CONTENT_LENGTH
+	);
+
+	require(request != NULL, bail);
+
+	// The inbound packet is gone once we return,
+	// so the worker gets its own copy.
+	buffer = (char*)(request + 1);
+	memcpy(buffer, smcp_inbound_get_packet(), packet_len);
+
+	request->packet = (const struct coap_header_s*)buffer;
+	request->packet_len = packet_len;
+	request->content = buffer + (smcp_inbound_get_content_ptr() - (const char*)smcp_inbound_get_packet());
+	request->content_len = smcp_inbound_get_content_len();
+	request->response_content_type = COAP_CONTENT_TYPE_UNKNOWN;
+	request->response = buffer + packet_len;
+	request->response_max_len = SMCP_MAX_CONTENT_LENGTH;
+	request->node = node;
+	request->interface = smcp_get_current_instance();
+
+	// Sends the empty ACK, so the client stops retransmitting.
+	ret = smcp_start_async_response(&request->async_response, 0);
+
+	if (ret == SMCP_STATUS_DUPE) {
+		// A worker already has this one.
+		ret = SMCP_STATUS_OK;
+		goto bail;
+	}
+
+	require_noerr(ret, bail);
+
+	pthread_mutex_lock(&pool->mutex);
+	*pool->tail = request;
+	pool->tail = &request->next;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	request = NULL;
+
+bail:
+	if (request != NULL) {
+		smcp_finish_async_response(&request->async_response);
+		smcp_slab_free(request);
+	}
+	return ret;
+}
+
+void
+smcp_offload_node_dealloc(smcp_offload_node_t x) {
+	free(x);
+}
+
+smcp_offload_node_t
+smcp_offload_node_alloc() {
+	smcp_offload_node_t ret =
+		(smcp_offload_node_t)calloc(sizeof(struct smcp_offload_node_s), 1);
+
+	if (ret) {
+		ret->node.finalize = (void (*)(smcp_node_t)) &smcp_offload_node_dealloc;
+	}
+	return ret;
+}
+
+smcp_offload_node_t
+smcp_offload_node_init(
+	smcp_offload_node_t	self,
+	smcp_node_t			parent,
+	const char*			name,
+	smcp_worker_pool_t	pool,
+	smcp_offload_handler_func handler
+) {
+	smcp_offload_node_t ret = NULL;
+
+	require(pool != NULL, bail);
+	require(handler != NULL, bail);
+
+	require(self || (self = smcp_offload_node_alloc()), bail);
+
+	require(smcp_node_init(
+			&self->node,
+			(void*)parent,
+			name
+	), bail);
+
+	self->pool = pool;
+	self->handler = handler;
+	((smcp_node_t)&self->node)->request_handler = (void*)&smcp_offload_node_request_handler;
+
+	ret = self;
+
+bail:
+	return ret;
+}
+
+#endif // SMCP_CONF_OFFLOAD_NODE
@@ -0,0 +1,134 @@
+/*!	@file smcp-offload.h
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Offloaded Request Handlers
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SMCP_smcp_offload_h
+#define SMCP_smcp_offload_h
+
+#include "smcp.h"
+#include "smcp-node-router.h"
+
+#if SMCP_CONF_OFFLOAD_NODE
+
+__BEGIN_DECLS
+
+/*!	@addtogroup smcp-extras
+**	@{
+*/
+
+/*!	@defgroup smcp-offload Offloaded Node
+**	@{
+**	@brief Running slow request handlers on a pool of worker threads.
+**
+**	An offload node answers every request with an empty ACK as soon
+**	as it arrives, and then calls its handler on one of the threads
+**	of a worker pool. The handler fills in the response, which is
+**	handed back to the event loop with smcp_submit() and sent as a
+**	separate response, with retransmissions if it is confirmable.
+**
+**	The handler can't use any of the `smcp_inbound_*()` or
+**	`smcp_outbound_*()` functions, since it isn't running on the
+**	event loop. Everything it needs is in the request object instead.
+*/
+
+typedef struct smcp_worker_pool_s* smcp_worker_pool_t;
+
+struct smcp_offload_node_s;
+typedef struct smcp_offload_node_s* smcp_offload_node_t;
+
+struct smcp_offload_request_s {
+	//! Copy of the whole request packet, including its content.
+	const struct coap_header_s* packet;
+	coap_size_t packet_len;
+
+	const char* content;
+	coap_size_t content_len;
+
+	//! Defaults to 2.05 for GET and 2.04 for everything else.
+	coap_code_t response_code;
+
+	//! Left out of the response if COAP_CONTENT_TYPE_UNKNOWN.
+	coap_content_type_t response_content_type;
+
+	//! Buffer for the content of the response.
+	char* response;
+	coap_size_t response_len;
+	coap_size_t response_max_len;
+
+	// Private
+	struct smcp_offload_request_s* next;
+	smcp_offload_node_t node;
+	smcp_t interface;
+	struct smcp_async_response_s async_response;
+	struct smcp_submission_s submission;
+};
+
+/*!	Called on a worker thread for each request. If this returns
+**	an error, the response code is derived from it and the content
+**	of the response is left empty. */
+typedef smcp_status_t (*smcp_offload_handler_func)(
+	smcp_offload_node_t node,
+	struct smcp_offload_request_s* request
+);
+
+struct smcp_offload_node_s {
+	struct smcp_node_s	node;
+	smcp_worker_pool_t pool;
+	smcp_offload_handler_func handler;
+};
+
+//!	Starts a pool of `thread_count` worker threads.
+SMCP_API_EXTERN smcp_worker_pool_t smcp_worker_pool_create(int thread_count);
+
+//!	Finishes the requests in the pool and stops its threads.
+/*!	The event loops that the responses are going to must keep
+**	running until this returns. */
+SMCP_API_EXTERN void smcp_worker_pool_release(smcp_worker_pool_t pool);
+
+SMCP_API_EXTERN smcp_offload_node_t smcp_offload_node_alloc();
+
+SMCP_API_EXTERN smcp_offload_node_t smcp_offload_node_init(
+	smcp_offload_node_t	self,
+	smcp_node_t			parent,
+	const char*			name,
+	smcp_worker_pool_t	pool,
+	smcp_offload_handler_func handler
+);
+
+SMCP_API_EXTERN smcp_status_t smcp_offload_node_request_handler(
+	smcp_offload_node_t	node
+);
+
+/*!	@} */
+/*!	@} */
+
+__END_DECLS
+
+#endif // SMCP_CONF_OFFLOAD_NODE
+
+#endif
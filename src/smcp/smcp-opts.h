@@ -41,5 +41,6 @@
 //#define DEBUG 1
 //#define VERBOSE_DEBUG 1
 //#define SMCP_MULTITHREAD 0
+//#define SMCP_CONF_TIMESTAMP_64BIT 1
 
 #endif
@@ -60,7 +60,7 @@
 #include <string.h>
 #include <ctype.h>
 
-static uint8_t
+uint8_t
 smcp_calc_uint32_option_size(uint32_t big_endian_value)
 {
 	if (((uint8_t*)(&big_endian_value))[0] != 0) {
@@ -90,13 +90,11 @@ smcp_outbound_drop() {
 void
 smcp_outbound_reset()
 {
-	memset(
-		&smcp_get_current_instance()->outbound,
-		0,
-		sizeof(smcp_get_current_instance()->outbound)
-	);
-	smcp_get_current_instance()->is_responding = false;
-	smcp_get_current_instance()->did_respond = false;
+	smcp_t const self = smcp_get_current_instance();
+
+	memset(&self->outbound, 0, sizeof(self->outbound));
+	self->is_responding = false;
+	self->did_respond = false;
 	smcp_plat_set_session_type(SMCP_SESSION_TYPE_UDP);
 }
 
@@ -142,13 +140,17 @@ smcp_outbound_begin(
 
 	} else if (code && (code < COAP_RESULT_100) && self->current_transaction) {
 		// For sending a request.
-		self->outbound.packet->token_len = sizeof(self->current_transaction->token);
-		memcpy(self->outbound.packet->token,(void*)&self->current_transaction->token,self->outbound.packet->token_len);
+		self->outbound.packet->token_len = self->current_transaction->token_len;
+		memcpy(self->outbound.packet->token,self->current_transaction->token,self->outbound.packet->token_len);
 	} else {
 		self->outbound.packet->token_len = 0;
 	}
 
 	self->outbound.last_option_key = 0;
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	self->outbound.staged_count = 0;
+	self->outbound.staged_bytes = 0;
+#endif
 
 	self->outbound.content_ptr = (char*)self->outbound.packet->token + self->outbound.packet->token_len;
 	*self->outbound.content_ptr++ = 0xFF;  // start-of-content marker
@@ -202,8 +204,9 @@ bail:
 
 smcp_status_t
 smcp_outbound_set_msg_id(coap_msg_id_t tid) {
-	assert(smcp_get_current_instance()->outbound.packet);
-	smcp_get_current_instance()->outbound.packet->msg_id = tid;
+	smcp_t const self = smcp_get_current_instance();
+	assert(self->outbound.packet);
+	self->outbound.packet->msg_id = tid;
 	return SMCP_STATUS_OK;
 }
 
@@ -229,6 +232,10 @@ smcp_outbound_set_token(const uint8_t *token,uint8_t token_length) {
 		self->outbound.content_ptr = (char*)self->outbound.packet->token+self->outbound.packet->token_len;
 		self->outbound.content_len = 0;
 		*self->outbound.content_ptr++ = 0xFF;
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+		self->outbound.staged_count = 0;
+		self->outbound.staged_bytes = 0;
+#endif
 	}
 
 	if(token_length)
@@ -238,25 +245,209 @@ bail:
 	return ret;
 }
 
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+//! Largest number of bytes an option header can take up.
+#define OPTION_HEADER_MAX_SIZE		(5)
+#endif
+
+static coap_size_t
+smcp_outbound_get_space_remaining_(smcp_t self)
+{
+	coap_size_t len = (coap_size_t)(self->outbound.content_ptr-(char*)self->outbound.packet)
+		+ self->outbound.content_len;
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	len += 2 * self->outbound.staged_bytes
+		+ OPTION_HEADER_MAX_SIZE * self->outbound.staged_count;
+#endif
+	if (self->outbound.max_packet_len > len) {
+		return self->outbound.max_packet_len - len;
+	}
+	return 0;
+}
+
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+//! Writes all staged options into the packet, in key order.
+/*!	The options that are already in the packet are first moved up
+**	against the staged values at the end of the buffer, and then
+**	everything is encoded again from the start of the options. The
+**	space accounting in smcp_outbound_get_space_remaining() makes
+**	sure that the writes never catch up with what is still to be read.
+*/
+static void
+smcp_outbound_flush_staged_options_(smcp_t self) {
+	uint8_t* const start = (uint8_t*)self->outbound.packet->token + self->outbound.packet->token_len;
+	uint8_t* const buffer_end = (uint8_t*)self->outbound.packet + self->outbound.max_packet_len;
+	uint8_t* const encoded_end = buffer_end - self->outbound.staged_bytes;
+	const coap_size_t encoded_len = (coap_size_t)((uint8_t*)self->outbound.content_ptr - 1 - start);
+	uint8_t* encoded = encoded_end - encoded_len;
+	coap_option_key_t encoded_key = 0;
+	coap_option_key_t prev_key = 0;
+	uint8_t* out = start;
+	uint8_t i = 0;
+
+	if (self->outbound.staged_count == 0) {
+		return;
+	}
+
+	memmove(encoded, start, encoded_len);
+
+	while (encoded < encoded_end) {
+		const uint8_t* value;
+		coap_size_t len;
+
+		encoded = coap_decode_option(encoded, &encoded_key, &value, &len);
+
+		// Options that were already in the packet go first
+		// when the keys are the same, since they were added first.
+		while ( (i < self->outbound.staged_count)
+		  && (self->outbound.staged[i].key < encoded_key)
+		) {
+			out = coap_encode_option(
+				out,
+				prev_key,
+				self->outbound.staged[i].key,
+				buffer_end - self->outbound.staged[i].offset,
+				self->outbound.staged[i].len
+			);
+			prev_key = self->outbound.staged[i].key;
+			i++;
+		}
+
+		out = coap_encode_option(out, prev_key, encoded_key, value, len);
+		prev_key = encoded_key;
+	}
+
+	for (; i < self->outbound.staged_count; i++) {
+		out = coap_encode_option(
+			out,
+			prev_key,
+			self->outbound.staged[i].key,
+			buffer_end - self->outbound.staged[i].offset,
+			self->outbound.staged[i].len
+		);
+		prev_key = self->outbound.staged[i].key;
+	}
+
+	*out++ = 0xFF;  // Add end-of-options marker
+
+	self->outbound.content_ptr = (char*)out;
+	self->outbound.staged_count = 0;
+	self->outbound.staged_bytes = 0;
+}
+
+//! Holds back an out-of-order option until the content is started.
+static smcp_status_t
+smcp_outbound_stage_option_(
+	smcp_t self, coap_option_key_t key, const char* value, coap_size_t len, coap_size_t space_remaining
+) {
+	uint8_t i = self->outbound.staged_count;
+
+	// Staged values are counted twice by smcp_outbound_get_space_remaining(),
+	// because both copies exist for a moment while they are flushed.
+	if ( (self->outbound.staged_count >= self->outbound.staged_limit)
+	  || (space_remaining < 2 * len + OPTION_HEADER_MAX_SIZE)
+	) {
+		return SMCP_STATUS_MESSAGE_TOO_BIG;
+	}
+
+	self->outbound.staged_bytes += len;
+
+	if (len) {
+		memcpy(
+			(uint8_t*)self->outbound.packet + self->outbound.max_packet_len - self->outbound.staged_bytes,
+			value,
+			len
+		);
+	}
+
+	// Keep the list sorted, with options that have the same
+	// key in the order they were added.
+	while ((i > 0) && (self->outbound.staged[i - 1].key > key)) {
+		self->outbound.staged[i] = self->outbound.staged[i - 1];
+		i--;
+	}
+
+	self->outbound.staged[i].key = key;
+	self->outbound.staged[i].offset = self->outbound.staged_bytes;
+	self->outbound.staged[i].len = len;
+	self->outbound.staged_count++;
+
+	return SMCP_STATUS_OK;
+}
+
+void
+smcp_outbound_set_staged_limit(smcp_t self, int count)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+
+	if (count < 0) {
+		count = 0;
+	} else if (count > SMCP_CONF_OUTBOUND_STAGED_OPTIONS) {
+		count = SMCP_CONF_OUTBOUND_STAGED_OPTIONS;
+	}
+
+	self->outbound.staged_limit = (uint8_t)count;
+}
+#endif // SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+
 static smcp_status_t
 smcp_outbound_add_option_(
-	coap_option_key_t key, const char* value, coap_size_t len
+	smcp_t self, coap_option_key_t key, const char* value, coap_size_t len
 ) {
-	smcp_t const self = smcp_get_current_instance();
+	coap_size_t space_remaining;
 
 	if(len == SMCP_CSTR_LEN)
 		len = (coap_size_t)strlen(value);
 
-	if(	smcp_outbound_get_space_remaining() < len + 8 ) {
+	space_remaining = smcp_outbound_get_space_remaining_(self);
+
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	if (	self->outbound.staged_count
+		&& space_remaining < len + 8
+	) {
+		// Make room by writing out the staged options.
+		smcp_outbound_flush_staged_options_(self);
+		space_remaining = smcp_outbound_get_space_remaining_(self);
+	}
+#endif
+
+	if(	space_remaining < len + 8 ) {
 		// We ran out of room!
 		return SMCP_STATUS_MESSAGE_TOO_BIG;
 	}
 
-	if (key < self->outbound.last_option_key) {
-		// This is just a performance issue.
-		assert_printf("warning: Out of order header: %s",coap_option_key_to_cstr(key, self->is_responding));
+	if (key >= self->outbound.last_option_key) {
+		// Common case: Just append.
+		self->outbound.content_ptr--;	// remove end-of-options marker
+
+		self->outbound.content_ptr = (char*)coap_encode_option(
+			(uint8_t*)self->outbound.content_ptr,
+			self->outbound.last_option_key,
+			key,
+			(const uint8_t*)value,
+			len
+		);
+
+		self->outbound.last_option_key = key;
+
+		*self->outbound.content_ptr++ = 0xFF;  // Add end-of-options marker
+
+		goto bail;
 	}
 
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	if (smcp_outbound_stage_option_(self, key, value, len, space_remaining) == SMCP_STATUS_OK) {
+		return SMCP_STATUS_OK;
+	}
+
+	// No room to stage it, so write out what we have
+	// and insert this one in place.
+	smcp_outbound_flush_staged_options_(self);
+#endif
+
+	// This is just a performance issue.
+	assert_printf("warning: Out of order header: %s",coap_option_key_to_cstr(key, self->is_responding));
+
 	if (self->outbound.content_ptr!=(char*)self->outbound.packet->token+self->outbound.packet->token_len) {
 		self->outbound.content_ptr--;	// remove end-of-options marker
 	}
@@ -269,12 +460,9 @@ smcp_outbound_add_option_(
 		len
 	);
 
-	if (key>self->outbound.last_option_key) {
-		self->outbound.last_option_key = key;
-	}
-
 	*self->outbound.content_ptr++ = 0xFF;  // Add end-of-options marker
 
+bail:
 #if OPTION_DEBUG
 	coap_dump_header(
 		SMCP_DEBUG_OUT_FILE,
@@ -289,10 +477,9 @@ smcp_outbound_add_option_(
 
 static smcp_status_t
 smcp_outbound_add_options_up_to_key_(
-	coap_option_key_t key
+	smcp_t self, coap_option_key_t key
 ) {
 	smcp_status_t ret = SMCP_STATUS_OK;
-	smcp_t const self = smcp_get_current_instance();
 
 	(void)self;
 
@@ -305,6 +492,7 @@ smcp_outbound_add_options_up_to_key_(
 		uint32_t block2 = htonl(self->current_transaction->next_block2);
 		uint8_t size = smcp_calc_uint32_option_size(block2);
 		ret = smcp_outbound_add_option_(
+			self,
 			COAP_OPTION_BLOCK2,
 			(char*)&block2+4-size,
 			size
@@ -320,6 +508,7 @@ smcp_outbound_add_options_up_to_key_(
 		if(self->outbound.packet->code && self->outbound.packet->code<COAP_RESULT_100) {
 			// For sending a request.
 			ret = smcp_outbound_add_option_(
+				self,
 				COAP_OPTION_OBSERVE,
 				(void*)NULL,
 				0
@@ -335,6 +524,7 @@ smcp_outbound_add_options_up_to_key_(
 	) {
 		uint8_t cc = self->cascade_count-1;
 		ret = smcp_outbound_add_option_(
+			self,
 			COAP_OPTION_CASCADE_COUNT,
 			(char*)&cc,
 			1
@@ -349,21 +539,22 @@ smcp_status_t
 smcp_outbound_add_option(
 	coap_option_key_t key, const char* value, coap_size_t len
 ) {
+	smcp_t const self = smcp_get_current_instance();
 	smcp_status_t ret;
 
-	ret = smcp_outbound_add_options_up_to_key_(key);
+	ret = smcp_outbound_add_options_up_to_key_(self, key);
 	require_noerr(ret, bail);
 
 #if SMCP_CONF_TRANS_ENABLE_BLOCK2
 	if ( key == COAP_OPTION_BLOCK2
-	  && smcp_get_current_instance()->current_transaction
-	  && smcp_get_current_instance()->current_transaction->next_block2
+	  && self->current_transaction
+	  && self->current_transaction->next_block2
 	) {
 		goto bail;
 	}
 #endif
 
-	ret = smcp_outbound_add_option_(key,value,len);
+	ret = smcp_outbound_add_option_(self, key, value, len);
 	require_noerr(ret, bail);
 
 bail:
@@ -432,7 +623,7 @@ smcp_outbound_set_uri(
 		// in the packet buffer, since this is temporary anyway...
 		// It helps a bunch that we know the user hasn't written
 		// any content yet (because that would be an API violation)
-		if (smcp_outbound_get_space_remaining() > strlen(uri) + 8) {
+		if (smcp_outbound_get_space_remaining_(self) > strlen(uri) + 8) {
 			uri_copy = self->outbound.content_ptr + self->outbound.content_len;
 
 			// The options section may be expanding as we parse this, so
@@ -464,7 +655,7 @@ smcp_outbound_set_uri(
 			// Talking to ourself.
 			components.protocol = "coap";
 			components.host = "::1";
-			toport = smcp_plat_get_port(smcp_get_current_instance());
+			toport = smcp_plat_get_port(self);
 			flags |= SMCP_MSG_SKIP_AUTHORITY;
 		} else if(components.port) {
 			toport = (uint16_t)atoi(components.port);
@@ -573,13 +764,32 @@ bail:
 coap_size_t
 smcp_outbound_get_space_remaining(void)
 {
-	smcp_t const self = smcp_get_current_instance();
-	coap_size_t len = (coap_size_t)(self->outbound.content_ptr-(char*)self->outbound.packet)
-		+ self->outbound.content_len;
-	if (self->outbound.max_packet_len > len) {
-		return self->outbound.max_packet_len - len;
+	return smcp_outbound_get_space_remaining_(smcp_get_current_instance());
+}
+
+static char*
+smcp_outbound_get_content_ptr_(smcp_t self, coap_size_t* max_len) {
+	assert(NULL!=self->outbound.packet);
+
+	// Finish up any remaining automatically-added headers.
+	if (self->outbound.packet->code) {
+		smcp_outbound_add_options_up_to_key_(self, COAP_OPTION_INVALID);
 	}
-	return 0;
+
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	smcp_outbound_flush_staged_options_(self);
+#endif
+
+	if (max_len) {
+		*max_len = smcp_outbound_get_space_remaining_(self)+self->outbound.content_len;
+	}
+
+	return self->outbound.content_ptr;
+}
+
+char*
+smcp_outbound_get_content_ptr(coap_size_t* max_len) {
+	return smcp_outbound_get_content_ptr_(smcp_get_current_instance(), max_len);
 }
 
 smcp_status_t
@@ -587,7 +797,7 @@ smcp_outbound_append_content(const char* value, coap_size_t len)
 {
 	smcp_status_t ret = SMCP_STATUS_FAILURE;
 	smcp_t const self = smcp_get_current_instance();
-	coap_size_t max_len = smcp_outbound_get_space_remaining();
+	coap_size_t max_len = smcp_outbound_get_space_remaining_(self);
 	char* dest;
 
 	if (SMCP_CSTR_LEN == len) {
@@ -596,7 +806,7 @@ smcp_outbound_append_content(const char* value, coap_size_t len)
 
 	require_action(max_len>len, bail, ret = SMCP_STATUS_MESSAGE_TOO_BIG);
 
-	dest = smcp_outbound_get_content_ptr(&max_len);
+	dest = smcp_outbound_get_content_ptr_(self, &max_len);
 	require(dest,bail);
 
 	dest += self->outbound.content_len;
@@ -611,27 +821,10 @@ bail:
 	return ret;
 }
 
-char*
-smcp_outbound_get_content_ptr(coap_size_t* max_len) {
-	smcp_t const self = smcp_get_current_instance();
-
-	assert(NULL!=self->outbound.packet);
-
-	// Finish up any remaining automatically-added headers.
-	if (self->outbound.packet->code) {
-		smcp_outbound_add_options_up_to_key_(COAP_OPTION_INVALID);
-	}
-
-	if (max_len) {
-		*max_len = smcp_outbound_get_space_remaining()+self->outbound.content_len;
-	}
-
-	return self->outbound.content_ptr;
-}
-
 smcp_status_t
 smcp_outbound_set_content_len(coap_size_t len) {
-	smcp_get_current_instance()->outbound.content_len = len;
+	smcp_t const self = smcp_get_current_instance();
+	self->outbound.content_len = len;
 	return SMCP_STATUS_OK;
 }
 
@@ -641,14 +834,15 @@ smcp_outbound_set_content_len(coap_size_t len) {
 #if !SMCP_AVOID_PRINTF
 smcp_status_t
 smcp_outbound_set_content_formatted(const char* fmt, ...) {
+	smcp_t const self = smcp_get_current_instance();
 	smcp_status_t ret = SMCP_STATUS_FAILURE;
 	va_list args;
-	char* content = smcp_outbound_get_content_ptr(NULL);
-	coap_size_t len = smcp_outbound_get_space_remaining();
+	char* content = smcp_outbound_get_content_ptr_(self, NULL);
+	coap_size_t len = smcp_outbound_get_space_remaining_(self);
 
 	require(content!=NULL, bail);
 
-	content += smcp_get_current_instance()->outbound.content_len;
+	content += self->outbound.content_len;
 
 	va_start(args,fmt);
 
@@ -656,8 +850,9 @@ smcp_outbound_set_content_formatted(const char* fmt, ...) {
 
 	require(len!=0,bail);
 
-	len += smcp_get_current_instance()->outbound.content_len;
-	ret = smcp_outbound_set_content_len(len);
+	len += self->outbound.content_len;
+	self->outbound.content_len = len;
+	ret = SMCP_STATUS_OK;
 
 bail:
 	va_end(args);
@@ -731,19 +926,19 @@ smcp_outbound_send() {
 	smcp_status_t ret = SMCP_STATUS_FAILURE;
 	smcp_t const self = smcp_get_current_instance();
 
-	coap_size_t header_len = (coap_size_t)(smcp_outbound_get_content_ptr(NULL)-(char*)self->outbound.packet);
+	coap_size_t header_len = (coap_size_t)(smcp_outbound_get_content_ptr_(self, NULL)-(char*)self->outbound.packet);
 
 	// Remove the start-of-payload marker if we have no payload.
-	if (!smcp_get_current_instance()->outbound.content_len) {
+	if (!self->outbound.content_len) {
 		header_len--;
 	}
 
 #if DEBUG
 	{
-		DEBUG_PRINTF("Outbound packet size: %d, %d remaining",header_len+smcp_get_current_instance()->outbound.content_len, smcp_outbound_get_space_remaining());
-		assert(header_len+smcp_get_current_instance()->outbound.content_len<=self->outbound.max_packet_len);
+		DEBUG_PRINTF("Outbound packet size: %d, %d remaining",header_len+self->outbound.content_len, smcp_outbound_get_space_remaining_(self));
+		assert(header_len+self->outbound.content_len<=self->outbound.max_packet_len);
 
-		assert(coap_verify_packet((char*)self->outbound.packet,header_len+smcp_get_current_instance()->outbound.content_len));
+		assert(coap_verify_packet((char*)self->outbound.packet,header_len+self->outbound.content_len));
 	}
 #endif // DEBUG
 
@@ -756,9 +951,9 @@ smcp_outbound_send() {
 #if defined(SMCP_DEBUG_OUTBOUND_DROP_PERCENT)
 	if(SMCP_DEBUG_OUTBOUND_DROP_PERCENT*SMCP_RANDOM_MAX>SMCP_FUNC_RANDOM_UINT32()) {
 		DEBUG_PRINTF("Dropping outbound packet for debugging!");
-		if(smcp_get_current_instance()->is_responding)
-			smcp_get_current_instance()->did_respond = true;
-		smcp_get_current_instance()->is_responding = false;
+		if(self->is_responding)
+			self->did_respond = true;
+		self->is_responding = false;
 
 		ret = SMCP_STATUS_OK;
 		goto bail;
@@ -771,6 +966,16 @@ smcp_outbound_send() {
 		// If the session type is reliable, we don't bother
 		// sending acks.
 	} else {
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE > 0
+		if (self->is_processing_message) {
+			smcp_dupe_remember_response(
+				self,
+				(const uint8_t*)self->outbound.packet,
+				header_len + self->outbound.content_len
+			);
+		}
+#endif
+
 		ret = smcp_plat_outbound_finish(
 			self,
 			(const uint8_t*)self->outbound.packet,
@@ -83,6 +83,80 @@
 #error Unsupported value for SMCP_BSD_SOCKETS_NET_FAMILY
 #endif // SMCP_BSD_SOCKETS_NET_FAMILY
 
+#if HAVE_RECVMMSG && (SMCP_CONF_RECV_BATCH_SIZE > 1)
+#define SMCP_BSD_SOCKETS_USE_RECVMMSG	1
+#include <sys/socket.h>
+
+//! Preallocated slot for a single datagram received by `recvmmsg()`.
+struct smcp_plat_recv_slot_s {
+	smcp_sockaddr_t			sockaddr_remote;
+	struct iovec			iov;
+	char					cmbuf[0x100];
+	char					packet[SMCP_MAX_PACKET_LENGTH+1];
+};
+#endif
+
+#if HAVE_SENDMMSG && (SMCP_CONF_SEND_QUEUE_SIZE > 1)
+#define SMCP_BSD_SOCKETS_USE_SENDMMSG	1
+#include <sys/socket.h>
+
+//! A finished outbound packet waiting in the deferred-send queue.
+struct smcp_plat_send_slot_s {
+	smcp_sockaddr_t			sockaddr_remote;
+	smcp_sockaddr_t			sockaddr_local;
+	coap_size_t				packet_len;
+	socklen_t				cmbuf_len;
+	uint8_t					cmbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	char					packet[SMCP_MAX_PACKET_LENGTH+1];
+};
+#endif
+
+#if SMCP_BSD_SOCKETS_USE_URING
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+//! Outbound packet owned by the kernel until its send completes.
+struct smcp_plat_uring_send_s {
+	struct msghdr			msg;
+	struct iovec			iov;
+	smcp_sockaddr_t			sockaddr_remote;
+	uint8_t					cmbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	bool					in_use;
+	char					packet[SMCP_MAX_PACKET_LENGTH+1];
+};
+
+struct smcp_plat_uring_s {
+	int						fd;			//!< Ring descriptor, or -1 if not in use.
+	bool					disabled;
+	bool					dispatching;	//!< Handling completions, so sends wait until we are done.
+
+	void*					ring_ptr;
+	size_t					ring_size;
+	struct io_uring_sqe*	sqes;
+	size_t					sqes_size;
+	unsigned				*sq_head;
+	unsigned				*sq_tail;
+	unsigned				*sq_flags;
+	unsigned				*sq_array;
+	unsigned				sq_mask;
+	unsigned				sq_pending;	//!< Prepared, but not yet submitted.
+	struct io_uring_sqe*	last_send_sqe;
+	unsigned				*cq_head;
+	unsigned				*cq_tail;
+	unsigned				cq_mask;
+	struct io_uring_cqe*	cqes;
+
+	struct io_uring_buf_ring* buf_ring;
+	size_t					buf_ring_size;
+	char*					buffers;
+	struct msghdr			recv_msg;	//!< Layout of each receive buffer.
+
+	int						send_current;	//!< Slot of the packet being composed, or -1.
+	int						send_in_flight;
+	struct smcp_plat_uring_send_s sends[SMCP_CONF_URING_SEND_SLOTS];
+};
+#endif
+
 struct smcp_plat_s {
 	int						mcfd;	//!< For multicast
 
@@ -93,6 +167,10 @@ struct smcp_plat_s {
 	smcp_sockaddr_t			sockaddr_remote;
 	smcp_session_type_t     session_type;
 
+	int						shard_index;
+	int						shard_count;	//!< Zero unless sharing a port with other instances.
+	int						shard_flags;
+
 #if SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET6
 	struct in6_pktinfo		pktinfo;
 #elif SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET
@@ -100,7 +178,55 @@ struct smcp_plat_s {
 #endif
 
 	char					outbound_packet_bytes[SMCP_MAX_PACKET_LENGTH+1];
+
+#if SMCP_BSD_SOCKETS_USE_RECVMMSG
+	int						recv_batch_size;
+	struct mmsghdr			recv_msgs[SMCP_CONF_RECV_BATCH_SIZE];
+	struct smcp_plat_recv_slot_s recv_slots[SMCP_CONF_RECV_BATCH_SIZE];
+#endif
+
+#if SMCP_BSD_SOCKETS_USE_SENDMMSG
+	int						send_queue_size;
+	int						send_queue_count;
+	struct mmsghdr			send_msgs[SMCP_CONF_SEND_QUEUE_SIZE];
+	struct iovec			send_iovs[SMCP_CONF_SEND_QUEUE_SIZE];
+	struct smcp_plat_send_slot_s send_slots[SMCP_CONF_SEND_QUEUE_SIZE];
+#endif
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	struct smcp_plat_uring_s uring;
+#endif
 };
 
+SMCP_INTERNAL_EXTERN socklen_t smcp_plat_fill_pktinfo(
+	uint8_t* cmbuf,
+	socklen_t cmbuf_len,
+	const struct sockaddr * saddr_to,
+	const struct sockaddr * saddr_from,
+	socklen_t socklen_from
+);
+
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_plat_process_datagram(
+	smcp_t self,
+	int fd,
+	struct msghdr* msg,
+	char* packet,
+	coap_size_t packet_len
+);
+
+#if SMCP_BSD_SOCKETS_USE_URING
+// Implemented in smcp-plat-uring.c
+SMCP_INTERNAL_EXTERN void smcp_plat_uring_init(smcp_t self);
+SMCP_INTERNAL_EXTERN void smcp_plat_uring_finalize(smcp_t self);
+SMCP_INTERNAL_EXTERN bool smcp_plat_uring_is_active(smcp_t self);
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_plat_uring_start(smcp_t self, int fd);
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_plat_uring_process(smcp_t self);
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_plat_uring_wait(smcp_t self, smcp_cms_t cms);
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_plat_uring_submit(smcp_t self);
+SMCP_INTERNAL_EXTERN char* smcp_plat_uring_outbound_start(smcp_t self);
+SMCP_INTERNAL_EXTERN bool smcp_plat_uring_owns_packet(smcp_t self, const uint8_t* data_ptr);
+SMCP_INTERNAL_EXTERN smcp_status_t smcp_plat_uring_outbound_finish(smcp_t self, const uint8_t* data_ptr, coap_size_t data_len);
+#endif
+
 
 #endif
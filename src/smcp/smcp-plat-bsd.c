@@ -62,6 +62,10 @@
 #include <sys/select.h>
 #include <poll.h>
 
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
+
 
 #ifndef SOCKADDR_HAS_LENGTH_FIELD
 #if defined(__KAME__)
@@ -69,6 +73,8 @@
 #endif
 #endif
 
+static bool smcp_plat_has_pending_sends(smcp_t self);
+
 
 static smcp_status_t
 smcp_internal_join_multicast_group(smcp_t self, const char* group)
@@ -129,6 +135,14 @@ smcp_plat_init(smcp_t self) {
 	self->plat.fd_dtls = -1;
 #endif
 
+#if SMCP_BSD_SOCKETS_USE_RECVMMSG
+	self->plat.recv_batch_size = SMCP_CONF_RECV_BATCH_SIZE;
+#endif
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	smcp_plat_uring_init(self);
+#endif
+
 #if SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET6
 	smcp_internal_join_multicast_group(self, COAP_MULTICAST_IP6_LL_ALLDEVICES);
 #endif
@@ -140,6 +154,12 @@ void
 smcp_plat_finalize(smcp_t self) {
 	SMCP_EMBEDDED_SELF_HOOK;
 
+	if(self->plat.fd_udp>=0) {
+		smcp_plat_flush(self);
+	}
+#if SMCP_BSD_SOCKETS_USE_URING
+	smcp_plat_uring_finalize(self);
+#endif
 	if(self->plat.fd_udp>=0) {
 		close(self->plat.fd_udp);
 	}
@@ -156,9 +176,37 @@ smcp_plat_finalize(smcp_t self) {
 int
 smcp_plat_get_fd(smcp_t self) {
 	SMCP_EMBEDDED_SELF_HOOK;
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		return self->plat.uring.fd;
+	}
+#endif
 	return self->plat.fd_udp;
 }
 
+smcp_status_t
+smcp_plat_set_io_uring(smcp_t self, bool enabled)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_status_t ret = SMCP_STATUS_OK;
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	self->plat.uring.disabled = !enabled;
+
+	if (!enabled) {
+		smcp_plat_uring_finalize(self);
+	} else if (self->plat.fd_udp >= 0) {
+		ret = smcp_plat_uring_start(self, self->plat.fd_udp);
+	}
+#else
+	if (enabled) {
+		ret = SMCP_STATUS_NOT_IMPLEMENTED;
+	}
+#endif
+
+	return ret;
+}
+
 uint16_t
 smcp_plat_get_port(smcp_t self) {
 	SMCP_EMBEDDED_SELF_HOOK;
@@ -172,14 +220,69 @@ smcp_plat_get_port(smcp_t self) {
 }
 
 
+#if SMCP_CONF_TIMESTAMP_64BIT
+static uint64_t
+monotonic_get_time_us(void)
+{
+#if HAVE_CLOCK_GETTIME
+	struct timespec tv = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+
+	return (uint64_t)tv.tv_sec * USEC_PER_SEC + (uint64_t)(tv.tv_nsec / NSEC_PER_USEC);
+#else
+	struct timeval tv = { 0 };
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * USEC_PER_SEC + (uint64_t)tv.tv_usec;
+#endif
+}
+
+smcp_timestamp_t
+smcp_plat_cms_to_timestamp(
+	smcp_cms_t cms
+) {
+	return monotonic_get_time_us() + (int64_t)cms * USEC_PER_MSEC;
+}
+
+smcp_cms_t
+smcp_plat_timestamp_diff(smcp_timestamp_t lhs, smcp_timestamp_t rhs) {
+	int64_t usec = (int64_t)(lhs - rhs);
+
+	// Round away from zero in the future and towards it in the past,
+	// so that a timestamp is only ever zero milliseconds away once it
+	// has actually been reached. Otherwise we'd wake up to fire a
+	// timer that is still a fraction of a millisecond out, and spin.
+	if (usec > 0) {
+		usec += USEC_PER_MSEC - 1;
+	}
+
+	usec /= USEC_PER_MSEC;
+
+	if (usec > INT32_MAX) {
+		return INT32_MAX;
+	}
+
+	if (usec < INT32_MIN) {
+		return INT32_MIN;
+	}
+
+	return (smcp_cms_t)usec;
+}
+
+smcp_cms_t
+smcp_plat_timestamp_to_cms(smcp_timestamp_t ts) {
+	return smcp_plat_timestamp_diff(ts, monotonic_get_time_us());
+}
+
+#else // SMCP_CONF_TIMESTAMP_64BIT
+
 static smcp_cms_t
 monotonic_get_time_ms(void)
 {
 #if HAVE_CLOCK_GETTIME
 	struct timespec tv = { 0 };
-	int ret;
 
-	ret = clock_gettime(CLOCK_MONOTONIC, &tv);
+	clock_gettime(CLOCK_MONOTONIC, &tv);
 
 	return (smcp_cms_t)(tv.tv_sec * MSEC_PER_SEC) + (smcp_cms_t)(tv.tv_nsec / NSEC_PER_MSEC);
 #else
@@ -204,6 +307,82 @@ smcp_cms_t
 smcp_plat_timestamp_to_cms(smcp_timestamp_t ts) {
 	return smcp_plat_timestamp_diff(ts, monotonic_get_time_ms());
 }
+#endif // !SMCP_CONF_TIMESTAMP_64BIT
+
+smcp_status_t
+smcp_plat_set_shard(smcp_t self, int index, int count, int flags)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_status_t ret = SMCP_STATUS_OK;
+
+	require_action(count > 0, bail, ret = SMCP_STATUS_INVALID_ARGUMENT);
+	require_action(index >= 0 && index < count, bail, ret = SMCP_STATUS_INVALID_ARGUMENT);
+	require_action(self->plat.fd_udp == -1, bail, ret = SMCP_STATUS_FAILURE);
+
+#if defined(SO_REUSEPORT)
+	self->plat.shard_index = index;
+	self->plat.shard_count = count;
+	self->plat.shard_flags = flags;
+#else
+	ret = SMCP_STATUS_NOT_IMPLEMENTED;
+#endif
+
+bail:
+	return ret;
+}
+
+#if defined(SO_REUSEPORT)
+static smcp_status_t
+smcp_plat_shard_setup(smcp_t self, int fd, bool is_bound)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+
+	if (!is_bound) {
+		int value = 1;
+
+		require_action_string(
+			setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) == 0,
+			bail,
+			ret = SMCP_STATUS_ERRNO,
+			strerror(errno)
+		);
+
+#if defined(SO_INCOMING_CPU)
+		if (self->plat.shard_flags & SMCP_PLAT_SHARD_STEER_BY_CPU) {
+			value = self->plat.shard_index;
+			if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &value, sizeof(value)) < 0) {
+				DEBUG_PRINTF("Setting SO_INCOMING_CPU on socket failed (%s)",strerror(errno));
+			}
+		}
+#endif
+
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+	} else if ((self->plat.shard_flags & SMCP_PLAT_SHARD_STEER_BY_CPU)
+		&& (self->plat.shard_index == 0)
+	) {
+		// Select the socket in the group by `cpu % count`. The
+		// program applies to the whole group, so only the first
+		// shard needs to attach it.
+		struct sock_filter code[] = {
+			{ BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)self->plat.shard_count },
+			{ BPF_RET | BPF_A, 0, 0, 0 },
+		};
+		struct sock_fprog prog = {
+			.len = sizeof(code)/sizeof(code[0]),
+			.filter = code,
+		};
+
+		if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+			DEBUG_PRINTF("Attaching reuseport steering program failed (%s)",strerror(errno));
+		}
+#endif
+	}
+
+bail:
+	return ret;
+}
+#endif // SO_REUSEPORT
 
 smcp_status_t
 smcp_plat_bind_to_sockaddr(
@@ -248,6 +427,13 @@ smcp_plat_bind_to_sockaddr(
 	}
 #endif
 
+#if defined(SO_REUSEPORT)
+	if (self->plat.shard_count > 0) {
+		ret = smcp_plat_shard_setup(self, fd, false);
+		require_noerr(ret, bail);
+	}
+#endif
+
 	require_action_string(
 		bind(fd, (struct sockaddr*)sockaddr, sizeof(*sockaddr)) == 0,
 		bail,
@@ -255,6 +441,13 @@ smcp_plat_bind_to_sockaddr(
 		strerror(errno)
 	);
 
+#if defined(SO_REUSEPORT)
+	if (self->plat.shard_count > 0) {
+		ret = smcp_plat_shard_setup(self, fd, true);
+		require_noerr(ret, bail);
+	}
+#endif
+
 #ifdef SMCP_RECVPKTINFO
 	{	// Handle sockopts.
 		int value = 1;
@@ -266,6 +459,12 @@ smcp_plat_bind_to_sockaddr(
 	switch(type) {
 	case SMCP_SESSION_TYPE_UDP:
 		self->plat.fd_udp = fd;
+#if SMCP_BSD_SOCKETS_USE_URING
+		if (smcp_plat_uring_start(self, fd) != SMCP_STATUS_OK) {
+			// Not fatal, we just fall back to poll().
+			DEBUG_PRINTF("Unable to use io_uring (%s)",strerror(errno));
+		}
+#endif
 		break;
 #if SMCP_DTLS
 	case SMCP_SESSION_TYPE_DTLS:
@@ -310,38 +509,85 @@ smcp_plat_bind_to_port(
 	return smcp_plat_bind_to_sockaddr(self, type, &saddr);
 }
 
+int
+smcp_plat_get_fds(
+	smcp_t self,
+	struct smcp_plat_fd_s fds[],
+	int maxfds
+) {
+	SMCP_EMBEDDED_SELF_HOOK;
+	int count = 0;
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		// Everything we wait on shows up on the ring.
+		if (count < maxfds) {
+			fds[count].fd = self->plat.uring.fd;
+			fds[count].events = SMCP_PLAT_FD_READ;
+		}
+		count++;
+	} else
+#endif
+	if (self->plat.fd_udp >= 0) {
+		if (count < maxfds) {
+			fds[count].fd = self->plat.fd_udp;
+			fds[count].events = SMCP_PLAT_FD_READ;
+			if (smcp_plat_has_pending_sends(self)) {
+				fds[count].events |= SMCP_PLAT_FD_WRITE;
+			}
+		}
+		count++;
+	}
+
+#if SMCP_DTLS
+	if (self->plat.fd_dtls >= 0) {
+		if (count < maxfds) {
+			fds[count].fd = self->plat.fd_dtls;
+			fds[count].events = SMCP_PLAT_FD_READ;
+		}
+		count++;
+	}
+#endif // SMCP_DTLS
+
+#if SMCP_CONF_SUBMIT_QUEUE
+	if (smcp_submit_get_fd(self) >= 0) {
+		if (count < maxfds) {
+			fds[count].fd = smcp_submit_get_fd(self);
+			fds[count].events = SMCP_PLAT_FD_READ;
+		}
+		count++;
+	}
+#endif
+
+	return count;
+}
+
 int
 smcp_plat_update_pollfds(
 	smcp_t self,
 	struct pollfd fds[],
 	int maxfds
 ) {
-	int ret = 1;
+	struct smcp_plat_fd_s plat_fds[SMCP_PLAT_MAX_FDS];
+	int count, i;
 
-	require_quiet(maxfds > 0, bail);
+	count = smcp_plat_get_fds(self, plat_fds, SMCP_PLAT_MAX_FDS);
 
-	assert(fds != NULL);
+	for (i = 0; (i < count) && (i < maxfds); i++) {
+		fds[i].fd = plat_fds[i].fd;
+		fds[i].events = POLLHUP;
+		fds[i].revents = 0;
 
-	if (self->plat.fd_udp > 0) {
-		fds->fd = self->plat.fd_udp;
-		fds->events = POLLIN | POLLHUP;
-		fds->revents = 0;
-		fds++;
-		maxfds--;
-	}
+		if (plat_fds[i].events & SMCP_PLAT_FD_READ) {
+			fds[i].events |= POLLIN;
+		}
 
-#if SMCP_DTLS
-	if (self->plat.fd_dtls > 0) {
-		fds->fd = self->plat.fd_dtls;
-		fds->events = POLLIN | POLLHUP;
-		fds->revents = 0;
-		fds++;
-		maxfds--;
+		if (plat_fds[i].events & SMCP_PLAT_FD_WRITE) {
+			fds[i].events |= POLLOUT;
+		}
 	}
-#endif // SMCP_DTLS
 
-bail:
-	return ret;
+	return count;
 }
 
 smcp_status_t
@@ -353,37 +599,30 @@ smcp_plat_update_fdsets(
 	int *fd_count,
 	smcp_cms_t *timeout
 ) {
-	smcp_status_t ret = SMCP_STATUS_OK;
+	struct smcp_plat_fd_s plat_fds[SMCP_PLAT_MAX_FDS];
+	int count, i;
 
-	if (self->plat.fd_udp > 0) {
-		if (read_fd_set) {
-			FD_SET(self->plat.fd_udp, read_fd_set);
-		}
+	count = smcp_plat_get_fds(self, plat_fds, SMCP_PLAT_MAX_FDS);
 
-		if (error_fd_set) {
-			FD_SET(self->plat.fd_udp, error_fd_set);
-		}
+	for (i = 0; i < count; i++) {
+		const int fd = plat_fds[i].fd;
 
-		if (fd_count && (*fd_count <= self->plat.fd_udp)) {
-			*fd_count = self->plat.fd_udp + 1;
+		if (read_fd_set && (plat_fds[i].events & SMCP_PLAT_FD_READ)) {
+			FD_SET(fd, read_fd_set);
 		}
-	}
 
-#if SMCP_DTLS
-	if (self->plat.fd_dtls > 0) {
-		if (read_fd_set) {
-			FD_SET(self->plat.fd_dtls, read_fd_set);
+		if (write_fd_set && (plat_fds[i].events & SMCP_PLAT_FD_WRITE)) {
+			FD_SET(fd, write_fd_set);
 		}
 
 		if (error_fd_set) {
-			FD_SET(self->plat.fd_dtls, error_fd_set);
+			FD_SET(fd, error_fd_set);
 		}
 
-		if (fd_count && (*fd_count <= self->plat.fd_dtls)) {
-			*fd_count = self->plat.fd_dtls + 1;
+		if (fd_count && (*fd_count <= fd)) {
+			*fd_count = fd + 1;
 		}
 	}
-#endif
 
 	if (timeout) {
 		smcp_cms_t tmp = smcp_get_timeout(self);
@@ -393,9 +632,67 @@ smcp_plat_update_fdsets(
 		}
 	}
 
-	return ret;
+	return SMCP_STATUS_OK;
 }
 
+//!	Fills in an IP_PKTINFO/IPV6_PKTINFO control message for the given source address.
+/*!	Returns the length of the control data, or zero if no
+**	control data is needed to send from `saddr_from`. */
+socklen_t
+smcp_plat_fill_pktinfo(
+	uint8_t* cmbuf,
+	socklen_t cmbuf_len,
+	const struct sockaddr * saddr_to,
+	const struct sockaddr * saddr_from, socklen_t socklen_from
+) {
+	struct cmsghdr *scmsgp;
+	struct msghdr msg = {
+		.msg_control = cmbuf,
+		.msg_controllen = cmbuf_len,
+	};
+
+	if ((socklen_from == 0)
+		|| (saddr_from == NULL)
+		|| (saddr_from->sa_family != saddr_to->sa_family)
+	) {
+		return 0;
+	}
+
+	memset(cmbuf, 0, cmbuf_len);
+
+#if defined(AF_INET6)
+	if (saddr_to->sa_family == AF_INET6) {
+		struct in6_pktinfo *pktinfo;
+		scmsgp = CMSG_FIRSTHDR(&msg);
+		scmsgp->cmsg_level = IPPROTO_IPV6;
+		scmsgp->cmsg_type = IPV6_PKTINFO;
+		scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+		pktinfo = (struct in6_pktinfo *)(CMSG_DATA(scmsgp));
+
+		pktinfo->ipi6_addr = ((struct sockaddr_in6*)saddr_from)->sin6_addr;
+		pktinfo->ipi6_ifindex = ((struct sockaddr_in6*)saddr_from)->sin6_scope_id;
+
+		return CMSG_SPACE(sizeof(struct in6_pktinfo));
+	} else
+#endif
+
+	if (saddr_to->sa_family == AF_INET) {
+		struct in_pktinfo *pktinfo;
+		scmsgp = CMSG_FIRSTHDR(&msg);
+		scmsgp->cmsg_level = IPPROTO_IP;
+		scmsgp->cmsg_type = IP_PKTINFO;
+		scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+		pktinfo = (struct in_pktinfo *)(CMSG_DATA(scmsgp));
+
+		pktinfo->ipi_spec_dst = ((struct sockaddr_in*)saddr_to)->sin_addr;
+		pktinfo->ipi_addr = ((struct sockaddr_in*)saddr_from)->sin_addr;
+		pktinfo->ipi_ifindex = 0;
+
+		return CMSG_SPACE(sizeof(struct in_pktinfo));
+	}
+
+	return 0;
+}
 
 static ssize_t
 sendtofrom(
@@ -406,10 +703,16 @@ sendtofrom(
 )
 {
 	ssize_t ret = -1;
-	if ((socklen_from == 0)
-		|| (saddr_from == NULL)
-		|| (saddr_from->sa_family != saddr_to->sa_family)
-	) {
+	uint8_t cmbuf[CMSG_SPACE(sizeof (struct in6_pktinfo))];
+	socklen_t cmbuf_len = smcp_plat_fill_pktinfo(
+		cmbuf,
+		sizeof(cmbuf),
+		saddr_to,
+		saddr_from,
+		socklen_from
+	);
+
+	if (cmbuf_len == 0) {
 		ret = sendto(
 			fd,
 			data,
@@ -421,44 +724,15 @@ sendtofrom(
 		check(ret>0);
 	} else {
 		struct iovec iov = { (void *)data, len };
-		uint8_t cmbuf[CMSG_SPACE(sizeof (struct in6_pktinfo))];
-		struct cmsghdr *scmsgp;
 		struct msghdr msg = {
 			.msg_name = (void*)saddr_to,
 			.msg_namelen = socklen_to,
 			.msg_iov = &iov,
 			.msg_iovlen = 1,
 			.msg_control = cmbuf,
-			.msg_controllen = sizeof(cmbuf),
+			.msg_controllen = cmbuf_len,
 		};
 
-#if defined(AF_INET6)
-		if (saddr_to->sa_family == AF_INET6) {
-			struct in6_pktinfo *pktinfo;
-			scmsgp = CMSG_FIRSTHDR(&msg);
-			scmsgp->cmsg_level = IPPROTO_IPV6;
-			scmsgp->cmsg_type = IPV6_PKTINFO;
-			scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-			pktinfo = (struct in6_pktinfo *)(CMSG_DATA(scmsgp));
-
-			pktinfo->ipi6_addr = ((struct sockaddr_in6*)saddr_from)->sin6_addr;
-			pktinfo->ipi6_ifindex = ((struct sockaddr_in6*)saddr_from)->sin6_scope_id;
-		} else
-#endif
-
-		if (saddr_to->sa_family == AF_INET) {
-			struct in_pktinfo *pktinfo;
-			scmsgp = CMSG_FIRSTHDR(&msg);
-			scmsgp->cmsg_level = IPPROTO_IP;
-			scmsgp->cmsg_type = IP_PKTINFO;
-			scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-			pktinfo = (struct in_pktinfo *)(CMSG_DATA(scmsgp));
-
-			pktinfo->ipi_spec_dst = ((struct sockaddr_in*)saddr_to)->sin_addr;
-			pktinfo->ipi_addr = ((struct sockaddr_in*)saddr_from)->sin_addr;
-			pktinfo->ipi_ifindex = 0;
-		}
-
 		ret = sendmsg(fd, &msg, flags);
 
 		check(ret > 0);
@@ -519,17 +793,211 @@ smcp_plat_get_session_type(void)
 	return smcp_get_current_instance()->plat.session_type;
 }
 
+// MARK: -
+// MARK: Deferred-send Queue
+
+#if SMCP_BSD_SOCKETS_USE_SENDMMSG
+static bool
+smcp_plat_has_pending_sends(smcp_t self)
+{
+	return self->plat.send_queue_count > 0;
+}
+
+smcp_status_t
+smcp_plat_flush(smcp_t self)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_status_t ret = SMCP_STATUS_OK;
+	const int queue_count = self->plat.send_queue_count;
+	int sent = 0;
+	int i;
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		ret = smcp_plat_uring_submit(self);
+	}
+#endif
+
+	require_quiet(queue_count > 0, bail);
+
+	for (i = 0; i < queue_count; i++) {
+		struct smcp_plat_send_slot_s* const slot = &self->plat.send_slots[i];
+		struct msghdr* const msg = &self->plat.send_msgs[i].msg_hdr;
+
+		self->plat.send_iovs[i].iov_base = slot->packet;
+		self->plat.send_iovs[i].iov_len = slot->packet_len;
+
+		msg->msg_name = &slot->sockaddr_remote;
+		msg->msg_namelen = sizeof(slot->sockaddr_remote);
+		msg->msg_iov = &self->plat.send_iovs[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = slot->cmbuf_len ? slot->cmbuf : NULL;
+		msg->msg_controllen = slot->cmbuf_len;
+		msg->msg_flags = 0;
+	}
+
+	while (sent < queue_count) {
+		int count = sendmmsg(
+			self->plat.fd_udp,
+			&self->plat.send_msgs[sent],
+			queue_count - sent,
+			MSG_DONTWAIT
+		);
+
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+				// The socket can't take any more right now. Leave the
+				// rest in the queue and let the caller know.
+				ret = SMCP_STATUS_QUEUE_FULL;
+				break;
+			}
+
+			// This particular packet can't be sent at all,
+			// so drop it and move on to the next one.
+			check_string(count >= 0, strerror(errno));
+			count = 1;
+		}
+
+		sent += count;
+	}
+
+	if (sent < queue_count) {
+		memmove(
+			&self->plat.send_slots[0],
+			&self->plat.send_slots[sent],
+			(queue_count - sent) * sizeof(self->plat.send_slots[0])
+		);
+	}
+
+	self->plat.send_queue_count -= sent;
+
+bail:
+	return ret;
+}
+
+smcp_status_t
+smcp_plat_set_send_queue_size(smcp_t self, int count)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_status_t ret = SMCP_STATUS_OK;
+
+	if (count < 0) {
+		count = 0;
+	} else if (count > SMCP_CONF_SEND_QUEUE_SIZE) {
+		count = SMCP_CONF_SEND_QUEUE_SIZE;
+	}
+
+	if (self->plat.send_queue_count > count) {
+		ret = smcp_plat_flush(self);
+		require_noerr(ret, bail);
+	}
+
+	self->plat.send_queue_size = count;
+
+bail:
+	return ret;
+}
+
+//!	Adds a finished packet to the end of the deferred-send queue.
+static smcp_status_t
+smcp_plat_queue_packet(smcp_t self, const uint8_t* data_ptr, coap_size_t data_len)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	struct smcp_plat_send_slot_s* slot;
+
+	if (self->plat.send_queue_count >= self->plat.send_queue_size) {
+		// The queue was full when this packet was started, so it
+		// was composed in `outbound_packet_bytes`. Make some room.
+		ret = smcp_plat_flush(self);
+
+		// The socket may only have taken part of the queue,
+		// which is still enough room for this packet.
+		require(self->plat.send_queue_count < self->plat.send_queue_size, bail);
+
+		ret = SMCP_STATUS_OK;
+	}
+
+	slot = &self->plat.send_slots[self->plat.send_queue_count];
+
+	if (data_ptr != (const uint8_t*)slot->packet) {
+		memcpy(slot->packet, data_ptr, data_len);
+	}
+
+	slot->packet_len = data_len;
+	slot->sockaddr_remote = *smcp_plat_get_remote_sockaddr();
+	slot->sockaddr_local = *smcp_plat_get_local_sockaddr();
+	slot->cmbuf_len = smcp_plat_fill_pktinfo(
+		slot->cmbuf,
+		sizeof(slot->cmbuf),
+		(struct sockaddr *)&slot->sockaddr_remote,
+		(struct sockaddr *)&slot->sockaddr_local,
+		sizeof(slot->sockaddr_local)
+	);
+
+	self->plat.send_queue_count++;
+
+bail:
+	return ret;
+}
+#else
+static bool
+smcp_plat_has_pending_sends(smcp_t self)
+{
+	return false;
+}
+
+smcp_status_t
+smcp_plat_flush(smcp_t self)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		return smcp_plat_uring_submit(self);
+	}
+#endif
+	return SMCP_STATUS_OK;
+}
+
+smcp_status_t
+smcp_plat_set_send_queue_size(smcp_t self, int count)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	return (count > 0) ? SMCP_STATUS_NOT_IMPLEMENTED : SMCP_STATUS_OK;
+}
+#endif // SMCP_BSD_SOCKETS_USE_SENDMMSG
+
+// MARK: -
+
 smcp_status_t
 smcp_plat_outbound_start(smcp_t self, uint8_t** data_ptr, coap_size_t *data_len)
 {
 	SMCP_EMBEDDED_SELF_HOOK;
+	char* packet_bytes = self->plat.outbound_packet_bytes;
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		// Compose directly into a free send slot, if there is one.
+		packet_bytes = smcp_plat_uring_outbound_start(self);
+
+		if (packet_bytes == NULL) {
+			packet_bytes = self->plat.outbound_packet_bytes;
+		}
+	} else
+#endif
+#if SMCP_BSD_SOCKETS_USE_SENDMMSG
+	// Compose directly into the next free queue slot, if there is one.
+	if (self->plat.send_queue_count < self->plat.send_queue_size) {
+		packet_bytes = self->plat.send_slots[self->plat.send_queue_count].packet;
+	}
+#endif
+
 	if (data_ptr) {
-		*data_ptr = (uint8_t*)self->plat.outbound_packet_bytes;
+		*data_ptr = (uint8_t*)packet_bytes;
 	}
 	if (data_len) {
 		*data_len = sizeof(self->plat.outbound_packet_bytes);
 	}
-	self->outbound.packet = (struct coap_header_s*)self->plat.outbound_packet_bytes;
+	self->outbound.packet = (struct coap_header_s*)packet_bytes;
 	return SMCP_STATUS_OK;
 }
 
@@ -561,6 +1029,33 @@ smcp_plat_outbound_finish(smcp_t self,const uint8_t* data_ptr, coap_size_t data_
 	}
 #endif
 
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		if (smcp_plat_uring_owns_packet(self, data_ptr)) {
+			ret = smcp_plat_uring_outbound_finish(self, data_ptr, data_len);
+
+			// Packets sent while handling received packets are
+			// submitted together once they have all been handled.
+			// Anything else, including responses to packets fed
+			// to smcp_inbound_packet_process() directly, goes now.
+			if ((ret == SMCP_STATUS_OK) && !self->plat.uring.dispatching) {
+				ret = smcp_plat_uring_submit(self);
+			}
+			goto bail;
+		}
+
+		// Every send slot was busy, so this one is sent right away.
+		// Submit what is already prepared first to keep the order.
+		smcp_plat_uring_submit(self);
+	} else
+#endif
+#if SMCP_BSD_SOCKETS_USE_SENDMMSG
+	if (self->plat.send_queue_size > 0) {
+		ret = smcp_plat_queue_packet(self, data_ptr, data_len);
+		goto bail;
+	}
+#endif
+
 	sent_bytes = sendtofrom(
 		fd,
 		data_ptr,
@@ -595,7 +1090,12 @@ smcp_plat_wait(
 ) {
 	SMCP_EMBEDDED_SELF_HOOK;
 	smcp_status_t ret = SMCP_STATUS_OK;
-	struct pollfd pollee = { self->plat.fd_udp, POLLIN | POLLHUP, 0 };
+	struct pollfd polls[2] = {
+		{ self->plat.fd_udp, POLLIN | POLLHUP, 0 },
+#if SMCP_CONF_SUBMIT_QUEUE
+		{ smcp_submit_get_fd(self), POLLIN, 0 },
+#endif
+	};
 	int descriptors_ready;
 
 	if(cms >= 0) {
@@ -604,9 +1104,24 @@ smcp_plat_wait(
 		cms = smcp_get_timeout(self);
 	}
 
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		return smcp_plat_uring_wait(self, cms);
+	}
+#endif
+
+	if (smcp_plat_flush(self) == SMCP_STATUS_QUEUE_FULL) {
+		// Wake up as soon as we can send the rest.
+		polls[0].events |= POLLOUT;
+	}
+
 	errno = 0;
 
-	descriptors_ready = poll(&pollee, 1, cms);
+#if SMCP_CONF_SUBMIT_QUEUE
+	descriptors_ready = poll(polls, 2, cms);
+#else
+	descriptors_ready = poll(polls, 1, cms);
+#endif
 
 	// Ensure that poll did not fail with an error.
 	require_action_string(descriptors_ready != -1,
@@ -619,10 +1134,249 @@ smcp_plat_wait(
 		ret = SMCP_STATUS_TIMEOUT;
 	}
 
+#if SMCP_CONF_SUBMIT_QUEUE
+	if (polls[1].revents) {
+		// smcp_plat_process() picks up the submissions.
+		smcp_submit_clear_wakeup(self);
+	}
+#endif
+
 bail:
 	return ret;
 }
 
+static void
+smcp_plat_parse_pktinfo(
+	smcp_t self,
+	struct msghdr* msg,
+	const smcp_sockaddr_t* remote_saddr,
+	smcp_sockaddr_t* local_saddr
+) {
+	struct cmsghdr *cmsg;
+
+	for (
+		cmsg = CMSG_FIRSTHDR(msg);
+		cmsg != NULL;
+		cmsg = CMSG_NXTHDR(msg, cmsg)
+	) {
+		if (cmsg->cmsg_level != SMCP_IPPROTO
+			|| cmsg->cmsg_type != SMCP_PKTINFO
+		) {
+			continue;
+		}
+
+		// Preinitialize some of the fields.
+		*local_saddr = *remote_saddr;
+
+#if SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET6
+		struct in6_pktinfo *pi = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+		local_saddr->smcp_addr = pi->ipi6_addr;
+		local_saddr->sin6_scope_id = pi->ipi6_ifindex;
+
+#elif SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET
+		struct in_pktinfo *pi = (struct in_pktinfo *)CMSG_DATA(cmsg);
+		local_saddr->smcp_addr = pi->ipi_addr;
+#endif
+
+		local_saddr->smcp_port = htons(smcp_plat_get_port(self));
+
+		self->plat.pktinfo = *pi;
+	}
+}
+
+smcp_status_t
+smcp_plat_process_datagram(
+	smcp_t self,
+	int fd,
+	struct msghdr* msg,
+	char* packet,
+	coap_size_t packet_len
+) {
+	smcp_status_t ret = SMCP_STATUS_OK;
+	const smcp_sockaddr_t* remote_saddr = (const smcp_sockaddr_t*)msg->msg_name;
+	smcp_sockaddr_t local_saddr = {};
+
+	packet[packet_len] = 0;
+
+	smcp_plat_parse_pktinfo(self, msg, remote_saddr, &local_saddr);
+
+	smcp_set_current_instance(self);
+	smcp_plat_set_remote_sockaddr(remote_saddr);
+	smcp_plat_set_local_sockaddr(&local_saddr);
+
+	if (self->plat.fd_udp == fd) {
+		smcp_plat_set_session_type(SMCP_SESSION_TYPE_UDP);
+
+		ret = smcp_inbound_packet_process(self, packet, packet_len, 0);
+
+#if SMCP_DTLS
+	} else if (self->plat.fd_dtls == fd) {
+		// TODO: Feed it into dtls, see if anything pops out.
+
+#endif
+	}
+
+	return ret;
+}
+
+#if SMCP_BSD_SOCKETS_USE_RECVMMSG
+void
+smcp_plat_set_recv_batch_size(smcp_t self, int count)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+
+	if (count < 1) {
+		count = 1;
+	} else if (count > SMCP_CONF_RECV_BATCH_SIZE) {
+		count = SMCP_CONF_RECV_BATCH_SIZE;
+	}
+
+	self->plat.recv_batch_size = count;
+}
+
+//!	Drains up to `recv_batch_size` datagrams from `fd` with one syscall.
+static smcp_status_t
+smcp_plat_process_batch(smcp_t self, int fd)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	int i, count;
+
+	for (i = 0; i < self->plat.recv_batch_size; i++) {
+		struct smcp_plat_recv_slot_s* const slot = &self->plat.recv_slots[i];
+		struct msghdr* const msg = &self->plat.recv_msgs[i].msg_hdr;
+
+		slot->iov.iov_base = slot->packet;
+		slot->iov.iov_len = SMCP_MAX_PACKET_LENGTH;
+
+		msg->msg_name = &slot->sockaddr_remote;
+		msg->msg_namelen = sizeof(slot->sockaddr_remote);
+		msg->msg_iov = &slot->iov;
+		msg->msg_iovlen = 1;
+		msg->msg_control = slot->cmbuf;
+		msg->msg_controllen = sizeof(slot->cmbuf);
+		msg->msg_flags = 0;
+	}
+
+	count = recvmmsg(fd, self->plat.recv_msgs, self->plat.recv_batch_size, MSG_DONTWAIT, NULL);
+
+	require_action(count > 0, bail, ret = SMCP_STATUS_ERRNO);
+
+	for (i = 0; i < count; i++) {
+		smcp_status_t status;
+
+		if (self->plat.recv_msgs[i].msg_len == 0) {
+			continue;
+		}
+
+		status = smcp_plat_process_datagram(
+			self,
+			fd,
+			&self->plat.recv_msgs[i].msg_hdr,
+			self->plat.recv_slots[i].packet,
+			(coap_size_t)self->plat.recv_msgs[i].msg_len
+		);
+
+		// Keep going so that one bad packet doesn't
+		// cause the rest of the batch to be dropped.
+		check_noerr(status);
+
+		if (ret == SMCP_STATUS_OK) {
+			ret = status;
+		}
+	}
+
+bail:
+	return ret;
+}
+#else
+void
+smcp_plat_set_recv_batch_size(smcp_t self, int count)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	(void)count;
+}
+#endif // SMCP_BSD_SOCKETS_USE_RECVMMSG
+
+//!	Reads whatever is waiting on `fd` and processes it.
+static smcp_status_t
+smcp_plat_read_fd(smcp_t self, int fd)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self) && (fd == self->plat.uring.fd)) {
+		// Completions are read straight from shared memory,
+		// there is no need to read the socket.
+		return smcp_plat_uring_process(self);
+	}
+#endif
+
+#if SMCP_BSD_SOCKETS_USE_RECVMMSG
+	if (self->plat.recv_batch_size > 1) {
+		return smcp_plat_process_batch(self, fd);
+	}
+#endif
+
+	{
+		char packet[SMCP_MAX_PACKET_LENGTH+1];
+		smcp_sockaddr_t remote_saddr = {};
+		ssize_t packet_len = 0;
+		char cmbuf[0x100];
+		struct iovec iov = { packet, SMCP_MAX_PACKET_LENGTH };
+		struct msghdr msg = {
+			.msg_name = &remote_saddr,
+			.msg_namelen = sizeof(remote_saddr),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = cmbuf,
+			.msg_controllen = sizeof(cmbuf),
+		};
+
+		packet_len = recvmsg(fd, &msg, MSG_DONTWAIT);
+
+		require_action(packet_len > 0, bail, ret = SMCP_STATUS_ERRNO);
+
+		ret = smcp_plat_process_datagram(self, fd, &msg, packet, (coap_size_t)packet_len);
+	}
+
+bail:
+	return ret;
+}
+
+smcp_status_t
+smcp_plat_process_fd(smcp_t self, int fd, int events)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_status_t ret = SMCP_STATUS_OK;
+
+	smcp_set_current_instance(self);
+
+#if SMCP_CONF_SUBMIT_QUEUE
+	if (fd == smcp_submit_get_fd(self)) {
+		smcp_submit_clear_wakeup(self);
+		smcp_submit_process(self);
+	} else
+#endif
+	if (events & (SMCP_PLAT_FD_READ | SMCP_PLAT_FD_ERROR)) {
+		ret = smcp_plat_read_fd(self, fd);
+
+		if ((ret == SMCP_STATUS_ERRNO)
+			&& ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		) {
+			// Spurious wakeup.
+			ret = SMCP_STATUS_OK;
+		}
+	}
+
+	// Send anything that was queued up while handling the packet,
+	// and anything that was waiting for the socket to be writable.
+	smcp_plat_flush(self);
+
+	smcp_set_current_instance(NULL);
+	self->is_responding = false;
+	return ret;
+}
+
 smcp_status_t
 smcp_plat_process(
 	smcp_t self
@@ -631,102 +1385,62 @@ smcp_plat_process(
 	smcp_status_t ret = 0;
 
 	int tmp;
-	struct pollfd polls[2];
+	struct pollfd polls[SMCP_PLAT_MAX_FDS];
 	int poll_count;
 
 	poll_count = smcp_plat_update_pollfds(self, polls, sizeof(polls)/sizeof(polls[0]));
 
-	errno = 0;
+#if SMCP_BSD_SOCKETS_USE_URING
+	if (smcp_plat_uring_is_active(self)) {
+		// Reaping completions costs no system calls,
+		// so there is no need to poll first.
+		polls[0].revents = POLLIN;
+		tmp = 1;
+	} else
+#endif
+	{
+		errno = 0;
 
-	tmp = poll(polls, poll_count, 0);
+		tmp = poll(polls, poll_count, 0);
 
-	// Ensure that poll did not fail with an error.
-	require_action_string(
-		errno == 0,
-		bail,
-		ret = SMCP_STATUS_ERRNO,
-		strerror(errno)
-	);
+		// Ensure that poll did not fail with an error.
+		require_action_string(
+			errno == 0,
+			bail,
+			ret = SMCP_STATUS_ERRNO,
+			strerror(errno)
+		);
+	}
 
 	if(tmp > 0) {
 		for (tmp = 0; tmp < poll_count; tmp++) {
 			if (!polls[tmp].revents) {
 				continue;
-			} else {
-				char packet[SMCP_MAX_PACKET_LENGTH+1];
-				smcp_sockaddr_t remote_saddr = {};
-				smcp_sockaddr_t local_saddr = {};
-				ssize_t packet_len = 0;
-				char cmbuf[0x100];
-				struct iovec iov = { packet, SMCP_MAX_PACKET_LENGTH };
-				struct msghdr msg = {
-					.msg_name = &remote_saddr,
-					.msg_namelen = sizeof(remote_saddr),
-					.msg_iov = &iov,
-					.msg_iovlen = 1,
-					.msg_control = cmbuf,
-					.msg_controllen = sizeof(cmbuf),
-				};
-				struct cmsghdr *cmsg;
-
-				packet_len = recvmsg(polls[tmp].fd, &msg, 0);
-
-				require_action(packet_len > 0, bail, ret = SMCP_STATUS_ERRNO);
-
-				packet[packet_len] = 0;
-
-				for (
-					cmsg = CMSG_FIRSTHDR(&msg);
-					cmsg != NULL;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)
-				) {
-					if (cmsg->cmsg_level != SMCP_IPPROTO
-						|| cmsg->cmsg_type != SMCP_PKTINFO
-					) {
-						continue;
-					}
-
-					// Preinitialize some of the fields.
-					local_saddr = remote_saddr;
-
-#if SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET6
-					struct in6_pktinfo *pi = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-					local_saddr.smcp_addr = pi->ipi6_addr;
-					local_saddr.sin6_scope_id = pi->ipi6_ifindex;
+			}
 
-#elif SMCP_BSD_SOCKETS_NET_FAMILY==AF_INET
-					struct in_pktinfo *pi = (struct in_pktinfo *)CMSG_DATA(cmsg);
-					local_saddr.smcp_addr = pi->ipi_addr;
+#if SMCP_CONF_SUBMIT_QUEUE
+			if (polls[tmp].fd == smcp_submit_get_fd(self)) {
+				smcp_submit_clear_wakeup(self);
+				continue;
+			}
 #endif
 
-					local_saddr.smcp_port = htons(smcp_plat_get_port(self));
-
-					self->plat.pktinfo = *pi;
-				}
-
-				smcp_set_current_instance(self);
-				smcp_plat_set_remote_sockaddr(&remote_saddr);
-				smcp_plat_set_local_sockaddr(&local_saddr);
-
-				if (self->plat.fd_udp == polls[tmp].fd) {
-					smcp_plat_set_session_type(SMCP_SESSION_TYPE_UDP);
-
-					ret = smcp_inbound_packet_process(self, packet, (coap_size_t)packet_len, 0);
-					require_noerr(ret, bail);
-
-#if SMCP_DTLS
-				} else if (self->plat.fd_dtls == polls[tmp].fd) {
-					// TODO: Feed it into dtls, see if anything pops out.
-
-#endif
-				}
-			}
+			ret = smcp_plat_read_fd(self, polls[tmp].fd);
+			require_noerr(ret, bail);
 		}
 	}
 
+#if SMCP_CONF_SUBMIT_QUEUE
+	// Cheap when nothing has been submitted.
+	smcp_submit_process(self);
+#endif
+
 	smcp_handle_timers(self);
 
 bail:
+	// Send anything that was queued up while handling events.
+	smcp_plat_flush(self);
+
 	smcp_set_current_instance(NULL);
 	self->is_responding = false;
 	return ret;
@@ -62,9 +62,108 @@ typedef struct sockaddr_in smcp_sockaddr_t;
 
 //!	Gets the file descriptor for the UDP socket.
 /*!	Useful for implementing asynchronous operation using select(),
-**	poll(), or other async mechanisms. */
+**	poll(), or other async mechanisms. When io_uring is in use, this
+**	is the descriptor of the ring instead. */
 SMCP_API_EXTERN int smcp_plat_get_fd(smcp_t self);
 
+//!	Sets the maximum number of datagrams read per socket per call to smcp_plat_process().
+/*!	Values are clamped between 1 and `SMCP_CONF_RECV_BATCH_SIZE`.
+**	Has no effect on platforms without `recvmmsg()`. */
+SMCP_API_EXTERN void smcp_plat_set_recv_batch_size(smcp_t self, int count);
+
+//!	Enables deferred sending of outbound packets.
+/*!	When `count` is greater than zero, finished outbound packets are
+**	held in a queue of up to `count` entries (clamped to
+**	`SMCP_CONF_SEND_QUEUE_SIZE`) instead of being sent immediately.
+**	The queue is flushed at the end of smcp_plat_process(), before
+**	smcp_plat_wait() blocks, or explicitly with smcp_plat_flush().
+**
+**	Passing zero flushes and disables the queue, which is the default.
+**	Returns SMCP_STATUS_NOT_IMPLEMENTED if `sendmmsg()` is unavailable. */
+SMCP_API_EXTERN smcp_status_t smcp_plat_set_send_queue_size(smcp_t self, int count);
+
+//!	Sends all packets waiting in the deferred-send queue.
+/*!	Packets that the socket cannot currently accept are left in
+**	the queue and SMCP_STATUS_QUEUE_FULL is returned. */
+SMCP_API_EXTERN smcp_status_t smcp_plat_flush(smcp_t self);
+
+//!	Flag for smcp_plat_set_shard(): Ask the kernel to steer packets to the shard matching the receiving CPU.
+#define SMCP_PLAT_SHARD_STEER_BY_CPU		(1<<0)
+
+//!	Configures this instance as one shard of a group sharing a single port.
+/*!	Several instances (typically one per thread) can bind to the same
+**	port when each of them calls this function *before* binding. The
+**	kernel then distributes inbound datagrams between the instances
+**	using `SO_REUSEPORT`.
+**
+**	Each shard keeps its own transactions, timers, and observers, and
+**	must only be used from the thread that runs it. A node tree may be
+**	shared between shards, since routing does not modify it, as long as
+**	the handlers themselves are thread-safe.
+**
+**	If `flags` includes SMCP_PLAT_SHARD_STEER_BY_CPU, shard `index` is
+**	hinted to receive packets handled by CPU number `index`. For this to
+**	be effective, the shards must be bound in order of their index and
+**	each shard's thread should be pinned to the matching CPU.
+**
+**	Returns SMCP_STATUS_NOT_IMPLEMENTED if the platform doesn't support
+**	`SO_REUSEPORT`. */
+SMCP_API_EXTERN smcp_status_t smcp_plat_set_shard(
+	smcp_t self,
+	int index,	//!< [IN] Index of this shard, starting at zero
+	int count,	//!< [IN] Total number of shards in the group
+	int flags	//!< [IN] Flags (SMCP_PLAT_SHARD_STEER_BY_CPU)
+);
+
+//!	Enables or disables io_uring for socket I/O on this instance.
+/*!	io_uring is used by default when SMCP is configured with
+**	`--enable-io-uring` and the kernel supports it. When it is in use,
+**	smcp_plat_get_fd() and smcp_plat_update_pollfds() return the ring's
+**	descriptor instead of the socket's.
+**
+**	Returns SMCP_STATUS_NOT_IMPLEMENTED if support was not compiled in,
+**	or an error if the kernel refused to set up the ring. */
+SMCP_API_EXTERN smcp_status_t smcp_plat_set_io_uring(smcp_t self, bool enabled);
+
+//!	Interest flag for smcp_plat_get_fds(): Readable.
+#define SMCP_PLAT_FD_READ			(1<<0)
+//!	Interest flag for smcp_plat_get_fds(): Writable.
+#define SMCP_PLAT_FD_WRITE			(1<<1)
+//!	Readiness flag for smcp_plat_process_fd(): Error or hangup.
+#define SMCP_PLAT_FD_ERROR			(1<<2)
+
+//!	The most descriptors an instance will ever need watched.
+#define SMCP_PLAT_MAX_FDS			(3)
+
+//!	A descriptor that the host's event loop should watch.
+struct smcp_plat_fd_s {
+	int fd;
+	int events;		//!< SMCP_PLAT_FD_READ and/or SMCP_PLAT_FD_WRITE
+};
+
+//!	Gets the descriptors that need watching, along with their interest sets.
+/*!	This is the preferred way to integrate SMCP into an external event
+**	loop (libuv, libevent, epoll, etc.). Up to `maxfds` entries are
+**	filled in. Returns the number of descriptors the instance needs,
+**	which is never more than SMCP_PLAT_MAX_FDS.
+**
+**	The interest sets change when outbound packets are waiting for the
+**	socket to become writable, so call this again after processing.
+**	When a descriptor reported readiness, call smcp_plat_process_fd().
+**	When the deadline from smcp_get_timeout() passes, call
+**	smcp_process_timers_until(). */
+SMCP_API_EXTERN int smcp_plat_get_fds(
+	smcp_t self,
+	struct smcp_plat_fd_s fds[],
+	int maxfds
+);
+
+//!	Handles readiness of a descriptor from smcp_plat_get_fds().
+/*!	Unlike smcp_plat_process(), this doesn't poll the descriptors
+**	first and doesn't fire any timers. `events` is the set of
+**	`SMCP_PLAT_FD_*` flags the host's event loop reported. */
+SMCP_API_EXTERN smcp_status_t smcp_plat_process_fd(smcp_t self, int fd, int events);
+
 //! Support for `select()` style asynchronous operation
 SMCP_API_EXTERN smcp_status_t smcp_plat_update_fdsets(
 	smcp_t self,
@@ -53,6 +53,10 @@
 #include <stdio.h>
 
 #if SMCP_USE_UIP
+#if SMCP_CONF_TIMESTAMP_64BIT
+#error SMCP_CONF_TIMESTAMP_64BIT is not supported by the uIP platform
+#endif
+
 #include "net/ip/uip-udp-packet.h"
 #include "net/ip/uiplib.h"
 extern uint16_t uip_slen;
@@ -0,0 +1,704 @@
+/*	@file smcp-plat-uring.c
+**	@brief io_uring backend for the BSD sockets platform layer
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*	Inbound datagrams are received with a single multishot recvmsg
+**	request that picks its buffers from a ring of buffers registered
+**	with the kernel, so a busy socket costs no system calls at all
+**	on the receive side: completions are read straight out of the
+**	shared completion queue. Outbound packets are composed directly
+**	into send slots, prepared as linked sendmsg requests, and
+**	submitted together with a single io_uring_enter() once all of
+**	the received packets that are ready have been handled. Packets
+**	sent at any other time are submitted right away.
+**
+**	The raw system calls are used so that liburing is not needed.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#ifndef DEBUG
+#define DEBUG VERBOSE_DEBUG
+#endif
+
+#include "assert-macros.h"
+
+#include "smcp.h"
+
+#if SMCP_USE_BSD_SOCKETS && SMCP_BSD_SOCKETS_USE_URING
+
+#include "smcp-internal.h"
+#include "smcp-logging.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+
+#if (SMCP_CONF_URING_RECV_BUFFERS & (SMCP_CONF_URING_RECV_BUFFERS - 1)) != 0
+#error SMCP_CONF_URING_RECV_BUFFERS must be a power of two
+#endif
+
+#define URING_TAG_RECV			(1ull)
+#define URING_TAG_SEND			(2ull)
+#define URING_USER_DATA(tag, index)	(((tag) << 32) | (uint32_t)(index))
+
+#define URING_RECV_NAME_LEN		((sizeof(smcp_sockaddr_t) + 7) & ~7)
+#define URING_RECV_CONTROL_LEN	(64)
+
+//! Size of each receive buffer, including one spare byte for
+//! the terminator that smcp_plat_process_datagram() appends.
+#define URING_RECV_BUFFER_STRIDE	\
+	((sizeof(struct io_uring_recvmsg_out) + URING_RECV_NAME_LEN	\
+		+ URING_RECV_CONTROL_LEN + SMCP_MAX_PACKET_LENGTH + 1 + 7) & ~7)
+
+#define URING_FINALIZE_TIMEOUT_MSEC	(100)
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+void
+smcp_plat_uring_init(smcp_t self)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+
+	memset(uring, 0, sizeof(*uring));
+	uring->fd = -1;
+	uring->send_current = -1;
+}
+
+bool
+smcp_plat_uring_is_active(smcp_t self)
+{
+	return self->plat.uring.fd >= 0;
+}
+
+// MARK: - Queues
+
+static struct io_uring_sqe*
+smcp_plat_uring_get_sqe(struct smcp_plat_uring_s* uring)
+{
+	struct io_uring_sqe* sqe = NULL;
+	unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *uring->sq_tail;
+
+	require_quiet(tail - head <= uring->sq_mask, bail);
+
+	sqe = &uring->sqes[tail & uring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+
+bail:
+	return sqe;
+}
+
+static void
+smcp_plat_uring_commit_sqe(struct smcp_plat_uring_s* uring)
+{
+	unsigned tail = *uring->sq_tail;
+
+	uring->sq_array[tail & uring->sq_mask] = tail & uring->sq_mask;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->sq_pending++;
+}
+
+static void
+smcp_plat_uring_recycle_buffer(struct smcp_plat_uring_s* uring, uint16_t bid)
+{
+	const uint16_t mask = SMCP_CONF_URING_RECV_BUFFERS - 1;
+	uint16_t tail = uring->buf_ring->tail;
+	struct io_uring_buf* buf = &uring->buf_ring->bufs[tail & mask];
+
+	// Only these fields may be written: the ring's tail
+	// shares its memory with the first entry's `resv`.
+	buf->addr = (uintptr_t)(uring->buffers + (size_t)bid * URING_RECV_BUFFER_STRIDE);
+	buf->len = URING_RECV_BUFFER_STRIDE - 1;
+	buf->bid = bid;
+
+	__atomic_store_n(&uring->buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static smcp_status_t
+smcp_plat_uring_arm_recv(smcp_t self, int fd)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	smcp_status_t ret = SMCP_STATUS_FAILURE;
+	struct io_uring_sqe* sqe = smcp_plat_uring_get_sqe(uring);
+
+	if (sqe == NULL) {
+		smcp_plat_uring_submit(self);
+		sqe = smcp_plat_uring_get_sqe(uring);
+	}
+
+	require(sqe != NULL, bail);
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)&uring->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = URING_USER_DATA(URING_TAG_RECV, fd);
+
+	smcp_plat_uring_commit_sqe(uring);
+
+	// Sends must not be linked to this request.
+	uring->last_send_sqe = NULL;
+
+	ret = SMCP_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+smcp_status_t
+smcp_plat_uring_submit(smcp_t self)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	smcp_status_t ret = SMCP_STATUS_OK;
+	int submitted;
+
+	require_quiet(uring->sq_pending > 0, bail);
+
+	submitted = sys_io_uring_enter(uring->fd, uring->sq_pending, 0, 0);
+
+	if (submitted < 0) {
+		if ((errno == EAGAIN) || (errno == EBUSY)) {
+			// The requests stay in the ring until next time.
+			ret = SMCP_STATUS_QUEUE_FULL;
+		} else {
+			ret = SMCP_STATUS_ERRNO;
+		}
+		goto bail;
+	}
+
+	uring->sq_pending -= (unsigned)submitted;
+
+	if (uring->sq_pending == 0) {
+		uring->last_send_sqe = NULL;
+	}
+
+bail:
+	return ret;
+}
+
+// MARK: - Setup
+
+static void
+smcp_plat_uring_teardown(struct smcp_plat_uring_s* uring)
+{
+	int i;
+
+	if (uring->fd >= 0) {
+		close(uring->fd);
+		uring->fd = -1;
+	}
+
+	if (uring->buf_ring != NULL) {
+		munmap(uring->buf_ring, uring->buf_ring_size);
+		uring->buf_ring = NULL;
+	}
+
+	if (uring->sqes != NULL) {
+		munmap(uring->sqes, uring->sqes_size);
+		uring->sqes = NULL;
+	}
+
+	if (uring->ring_ptr != NULL) {
+		munmap(uring->ring_ptr, uring->ring_size);
+		uring->ring_ptr = NULL;
+	}
+
+	free(uring->buffers);
+	uring->buffers = NULL;
+
+	for (i = 0; i < SMCP_CONF_URING_SEND_SLOTS; i++) {
+		uring->sends[i].in_use = false;
+	}
+
+	uring->sq_pending = 0;
+	uring->last_send_sqe = NULL;
+	uring->send_current = -1;
+	uring->send_in_flight = 0;
+}
+
+smcp_status_t
+smcp_plat_uring_start(smcp_t self, int fd)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	smcp_status_t ret = SMCP_STATUS_ERRNO;
+	struct io_uring_params params = { };
+	struct io_uring_buf_reg reg = { };
+	size_t sq_size, cq_size;
+	void* ptr;
+	int i;
+
+	require_quiet(!uring->disabled, bail_ok);
+	require_quiet(uring->fd < 0, bail_ok);
+
+	// Every receive completion holds a buffer and every send
+	// completion holds a slot, so the completion queue can
+	// never overflow.
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	params.cq_entries = 2 * (SMCP_CONF_URING_RECV_BUFFERS + SMCP_CONF_URING_SEND_SLOTS);
+
+	uring->fd = sys_io_uring_setup(SMCP_CONF_URING_SEND_SLOTS + 2, &params);
+	require(uring->fd >= 0, bail);
+
+	require_action(
+		params.features & IORING_FEAT_SINGLE_MMAP,
+		bail,
+		errno = ENOTSUP
+	);
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->ring_size = MAX(sq_size, cq_size);
+
+	ptr = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	require(ptr != MAP_FAILED, bail);
+	uring->ring_ptr = ptr;
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	require(ptr != MAP_FAILED, bail);
+	uring->sqes = ptr;
+
+	uring->sq_head = (unsigned*)((char*)uring->ring_ptr + params.sq_off.head);
+	uring->sq_tail = (unsigned*)((char*)uring->ring_ptr + params.sq_off.tail);
+	uring->sq_flags = (unsigned*)((char*)uring->ring_ptr + params.sq_off.flags);
+	uring->sq_array = (unsigned*)((char*)uring->ring_ptr + params.sq_off.array);
+	uring->sq_mask = *(unsigned*)((char*)uring->ring_ptr + params.sq_off.ring_mask);
+	uring->cq_head = (unsigned*)((char*)uring->ring_ptr + params.cq_off.head);
+	uring->cq_tail = (unsigned*)((char*)uring->ring_ptr + params.cq_off.tail);
+	uring->cq_mask = *(unsigned*)((char*)uring->ring_ptr + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*)((char*)uring->ring_ptr + params.cq_off.cqes);
+
+	// Set up and register the receive buffers.
+	uring->buffers = malloc((size_t)SMCP_CONF_URING_RECV_BUFFERS * URING_RECV_BUFFER_STRIDE);
+	require_action(uring->buffers != NULL, bail, errno = ENOMEM);
+
+	uring->buf_ring_size = SMCP_CONF_URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+	ptr = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	require(ptr != MAP_FAILED, bail);
+	uring->buf_ring = ptr;
+
+	reg.ring_addr = (uintptr_t)uring->buf_ring;
+	reg.ring_entries = SMCP_CONF_URING_RECV_BUFFERS;
+	reg.bgid = 0;
+
+	require(sys_io_uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0, bail);
+
+	for (i = 0; i < SMCP_CONF_URING_RECV_BUFFERS; i++) {
+		smcp_plat_uring_recycle_buffer(uring, (uint16_t)i);
+	}
+
+	// Layout of each receive buffer: the kernel only looks at
+	// the name and control lengths of this header.
+	memset(&uring->recv_msg, 0, sizeof(uring->recv_msg));
+	uring->recv_msg.msg_namelen = URING_RECV_NAME_LEN;
+	uring->recv_msg.msg_controllen = URING_RECV_CONTROL_LEN;
+
+	require_action(
+		smcp_plat_uring_arm_recv(self, fd) == SMCP_STATUS_OK,
+		bail,
+		errno = ENOSPC
+	);
+
+	require_action(
+		sys_io_uring_enter(uring->fd, uring->sq_pending, 0, 0) >= 0,
+		bail,
+		uring->sq_pending = 0
+	);
+
+	uring->sq_pending = 0;
+
+	DEBUG_PRINTF("smcp(%p): Using io_uring for fd %d", self, fd);
+
+bail_ok:
+	ret = SMCP_STATUS_OK;
+	return ret;
+
+bail:
+	{
+		int prev_errno = errno;
+		smcp_plat_uring_teardown(uring);
+		errno = prev_errno;
+	}
+	return ret;
+}
+
+// MARK: - Completions
+
+static void
+smcp_plat_uring_handle_recv(smcp_t self, int fd, int res, unsigned flags)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+
+	if (flags & IORING_CQE_F_BUFFER) {
+		const uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+		char* buffer = uring->buffers + (size_t)bid * URING_RECV_BUFFER_STRIDE;
+		struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buffer;
+		char* name = buffer + sizeof(*out);
+		char* control = name + uring->recv_msg.msg_namelen;
+		char* packet = control + uring->recv_msg.msg_controllen;
+
+		if ((res >= (int)sizeof(*out))
+			&& !(out->flags & MSG_TRUNC)
+			&& (out->payloadlen > 0)
+			&& (out->payloadlen <= SMCP_MAX_PACKET_LENGTH)
+		) {
+			struct msghdr msg = {
+				.msg_name = name,
+				.msg_namelen = out->namelen,
+				.msg_control = control,
+				.msg_controllen = out->controllen,
+			};
+
+			smcp_plat_process_datagram(self, fd, &msg, packet, (coap_size_t)out->payloadlen);
+		}
+
+		smcp_plat_uring_recycle_buffer(uring, bid);
+	} else if ((res < 0) && (res != -ENOBUFS)) {
+		DEBUG_PRINTF("smcp(%p): io_uring recvmsg: %s", self, strerror(-res));
+
+		if (!(flags & IORING_CQE_F_MORE) && (res != -EINTR)) {
+			// Most likely the kernel doesn't support multishot
+			// recvmsg. Fall back to poll() from now on.
+			smcp_plat_uring_finalize(self);
+			return;
+		}
+	}
+
+	if (!(flags & IORING_CQE_F_MORE) && (fd == self->plat.fd_udp)) {
+		// The multishot request has ended. Running out of
+		// buffers (ENOBUFS) is the usual reason.
+		smcp_plat_uring_arm_recv(self, fd);
+	}
+}
+
+static void
+smcp_plat_uring_handle_send(smcp_t self, int slot, int res)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+
+	require(slot >= 0 && slot < SMCP_CONF_URING_SEND_SLOTS, bail);
+	require(uring->sends[slot].in_use, bail);
+
+	uring->sends[slot].in_use = false;
+	uring->send_in_flight--;
+
+	if (res < 0) {
+		DEBUG_PRINTF("smcp(%p): io_uring sendmsg: %s", self, strerror(-res));
+	}
+
+bail:
+	return;
+}
+
+//!	Handles the completions that are ready now.
+/*!	Returns the number handled. If `sends_only` is true, receive
+**	completions are dropped instead of being processed. */
+static int
+smcp_plat_uring_reap(smcp_t self, bool sends_only)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	unsigned head = *uring->cq_head;
+	// Only what is already there, so that a flood of
+	// packets can't keep us here forever.
+	const unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	int count = 0;
+
+	while (head != tail) {
+		const struct io_uring_cqe* cqe = &uring->cqes[head & uring->cq_mask];
+		const uint64_t user_data = cqe->user_data;
+		const int res = cqe->res;
+		const unsigned flags = cqe->flags;
+
+		__atomic_store_n(uring->cq_head, ++head, __ATOMIC_RELEASE);
+		count++;
+
+		switch (user_data >> 32) {
+		case URING_TAG_RECV:
+			if (sends_only) {
+				if (flags & IORING_CQE_F_BUFFER) {
+					smcp_plat_uring_recycle_buffer(uring, (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+				}
+			} else {
+				smcp_plat_uring_handle_recv(self, (int)(uint32_t)user_data, res, flags);
+
+				if (uring->fd < 0) {
+					// We fell back to poll().
+					return count;
+				}
+			}
+			break;
+
+		case URING_TAG_SEND:
+			smcp_plat_uring_handle_send(self, (int)(uint32_t)user_data, res);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return count;
+}
+
+smcp_status_t
+smcp_plat_uring_process(smcp_t self)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+
+	if (__atomic_load_n(uring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+		// Have the kernel move the overflowed completions back in.
+		sys_io_uring_enter(uring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+	}
+
+	// Whatever the handlers send is submitted together
+	// once all of the completions have been handled.
+	uring->dispatching = true;
+	smcp_plat_uring_reap(self, false);
+	uring->dispatching = false;
+
+	if (uring->fd < 0) {
+		// We fell back to poll().
+		return SMCP_STATUS_OK;
+	}
+
+	return smcp_plat_uring_submit(self);
+}
+
+smcp_status_t
+smcp_plat_uring_wait(smcp_t self, smcp_cms_t cms)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	smcp_status_t ret = SMCP_STATUS_OK;
+	struct pollfd polls[2] = {
+		{ uring->fd, POLLIN, 0 },
+#if SMCP_CONF_SUBMIT_QUEUE
+		{ smcp_submit_get_fd(self), POLLIN, 0 },
+#endif
+	};
+	int descriptors_ready;
+
+	smcp_plat_uring_submit(self);
+
+	require_quiet(
+		*uring->cq_head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE),
+		bail
+	);
+
+	errno = 0;
+
+#if SMCP_CONF_SUBMIT_QUEUE
+	descriptors_ready = poll(polls, 2, cms);
+#else
+	descriptors_ready = poll(polls, 1, cms);
+#endif
+
+	// Ensure that poll did not fail with an error.
+	require_action_string(descriptors_ready != -1,
+		bail,
+		ret = SMCP_STATUS_ERRNO,
+		strerror(errno)
+	);
+
+	if (descriptors_ready == 0) {
+		ret = SMCP_STATUS_TIMEOUT;
+	}
+
+#if SMCP_CONF_SUBMIT_QUEUE
+	if (polls[1].revents) {
+		smcp_submit_clear_wakeup(self);
+	}
+#endif
+
+bail:
+	return ret;
+}
+
+void
+smcp_plat_uring_finalize(smcp_t self)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+
+	require_quiet(uring->fd >= 0, bail);
+
+	smcp_plat_uring_submit(self);
+
+	// Give the packets that are still in flight a chance to go out.
+	while (uring->send_in_flight > 0) {
+		struct pollfd pollee = { uring->fd, POLLIN, 0 };
+
+		if (poll(&pollee, 1, URING_FINALIZE_TIMEOUT_MSEC) <= 0) {
+			break;
+		}
+
+		smcp_plat_uring_reap(self, true);
+	}
+
+	smcp_plat_uring_teardown(uring);
+
+bail:
+	return;
+}
+
+// MARK: - Outbound
+
+char*
+smcp_plat_uring_outbound_start(smcp_t self)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	int i;
+
+	// A packet that was started but never finished
+	// leaves its slot free for the next one.
+	if ((uring->send_current >= 0) && !uring->sends[uring->send_current].in_use) {
+		return uring->sends[uring->send_current].packet;
+	}
+
+	for (i = 0; i < SMCP_CONF_URING_SEND_SLOTS; i++) {
+		if (!uring->sends[i].in_use) {
+			uring->send_current = i;
+			return uring->sends[i].packet;
+		}
+	}
+
+	uring->send_current = -1;
+	return NULL;
+}
+
+bool
+smcp_plat_uring_owns_packet(smcp_t self, const uint8_t* data_ptr)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+
+	return (uring->send_current >= 0)
+		&& (data_ptr == (const uint8_t*)uring->sends[uring->send_current].packet);
+}
+
+smcp_status_t
+smcp_plat_uring_outbound_finish(smcp_t self, const uint8_t* data_ptr, coap_size_t data_len)
+{
+	struct smcp_plat_uring_s* const uring = &self->plat.uring;
+	smcp_status_t ret = SMCP_STATUS_FAILURE;
+	const int index = uring->send_current;
+	struct smcp_plat_uring_send_s* const slot = &uring->sends[index];
+	struct io_uring_sqe* sqe;
+	socklen_t cmbuf_len;
+
+	require(data_len <= SMCP_MAX_PACKET_LENGTH, bail);
+
+	sqe = smcp_plat_uring_get_sqe(uring);
+
+	if (sqe == NULL) {
+		ret = smcp_plat_uring_submit(self);
+		require_noerr(ret, bail);
+		sqe = smcp_plat_uring_get_sqe(uring);
+		require_action(sqe != NULL, bail, ret = SMCP_STATUS_QUEUE_FULL);
+	}
+
+	uring->send_current = -1;
+
+	slot->sockaddr_remote = *smcp_plat_get_remote_sockaddr();
+	slot->iov.iov_base = slot->packet;
+	slot->iov.iov_len = data_len;
+
+	cmbuf_len = smcp_plat_fill_pktinfo(
+		slot->cmbuf,
+		sizeof(slot->cmbuf),
+		(const struct sockaddr*)&slot->sockaddr_remote,
+		(const struct sockaddr*)smcp_plat_get_local_sockaddr(),
+		sizeof(smcp_sockaddr_t)
+	);
+
+	memset(&slot->msg, 0, sizeof(slot->msg));
+	slot->msg.msg_name = &slot->sockaddr_remote;
+	slot->msg.msg_namelen = sizeof(slot->sockaddr_remote);
+	slot->msg.msg_iov = &slot->iov;
+	slot->msg.msg_iovlen = 1;
+	slot->msg.msg_control = cmbuf_len ? slot->cmbuf : NULL;
+	slot->msg.msg_controllen = cmbuf_len;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = self->plat.fd_udp;
+	sqe->addr = (uintptr_t)&slot->msg;
+	sqe->len = 1;
+	sqe->user_data = URING_USER_DATA(URING_TAG_SEND, index);
+
+	// Keep packets that are submitted together in order. A hard
+	// link doesn't cancel the rest of the chain if one send fails.
+	if (uring->last_send_sqe != NULL) {
+		uring->last_send_sqe->flags |= IOSQE_IO_HARDLINK;
+	}
+	uring->last_send_sqe = sqe;
+
+	smcp_plat_uring_commit_sqe(uring);
+
+	slot->in_use = true;
+	uring->send_in_flight++;
+
+	ret = SMCP_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+#endif // SMCP_USE_BSD_SOCKETS && SMCP_BSD_SOCKETS_USE_URING
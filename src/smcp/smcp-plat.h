@@ -179,6 +179,8 @@ SMCP_API_EXTERN smcp_session_type_t smcp_plat_get_session_type(void);
 struct pollfd;
 
 //! Support for `poll()` style asynchronous operation
+/*!	Fills in up to `maxfds` entries and returns the number
+**	of descriptors that the instance needs polled. */
 SMCP_API_EXTERN int smcp_plat_update_pollfds(
 	smcp_t self,
 	struct pollfd *fds,
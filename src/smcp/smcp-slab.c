@@ -0,0 +1,491 @@
+/*!	@file smcp-slab.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Per-instance Slab Allocator
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*	Every object starts with a small header that says which slab it
+**	came from and which size class it belongs to, so that it can be
+**	freed without knowing which instance it was allocated for. Objects
+**	that came from the heap have a header with a NULL slab.
+**
+**	The free lists and the statistics are only ever touched by the
+**	thread running the event loop of the instance that owns the slab,
+**	which is whichever thread has it as its current instance. Any
+**	other thread that frees an object pushes it onto a separate list
+**	with a compare-and-swap, and the owner takes that whole list back
+**	the next time it allocates, the same way the submit queue works.
+**
+**	A slab that still has live objects when its instance is released
+**	is left behind instead of being torn down, and counts down the
+**	objects that are freed after that. Whoever frees the last one
+**	tears it down. Its list of remotely freed objects is closed off
+**	with a marker in the same compare-and-swap, so an object can't be
+**	pushed onto it after nobody is going to take it back off.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#include "assert-macros.h"
+#include "smcp.h"
+
+#if SMCP_CONF_SLAB
+
+#include "smcp-internal.h"
+#include "smcp-logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define SMCP_SLAB_MIN_SHIFT			(6)
+#define SMCP_SLAB_CLASS_LARGE		(SMCP_SLAB_CLASS_COUNT)
+
+//! Value of `remote_free` once the instance has been released.
+#define SMCP_SLAB_ORPHANED			((struct smcp_slab_free_s*)1)
+
+//! Sixteen bytes, so that objects are as aligned as malloc() would make them.
+struct smcp_slab_header_s {
+	struct smcp_slab_s* slab;
+	uint32_t size_class;
+} __attribute__((aligned(16)));
+
+//! Overlays the object of a freed allocation.
+struct smcp_slab_free_s {
+	struct smcp_slab_header_s header;
+	struct smcp_slab_free_s* next;
+};
+
+struct smcp_slab_chunk_s {
+	struct smcp_slab_chunk_s* next;
+	size_t size;
+} __attribute__((aligned(16)));
+
+struct smcp_slab_class_s {
+	struct smcp_slab_free_s* free_list;
+
+	// Part of the newest chunk that hasn't been handed out yet.
+	// Objects are carved out of it one after the other.
+	uint8_t* unused;
+	uint8_t* unused_end;
+
+	uint32_t live;
+	uint32_t peak;
+	uint32_t failed;
+};
+
+struct smcp_slab_s {
+	smcp_t owner;
+	struct smcp_slab_free_s* remote_free;
+	struct smcp_slab_chunk_s* chunks;
+	size_t reserved;
+	size_t limit;
+	uint32_t live;
+	uint32_t peak;
+	uint32_t failed;
+	uint32_t large;
+
+	// Objects that were still allocated when the instance was
+	// released, plus one while smcp_slab_finalize() is running.
+	uint32_t orphans;
+
+	struct smcp_slab_class_s classes[SMCP_SLAB_CLASS_COUNT];
+};
+
+// MARK: -
+// MARK: Chunks
+
+static void*
+smcp_slab_map_(size_t size)
+{
+	void* ret = NULL;
+
+#if HAVE_SYS_MMAN_H
+#if SMCP_CONF_SLAB_HUGEPAGES && defined(MAP_HUGETLB)
+	ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+
+	if (ret != MAP_FAILED) {
+		return ret;
+	}
+#endif
+
+	ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if (ret == MAP_FAILED) {
+		return NULL;
+	}
+
+#if SMCP_CONF_SLAB_HUGEPAGES && defined(MADV_HUGEPAGE)
+	// No reserved huge pages, so let the kernel use transparent ones.
+	(void)madvise(ret, size, MADV_HUGEPAGE);
+#endif
+#else
+	ret = malloc(size);
+#endif
+
+	return ret;
+}
+
+static void
+smcp_slab_unmap_(void* ptr, size_t size)
+{
+#if HAVE_SYS_MMAN_H
+	munmap(ptr, size);
+#else
+	free(ptr);
+#endif
+}
+
+static bool
+smcp_slab_grow_(struct smcp_slab_s* slab, struct smcp_slab_class_s* class)
+{
+	struct smcp_slab_chunk_s* chunk;
+	const size_t size = SMCP_CONF_SLAB_CHUNK_SIZE;
+
+	if (slab->limit != 0 && slab->reserved + size > slab->limit) {
+		return false;
+	}
+
+	chunk = smcp_slab_map_(size);
+
+	if (chunk == NULL) {
+		return false;
+	}
+
+	chunk->next = slab->chunks;
+	chunk->size = size;
+	slab->chunks = chunk;
+	slab->reserved += size;
+
+	// Whatever was left of the previous chunk is too
+	// small for this class, so it is simply abandoned.
+	class->unused = (uint8_t*)(chunk + 1);
+	class->unused_end = (uint8_t*)chunk + size;
+
+	DEBUG_PRINTF("slab %p: reserved %d bytes (%d total)", slab, (int)size, (int)slab->reserved);
+
+	return true;
+}
+
+static void
+smcp_slab_destroy_(struct smcp_slab_s* slab)
+{
+	struct smcp_slab_chunk_s* chunk;
+
+	while ((chunk = slab->chunks) != NULL) {
+		slab->chunks = chunk->next;
+		smcp_slab_unmap_(chunk, chunk->size);
+	}
+
+	free(slab);
+}
+
+// MARK: -
+// MARK: Bookkeeping
+
+static uint32_t
+smcp_slab_class_for_size_(size_t size)
+{
+	uint32_t ret = 0;
+
+	size += sizeof(struct smcp_slab_header_s);
+
+	while (((size_t)1 << (ret + SMCP_SLAB_MIN_SHIFT)) < size) {
+		if (++ret == SMCP_SLAB_CLASS_COUNT) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+static void
+smcp_slab_release_(struct smcp_slab_s* slab, struct smcp_slab_free_s* item)
+{
+	struct smcp_slab_class_s* const class = &slab->classes[item->header.size_class];
+
+	item->next = class->free_list;
+	class->free_list = item;
+	class->live--;
+	slab->live--;
+}
+
+static void
+smcp_slab_drain_remote_(struct smcp_slab_s* slab)
+{
+	struct smcp_slab_free_s* item;
+
+	item = __atomic_exchange_n(&slab->remote_free, NULL, __ATOMIC_ACQUIRE);
+
+	while (item != NULL) {
+		struct smcp_slab_free_s* const next = item->next;
+		smcp_slab_release_(slab, item);
+		item = next;
+	}
+}
+
+static void*
+smcp_slab_alloc_large_(size_t size)
+{
+	struct smcp_slab_header_s* header;
+
+	header = calloc(1, sizeof(*header) + size);
+
+	if (header == NULL) {
+		return NULL;
+	}
+
+	header->slab = NULL;
+	header->size_class = SMCP_SLAB_CLASS_LARGE;
+
+	return header + 1;
+}
+
+// MARK: -
+// MARK: Internal API
+
+smcp_status_t
+smcp_slab_init(smcp_t self)
+{
+	struct smcp_slab_s* slab;
+
+	slab = calloc(1, sizeof(*slab));
+
+	if (slab == NULL) {
+		return SMCP_STATUS_MALLOC_FAILURE;
+	}
+
+	slab->owner = self;
+	self->slab = slab;
+
+	return SMCP_STATUS_OK;
+}
+
+void
+smcp_slab_finalize(smcp_t self)
+{
+	struct smcp_slab_s* const slab = self->slab;
+	struct smcp_slab_free_s* item;
+
+	if (slab == NULL) {
+		return;
+	}
+
+	self->slab = NULL;
+
+	smcp_slab_drain_remote_(slab);
+
+	// From here on, every free counts down the orphans.
+	__atomic_store_n(&slab->orphans, slab->live + 1, __ATOMIC_RELAXED);
+
+	// Anything another thread freed since the drain. Every free
+	// after this sees the marker instead of pushing.
+	item = __atomic_exchange_n(&slab->remote_free, SMCP_SLAB_ORPHANED, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&slab->owner, NULL, __ATOMIC_RELEASE);
+
+	while (item != NULL) {
+		item = item->next;
+		__atomic_sub_fetch(&slab->orphans, 1, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_sub_fetch(&slab->orphans, 1, __ATOMIC_ACQ_REL) == 0) {
+		smcp_slab_destroy_(slab);
+	} else {
+		DEBUG_PRINTF("slab %p: %d objects outlived their instance", slab, (int)slab->orphans);
+	}
+}
+
+void*
+smcp_slab_alloc(smcp_t self, size_t size)
+{
+	struct smcp_slab_s* slab;
+	struct smcp_slab_class_s* class;
+	struct smcp_slab_free_s* item;
+	const uint32_t size_class = smcp_slab_class_for_size_(size);
+	const size_t class_size = (size_t)1 << (size_class + SMCP_SLAB_MIN_SHIFT);
+
+	if ( self == NULL
+	  || self->slab == NULL
+	  || self != smcp_get_current_instance()
+	) {
+		// Only the thread running the event loop may touch the slab.
+		return smcp_slab_alloc_large_(size);
+	}
+
+	slab = self->slab;
+
+	if (size_class == SMCP_SLAB_CLASS_LARGE) {
+		slab->large++;
+		return smcp_slab_alloc_large_(size);
+	}
+
+	if (__atomic_load_n(&slab->remote_free, __ATOMIC_RELAXED) != NULL) {
+		smcp_slab_drain_remote_(slab);
+	}
+
+	class = &slab->classes[size_class];
+
+	if (class->free_list != NULL) {
+		item = class->free_list;
+		class->free_list = item->next;
+
+	} else {
+		if ( (size_t)(class->unused_end - class->unused) < class_size
+		  && !smcp_slab_grow_(slab, class)
+		) {
+			class->failed++;
+			slab->failed++;
+			return NULL;
+		}
+
+		item = (struct smcp_slab_free_s*)class->unused;
+		class->unused += class_size;
+		item->header.slab = slab;
+		item->header.size_class = size_class;
+	}
+
+	if (++class->live > class->peak) {
+		class->peak = class->live;
+	}
+
+	if (++slab->live > slab->peak) {
+		slab->peak = slab->live;
+	}
+
+	memset(&item->header + 1, 0, size);
+
+	return &item->header + 1;
+}
+
+void
+smcp_slab_free(void* ptr)
+{
+	struct smcp_slab_header_s* header;
+	struct smcp_slab_s* slab;
+	struct smcp_slab_free_s* item;
+	struct smcp_slab_free_s* head;
+	smcp_t owner;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	header = (struct smcp_slab_header_s*)ptr - 1;
+	slab = header->slab;
+
+	if (slab == NULL) {
+		free(header);
+		return;
+	}
+
+	item = (struct smcp_slab_free_s*)header;
+
+	owner = __atomic_load_n(&slab->owner, __ATOMIC_ACQUIRE);
+
+	if ((owner != NULL) && (owner == smcp_get_current_instance())) {
+		smcp_slab_release_(slab, item);
+		return;
+	}
+
+	head = __atomic_load_n(&slab->remote_free, __ATOMIC_ACQUIRE);
+
+	do {
+		if (head == SMCP_SLAB_ORPHANED) {
+			// The instance is gone, so nothing will ever reuse this.
+			if (__atomic_sub_fetch(&slab->orphans, 1, __ATOMIC_ACQ_REL) == 0) {
+				smcp_slab_destroy_(slab);
+			}
+			return;
+		}
+		item->next = head;
+	} while (!__atomic_compare_exchange_n(
+		&slab->remote_free,
+		&head,
+		item,
+		true,
+		__ATOMIC_RELEASE,
+		__ATOMIC_ACQUIRE
+	));
+}
+
+// MARK: -
+// MARK: Public API
+
+smcp_status_t
+smcp_slab_get_stats(smcp_t self, struct smcp_slab_stats_s* stats)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+	struct smcp_slab_s* slab;
+	smcp_status_t ret = SMCP_STATUS_INVALID_ARGUMENT;
+	uint32_t i;
+
+	require(self != NULL, bail);
+	require(stats != NULL, bail);
+
+	slab = self->slab;
+
+	require(slab != NULL, bail);
+
+	stats->reserved = slab->reserved;
+	stats->limit = slab->limit;
+	stats->live = slab->live;
+	stats->peak = slab->peak;
+	stats->failed = slab->failed;
+	stats->large = slab->large;
+
+	for (i = 0; i < SMCP_SLAB_CLASS_COUNT; i++) {
+		stats->classes[i].size = ((size_t)1 << (i + SMCP_SLAB_MIN_SHIFT)) - sizeof(struct smcp_slab_header_s);
+		stats->classes[i].live = slab->classes[i].live;
+		stats->classes[i].peak = slab->classes[i].peak;
+		stats->classes[i].failed = slab->classes[i].failed;
+	}
+
+	ret = SMCP_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+void
+smcp_slab_set_limit(smcp_t self, size_t limit)
+{
+	SMCP_EMBEDDED_SELF_HOOK;
+
+	if (self->slab != NULL) {
+		self->slab->limit = limit;
+	}
+}
+
+#endif // SMCP_CONF_SLAB
@@ -0,0 +1,114 @@
+/*!	@file smcp-slab.h
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Per-instance Slab Allocator
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SMCP_smcp_slab_h
+#define SMCP_smcp_slab_h
+
+#include "smcp.h"
+
+#if SMCP_CONF_SLAB
+
+__BEGIN_DECLS
+
+/*!	@addtogroup smcp
+**	@{
+*/
+
+/*!	@defgroup smcp_slab Slab allocator API
+**	@{
+**	@brief Inspecting and bounding the memory an instance allocates.
+**
+**	Transactions and other short-lived objects that the library
+**	allocates while an instance is handling traffic come from a slab
+**	allocator that belongs to that instance. Objects are grouped into
+**	size classes of powers of two, and freed objects are kept on a
+**	free list for their class and handed out again, so once an
+**	instance has seen its busiest moment it stops calling malloc()
+**	for them entirely.
+**
+**	Objects that are allocated when no instance is current, like a
+**	transaction begun before the event loop starts, come from the
+**	heap as usual. Nodes always come from the heap, since they are
+**	owned by the application and usually outlive the instance.
+*/
+
+//! Number of size classes, starting at 64 bytes and doubling each time.
+#define SMCP_SLAB_CLASS_COUNT		(7)
+
+struct smcp_slab_class_stats_s {
+	//! Largest object that fits into this class, in bytes.
+	size_t size;
+
+	//! Number of objects currently allocated.
+	uint32_t live;
+
+	//! Largest value `live` has ever had.
+	uint32_t peak;
+
+	//! Number of allocations that failed because of the limit.
+	uint32_t failed;
+};
+
+struct smcp_slab_stats_s {
+	//! Bytes of memory set aside for objects, whether in use or not.
+	size_t reserved;
+
+	//! Most bytes that may be reserved, or zero if there is no limit.
+	size_t limit;
+
+	//! Totals across all of the size classes.
+	uint32_t live;
+	uint32_t peak;
+	uint32_t failed;
+
+	//! Allocations too big for any size class, which came from the heap.
+	uint32_t large;
+
+	struct smcp_slab_class_stats_s classes[SMCP_SLAB_CLASS_COUNT];
+};
+
+//!	Fills out `stats` with the allocation statistics of `self`.
+/*!	Objects that were freed by other threads are only accounted
+**	for once the event loop of the instance has run again. */
+SMCP_API_EXTERN smcp_status_t smcp_slab_get_stats(smcp_t self, struct smcp_slab_stats_s* stats);
+
+//!	Limits how many bytes the slab of `self` may reserve.
+/*!	Once the limit is reached, allocations from a size class with
+**	an empty free list fail instead of reserving more memory. Zero
+**	means no limit. Memory that is already reserved is kept. */
+SMCP_API_EXTERN void smcp_slab_set_limit(smcp_t self, size_t limit);
+
+/*!	@} */
+/*!	@} */
+
+__END_DECLS
+
+#endif // SMCP_CONF_SLAB
+
+#endif
@@ -0,0 +1,519 @@
+/*!	@file smcp-submit.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Cross-thread Request Submission
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*	Both the submission queue of an instance and the completion
+**	queues are intrusive lists of submissions that any number of
+**	threads push onto with a compare-and-swap, and that a single
+**	thread empties all at once by swapping the head out for NULL.
+**	Since nothing is ever removed from the middle, there is no ABA
+**	problem to worry about. Whoever makes the list non-empty also
+**	pokes an eventfd (or a pipe, where there is no eventfd), which
+**	is what the consuming thread waits on.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "assert-macros.h"
+#include "smcp.h"
+
+#if SMCP_CONF_SUBMIT_QUEUE
+
+#include "smcp-internal.h"
+#include "smcp-logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+struct smcp_completion_queue_s {
+	struct smcp_submit_queue_s queue;
+};
+
+// MARK: -
+// MARK: Queue Primitives
+
+static smcp_status_t
+smcp_submit_queue_init_(struct smcp_submit_queue_s* queue)
+{
+	smcp_status_t ret = SMCP_STATUS_ERRNO;
+
+	queue->head = NULL;
+	queue->fd_read = -1;
+	queue->fd_write = -1;
+
+#if HAVE_SYS_EVENTFD_H
+	queue->fd_read = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	require(queue->fd_read >= 0, bail);
+	queue->fd_write = queue->fd_read;
+#else
+	{
+		int fds[2];
+
+		require(pipe(fds) == 0, bail);
+
+		queue->fd_read = fds[0];
+		queue->fd_write = fds[1];
+
+		fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	ret = SMCP_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+static void
+smcp_submit_queue_finalize_(struct smcp_submit_queue_s* queue)
+{
+	if (queue->fd_write >= 0 && queue->fd_write != queue->fd_read) {
+		close(queue->fd_write);
+	}
+	if (queue->fd_read >= 0) {
+		close(queue->fd_read);
+	}
+	queue->fd_read = -1;
+	queue->fd_write = -1;
+}
+
+static void
+smcp_submit_queue_push_(struct smcp_submit_queue_s* queue, struct smcp_submission_s* submission)
+{
+	struct smcp_submission_s* head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+	do {
+		submission->next = head;
+	} while (!__atomic_compare_exchange_n(
+		&queue->head,
+		&head,
+		submission,
+		true,
+		__ATOMIC_RELEASE,
+		__ATOMIC_RELAXED
+	));
+
+	if (head == NULL) {
+		// The consumer may be asleep. Anyone pushing after us
+		// knows that it has already been woken up.
+#if HAVE_SYS_EVENTFD_H
+		const uint64_t one = 1;
+#else
+		const uint8_t one = 1;
+#endif
+		ssize_t len = write(queue->fd_write, &one, sizeof(one));
+
+		// If the pipe is full, the consumer is awake anyway.
+		(void)len;
+	}
+}
+
+//! Clears the wakeup. Must come before smcp_submit_queue_take_().
+static void
+smcp_submit_queue_clear_(struct smcp_submit_queue_s* queue)
+{
+#if HAVE_SYS_EVENTFD_H
+	// Reading an eventfd resets its counter.
+	uint64_t count;
+	ssize_t len = read(queue->fd_read, &count, sizeof(count));
+
+	(void)len;
+#else
+	uint8_t buffer[64];
+
+	while (read(queue->fd_read, buffer, sizeof(buffer)) > 0) {
+	}
+#endif
+}
+
+//! Takes everything off of the queue, in the order it was pushed.
+static struct smcp_submission_s*
+smcp_submit_queue_take_(struct smcp_submit_queue_s* queue)
+{
+	struct smcp_submission_s* list = NULL;
+	struct smcp_submission_s* iter;
+
+	if (__atomic_load_n(&queue->head, __ATOMIC_RELAXED) == NULL) {
+		return NULL;
+	}
+
+	iter = __atomic_exchange_n(&queue->head, NULL, __ATOMIC_ACQUIRE);
+
+	// The list was built backwards.
+	while (iter != NULL) {
+		struct smcp_submission_s* const next = iter->next;
+		iter->next = list;
+		list = iter;
+		iter = next;
+	}
+
+	return list;
+}
+
+static smcp_status_t
+smcp_submit_queue_wait_(struct smcp_submit_queue_s* queue, smcp_cms_t cms)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	struct pollfd pollee = { queue->fd_read, POLLIN, 0 };
+	int descriptors_ready;
+
+	require_quiet(__atomic_load_n(&queue->head, __ATOMIC_RELAXED) == NULL, bail);
+
+	errno = 0;
+
+	descriptors_ready = poll(&pollee, 1, cms);
+
+	// Ensure that poll did not fail with an error.
+	require_action_string(descriptors_ready != -1,
+		bail,
+		ret = SMCP_STATUS_ERRNO,
+		strerror(errno)
+	);
+
+	if (descriptors_ready == 0) {
+		ret = SMCP_STATUS_TIMEOUT;
+	}
+
+bail:
+	return ret;
+}
+
+// MARK: -
+// MARK: Event Loop Side
+
+static void
+smcp_submission_finish_(struct smcp_submission_s* submission)
+{
+	if (submission->completion_queue != NULL) {
+		smcp_submit_queue_push_(&submission->completion_queue->queue, submission);
+	} else if (submission->callback != NULL) {
+		(*submission->callback)(submission);
+	}
+}
+
+static smcp_status_t
+smcp_submission_resend_(void* context)
+{
+	struct smcp_submission_s* const submission = context;
+	smcp_status_t ret;
+
+	if (submission->async_response != NULL) {
+		ret = smcp_outbound_begin_async_response(
+			submission->method,
+			submission->async_response
+		);
+		require_noerr(ret, bail);
+
+	} else {
+		ret = smcp_outbound_begin(
+			smcp_get_current_instance(),
+			submission->method,
+			COAP_TRANS_TYPE_CONFIRMABLE
+		);
+		require_noerr(ret, bail);
+
+		ret = smcp_outbound_set_uri(submission->uri, 0);
+		require_noerr(ret, bail);
+	}
+
+	if (submission->content_len != 0) {
+		if (submission->content_type != COAP_CONTENT_TYPE_UNKNOWN) {
+			ret = smcp_outbound_add_option_uint(
+				COAP_OPTION_CONTENT_TYPE,
+				submission->content_type
+			);
+			require_noerr(ret, bail);
+		}
+
+		ret = smcp_outbound_append_content(
+			(const char*)submission->content,
+			submission->content_len
+		);
+		require_noerr(ret, bail);
+	}
+
+	ret = smcp_outbound_send();
+
+bail:
+	if (ret == SMCP_STATUS_HOST_LOOKUP_FAILURE) {
+		ret = SMCP_STATUS_WAIT_FOR_DNS;
+	}
+	return ret;
+}
+
+static smcp_status_t
+smcp_submission_response_(int statuscode, void* context)
+{
+	struct smcp_submission_s* const submission = context;
+
+	if (statuscode == SMCP_STATUS_TRANSACTION_INVALIDATED) {
+		// The transaction belongs to the library, so it is
+		// safe to hand the submission back from in here.
+		smcp_submission_finish_(submission);
+
+	} else if (statuscode < 0) {
+		submission->status = statuscode;
+
+	} else {
+		if (submission->status == SMCP_STATUS_TRANSACTION_INVALIDATED) {
+			// This is the first response.
+			submission->status = SMCP_STATUS_OK;
+		}
+
+		// An acknowledgement of an async response is empty.
+		submission->response_code = (coap_code_t)statuscode;
+
+		if (submission->response != NULL) {
+			// Block2 responses arrive one block at a time.
+			const coap_size_t content_len = smcp_inbound_get_content_len();
+			coap_size_t len = submission->response_max_len - submission->response_len;
+
+			if (len >= content_len) {
+				len = content_len;
+			} else {
+				submission->status = SMCP_STATUS_MESSAGE_TOO_BIG;
+			}
+
+			memcpy(
+				submission->response + submission->response_len,
+				smcp_inbound_get_content_ptr(),
+				len
+			);
+			submission->response_len += len;
+		}
+	}
+
+	return SMCP_STATUS_OK;
+}
+
+static void
+smcp_submission_begin_(smcp_t self, struct smcp_submission_s* submission)
+{
+	smcp_status_t ret = SMCP_STATUS_MALLOC_FAILURE;
+	smcp_transaction_t transaction;
+
+	if ( submission->async_response != NULL
+	  && submission->async_response->request.header.tt != COAP_TRANS_TYPE_CONFIRMABLE
+	) {
+		// Nothing is going to acknowledge the response,
+		// so there is no point in retransmitting it.
+		self->current_transaction = NULL;
+		submission->status = smcp_submission_resend_(submission);
+		smcp_submission_finish_(submission);
+		return;
+	}
+
+	// Stays this way until something comes back.
+	submission->status = SMCP_STATUS_TRANSACTION_INVALIDATED;
+
+	// The transaction has to end after the first response
+	// (or last block), so that the submission is finished.
+	transaction = smcp_transaction_init(
+		NULL,
+		SMCP_TRANSACTION_ALWAYS_INVALIDATE,
+		&smcp_submission_resend_,
+		&smcp_submission_response_,
+		(void*)submission
+	);
+
+	require(transaction != NULL, bail);
+
+	ret = smcp_transaction_begin(
+		self,
+		transaction,
+		submission->timeout ? submission->timeout : -1
+	);
+
+	if (ret != SMCP_STATUS_OK) {
+		// It never made it into the instance.
+		smcp_slab_free(transaction);
+	}
+
+bail:
+	if (ret != SMCP_STATUS_OK) {
+		submission->status = ret;
+		smcp_submission_finish_(submission);
+	}
+}
+
+smcp_status_t
+smcp_submit_init(smcp_t self)
+{
+	return smcp_submit_queue_init_(&self->submit_queue);
+}
+
+void
+smcp_submit_finalize(smcp_t self)
+{
+	struct smcp_submission_s* iter;
+
+	smcp_submit_queue_clear_(&self->submit_queue);
+
+	iter = smcp_submit_queue_take_(&self->submit_queue);
+
+	while (iter != NULL) {
+		struct smcp_submission_s* const next = iter->next;
+		iter->status = SMCP_STATUS_TRANSACTION_INVALIDATED;
+		smcp_submission_finish_(iter);
+		iter = next;
+	}
+
+	smcp_submit_queue_finalize_(&self->submit_queue);
+}
+
+int
+smcp_submit_get_fd(smcp_t self)
+{
+	return self->submit_queue.fd_read;
+}
+
+void
+smcp_submit_clear_wakeup(smcp_t self)
+{
+	smcp_submit_queue_clear_(&self->submit_queue);
+}
+
+void
+smcp_submit_process(smcp_t self)
+{
+	struct smcp_submission_s* iter = smcp_submit_queue_take_(&self->submit_queue);
+
+	if (iter != NULL) {
+		smcp_set_current_instance(self);
+	}
+
+	while (iter != NULL) {
+		struct smcp_submission_s* const next = iter->next;
+		smcp_submission_begin_(self, iter);
+		iter = next;
+	}
+}
+
+// MARK: -
+// MARK: Public API
+
+smcp_status_t
+smcp_submit(smcp_t self, struct smcp_submission_s* submission)
+{
+	smcp_status_t ret = SMCP_STATUS_INVALID_ARGUMENT;
+
+	require(submission != NULL, bail);
+	require((submission->uri != NULL) || (submission->async_response != NULL), bail);
+	require_action(self->submit_queue.fd_write >= 0, bail, ret = SMCP_STATUS_FAILURE);
+
+	submission->status = SMCP_STATUS_OK;
+	submission->response_code = 0;
+	submission->response_len = 0;
+
+	smcp_submit_queue_push_(&self->submit_queue, submission);
+
+	ret = SMCP_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+smcp_completion_queue_t
+smcp_completion_queue_create(void)
+{
+	smcp_completion_queue_t ret = calloc(1, sizeof(*ret));
+
+	require(ret != NULL, bail);
+
+	if (smcp_submit_queue_init_(&ret->queue) != SMCP_STATUS_OK) {
+		free(ret);
+		ret = NULL;
+	}
+
+bail:
+	return ret;
+}
+
+void
+smcp_completion_queue_release(smcp_completion_queue_t queue)
+{
+	require(queue != NULL, bail);
+
+	smcp_submit_queue_finalize_(&queue->queue);
+	free(queue);
+
+bail:
+	return;
+}
+
+int
+smcp_completion_queue_get_fd(smcp_completion_queue_t queue)
+{
+	return queue->queue.fd_read;
+}
+
+smcp_status_t
+smcp_completion_queue_wait(smcp_completion_queue_t queue, smcp_cms_t cms)
+{
+	return smcp_submit_queue_wait_(&queue->queue, cms);
+}
+
+int
+smcp_completion_queue_process(smcp_completion_queue_t queue)
+{
+	struct smcp_submission_s* iter;
+	int count = 0;
+
+	smcp_submit_queue_clear_(&queue->queue);
+
+	iter = smcp_submit_queue_take_(&queue->queue);
+
+	while (iter != NULL) {
+		// The callback may reuse or free the submission.
+		struct smcp_submission_s* const next = iter->next;
+
+		if (iter->callback != NULL) {
+			(*iter->callback)(iter);
+		}
+
+		iter = next;
+		count++;
+	}
+
+	return count;
+}
+
+#endif // SMCP_CONF_SUBMIT_QUEUE
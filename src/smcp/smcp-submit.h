@@ -0,0 +1,151 @@
+/*!	@file smcp-submit.h
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Cross-thread Request Submission
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SMCP_smcp_submit_h
+#define SMCP_smcp_submit_h
+
+#include "smcp.h"
+
+#if SMCP_CONF_SUBMIT_QUEUE
+
+__BEGIN_DECLS
+
+/*!	@addtogroup smcp
+**	@{
+*/
+
+/*!	@defgroup smcp_submit Cross-thread request submission API
+**	@{
+**	@brief Starting requests on an instance from other threads.
+**
+**	An SMCP instance may only be used from the thread that runs its
+**	event loop. Other threads can still issue requests through it by
+**	filling out a `struct smcp_submission_s` and handing it to
+**	smcp_submit(), which may be called from any thread at any time
+**	without taking a lock.
+**
+**	The event loop picks up everything that has been submitted
+**	since it last looked in smcp_plat_process(), and begins a
+**	transaction for each submission. Once the transaction is over,
+**	the results are stored in the submission and its callback is
+**	called. If the submission names a completion queue, the callback
+**	is called from smcp_completion_queue_process() on whichever thread
+**	processes that queue. Otherwise it is called on the event loop
+**	thread, and must not block.
+**
+**	A submission can also carry the response to a request that was
+**	answered with smcp_start_async_response(), which lets another
+**	thread finish an asynchronous response. Confirmable responses are
+**	retransmitted until they are acknowledged.
+**
+**	The submission, its URI, its content and its response buffer
+**	all belong to the library until the callback is called.
+*/
+
+struct smcp_submission_s;
+
+typedef struct smcp_completion_queue_s* smcp_completion_queue_t;
+
+typedef void (*smcp_submission_callback_func)(struct smcp_submission_s* submission);
+
+struct smcp_submission_s {
+	//! Request method, like `COAP_METHOD_GET`.
+	//! If `async_response` is set, this is the response code instead.
+	coap_code_t method;
+
+	//! Absolute URI of the resource. Ignored if `async_response` is set.
+	const char* uri;
+
+	//! Request to send a response to, instead of making a new request.
+	struct smcp_async_response_s* async_response;
+
+	//! Content of the request, if `content_len` isn't zero.
+	const void* content;
+	coap_size_t content_len;
+	coap_content_type_t content_type;
+
+	//! How long to keep trying, or zero for the default.
+	smcp_cms_t timeout;
+
+	//! Where to put the content of the response. May be NULL.
+	char* response;
+	coap_size_t response_max_len;
+
+	smcp_submission_callback_func callback;
+	void* context;
+
+	//! Queue to deliver the submission to once it is finished, or NULL.
+	smcp_completion_queue_t completion_queue;
+
+	//!	SMCP_STATUS_OK if a response (or an acknowledgement of
+	//!	`async_response`) was received, an error otherwise.
+	smcp_status_t status;
+
+	//! Code of the response, like `COAP_RESULT_205_CONTENT`.
+	coap_code_t response_code;
+
+	//! Number of bytes written into `response`.
+	coap_size_t response_len;
+
+	// Private
+	struct smcp_submission_s* next;
+};
+
+//!	Hands a request to the event loop of `self`. Thread-safe.
+/*!	The submission must be zeroed before its fields are filled out.
+**	Returns SMCP_STATUS_OK once the submission has been queued, after
+**	which its callback will always be called exactly once. */
+SMCP_API_EXTERN smcp_status_t smcp_submit(smcp_t self, struct smcp_submission_s* submission);
+
+//! Creates a queue that finished submissions can be delivered to.
+SMCP_API_EXTERN smcp_completion_queue_t smcp_completion_queue_create(void);
+
+//! Releases a completion queue. Nothing may still be delivered to it.
+SMCP_API_EXTERN void smcp_completion_queue_release(smcp_completion_queue_t queue);
+
+//! Returns a file descriptor that becomes readable when submissions are delivered.
+SMCP_API_EXTERN int smcp_completion_queue_get_fd(smcp_completion_queue_t queue);
+
+//!	Waits up to `cms` milliseconds for a submission to be delivered.
+/*!	Returns SMCP_STATUS_TIMEOUT if nothing was delivered in time. */
+SMCP_API_EXTERN smcp_status_t smcp_completion_queue_wait(smcp_completion_queue_t queue, smcp_cms_t cms);
+
+//!	Calls the callbacks of all of the submissions delivered so far.
+/*!	Returns the number of callbacks that were called. */
+SMCP_API_EXTERN int smcp_completion_queue_process(smcp_completion_queue_t queue);
+
+/*!	@} */
+
+/*!	@} */
+
+__END_DECLS
+
+#endif // SMCP_CONF_SUBMIT_QUEUE
+
+#endif
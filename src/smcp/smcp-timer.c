@@ -44,6 +44,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "smcp-timer.h"
 #include "smcp-logging.h"
@@ -57,25 +58,154 @@
 #define SMCP_MAX_TIMEOUT    (SMCP_CONF_MAX_TIMEOUT * MSEC_PER_SEC)
 #endif
 
+#if SMCP_CONF_TIMESTAMP_64BIT
+// 64-bit timestamps never wrap, so they can be compared directly.
+#define smcp_timestamp_before_(lhs, rhs)	((lhs) < (rhs))
+#else
+#define smcp_timestamp_before_(lhs, rhs)	(smcp_plat_timestamp_diff(lhs, rhs) < 0)
+#endif
+
+#if SMCP_TIMERS_USE_HEAP
+// MARK: -
+// MARK: Timer Heap
+
+// Timers are kept in a 4-ary min-heap ordered by fire date. A wider
+// heap is shallower than a binary one, which means fewer cache misses
+// when sifting down, at the cost of a few more comparisons per level.
+#define SMCP_TIMER_HEAP_ARITY		4
+#define SMCP_TIMER_HEAP_MIN_SIZE	16
+
+static bool
+smcp_timer_fires_before_(smcp_timer_t lhs, smcp_timer_t rhs) {
+	if (lhs->fire_date != rhs->fire_date) {
+		return smcp_timestamp_before_(lhs->fire_date, rhs->fire_date);
+	}
+
+	return (int32_t)(lhs->serial - rhs->serial) < 0;
+}
+
+static void
+smcp_timer_heap_place_(smcp_t self, smcp_timer_t timer, uint32_t i) {
+	self->timer_heap[i] = timer;
+	timer->heap_index = i + 1;
+}
+
+static void
+smcp_timer_heap_sift_up_(smcp_t self, smcp_timer_t timer, uint32_t i) {
+	while (i > 0) {
+		const uint32_t parent = (i - 1) / SMCP_TIMER_HEAP_ARITY;
+
+		if (!smcp_timer_fires_before_(timer, self->timer_heap[parent])) {
+			break;
+		}
+
+		smcp_timer_heap_place_(self, self->timer_heap[parent], i);
+		i = parent;
+	}
+
+	smcp_timer_heap_place_(self, timer, i);
+}
+
+static void
+smcp_timer_heap_sift_down_(smcp_t self, smcp_timer_t timer, uint32_t i) {
+	for (;;) {
+		const uint32_t first = i * SMCP_TIMER_HEAP_ARITY + 1;
+		const uint32_t last = MIN(first + SMCP_TIMER_HEAP_ARITY, self->timer_count);
+		uint32_t child, best;
+
+		if (first >= self->timer_count) {
+			break;
+		}
+
+		best = first;
+
+		for (child = first + 1; child < last; child++) {
+			if (smcp_timer_fires_before_(self->timer_heap[child], self->timer_heap[best])) {
+				best = child;
+			}
+		}
+
+		if (!smcp_timer_fires_before_(self->timer_heap[best], timer)) {
+			break;
+		}
+
+		smcp_timer_heap_place_(self, self->timer_heap[best], i);
+		i = best;
+	}
+
+	smcp_timer_heap_place_(self, timer, i);
+}
+
+static smcp_status_t
+smcp_timer_heap_insert_(smcp_t self, smcp_timer_t timer) {
+	if (self->timer_count == self->timer_capacity) {
+		uint32_t capacity = MAX(self->timer_capacity * 2, SMCP_TIMER_HEAP_MIN_SIZE);
+		smcp_timer_t* heap = (smcp_timer_t*)realloc(self->timer_heap, capacity * sizeof(smcp_timer_t));
+
+		if (heap == NULL) {
+			return SMCP_STATUS_MALLOC_FAILURE;
+		}
+
+		self->timer_heap = heap;
+		self->timer_capacity = capacity;
+	}
+
+	timer->serial = self->timer_serial++;
+
+	smcp_timer_heap_sift_up_(self, timer, self->timer_count++);
+
+	return SMCP_STATUS_OK;
+}
+
+static void
+smcp_timer_heap_remove_(smcp_t self, smcp_timer_t timer) {
+	const uint32_t i = timer->heap_index - 1;
+	smcp_timer_t last;
+
+	timer->heap_index = 0;
+
+	last = self->timer_heap[--self->timer_count];
+
+	if (last == timer) {
+		return;
+	}
+
+	// Move the last timer into the hole and restore the heap
+	// property in whichever direction it is violated.
+	if ((i > 0) && smcp_timer_fires_before_(last, self->timer_heap[(i - 1) / SMCP_TIMER_HEAP_ARITY])) {
+		smcp_timer_heap_sift_up_(self, last, i);
+	} else {
+		smcp_timer_heap_sift_down_(self, last, i);
+	}
+}
+
+#define smcp_next_timer_(self)	((self)->timer_count ? (self)->timer_heap[0] : NULL)
+
+#else // SMCP_TIMERS_USE_HEAP
+
 static ll_compare_result_t
 smcp_timer_compare_func(
 	const void* lhs_, const void* rhs_, void* context
 ) {
 	const smcp_timer_t lhs = (smcp_timer_t)lhs_;
 	const smcp_timer_t rhs = (smcp_timer_t)rhs_;
-	smcp_cms_t x = smcp_plat_timestamp_diff(lhs->fire_date, rhs->fire_date);
-
-	if(x > 0) {
+	if(smcp_timestamp_before_(rhs->fire_date, lhs->fire_date)) {
 		return 1;
 	}
 
-	if(x < 0) {
+	if(smcp_timestamp_before_(lhs->fire_date, rhs->fire_date)) {
 		return -1;
 	}
 
 	return 0;
 }
 
+#define smcp_next_timer_(self)	((self)->timers)
+
+#endif // !SMCP_TIMERS_USE_HEAP
+
+// MARK: -
+
 smcp_timer_t
 smcp_timer_init(
 	smcp_timer_t			self,
@@ -97,7 +227,11 @@ smcp_timer_is_scheduled(
 	smcp_t self, smcp_timer_t timer
 ) {
 	SMCP_EMBEDDED_SELF_HOOK;
+#if SMCP_TIMERS_USE_HEAP
+	return timer->heap_index != 0;
+#else
 	return timer->ll.next || timer->ll.prev || (self->timers == timer);
+#endif
 }
 
 smcp_status_t
@@ -112,15 +246,16 @@ smcp_schedule_timer(
 	assert(self!=NULL);
 	assert(timer!=NULL);
 
-	// Make sure we aren't already part of the list.
+	// Make sure we aren't already scheduled.
+#if SMCP_TIMERS_USE_HEAP
+	require(!timer->heap_index, bail);
+#else
 	require(!timer->ll.next, bail);
 	require(!timer->ll.prev, bail);
 	require(self->timers != timer, bail);
+#endif
 
 	DEBUG_PRINTF("Timer:%p: Scheduling to fire in %dms ...",timer,cms);
-#if SMCP_DEBUG_TIMERS
-	size_t previousTimerCount = ll_count(self->timers);
-#endif
 
 	if (cms < 0) {
 		cms = 0;
@@ -128,6 +263,17 @@ smcp_schedule_timer(
 
 	timer->fire_date = smcp_plat_cms_to_timestamp(cms);
 
+#if SMCP_TIMERS_USE_HEAP
+	ret = smcp_timer_heap_insert_(self, timer);
+	require_noerr(ret, bail);
+
+	DEBUG_PRINTF("Timer:%p(CTX=%p): Scheduled.",timer,timer->context);
+	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)self->timer_count);
+#else
+#if SMCP_DEBUG_TIMERS
+	size_t previousTimerCount = ll_count(self->timers);
+#endif
+
 	ll_sorted_insert(
 			(void**)&self->timers,
 		timer,
@@ -143,6 +289,7 @@ smcp_schedule_timer(
 #if SMCP_DEBUG_TIMERS
 	assert((ll_count(self->timers)) == previousTimerCount+1);
 #endif
+#endif // !SMCP_TIMERS_USE_HEAP
 
 bail:
 	return ret;
@@ -154,6 +301,16 @@ smcp_invalidate_timer(
 	smcp_timer_t	timer
 ) {
 	SMCP_EMBEDDED_SELF_HOOK;
+
+	DEBUG_PRINTF("Timer:%p: Invalidating...",timer);
+	DEBUG_PRINTF("Timer:%p: (CTX=%p)",timer,timer->context);
+
+#if SMCP_TIMERS_USE_HEAP
+	if (timer->heap_index) {
+		smcp_timer_heap_remove_(self, timer);
+	}
+	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)self->timer_count);
+#else
 #if SMCP_DEBUG_TIMERS
 	size_t previousTimerCount = ll_count(self->timers);
 	// Sanity check. If we don't have at least one timer
@@ -161,9 +318,6 @@ smcp_invalidate_timer(
 	check(previousTimerCount>=1);
 #endif
 
-	DEBUG_PRINTF("Timer:%p: Invalidating...",timer);
-	DEBUG_PRINTF("Timer:%p: (CTX=%p)",timer,timer->context);
-
 	ll_remove((void**)&self->timers, (void*)timer);
 
 #if SMCP_DEBUG_TIMERS
@@ -171,15 +325,49 @@ smcp_invalidate_timer(
 #endif
 	timer->ll.next = NULL;
 	timer->ll.prev = NULL;
+	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)ll_count(self->timers));
+#endif // !SMCP_TIMERS_USE_HEAP
+
 	if(timer->cancel)
 		(*timer->cancel)(self,timer->context);
 	DEBUG_PRINTF("Timer:%p: Invalidated.",timer);
-	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)ll_count(self->timers));
+}
+
+void
+smcp_timers_finalize(smcp_t self) {
+	smcp_timer_t timer;
+
+	while ((timer = smcp_next_timer_(self)) != NULL) {
+		if(timer->cancel)
+			timer->cancel(self, timer->context);
+		smcp_invalidate_timer(self, timer);
+	}
+
+#if SMCP_TIMERS_USE_HEAP
+	free(self->timer_heap);
+	self->timer_heap = NULL;
+	self->timer_capacity = 0;
+#endif
 }
 
 #if SMCP_DEBUG_TIMERS || VERBOSE_DEBUG
 void
 smcp_dump_all_timers(smcp_t self) {
+#if SMCP_TIMERS_USE_HEAP
+	uint32_t i;
+
+	if (self->timer_count) {
+		// Heap order, not firing order.
+		DEBUG_PRINTF("smcp(%p): Current Timers:",self);
+
+		for (i = 0; i < self->timer_count; i++) {
+			smcp_timer_t iter = self->timer_heap[i];
+			DEBUG_PRINTF("\t* [%p] expires-in:%dms context:%p",iter,smcp_plat_timestamp_to_cms(iter->fire_date),iter->context);
+		}
+	} else {
+		DEBUG_PRINTF("smcp(%p): No timers active.",self);
+	}
+#else
 	smcp_timer_t iter;
 
 	if (self->timers) {
@@ -191,6 +379,7 @@ smcp_dump_all_timers(smcp_t self) {
 	} else {
 		DEBUG_PRINTF("smcp(%p): No timers active.",self);
 	}
+#endif
 }
 #endif
 
@@ -199,8 +388,8 @@ smcp_get_timeout(smcp_t self) {
 	smcp_cms_t ret = SMCP_MAX_TIMEOUT;
 	SMCP_EMBEDDED_SELF_HOOK;
 
-	if (self->timers) {
-		ret = MIN(ret, smcp_plat_timestamp_to_cms(self->timers->fire_date));
+	if (smcp_next_timer_(self)) {
+		ret = MIN(ret, smcp_plat_timestamp_to_cms(smcp_next_timer_(self)->fire_date));
 	}
 
 	ret = MAX(ret, 0);
@@ -214,18 +403,43 @@ smcp_get_timeout(smcp_t self) {
 	return ret;
 }
 
-void
-smcp_handle_timers(smcp_t self) {
-	SMCP_EMBEDDED_SELF_HOOK;
-	smcp_set_current_instance(self);
-	if (self->timers
-		&& (smcp_plat_timestamp_to_cms(self->timers->fire_date) <= 0)
+//! Fires the timers that are due at `now`, up to `budget` of them.
+/*!	A budget of zero means every timer that was due when the pass
+**	started. Timers that get scheduled by the callbacks are left for
+**	the next pass even if they are already due, so a timer that keeps
+**	rescheduling itself with no delay can't keep us here forever. The
+**	heap tells those apart by their serial. The sorted list has no
+**	serial, so there the pass stops after as many timers as were due
+**	when it started. */
+static void
+smcp_fire_timers_(smcp_t self, smcp_timestamp_t now, uint32_t budget) {
+	smcp_timer_t timer;
+#if SMCP_TIMERS_USE_HEAP
+	const uint32_t serial_limit = self->timer_serial;
+#else
+	if (budget == 0) {
+		for ( timer = smcp_next_timer_(self)
+		    ; timer != NULL && !smcp_timestamp_before_(now, timer->fire_date)
+		    ; timer = (smcp_timer_t)timer->ll.next
+		) {
+			budget++;
+		}
+
+		if (budget == 0) {
+			return;
+		}
+	}
+#endif
+
+	while (((timer = smcp_next_timer_(self)) != NULL)
+		&& !smcp_timestamp_before_(now, timer->fire_date)
+#if SMCP_TIMERS_USE_HEAP
+		&& ((int32_t)(timer->serial - serial_limit) < 0)
+#endif
 	) {
-		SMCP_NON_RECURSIVE smcp_timer_t timer;
 		SMCP_NON_RECURSIVE smcp_timer_callback_t callback;
 		SMCP_NON_RECURSIVE void* context;
 
-		timer = self->timers;
 		callback = timer->callback;
 		context = timer->context;
 
@@ -236,8 +450,26 @@ smcp_handle_timers(smcp_t self) {
 		if (callback) {
 			callback(self, context);
 		}
+
+		if (budget && !--budget) {
+			break;
+		}
 	}
 #if SMCP_DEBUG_TIMERS
 	smcp_dump_all_timers(self);
 #endif
 }
+
+void
+smcp_handle_timers(smcp_t self) {
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_set_current_instance(self);
+	smcp_fire_timers_(self, smcp_plat_cms_to_timestamp(0), SMCP_CONF_TIMER_BUDGET);
+}
+
+void
+smcp_process_timers_until(smcp_t self, smcp_timestamp_t now) {
+	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_set_current_instance(self);
+	smcp_fire_timers_(self, now, 0);
+}
@@ -43,6 +43,7 @@
 #define smcp_schedule_timer(self,...)		smcp_schedule_timer(__VA_ARGS__)
 #define smcp_invalidate_timer(self,...)		smcp_invalidate_timer(__VA_ARGS__)
 #define smcp_handle_timers(self,...)		smcp_handle_timers(__VA_ARGS__)
+#define smcp_process_timers_until(self,...)		smcp_process_timers_until(__VA_ARGS__)
 #define smcp_timer_is_scheduled(self,...)		smcp_timer_is_scheduled(__VA_ARGS__)
 #endif
 
@@ -58,6 +59,14 @@
 #define USEC_PER_SEC    (1000000)
 #endif
 
+#ifndef NSEC_PER_USEC
+#define NSEC_PER_USEC   (1000)
+#endif
+
+#ifndef NSEC_PER_MSEC
+#define NSEC_PER_MSEC   (1000000)
+#endif
+
 __BEGIN_DECLS
 /*!	@addtogroup smcp
 **	@{
@@ -84,7 +93,12 @@ __BEGIN_DECLS
 typedef void (*smcp_timer_callback_t)(smcp_t, void*);
 
 typedef struct smcp_timer_s {
+#if SMCP_TIMERS_USE_HEAP
+	uint32_t				heap_index;		//!< One past the position in the heap, zero if not scheduled.
+	uint32_t				serial;			//!< Keeps timers due at the same time in FIFO order.
+#else
 	struct ll_item_s		ll;
+#endif
 	smcp_timestamp_t		fire_date;
 	void*					context;
 	smcp_timer_callback_t	callback;
@@ -106,7 +120,21 @@ SMCP_API_EXTERN smcp_status_t smcp_schedule_timer(
 
 SMCP_API_EXTERN void smcp_invalidate_timer(smcp_t self, smcp_timer_t timer);
 SMCP_API_EXTERN smcp_cms_t smcp_get_timeout(smcp_t self);
+
+//!	Fires the timers that have expired.
+/*!	Fires up to `SMCP_CONF_TIMER_BUDGET` timers that were due when
+**	the call started. If any are left over, `smcp_get_timeout()`
+**	returns zero so that the next call happens right away. */
 SMCP_API_EXTERN void smcp_handle_timers(smcp_t self);
+
+//!	Fires every timer that is due at or before `now`.
+/*!	This is meant for hosts that run their own event loop: pass
+**	the time the loop woke up with, as returned by
+**	`smcp_plat_cms_to_timestamp(0)`. Afterward, `smcp_get_timeout()`
+**	returns how long the host may wait before calling this again.
+**	Timers scheduled by the callbacks fire on the next call, even if
+**	they are already due. */
+SMCP_API_EXTERN void smcp_process_timers_until(smcp_t self, smcp_timestamp_t now);
 SMCP_API_EXTERN bool smcp_timer_is_scheduled(smcp_t self, smcp_timer_t timer);
 
 /*!	@} */
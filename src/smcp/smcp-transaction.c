@@ -35,6 +35,10 @@
 #include "smcp-logging.h"
 #include "smcp-internal.h"
 
+#if (SMCP_CONF_TRANSACTION_TOKEN_LENGTH < 4) || (SMCP_CONF_TRANSACTION_TOKEN_LENGTH > COAP_MAX_TOKEN_SIZE)
+#error SMCP_CONF_TRANSACTION_TOKEN_LENGTH must be between 4 and 8
+#endif
+
 #if SMCP_AVOID_MALLOC
 #warning Transaction pool should be moved into the SMCP instance.
 static struct smcp_transaction_s smcp_transaction_pool[SMCP_CONF_MAX_TRANSACTIONS];
@@ -56,60 +60,241 @@ smcp_transaction_compare(
 	}
 	return 0;
 }
+#endif
 
-static bt_compare_result_t
-smcp_transaction_compare_msg_id(
-	const void* lhs_, const void* rhs_, void* context
-) {
-	const smcp_transaction_t lhs = (smcp_transaction_t)lhs_;
-	coap_msg_id_t rhs = (coap_msg_id_t)(uintptr_t)rhs_;
+// MARK: -
+// MARK: Transaction Index
 
-	if(lhs->msg_id > rhs) {
-		return 1;
+static uint32_t
+smcp_transaction_index_mask_(smcp_t self) {
+#if SMCP_AVOID_MALLOC
+	return SMCP_CONF_TRANSACTION_INDEX_SIZE - 1;
+#else
+	return self->transaction_index.mask;
+#endif
+}
+
+static void
+smcp_transaction_index_link_msg_id_(smcp_t self, smcp_transaction_t handler) {
+	smcp_transaction_t* const bucket = &self->transaction_index.by_msg_id[handler->msg_id & smcp_transaction_index_mask_(self)];
+
+	handler->next_by_msg_id = *bucket;
+	*bucket = handler;
+}
+
+static bool
+smcp_transaction_index_unlink_msg_id_(smcp_t self, smcp_transaction_t handler) {
+	smcp_transaction_t* iter = &self->transaction_index.by_msg_id[handler->msg_id & smcp_transaction_index_mask_(self)];
+
+	for (; *iter != NULL; iter = &(*iter)->next_by_msg_id) {
+		if (*iter == handler) {
+			*iter = handler->next_by_msg_id;
+			handler->next_by_msg_id = NULL;
+			return true;
+		}
 	}
-	if(lhs->msg_id < rhs) {
-		return -1;
+
+	return false;
+}
+
+//! Tokens are hashed on their first four bytes.
+/*!	For the tokens we hand out, those hold a counter, so consecutive
+**	transactions land in consecutive buckets. */
+static uint32_t
+smcp_transaction_token_hash_(const uint8_t* token, uint8_t token_len) {
+	uint32_t ret = 0;
+
+	memcpy(&ret, token, MIN(token_len, sizeof(ret)));
+
+	return ret;
+}
+
+static void
+smcp_transaction_index_link_token_(smcp_t self, smcp_transaction_t handler) {
+	smcp_transaction_t* const bucket = &self->transaction_index.by_token[
+		smcp_transaction_token_hash_(handler->token, handler->token_len) & smcp_transaction_index_mask_(self)
+	];
+
+	handler->next_by_token = *bucket;
+	*bucket = handler;
+}
+
+static void
+smcp_transaction_index_unlink_token_(smcp_t self, smcp_transaction_t handler) {
+	smcp_transaction_t* iter = &self->transaction_index.by_token[
+		smcp_transaction_token_hash_(handler->token, handler->token_len) & smcp_transaction_index_mask_(self)
+	];
+
+	for (; *iter != NULL; iter = &(*iter)->next_by_token) {
+		if (*iter == handler) {
+			*iter = handler->next_by_token;
+			handler->next_by_token = NULL;
+			break;
+		}
 	}
-	return 0;
 }
+
+#if !SMCP_AVOID_MALLOC
+static smcp_status_t
+smcp_transaction_index_resize_(smcp_t self, uint32_t size) {
+	struct smcp_transaction_index_s* const index = &self->transaction_index;
+	smcp_transaction_t* old_by_msg_id = index->by_msg_id;
+	uint32_t old_size = old_by_msg_id ? index->mask + 1 : 0;
+	smcp_transaction_t* table;
+	uint32_t i;
+
+	// Both tables share a single allocation.
+	table = (smcp_transaction_t*)calloc(size * 2, sizeof(smcp_transaction_t));
+
+	if (table == NULL) {
+		return SMCP_STATUS_MALLOC_FAILURE;
+	}
+
+	index->by_msg_id = table;
+	index->by_token = table + size;
+	index->mask = size - 1;
+
+	// Every indexed transaction is on exactly one of the old
+	// message id chains, so walking those is enough to move
+	// everything over to both of the new tables.
+	for (i = 0; i < old_size; i++) {
+		smcp_transaction_t handler = old_by_msg_id[i];
+
+		while (handler != NULL) {
+			smcp_transaction_t next = handler->next_by_msg_id;
+			smcp_transaction_index_link_msg_id_(self, handler);
+			smcp_transaction_index_link_token_(self, handler);
+			handler = next;
+		}
+	}
+
+	free(old_by_msg_id);
+
+	return SMCP_STATUS_OK;
+}
+#endif // !SMCP_AVOID_MALLOC
+
+//! Makes sure there is room in the index for one more transaction.
+static smcp_status_t
+smcp_transaction_index_reserve_(smcp_t self) {
+#if !SMCP_AVOID_MALLOC
+	struct smcp_transaction_index_s* const index = &self->transaction_index;
+
+	if (index->by_msg_id == NULL) {
+		return smcp_transaction_index_resize_(self, SMCP_CONF_TRANSACTION_INDEX_SIZE);
+	}
+
+	// Failing to grow only makes the chains longer.
+	if ((index->count > index->mask) && (index->mask < (1u << 30))) {
+		smcp_transaction_index_resize_(self, (index->mask + 1) * 2);
+	}
 #endif
+	return SMCP_STATUS_OK;
+}
+
+static void
+smcp_transaction_index_insert_(smcp_t self, smcp_transaction_t handler) {
+	smcp_transaction_index_link_msg_id_(self, handler);
+	smcp_transaction_index_link_token_(self, handler);
+	self->transaction_index.count++;
+}
+
+static void
+smcp_transaction_index_remove_(smcp_t self, smcp_transaction_t handler) {
+#if !SMCP_AVOID_MALLOC
+	if (self->transaction_index.by_msg_id == NULL) {
+		return;
+	}
+#endif
+
+	// A transaction that failed to begin is marked active
+	// without being indexed, so this must tolerate misses.
+	if (smcp_transaction_index_unlink_msg_id_(self, handler)) {
+		smcp_transaction_index_unlink_token_(self, handler);
+		self->transaction_index.count--;
+	}
+}
+
+void
+smcp_transaction_index_finalize(smcp_t self) {
+#if !SMCP_AVOID_MALLOC
+	free(self->transaction_index.by_msg_id);
+	self->transaction_index.by_msg_id = NULL;
+	self->transaction_index.by_token = NULL;
+	self->transaction_index.mask = 0;
+#endif
+	self->transaction_index.count = 0;
+}
+
+// MARK: -
 
 smcp_transaction_t
 smcp_transaction_find_via_msg_id(smcp_t self, coap_msg_id_t msg_id) {
 	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_transaction_t ret = NULL;
 
-#if SMCP_TRANSACTIONS_USE_BTREE
-	return (smcp_transaction_t)bt_find(
-		(void*)&self->transactions,
-		(void*)(uintptr_t)msg_id,
-		(bt_compare_func_t)smcp_transaction_compare_msg_id,
-		self
-	);
-#else
-	// Ouch. Linear search.
-	smcp_transaction_t ret = self->transactions;
-	while(ret && (ret->msg_id != msg_id)) ret = ll_next((void*)ret);
-	return ret;
+#if !SMCP_AVOID_MALLOC
+	if (self->transaction_index.by_msg_id == NULL) {
+		return NULL;
+	}
 #endif
 
+	ret = self->transaction_index.by_msg_id[msg_id & smcp_transaction_index_mask_(self)];
+	while(ret && (ret->msg_id != msg_id)) ret = ret->next_by_msg_id;
+
+	return ret;
 }
 
 smcp_transaction_t
-smcp_transaction_find_via_token(smcp_t self, coap_msg_id_t token) {
+smcp_transaction_find_via_token(smcp_t self, const uint8_t* token, uint8_t token_len) {
 	SMCP_EMBEDDED_SELF_HOOK;
+	smcp_transaction_t ret = NULL;
 
-	// Ouch. Linear search.
-#if SMCP_TRANSACTIONS_USE_BTREE
-	smcp_transaction_t ret = bt_first(self->transactions);
-	while(ret && (ret->token != token)) ret = bt_next(ret);
-#else
-	smcp_transaction_t ret = self->transactions;
-	while(ret && (ret->token != token)) ret = ll_next((void*)ret);
+#if !SMCP_AVOID_MALLOC
+	if (self->transaction_index.by_token == NULL) {
+		return NULL;
+	}
 #endif
 
+	ret = self->transaction_index.by_token[
+		smcp_transaction_token_hash_(token, token_len) & smcp_transaction_index_mask_(self)
+	];
+
+	while (ret != NULL) {
+		if ((ret->token_len == token_len) && (0 == memcmp(ret->token, token, token_len))) {
+			break;
+		}
+		ret = ret->next_by_token;
+	}
+
 	return ret;
 }
 
+//! Fills in a fresh token for `handler`.
+/*!	The first four bytes come from a counter that starts at a random
+**	value, which keeps our own tokens from colliding with each other.
+**	The rest is random, so the tokens of any one instance can't be
+**	predicted from those that came before. */
+static void
+smcp_transaction_new_token_(smcp_t self, smcp_transaction_t handler) {
+	uint8_t i;
+
+	if (!self->last_token_counter) {
+		self->last_token_counter = SMCP_FUNC_RANDOM_UINT32();
+	}
+
+	self->last_token_counter++;
+
+	memcpy(handler->token, &self->last_token_counter, sizeof(self->last_token_counter));
+
+	for (i = sizeof(self->last_token_counter); i < SMCP_CONF_TRANSACTION_TOKEN_LENGTH; i += sizeof(uint32_t)) {
+		uint32_t r = SMCP_FUNC_RANDOM_UINT32();
+		memcpy(handler->token + i, &r, MIN(sizeof(r), (size_t)(SMCP_CONF_TRANSACTION_TOKEN_LENGTH - i)));
+	}
+
+	handler->token_len = SMCP_CONF_TRANSACTION_TOKEN_LENGTH;
+}
+
 static void
 smcp_internal_delete_transaction_(
 	smcp_transaction_t handler,
@@ -145,7 +330,7 @@ smcp_internal_delete_transaction_(
 	}
 #else
 	if (handler->should_dealloc) {
-		free(handler);
+		smcp_slab_free(handler);
 	}
 #endif
 }
@@ -173,9 +358,11 @@ smcp_transaction_new_msg_id(
 	smcp_transaction_t handler,
 	coap_msg_id_t msg_id
 ) {
-	//SMCP_EMBEDDED_SELF_HOOK;
+	SMCP_EMBEDDED_SELF_HOOK;
 	require(handler->active,bail);
 
+	smcp_transaction_index_remove_(self, handler);
+
 #if SMCP_TRANSACTIONS_USE_BTREE
 	bt_remove(
 		(void**)&self->transactions,
@@ -190,6 +377,8 @@ smcp_transaction_new_msg_id(
 
 	handler->msg_id = msg_id;
 
+	smcp_transaction_index_insert_(self, handler);
+
 #if SMCP_TRANSACTIONS_USE_BTREE
 	bt_insert(
 		(void**)&self->transactions,
@@ -359,7 +548,7 @@ smcp_transaction_init(
 			handler = NULL;
 		}
 #else
-		handler = (smcp_transaction_t)calloc(sizeof(*handler), 1);
+		handler = (smcp_transaction_t)smcp_slab_alloc(smcp_get_current_instance(), sizeof(*handler));
 #endif
 		if (handler) {
 			handler->should_dealloc = 1;
@@ -406,6 +595,10 @@ smcp_transaction_begin(
 
 	DEBUG_PRINTF("smcp_transaction_begin: %p",handler);
 
+	if (handler->active) {
+		smcp_transaction_index_remove_(self, handler);
+	}
+
 #if SMCP_TRANSACTIONS_USE_BTREE
 	bt_remove(
 		(void**)&self->transactions,
@@ -418,12 +611,17 @@ smcp_transaction_begin(
 	ll_remove((void**)&self->transactions,(void*)handler);
 #endif
 
+	handler->active = 0;
+
+	ret = smcp_transaction_index_reserve_(self);
+	require_noerr(ret, bail);
+
 	if (expiration<0) {
 		expiration = (smcp_cms_t)(COAP_EXCHANGE_LIFETIME*MSEC_PER_SEC);
 	}
 
-	handler->token = smcp_get_next_msg_id(self);
-	handler->msg_id = handler->token;
+	smcp_transaction_new_token_(self, handler);
+	handler->msg_id = smcp_get_next_msg_id(self);
 	handler->waiting_for_async_response = false;
 	handler->attemptCount = 0;
 #if SMCP_CONF_TRANS_ENABLE_OBSERVING
@@ -465,6 +663,8 @@ smcp_transaction_begin(
 
 	require_noerr(ret, bail);
 
+	smcp_transaction_index_insert_(self, handler);
+
 #if SMCP_TRANSACTIONS_USE_BTREE
 	bt_insert(
 		(void**)&self->transactions,
@@ -508,6 +708,7 @@ smcp_transaction_end(
 
 	if(transaction->active) {
 		transaction->active = 0; // Maybe we should remove this line? May be hiding bad behavior.
+		smcp_transaction_index_remove_(self, transaction);
 #if SMCP_TRANSACTIONS_USE_BTREE
 		bt_remove(
 			(void**)&self->transactions,
@@ -547,19 +748,19 @@ smcp_handle_response() {
 #endif // VERBOSE_DEBUG
 
 	{
-		coap_msg_id_t token = 0;
-		if(self->inbound.packet->token_len == sizeof(coap_msg_id_t)) {
-			memcpy(&token,self->inbound.packet->token,sizeof(token));
-		}
+		const uint8_t* token = self->inbound.packet->token;
+		const uint8_t token_len = self->inbound.packet->token_len;
 
 		handler = smcp_transaction_find_via_msg_id(self,msg_id);
 
 		if (NULL == handler) {
 			if (self->inbound.packet->tt < COAP_TRANS_TYPE_ACK) {
-				handler = smcp_transaction_find_via_token(self,token);
+				handler = smcp_transaction_find_via_token(self,token,token_len);
 			}
 		} else if (smcp_inbound_get_packet()->code != COAP_CODE_EMPTY
-			&& token != handler->token
+			&& ( token_len != handler->token_len
+			  || 0 != memcmp(token, handler->token, token_len)
+			)
 		) {
 			handler = NULL;
 		}
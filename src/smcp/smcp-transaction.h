@@ -91,10 +91,15 @@ struct smcp_transaction_s {
 	smcp_timestamp_t			expiration;
 	struct smcp_timer_s			timer;
 
-	coap_msg_id_t				token;
+	uint8_t						token[COAP_MAX_TOKEN_SIZE];
+	uint8_t						token_len;
 	coap_msg_id_t				msg_id;
 	smcp_sockaddr_t				sockaddr_remote;
 
+	// Chains in the instance's transaction index.
+	struct smcp_transaction_s*	next_by_msg_id;
+	struct smcp_transaction_s*	next_by_token;
+
 #if SMCP_CONF_TRANS_ENABLE_OBSERVING
 	uint32_t					last_observe;
 #endif
@@ -163,6 +168,19 @@ SMCP_API_EXTERN void smcp_transaction_new_msg_id(
 	coap_msg_id_t msg_id
 );
 
+//!	Returns the active transaction with the given message id, or NULL.
+SMCP_API_EXTERN smcp_transaction_t smcp_transaction_find_via_msg_id(
+	smcp_t self,
+	coap_msg_id_t msg_id
+);
+
+//!	Returns the active transaction with the given token, or NULL.
+SMCP_API_EXTERN smcp_transaction_t smcp_transaction_find_via_token(
+	smcp_t self,
+	const uint8_t* token,
+	uint8_t token_len
+);
+
 /*!	@} */
 /*!	@} */
 
@@ -57,7 +57,19 @@
 
 #if SMCP_EMBEDDED
 struct smcp_s smcp_global_instance;
-#elif SMCP_MULTITHREAD && HAVE_PTHREAD
+#elif defined(SMCP_CURRENT_INSTANCE_STORAGE)
+SMCP_CURRENT_INSTANCE_STORAGE smcp_t smcp_current_instance;
+void
+smcp_set_current_instance(smcp_t x)
+{
+	smcp_current_instance = (x);
+}
+smcp_t
+(smcp_get_current_instance)(void)
+{
+	return smcp_current_instance;
+}
+#else
 #include <pthread.h>
 static pthread_key_t smcp_current_instance_key;
 static pthread_once_t smcp_current_instance_once;
@@ -78,18 +90,6 @@ smcp_get_current_instance()
 	pthread_once(&smcp_current_instance_once, smcp_current_instance_setup);
 	return (smcp_t)pthread_getspecific(smcp_current_instance_key);
 }
-#else
-static smcp_t smcp_current_instance;
-void
-smcp_set_current_instance(smcp_t x)
-{
-	smcp_current_instance = (x);
-}
-smcp_t
-smcp_get_current_instance()
-{
-	return smcp_current_instance;
-}
 #endif
 
 #if !SMCP_EMBEDDED
@@ -135,6 +135,20 @@ smcp_init(smcp_t self) {
 	// Clear the entire structure.
 	memset(self, 0, sizeof(*self));
 
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	self->outbound.staged_limit = SMCP_CONF_OUTBOUND_STAGED_OPTIONS;
+#endif
+
+#if SMCP_CONF_SLAB
+	// Not fatal, everything will just come from the heap.
+	(void)smcp_slab_init(self);
+#endif
+
+#if SMCP_CONF_SUBMIT_QUEUE
+	// Not fatal, smcp_submit() will just fail.
+	(void)smcp_submit_init(self);
+#endif
+
 	return smcp_plat_init(self);
 }
 
@@ -144,21 +158,36 @@ smcp_release(smcp_t self) {
 	SMCP_EMBEDDED_SELF_HOOK;
 	require(self, bail);
 
+	smcp_observers_finalize(self);
+
+#if SMCP_CONF_SUBMIT_QUEUE
+	// Hand back anything that was never started.
+	smcp_submit_finalize(self);
+#endif
+
 	// Delete all pending transactions
 	while(self->transactions) {
 		smcp_transaction_end(self, self->transactions);
 	}
 
+	smcp_transaction_index_finalize(self);
+
 	// Delete all timers
-	while(self->timers) {
-		smcp_timer_t timer = self->timers;
-		if(timer->cancel)
-			timer->cancel(self, timer->context);
-		smcp_invalidate_timer(self, timer);
-	}
+	smcp_timers_finalize(self);
 
 	smcp_plat_finalize(self);
 
+	smcp_dupe_finalize(self);
+
+#if SMCP_CONF_SLAB
+	smcp_slab_finalize(self);
+#endif
+
+	// Don't leave a dangling pointer behind for the slab to find.
+	if (smcp_get_current_instance() == self) {
+		smcp_set_current_instance(NULL);
+	}
+
 #if !SMCP_EMBEDDED
 	free(self);
 #endif
@@ -220,26 +249,18 @@ bail:
 smcp_status_t
 smcp_vhost_route(smcp_request_handler_func* func, void** context) {
 	smcp_t const self = smcp_get_current_instance();
-	coap_option_key_t key;
 
 	if(self->vhost_count) {
 		const uint8_t* value;
 		coap_size_t value_len = 0;
+		int i;
 
-		smcp_inbound_reset_next_option();
-
-		while((key = smcp_inbound_next_option(&value,&value_len))!=COAP_OPTION_INVALID) {
-			if(key >= COAP_OPTION_URI_HOST)
-				break;
-		}
-
-		if(value_len>(sizeof(self->vhost[0].name)-1))
-			return SMCP_STATUS_INVALID_ARGUMENT;
+		if(smcp_inbound_find_option(COAP_OPTION_URI_HOST, &value, &value_len)) {
+			if(value_len>(sizeof(self->vhost[0].name)-1))
+				return SMCP_STATUS_INVALID_ARGUMENT;
 
-		if(key == COAP_OPTION_URI_HOST) {
-			int i;
 			for(i=0;i<self->vhost_count;i++) {
-				if(strncmp(self->vhost[i].name,(const char*)value,value_len) && self->vhost[i].name[value_len]==0) {
+				if(strncmp(self->vhost[i].name,(const char*)value,value_len) == 0 && self->vhost[i].name[value_len] == 0) {
 					*func = self->vhost[i].func;
 					*context = self->vhost[i].context;
 					break;
@@ -307,6 +328,7 @@ const char* smcp_status_to_cstr(int x) {
 
 	case SMCP_STATUS_WAIT_FOR_DNS: return "Wait For DNS"; break;
 	case SMCP_STATUS_WAIT_FOR_SESSION: return "Wait For Session"; break;
+	case SMCP_STATUS_QUEUE_FULL: return "Queue Full"; break;
 
 	case SMCP_STATUS_ERRNO:
 #if SMCP_USE_BSD_SOCKETS
@@ -118,6 +118,7 @@ enum {
 	SMCP_STATUS_SESSION_ERROR       = -29,
 	SMCP_STATUS_SESSION_CLOSED      = -30,
 	SMCP_STATUS_OUT_OF_SESSIONS     = -31,
+	SMCP_STATUS_QUEUE_FULL          = -32,	//!< Outbound queue is full and the socket is not writable.
 };
 
 typedef int smcp_status_t;
@@ -132,8 +133,14 @@ typedef struct smcp_s *smcp_t;
 //!	Relative time period, in milliseconds.
 typedef int32_t smcp_cms_t;
 
+#if SMCP_CONF_TIMESTAMP_64BIT
+//!	Absolute timestamp, in microseconds from an arbitrary point in the past.
+/*!	Unlike the 32-bit timestamps, these never wrap around. */
+typedef uint64_t smcp_timestamp_t;
+#else
 //!	Absolute timestamp, platform-specific value.
 typedef int32_t smcp_timestamp_t;
+#endif
 
 //!	Special `cms` value representing the distant future.
 /*!	Note that this value does not refer to a specific time. */
@@ -166,6 +173,7 @@ typedef smcp_callback_func smcp_inbound_resend_func;
 #define smcp_inbound_packet_process(self,...)		smcp_inbound_packet_process(__VA_ARGS__)
 #define smcp_vhost_add(self,...)		smcp_vhost_add(__VA_ARGS__)
 #define smcp_set_default_request_handler(self,...)		smcp_set_default_request_handler(__VA_ARGS__)
+#define smcp_set_dupe_capacity(self,...)		smcp_set_dupe_capacity(__VA_ARGS__)
 
 #define smcp_plat_get_port(self)		smcp_plat_get_port()
 #define smcp_plat_init(self)		smcp_plat_init()
@@ -237,6 +245,18 @@ SMCP_API_EXTERN void smcp_set_default_request_handler(
 	void* context
 );
 
+#if !SMCP_AVOID_MALLOC
+//!	Sets how many recent packets are remembered for duplicate detection.
+/*!	The capacity is rounded up to a power of two. Packets are
+**	remembered for `COAP_EXCHANGE_LIFETIME`, so the capacity should
+**	cover the number of packets expected from all peers within that
+**	time. Defaults to `SMCP_CONF_DUPE_BUFFER_SIZE`, and grows on its
+**	own up to `SMCP_CONF_DUPE_BUFFER_MAX_SIZE` when it gets crowded.
+**	The table may end up larger than asked for, if the packets that
+**	are still remembered wouldn't fit otherwise. */
+SMCP_API_EXTERN smcp_status_t smcp_set_dupe_capacity(smcp_t self, uint32_t capacity);
+#endif
+
 #if SMCP_CONF_ENABLE_VHOSTS
 /*!	Adds a virtual host that will use the given request handler
 **	instead of the default one.
@@ -368,6 +388,10 @@ SMCP_API_EXTERN coap_option_key_t smcp_inbound_peek_option(const uint8_t** ptr,
 //!	Reset the option pointer to the start of the options.
 SMCP_API_EXTERN void smcp_inbound_reset_next_option(void);
 
+//!	Looks up the first option with the given key, without moving the option pointer.
+/*!	Returns false if the inbound packet has no such option. */
+SMCP_API_EXTERN bool smcp_inbound_find_option(coap_option_key_t key, const uint8_t** ptr, coap_size_t* len);
+
 //!	Compares the key and value of the current option to specific c-string values.
 SMCP_API_EXTERN bool smcp_inbound_option_strequal(coap_option_key_t key, const char* str);
 
@@ -523,6 +547,8 @@ __END_DECLS
 
 #include "smcp-async.h"
 #include "smcp-transaction.h"
+#include "smcp-submit.h"
+#include "smcp-slab.h"
 #include "smcp-observable.h"
 #include "smcp-helpers.h"
 #include "smcp-session.h"
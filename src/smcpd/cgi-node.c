@@ -53,6 +53,8 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include "smcpd-event.h"
 #include "cgi-node.h"
 
 #ifndef CGI_NODE_MAX_REQUESTS
@@ -106,7 +108,9 @@ struct cgi_node_request_s {
 
 	struct smcp_async_response_s async_response;
 	cgi_node_state_t state;
-	smcp_timestamp_t expiration;
+	struct cgi_node_s* node;
+	struct smcp_timer_s expiration_timer;
+	struct smcp_timer_s kick_timer;
 	bool is_active;
 
 	int fd_cmd_stdin;
@@ -134,6 +138,9 @@ struct cgi_node_s {
 };
 
 smcp_status_t cgi_node_request_change_state(cgi_node_t node, cgi_node_request_t request, cgi_node_state_t new_state);
+static void cgi_node_request_close_stdin(cgi_node_request_t request);
+static void cgi_node_request_close_stdout(cgi_node_request_t request);
+static void cgi_node_request_event(int fd, int events, void* context);
 
 cgi_node_request_t
 cgi_node_get_associated_request(cgi_node_t node) {
@@ -186,22 +193,19 @@ cgi_node_create_request(cgi_node_t node) {
 		waitpid(ret->pid, &status, 0);
 	}
 
-	if(ret->fd_cmd_stdin>=0) {
-		close(ret->fd_cmd_stdin);
-	}
-
-	if(ret->fd_cmd_stdout>=0) {
-		close(ret->fd_cmd_stdout);
-	}
+	cgi_node_request_close_stdin(ret);
+	cgi_node_request_close_stdout(ret);
 
 	ret->pid = 0;
-	ret->fd_cmd_stdin = -1;
-	ret->fd_cmd_stdout = -1;
 	ret->block1 = BLOCK_OPTION_UNSPECIFIED;
 	ret->block2 = BLOCK_OPTION_DEFAULT; // Default value, overwrite with actual block
 	ret->stdin_buffer_len = 0;
 	ret->stdout_buffer_len = 0;
-	ret->expiration = smcp_plat_cms_to_timestamp(30 * MSEC_PER_SEC);
+
+	if (smcp_timer_is_scheduled(node->interface, &ret->expiration_timer)) {
+		smcp_invalidate_timer(node->interface, &ret->expiration_timer);
+	}
+	smcp_schedule_timer(node->interface, &ret->expiration_timer, 30 * MSEC_PER_SEC);
 
 	free(ret->stdin_buffer);
 	ret->stdin_buffer = NULL;
@@ -209,6 +213,7 @@ cgi_node_create_request(cgi_node_t node) {
 	free(ret->stdout_buffer);
 	ret->stdout_buffer = NULL;
 
+	smcp_finish_async_response(&ret->async_response);
 	smcp_start_async_response(&ret->async_response, SMCP_ASYNC_RESPONSE_FLAG_DONT_ACK);
 
 	pipe(pipe_cmd_stdin);
@@ -280,6 +285,22 @@ cgi_node_create_request(cgi_node_t node) {
 	close(pipe_cmd_stdin[0]);
 	close(pipe_cmd_stdout[1]);
 
+	// The event loop only tells us a pipe is ready, not how much
+	// it can take, so we must never block on one.
+	fcntl(ret->fd_cmd_stdin, F_SETFL, fcntl(ret->fd_cmd_stdin, F_GETFL) | O_NONBLOCK);
+	fcntl(ret->fd_cmd_stdout, F_SETFL, fcntl(ret->fd_cmd_stdout, F_GETFL) | O_NONBLOCK);
+
+	if ( smcpd_event_add_fd(ret->fd_cmd_stdin, 0, &cgi_node_request_event, ret) != SMCP_STATUS_OK
+	  || smcpd_event_add_fd(ret->fd_cmd_stdout, SMCPD_EVENT_READ, &cgi_node_request_event, ret) != SMCP_STATUS_OK
+	) {
+		syslog(LOG_ERR,"Unable to register pipes with event loop!");
+
+		cgi_node_request_change_state(node, ret, CGI_NODE_STATE_FINISHED);
+
+		ret = NULL;
+		goto bail;
+	}
+
 bail:
 	return ret;
 }
@@ -452,6 +473,7 @@ cgi_node_request_change_state(cgi_node_t node, cgi_node_request_t request, cgi_n
 	} else if ( request->state == CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_REQ
 	         && new_state == CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_FD
 	) {
+		smcp_finish_async_response(&request->async_response);
 		smcp_start_async_response(&request->async_response, 0);
 
 	} else if ( request->state == CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_FD
@@ -472,25 +494,23 @@ cgi_node_request_change_state(cgi_node_t node, cgi_node_request_t request, cgi_n
 	            )
 	         && ( new_state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_FD)
 	) {
-		if(!request->stdin_buffer_len &&  request->fd_cmd_stdin>=0) {
-			close(request->fd_cmd_stdin);
-			request->fd_cmd_stdin = -1;
+		if(!request->stdin_buffer_len) {
+			cgi_node_request_close_stdin(request);
 		}
+		smcp_finish_async_response(&request->async_response);
 		smcp_start_async_response(&request->async_response, 0);
 	} else if(request->state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_FD
 		&& new_state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_ACK
 	) {
-		if(!request->stdin_buffer_len &&  request->fd_cmd_stdin>=0) {
-			close(request->fd_cmd_stdin);
-			request->fd_cmd_stdin = -1;
+		if(!request->stdin_buffer_len) {
+			cgi_node_request_close_stdin(request);
 		}
 		cgi_node_send_next_block(node,request);
 	} else if(request->state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_ACK
 		&& new_state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_REQ
 	) {
-		if(!request->stdin_buffer_len &&  request->fd_cmd_stdin>=0) {
-			close(request->fd_cmd_stdin);
-			request->fd_cmd_stdin = -1;
+		if(!request->stdin_buffer_len) {
+			cgi_node_request_close_stdin(request);
 		}
 		//cgi_node_request_pop_bytes_from_stdout(request,(1<<((request->block2&0x7)+4)));
 		if(request->transaction) {
@@ -502,10 +522,11 @@ cgi_node_request_change_state(cgi_node_t node, cgi_node_request_t request, cgi_n
 			smcp_transaction_end(smcp_get_current_instance(),request->transaction);
 			request->transaction = NULL;
 		}
-		close(request->fd_cmd_stdin);
-		request->fd_cmd_stdin = -1;
-		close(request->fd_cmd_stdout);
-		request->fd_cmd_stdout = -1;
+		if(smcp_timer_is_scheduled(request->node->interface, &request->expiration_timer)) {
+			smcp_invalidate_timer(request->node->interface, &request->expiration_timer);
+		}
+		cgi_node_request_close_stdin(request);
+		cgi_node_request_close_stdout(request);
 		if(request->pid != 0 && request->pid != -1) {
 			int status;
 			kill(request->pid,SIGTERM);
@@ -526,6 +547,168 @@ cgi_node_request_change_state(cgi_node_t node, cgi_node_request_t request, cgi_n
 
 
 
+static void
+cgi_node_request_close_stdin(cgi_node_request_t request)
+{
+	if (request->fd_cmd_stdin >= 0) {
+		smcpd_event_remove_fd(request->fd_cmd_stdin);
+		close(request->fd_cmd_stdin);
+		request->fd_cmd_stdin = -1;
+	}
+}
+
+static void
+cgi_node_request_close_stdout(cgi_node_request_t request)
+{
+	if (request->fd_cmd_stdout >= 0) {
+		smcpd_event_remove_fd(request->fd_cmd_stdout);
+		close(request->fd_cmd_stdout);
+		request->fd_cmd_stdout = -1;
+	}
+}
+
+// Tells the event loop which of the request's pipes we are
+// currently waiting on. This only costs a syscall when it changes.
+static void
+cgi_node_request_update_events(cgi_node_request_t request)
+{
+	int stdin_events = 0;
+	int stdout_events = 0;
+
+	if (request->state > CGI_NODE_STATE_FINISHED) {
+		if (request->stdin_buffer_len) {
+			stdin_events = SMCPD_EVENT_WRITE;
+		}
+
+		if (request->stdout_buffer_len<(1<<((request->block2&0x7)+4))) {
+			stdout_events = SMCPD_EVENT_READ;
+		}
+	}
+
+	if (request->fd_cmd_stdin >= 0) {
+		smcpd_event_modify_fd(request->fd_cmd_stdin, stdin_events);
+	}
+
+	if (request->fd_cmd_stdout >= 0) {
+		smcpd_event_modify_fd(request->fd_cmd_stdout, stdout_events);
+	}
+}
+
+static void
+cgi_node_request_advance(cgi_node_request_t request)
+{
+	cgi_node_t self = request->node;
+
+	if (request->state == CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_FD) {
+		if ( request->stdin_buffer_len == 0
+		  || request->fd_cmd_stdin < 0
+		) {
+			cgi_node_request_change_state(
+				self,
+				request,
+				CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_ACK
+			);
+		}
+	}
+
+	if (request->state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_FD) {
+		if (!request->stdin_buffer_len) {
+			cgi_node_request_close_stdin(request);
+		}
+		if ( request->stdout_buffer_len>= (1<<((request->block2&0x7)+4))
+		  || request->fd_cmd_stdout <= 0
+		) {
+			cgi_node_request_change_state(
+				self,
+				request,
+				CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_ACK
+			);
+		}
+	}
+
+	cgi_node_request_update_events(request);
+}
+
+static void
+cgi_node_request_event(int fd, int events, void* context)
+{
+	cgi_node_request_t request = context;
+
+	if (request->state <= CGI_NODE_STATE_FINISHED) {
+		return;
+	}
+
+	if (fd == request->fd_cmd_stdin) {
+		if (request->stdin_buffer_len) {
+			// Ready to send data to command
+			ssize_t bytes_written = write(fd, request->stdin_buffer, request->stdin_buffer_len);
+
+			if (bytes_written >= 0) {
+				cgi_node_request_pop_bytes_from_stdin(request, (int)bytes_written);
+			} else if (errno != EAGAIN) {
+				if (errno != EPIPE) {
+					syslog(LOG_ERR,"Error on write, %s (%d)",strerror(errno),errno);
+				}
+				cgi_node_request_close_stdin(request);
+			}
+		} else if (events & SMCPD_EVENT_ERROR) {
+			// The command closed its end of the pipe.
+			cgi_node_request_close_stdin(request);
+		}
+
+	} else if (fd == request->fd_cmd_stdout) {
+		// Data is pending from command
+		ssize_t bytes_read = (1<<((request->block2&0x7)+4))*2;
+		char* buffer = realloc(request->stdout_buffer, request->stdout_buffer_len+bytes_read);
+
+		if (!buffer) {
+			syslog(LOG_ERR,"cgi-node: Out of memory, dropping request");
+			cgi_node_request_change_state(request->node, request, CGI_NODE_STATE_FINISHED);
+			return;
+		}
+
+		request->stdout_buffer = buffer;
+
+		bytes_read = read(fd, request->stdout_buffer+request->stdout_buffer_len, bytes_read);
+
+		if (bytes_read > 0) {
+			request->stdout_buffer_len += bytes_read;
+		} else if (bytes_read == 0 || errno != EAGAIN) {
+			if (bytes_read < 0 && errno != EPIPE) {
+				syslog(LOG_ERR,"Error on read, %s (%d)",strerror(errno),errno);
+			}
+			cgi_node_request_close_stdout(request);
+		}
+	}
+
+	cgi_node_request_advance(request);
+}
+
+static void
+cgi_node_request_kick(smcp_t smcp, void* context)
+{
+	cgi_node_request_t request = context;
+
+	if (request->state > CGI_NODE_STATE_FINISHED) {
+		cgi_node_request_advance(request);
+	}
+}
+
+static void
+cgi_node_request_expired(smcp_t smcp, void* context)
+{
+	cgi_node_request_t request = context;
+
+	if (request->state > CGI_NODE_STATE_FINISHED) {
+		cgi_node_request_change_state(
+			request->node,
+			request,
+			CGI_NODE_STATE_FINISHED
+		);
+	}
+}
+
+
 smcp_status_t
 cgi_node_request_handler(
 	cgi_node_t		node
@@ -750,13 +933,28 @@ cgi_node_request_handler(
 	}
 
 bail:
+	if ( request != NULL
+	  && request->state > CGI_NODE_STATE_FINISHED
+	  && !smcp_timer_is_scheduled(node->interface, &request->kick_timer)
+	) {
+		// The request may now be waiting on a pipe that is already
+		// ready, or on nothing at all. Advance it from the event loop
+		// once we are done with the inbound packet.
+		smcp_schedule_timer(node->interface, &request->kick_timer, 0);
+	}
 
 	return ret;
 }
 
 void
 cgi_node_dealloc(cgi_node_t x) {
-	// TODO: Clean up requests!
+	int i;
+
+	// TODO: Clean up the rest of the requests!
+	for (i = 0; i < CGI_NODE_MAX_REQUESTS; i++) {
+		smcp_finish_async_response(&x->requests[i].async_response);
+	}
+
 	free((void*)x->cmd);
 	free((void*)x->shell);
 	free(x);
@@ -795,208 +993,19 @@ cgi_node_init(
 	self->shell = strdup("/bin/sh");
 
 	for(i=0;i<CGI_NODE_MAX_REQUESTS;i++) {
-		self->requests[i].fd_cmd_stdin = -1;
-		self->requests[i].fd_cmd_stdout = -1;
-	}
-
-bail:
-	return self;
-}
-
-smcp_status_t
-cgi_node_update_fdset(
-	cgi_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-) {
-	int i;
-	for (i = 0; i < CGI_NODE_MAX_REQUESTS; i++) {
 		cgi_node_request_t request = &self->requests[i];
 
-		if (request->state<=CGI_NODE_STATE_FINISHED) {
-			continue;
-		}
-
-		if ( request->stdin_buffer_len
-		  && request->fd_cmd_stdin >= 0
-		) {
-			printf("Adding FD %d to write set\n",request->fd_cmd_stdin);
-			if (write_fd_set) {
-				FD_SET(request->fd_cmd_stdin,write_fd_set);
-			}
-			if (error_fd_set) {
-				FD_SET(request->fd_cmd_stdin,error_fd_set);
-			}
-			if (fd_count) {
-				*fd_count = MAX(*fd_count,request->fd_cmd_stdin+1);
-			}
-		}
-
-		if ( request->fd_cmd_stdout >= 0
-		  && request->stdout_buffer_len<(1<<((request->block2&0x7)+4))
-		) {
-			printf("Adding FD %d to read set\n",request->fd_cmd_stdout);
-			if (read_fd_set) {
-				FD_SET(request->fd_cmd_stdout, read_fd_set);
-			}
-			if (error_fd_set) {
-				FD_SET(request->fd_cmd_stdout, error_fd_set);
-			}
-			if (fd_count) {
-				*fd_count = MAX(*fd_count,request->fd_cmd_stdout+1);
-			}
-		}
-
-		if (timeout && request->expiration) {
-			*timeout = MIN(*timeout,MAX(0,smcp_plat_timestamp_to_cms(request->expiration)));
-		}
-
-	}
-	return SMCP_STATUS_OK;
-}
-
-smcp_status_t
-cgi_node_process(cgi_node_t self) {
-	int i;
-	fd_set rd_set, wr_set, er_set;
-	int fd_count = 0;
-	struct timeval tv = {0,0};
-	smcp_cms_t timeout = CMS_DISTANT_FUTURE;
-
-	FD_ZERO(&rd_set);
-	FD_ZERO(&wr_set);
-	FD_ZERO(&er_set);
-
-	cgi_node_update_fdset(self, &rd_set, &wr_set, &er_set, &fd_count, &timeout);
-
-	errno = 0;
-	if (select(fd_count, &rd_set, &wr_set, &er_set, &tv) >= 0) {
-
-		for (i=0; i < CGI_NODE_MAX_REQUESTS; i++) {
-			cgi_node_request_t request = &self->requests[i];
-
-			if (request->state <= CGI_NODE_STATE_FINISHED) {
-				//printf("Skipping Request %p, stdin_fd=%d, stdout_fd=%d\n",request,request->fd_cmd_stdin,request->fd_cmd_stdout);
-				continue;
-			}
-
-			if (smcp_plat_timestamp_to_cms(request->expiration) < 0) {
-				request->expiration = 0;
-				cgi_node_request_change_state(
-					self,
-					request,
-					CGI_NODE_STATE_FINISHED
-				);
-			}
-
-			printf("Request %p, stdin_fd=%d, stdout_fd=%d\n",request,request->fd_cmd_stdin,request->fd_cmd_stdout);
-			errno = 0;
-
-			if ( request->stdin_buffer_len
-			  && request->fd_cmd_stdin >= 0
-			  && ( FD_ISSET(request->fd_cmd_stdin,&wr_set)
-			    || FD_ISSET(request->fd_cmd_stdin,&er_set)
-			  )
-			) {
-				// Ready to send data to command
-				int bytes_written = write(request->fd_cmd_stdin, request->stdin_buffer, request->stdin_buffer_len);
-				printf("WROTE %d BYTES TO FD_CMD_STDIN\n",bytes_written);
-				if (bytes_written<0 || errno || FD_ISSET(request->fd_cmd_stdin,&er_set)) {
-					if (errno!=EPIPE) {
-						syslog(LOG_ERR,"Error on write, %s (%d)",strerror(errno),errno);
-					}
-					close(request->fd_cmd_stdin);
-					request->fd_cmd_stdin = -1;
-				} else if ((size_t)bytes_written==request->stdin_buffer_len) {
-					request->stdin_buffer_len = 0;
-				} else {
-					request->stdin_buffer_len-=bytes_written;
-					memmove(request->stdin_buffer,request->stdin_buffer+bytes_written,request->stdin_buffer_len);
-				}
-			}
-
-			if (request->state == CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_FD) {
-				if ( request->stdin_buffer_len == 0
-				  || request->fd_cmd_stdin < 0
-				) {
-					cgi_node_request_change_state(
-						self,
-						request,
-						CGI_NODE_STATE_ACTIVE_BLOCK1_WAIT_ACK
-					);
-				}
-			}
-
-			errno = 0;
-			if ( request->fd_cmd_stdout >= 0
-			  && ( FD_ISSET(request->fd_cmd_stdout,&rd_set)
-			    || FD_ISSET(request->fd_cmd_stdout,&er_set)
-			  )
-			) {
-				// Data is pending from command
-				int bytes_read = (1<<((request->block2&0x7)+4))*2;
-				request->stdout_buffer = realloc(request->stdout_buffer,request->stdout_buffer_len+bytes_read);
-				if(!request->stdout_buffer)
-					return SMCP_STATUS_MALLOC_FAILURE;
-				bytes_read = read(request->fd_cmd_stdout, request->stdout_buffer+request->stdout_buffer_len, bytes_read);
-
-				if(bytes_read<=0 || errno || FD_ISSET(request->fd_cmd_stdout,&er_set)) {
-					if(errno && errno!=EPIPE)
-						syslog(LOG_ERR,"Error on read, %s (%d)",strerror(errno),errno);
-					close(request->fd_cmd_stdout);
-					request->fd_cmd_stdout = -1;
-				} else {
-					printf("READ %d BYTES FROM FD_CMD_STDOUT\n",bytes_read);
-					request->stdout_buffer_len += bytes_read;
-				}
-			}
-
-			if (request->state == CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_FD) {
-				if ( !request->stdin_buffer_len
-				  && request->fd_cmd_stdin >= 0
-				) {
-					close(request->fd_cmd_stdin);
-					request->fd_cmd_stdin = -1;
-				}
-				if ( request->stdout_buffer_len>= (1<<((request->block2&0x7)+4))
-				  || request->fd_cmd_stdout <= 0
-				) {
-					cgi_node_request_change_state(
-						self,
-						request,
-						CGI_NODE_STATE_ACTIVE_BLOCK2_WAIT_ACK
-					);
-				}
-			}
-		}
-	} else {
-		if (fd_count > 0) {
-			printf("...fd_count:%d timeout:%d errno: %d %s\n",fd_count,timeout, errno, strerror(errno));
-		}
+		// Finished before every capture, so it has to start out empty.
+		memset(&request->async_response, 0, sizeof(request->async_response));
+		request->node = self;
+		request->fd_cmd_stdin = -1;
+		request->fd_cmd_stdout = -1;
+		smcp_timer_init(&request->expiration_timer, &cgi_node_request_expired, NULL, request);
+		smcp_timer_init(&request->kick_timer, &cgi_node_request_kick, NULL, request);
 	}
-	return SMCP_STATUS_OK;
-}
-
 
-
-smcp_status_t
-SMCPD_module__cgi_node_process(cgi_node_t self) {
-	return cgi_node_process(self);
-}
-
-smcp_status_t
-SMCPD_module__cgi_node_update_fdset(
-	cgi_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-) {
-	return cgi_node_update_fdset(self, read_fd_set, write_fd_set, error_fd_set, fd_count, timeout);
+bail:
+	return self;
 }
 
 cgi_node_t
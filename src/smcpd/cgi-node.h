@@ -36,19 +36,6 @@ struct cgi_node_s;
 
 typedef struct cgi_node_s* cgi_node_t;
 
-extern smcp_status_t
-SMCPD_module__cgi_node_process(cgi_node_t self);
-
-extern smcp_status_t
-SMCPD_module__cgi_node_update_fdset(
-	cgi_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-);
-
 extern cgi_node_t
 SMCPD_module__cgi_node_init(
 	cgi_node_t	self,
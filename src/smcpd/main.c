@@ -68,6 +68,7 @@
 #endif
 #endif
 
+#include "smcpd-event.h"
 #include "cgi-node.h"
 #include "system-node.h"
 #include "ud-var-node.h"
@@ -104,12 +105,14 @@ static arg_list_item_t option_list[] = {
 	{ 'd', "debug", NULL, "Enable debugging mode"	},
 	{ 'p', "port",	NULL, "Port number"				},
 	{ 'c', "config",NULL, "Config File"				},
+	{ 0,   "select",NULL, "Use select() instead of epoll()" },
 	{ 0 }
 };
 
 static smcp_t smcp;
 static struct smcp_node_s root_node;
 static int gRet;
+static int gInstanceFD = -1;
 
 static const char* gProcessName = "smcpd";
 static const char* gPIDFilename = NULL;
@@ -139,6 +142,10 @@ signal_SIGHUP(int sig) {
 	syslog(LOG_NOTICE,"Caught SIGHUP!");
 }
 
+// Modules that are polled with `update_fdset()` and `process()` on
+// every pass through the main loop. The built-in modules register
+// their descriptors with the event loop instead (see smcpd-event.h),
+// so this is only used by external modules.
 #define SMCPD_MAX_ASYNC_IO_MODULES	30
 struct {
 	smcp_node_t node;
@@ -224,16 +231,10 @@ smcp_node_t smcpd_make_node(const char* type, smcp_node_t parent, const char* na
 #endif
 	} else if(strcaseequal(type,"system_node")) {
 		init_func = (init_func_t)&SMCPD_module__system_node_init;
-		update_fdset_func = (update_fdset_func_t)&SMCPD_module__system_node_update_fdset;
-		process_func = (process_func_t)&SMCPD_module__system_node_process;
 	} else if(strcaseequal(type,"cgi_node")) {
 		init_func = (init_func_t)&SMCPD_module__cgi_node_init;
-		update_fdset_func = (update_fdset_func_t)&SMCPD_module__cgi_node_update_fdset;
-		process_func = (process_func_t)&SMCPD_module__cgi_node_process;
 	} else if(strcaseequal(type,"ud_var_node")) {
 		init_func = (init_func_t)&SMCPD_module__ud_var_node_init;
-		update_fdset_func = (update_fdset_func_t)&SMCPD_module__ud_var_node_update_fdset;
-		process_func = (process_func_t)&SMCPD_module__ud_var_node_process;
 #if HAVE_DLFCN_H
 	} else if(type) {
 		char symbol_name[100];
@@ -497,6 +498,69 @@ bail:
 	return ret;
 }
 
+static void
+smcpd_instance_event(int fd, int events, void* context)
+{
+	int plat_events = 0;
+
+	if (events & SMCPD_EVENT_READ) {
+		plat_events |= SMCP_PLAT_FD_READ;
+	}
+
+	if (events & SMCPD_EVENT_WRITE) {
+		plat_events |= SMCP_PLAT_FD_WRITE;
+	}
+
+	if (events & SMCPD_EVENT_ERROR) {
+		plat_events |= SMCP_PLAT_FD_ERROR;
+	}
+
+	smcp_plat_process_fd((smcp_t)context, fd, plat_events);
+}
+
+static void
+smcpd_instance_unregister(void)
+{
+	if (gInstanceFD >= 0) {
+		smcpd_event_remove_fd(gInstanceFD);
+		gInstanceFD = -1;
+	}
+}
+
+// Keeps the registration of the instance's socket in sync with what
+// the instance wants to wait for. This only costs a syscall when
+// that actually changes, such as when packets are queued for sending.
+static void
+smcpd_instance_update(smcp_t smcp)
+{
+	struct smcp_plat_fd_s plat_fd = { -1, 0 };
+	int events = 0;
+
+	smcp_plat_get_fds(smcp, &plat_fd, 1);
+
+	if (plat_fd.events & SMCP_PLAT_FD_READ) {
+		events |= SMCPD_EVENT_READ;
+	}
+
+	if (plat_fd.events & SMCP_PLAT_FD_WRITE) {
+		events |= SMCPD_EVENT_WRITE;
+	}
+
+	if (plat_fd.fd != gInstanceFD) {
+		smcpd_instance_unregister();
+
+		if (plat_fd.fd >= 0) {
+			if (smcpd_event_add_fd(plat_fd.fd, events, &smcpd_instance_event, smcp) == SMCP_STATUS_OK) {
+				gInstanceFD = plat_fd.fd;
+			} else {
+				syslog(LOG_ERR,"Unable to register socket with event loop! \"%s\" (%d)",strerror(errno),errno);
+			}
+		}
+	} else if (gInstanceFD >= 0) {
+		smcpd_event_modify_fd(gInstanceFD, events);
+	}
+}
+
 static void
 syslog_dump_select_info(int loglevel, fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int fd_count, smcp_cms_t timeout)
 {
@@ -531,6 +595,7 @@ main(
 ) {
 	int i, debug_mode = 0;
 	int port = 0;
+	bool use_select = false;
 	const char* config_file = ETC_PREFIX "smcp.conf";
 
 	openlog(basename(argv[0]),LOG_PERROR|LOG_PID|LOG_CONS,LOG_DAEMON);
@@ -548,6 +613,7 @@ main(
 	HANDLE_LONG_ARGUMENT("port") port = strtol(argv[++i], NULL, 0);
 	HANDLE_LONG_ARGUMENT("config") config_file = argv[++i];
 	HANDLE_LONG_ARGUMENT("debug") debug_mode++;
+	HANDLE_LONG_ARGUMENT("select") use_select = true;
 
 	HANDLE_LONG_ARGUMENT("help") {
 		print_arg_list_help(
@@ -620,6 +686,10 @@ main(
 		}
 	}
 
+	smcpd_event_init(smcp, use_select);
+
+	syslog(LOG_INFO,"Using %s() event loop.",smcpd_event_get_backend_name());
+
 	// Set up the root node.
 	smcp_node_init(&root_node,NULL,NULL);
 
@@ -636,36 +706,62 @@ main(
 	}
 
 	while (!gRet) {
-		int fds_ready = 0, fd_count = 0;
-		fd_set read_fd_set,write_fd_set,error_fd_set;
 		smcp_cms_t cms_timeout = 60 * MSEC_PER_SEC;
-		struct timeval timeout = {};
-
-		FD_ZERO(&read_fd_set);
-		FD_ZERO(&write_fd_set);
-		FD_ZERO(&error_fd_set);
-		smcpd_modules_update_fdset(
-			&read_fd_set,
-			&write_fd_set,
-			&error_fd_set,
-			&fd_count,
-			&cms_timeout
-		);
+		smcp_status_t status;
+
+		smcpd_instance_update(smcp);
 
-		cms_timeout = MIN(smcp_get_timeout(smcp),cms_timeout);
-		fd_count = MAX(smcp_plat_get_fd(smcp)+1,fd_count);
-		FD_SET(smcp_plat_get_fd(smcp),&read_fd_set);
-		FD_SET(smcp_plat_get_fd(smcp),&error_fd_set);
+		if (async_io_module_count == 0) {
+			cms_timeout = MIN(smcp_get_timeout(smcp),cms_timeout);
 
-		//syslog_dump_select_info(LOG_INFO, &read_fd_set,&write_fd_set,&error_fd_set, fd_count, cms_timeout);
+			status = smcpd_event_wait(cms_timeout);
 
-		timeout.tv_sec = cms_timeout / MSEC_PER_SEC;
-		timeout.tv_usec = (cms_timeout % MSEC_PER_SEC) * USEC_PER_MSEC;
+		} else {
+			// External modules can only tell us about their descriptors
+			// with fd_sets, so we select() on those along with whatever
+			// the event loop needs.
+			int fds_ready = 0, fd_count = 0;
+			fd_set read_fd_set,write_fd_set,error_fd_set;
+			struct timeval timeout = {};
+
+			FD_ZERO(&read_fd_set);
+			FD_ZERO(&write_fd_set);
+			FD_ZERO(&error_fd_set);
+			smcpd_modules_update_fdset(
+				&read_fd_set,
+				&write_fd_set,
+				&error_fd_set,
+				&fd_count,
+				&cms_timeout
+			);
 
-		fds_ready = select(fd_count,&read_fd_set,&write_fd_set,&error_fd_set,&timeout);
+			smcpd_event_update_fdset(
+				&read_fd_set,
+				&write_fd_set,
+				&error_fd_set,
+				&fd_count
+			);
 
-		if(fds_ready < 0 && errno!=EINTR) {
-			syslog(LOG_ERR,"select() errno=\"%s\" (%d)",strerror(errno),errno);
+			cms_timeout = MIN(smcp_get_timeout(smcp),cms_timeout);
+
+			//syslog_dump_select_info(LOG_INFO, &read_fd_set,&write_fd_set,&error_fd_set, fd_count, cms_timeout);
+
+			timeout.tv_sec = cms_timeout / MSEC_PER_SEC;
+			timeout.tv_usec = (cms_timeout % MSEC_PER_SEC) * USEC_PER_MSEC;
+
+			fds_ready = select(fd_count,&read_fd_set,&write_fd_set,&error_fd_set,&timeout);
+
+			if (fds_ready > 0) {
+				status = smcpd_event_process_fdset(&read_fd_set,&write_fd_set,&error_fd_set);
+			} else if (fds_ready < 0 && errno != EINTR) {
+				status = SMCP_STATUS_ERRNO;
+			} else {
+				status = SMCP_STATUS_OK;
+			}
+		}
+
+		if (status == SMCP_STATUS_ERRNO) {
+			syslog(LOG_ERR,"%s() errno=\"%s\" (%d)",smcpd_event_get_backend_name(),strerror(errno),errno);
 			break;
 		}
 
@@ -673,7 +769,8 @@ main(
 			break;
 		}
 
-		smcp_plat_process(smcp);
+		smcp_process_timers_until(smcp, smcp_plat_cms_to_timestamp(0));
+		smcp_plat_flush(smcp);
 
 		if (smcpd_modules_process() != SMCP_STATUS_OK) {
 			syslog(LOG_ERR,"Module process error.");
@@ -682,6 +779,11 @@ main(
 
 		if(gRet == ERRORCODE_SIGHUP) {
 			gRet = 0;
+
+			// The configuration may rebind the socket, which can
+			// reuse the old descriptor number.
+			smcpd_instance_unregister();
+
 			read_configuration(smcp,config_file);
 		}
 	}
@@ -697,8 +799,12 @@ bail:
 		if(gPIDFilename)
 			unlink(gPIDFilename);
 
+		smcpd_instance_unregister();
+
 		smcp_release(smcp);
 
+		smcpd_event_finalize();
+
 		syslog(LOG_NOTICE,"Stopped.");
 	}
 	return gRet;
@@ -0,0 +1,476 @@
+/*	@file smcpd-event.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef ASSERT_MACROS_USE_SYSLOG
+#define ASSERT_MACROS_USE_SYSLOG 1
+#endif
+
+#include <smcp/assert-macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/time.h>
+#include <smcp/smcp.h>
+#include "smcpd-event.h"
+
+#ifndef SMCPD_EVENT_USE_EPOLL
+#define SMCPD_EVENT_USE_EPOLL		(HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE1)
+#endif
+
+#if SMCPD_EVENT_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifndef SMCPD_EVENT_MAX_EVENTS
+#define SMCPD_EVENT_MAX_EVENTS		(64)
+#endif
+
+struct smcpd_event_fd_s {
+	smcpd_event_callback_t callback;
+	void* context;
+	int events;
+
+	// Changes every time a descriptor is registered, so that
+	// stale readiness for a closed descriptor is never delivered
+	// to whoever reused its number.
+	uint32_t generation;
+};
+
+static smcp_t gInstance;
+static struct smcpd_event_fd_s* gFDs;
+static int gFDsAllocated;
+static int gFDCount;
+static uint32_t gGeneration;
+
+#if SMCPD_EVENT_USE_EPOLL
+static int gEpollFD = -1;
+#endif
+
+static bool
+smcpd_event_is_epoll(void)
+{
+#if SMCPD_EVENT_USE_EPOLL
+	return gEpollFD >= 0;
+#else
+	return false;
+#endif
+}
+
+static struct smcpd_event_fd_s*
+smcpd_event_lookup(int fd)
+{
+	if ((fd < 0) || (fd >= gFDsAllocated) || (gFDs[fd].callback == NULL)) {
+		return NULL;
+	}
+	return &gFDs[fd];
+}
+
+static void
+smcpd_event_dispatch_fd(int fd, int events, uint32_t generation)
+{
+	struct smcpd_event_fd_s* entry = smcpd_event_lookup(fd);
+
+	if ((entry == NULL) || (entry->generation != generation)) {
+		return;
+	}
+
+	events &= entry->events | SMCPD_EVENT_ERROR;
+
+	if (events) {
+		(*entry->callback)(fd, events, entry->context);
+	}
+}
+
+// MARK: - epoll Backend
+
+#if SMCPD_EVENT_USE_EPOLL
+static uint32_t
+smcpd_event_to_epoll(int events)
+{
+	uint32_t ret = 0;
+
+	if (events & SMCPD_EVENT_READ) {
+		ret |= EPOLLIN;
+	}
+
+	if (events & SMCPD_EVENT_WRITE) {
+		ret |= EPOLLOUT;
+	}
+
+	if (events & SMCPD_EVENT_PRI) {
+		ret |= EPOLLPRI;
+	}
+
+	return ret;
+}
+
+static int
+smcpd_event_from_epoll(uint32_t events)
+{
+	int ret = 0;
+
+	if (events & EPOLLIN) {
+		ret |= SMCPD_EVENT_READ;
+	}
+
+	if (events & EPOLLOUT) {
+		ret |= SMCPD_EVENT_WRITE;
+	}
+
+	if (events & EPOLLPRI) {
+		ret |= SMCPD_EVENT_PRI;
+	}
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		ret |= SMCPD_EVENT_ERROR;
+	}
+
+	return ret;
+}
+
+static smcp_status_t
+smcpd_event_epoll_ctl(int op, int fd, const struct smcpd_event_fd_s* entry)
+{
+	struct epoll_event event = { };
+
+	if (entry != NULL) {
+		event.events = smcpd_event_to_epoll(entry->events);
+		event.data.u64 = ((uint64_t)entry->generation << 32) | (uint32_t)fd;
+	}
+
+	return epoll_ctl(gEpollFD, op, fd, &event) == 0
+		? SMCP_STATUS_OK
+		: SMCP_STATUS_ERRNO;
+}
+
+static smcp_status_t
+smcpd_event_epoll_dispatch(smcp_cms_t cms)
+{
+	struct epoll_event events[SMCPD_EVENT_MAX_EVENTS];
+	int i, count;
+
+	count = epoll_wait(gEpollFD, events, SMCPD_EVENT_MAX_EVENTS, cms);
+
+	if (count < 0) {
+		return (errno == EINTR) ? SMCP_STATUS_OK : SMCP_STATUS_ERRNO;
+	}
+
+	for (i = 0; i < count; i++) {
+		smcpd_event_dispatch_fd(
+			(int)(uint32_t)events[i].data.u64,
+			smcpd_event_from_epoll(events[i].events),
+			(uint32_t)(events[i].data.u64 >> 32)
+		);
+	}
+
+	return SMCP_STATUS_OK;
+}
+#endif // SMCPD_EVENT_USE_EPOLL
+
+// MARK: - Registration
+
+smcp_status_t
+smcpd_event_init(smcp_t instance, bool use_select)
+{
+	gInstance = instance;
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (!use_select && (gEpollFD < 0)) {
+		gEpollFD = epoll_create1(EPOLL_CLOEXEC);
+
+		if (gEpollFD < 0) {
+			syslog(LOG_WARNING, "epoll_create1() failed, falling back to select(): %s (%d)", strerror(errno), errno);
+		}
+	}
+#endif
+
+	return SMCP_STATUS_OK;
+}
+
+void
+smcpd_event_finalize(void)
+{
+#if SMCPD_EVENT_USE_EPOLL
+	if (gEpollFD >= 0) {
+		close(gEpollFD);
+		gEpollFD = -1;
+	}
+#endif
+
+	free(gFDs);
+	gFDs = NULL;
+	gFDsAllocated = 0;
+	gFDCount = 0;
+	gInstance = NULL;
+}
+
+const char*
+smcpd_event_get_backend_name(void)
+{
+	return smcpd_event_is_epoll() ? "epoll" : "select";
+}
+
+smcp_t
+smcpd_event_get_instance(void)
+{
+	return gInstance;
+}
+
+smcp_status_t
+smcpd_event_add_fd(
+	int fd,
+	int events,
+	smcpd_event_callback_t callback,
+	void* context
+) {
+	smcp_status_t ret = SMCP_STATUS_INVALID_ARGUMENT;
+	struct smcpd_event_fd_s entry = { callback, context, events, gGeneration + 1 };
+
+	require(fd >= 0, bail);
+	require(callback != NULL, bail);
+	require(smcpd_event_lookup(fd) == NULL, bail);
+
+	if (!smcpd_event_is_epoll()) {
+		require(fd < FD_SETSIZE, bail);
+	}
+
+	if (fd >= gFDsAllocated) {
+		int count = MAX(fd + 1, gFDsAllocated * 2);
+		struct smcpd_event_fd_s* fds = realloc(gFDs, count * sizeof(*fds));
+
+		require_action(fds != NULL, bail, ret = SMCP_STATUS_MALLOC_FAILURE);
+
+		memset(fds + gFDsAllocated, 0, (count - gFDsAllocated) * sizeof(*fds));
+		gFDs = fds;
+		gFDsAllocated = count;
+	}
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (smcpd_event_is_epoll()) {
+		// Failure is not logged here: epoll refuses regular files,
+		// and callers are expected to cope with that.
+		ret = smcpd_event_epoll_ctl(EPOLL_CTL_ADD, fd, &entry);
+		if (ret != SMCP_STATUS_OK) {
+			goto bail;
+		}
+	}
+#endif
+
+	gFDs[fd] = entry;
+	gGeneration = entry.generation;
+	gFDCount = MAX(gFDCount, fd + 1);
+
+	ret = SMCP_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+smcp_status_t
+smcpd_event_modify_fd(int fd, int events)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	struct smcpd_event_fd_s* entry = smcpd_event_lookup(fd);
+
+	require_action(entry != NULL, bail, ret = SMCP_STATUS_INVALID_ARGUMENT);
+
+	if (entry->events == events) {
+		goto bail;
+	}
+
+	entry->events = events;
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (smcpd_event_is_epoll()) {
+		ret = smcpd_event_epoll_ctl(EPOLL_CTL_MOD, fd, entry);
+		require_string(ret == SMCP_STATUS_OK, bail, strerror(errno));
+	}
+#endif
+
+bail:
+	return ret;
+}
+
+smcp_status_t
+smcpd_event_remove_fd(int fd)
+{
+	smcp_status_t ret = SMCP_STATUS_OK;
+	struct smcpd_event_fd_s* entry = smcpd_event_lookup(fd);
+
+	require_action(entry != NULL, bail, ret = SMCP_STATUS_INVALID_ARGUMENT);
+
+	memset(entry, 0, sizeof(*entry));
+
+	while ((gFDCount > 0) && (gFDs[gFDCount - 1].callback == NULL)) {
+		gFDCount--;
+	}
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (smcpd_event_is_epoll()) {
+		ret = smcpd_event_epoll_ctl(EPOLL_CTL_DEL, fd, NULL);
+		require_string(ret == SMCP_STATUS_OK, bail, strerror(errno));
+	}
+#endif
+
+bail:
+	return ret;
+}
+
+// MARK: - Dispatch
+
+void
+smcpd_event_update_fdset(
+	fd_set *read_fd_set,
+	fd_set *write_fd_set,
+	fd_set *error_fd_set,
+	int *fd_count
+) {
+	int fd;
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (smcpd_event_is_epoll()) {
+		FD_SET(gEpollFD, read_fd_set);
+		*fd_count = MAX(*fd_count, gEpollFD + 1);
+		return;
+	}
+#endif
+
+	for (fd = 0; fd < gFDCount; fd++) {
+		const struct smcpd_event_fd_s* entry = smcpd_event_lookup(fd);
+
+		if (entry == NULL) {
+			continue;
+		}
+
+		if (entry->events & SMCPD_EVENT_READ) {
+			FD_SET(fd, read_fd_set);
+		}
+
+		if (entry->events & SMCPD_EVENT_WRITE) {
+			FD_SET(fd, write_fd_set);
+		}
+
+		if (entry->events & SMCPD_EVENT_PRI) {
+			FD_SET(fd, error_fd_set);
+		}
+	}
+
+	*fd_count = MAX(*fd_count, gFDCount);
+}
+
+smcp_status_t
+smcpd_event_process_fdset(
+	fd_set *read_fd_set,
+	fd_set *write_fd_set,
+	fd_set *error_fd_set
+) {
+	// Descriptors registered by a callback during this pass
+	// were not part of the select() call.
+	const uint32_t generation = gGeneration;
+	const int fd_count = gFDCount;
+	int fd;
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (smcpd_event_is_epoll()) {
+		if (FD_ISSET(gEpollFD, read_fd_set)) {
+			return smcpd_event_epoll_dispatch(0);
+		}
+		return SMCP_STATUS_OK;
+	}
+#endif
+
+	for (fd = 0; fd < fd_count; fd++) {
+		const struct smcpd_event_fd_s* entry = smcpd_event_lookup(fd);
+		int events = 0;
+
+		if ((entry == NULL) || (entry->generation > generation)) {
+			continue;
+		}
+
+		if (FD_ISSET(fd, read_fd_set)) {
+			events |= SMCPD_EVENT_READ;
+		}
+
+		if (FD_ISSET(fd, write_fd_set)) {
+			events |= SMCPD_EVENT_WRITE;
+		}
+
+		if (FD_ISSET(fd, error_fd_set)) {
+			events |= SMCPD_EVENT_PRI;
+		}
+
+		smcpd_event_dispatch_fd(fd, events, entry->generation);
+	}
+
+	return SMCP_STATUS_OK;
+}
+
+smcp_status_t
+smcpd_event_wait(smcp_cms_t cms)
+{
+	fd_set read_fd_set, write_fd_set, error_fd_set;
+	struct timeval timeout = {};
+	int fd_count = 0;
+	int fds_ready;
+
+#if SMCPD_EVENT_USE_EPOLL
+	if (smcpd_event_is_epoll()) {
+		return smcpd_event_epoll_dispatch(cms);
+	}
+#endif
+
+	FD_ZERO(&read_fd_set);
+	FD_ZERO(&write_fd_set);
+	FD_ZERO(&error_fd_set);
+
+	smcpd_event_update_fdset(&read_fd_set, &write_fd_set, &error_fd_set, &fd_count);
+
+	timeout.tv_sec = cms / MSEC_PER_SEC;
+	timeout.tv_usec = (cms % MSEC_PER_SEC) * USEC_PER_MSEC;
+
+	fds_ready = select(fd_count, &read_fd_set, &write_fd_set, &error_fd_set, &timeout);
+
+	if (fds_ready < 0) {
+		return (errno == EINTR) ? SMCP_STATUS_OK : SMCP_STATUS_ERRNO;
+	}
+
+	if (fds_ready == 0) {
+		return SMCP_STATUS_OK;
+	}
+
+	return smcpd_event_process_fdset(&read_fd_set, &write_fd_set, &error_fd_set);
+}
@@ -0,0 +1,107 @@
+/*	@file smcpd-event.h
+**	@brief smcpd Event Loop Header
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**
+**	Copyright (C) 2016 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef smcpd_event_h
+#define smcpd_event_h
+
+#include <stdbool.h>
+#include <sys/select.h>
+#include <smcp/smcp.h>
+
+/*	Modules register their file descriptors with the event loop once,
+**	change the events they are interested in only when their state
+**	changes, and unregister them before closing them. Timers are
+**	scheduled directly on the daemon's SMCP instance (see
+**	`smcpd_event_get_instance()`) with `smcp_schedule_timer()`.
+**
+**	When epoll is available the registrations are kept by the kernel,
+**	so the cost of a wakeup does not depend on how many descriptors
+**	are registered. Otherwise the registrations are turned into
+**	`fd_set`s for `select()` on every wakeup.
+*/
+
+#define SMCPD_EVENT_READ		(1<<0)	//!< Readable
+#define SMCPD_EVENT_WRITE		(1<<1)	//!< Writable
+#define SMCPD_EVENT_PRI			(1<<2)	//!< Exceptional condition (POLLPRI)
+#define SMCPD_EVENT_ERROR		(1<<3)	//!< Error or hangup. Always reported.
+
+typedef void (*smcpd_event_callback_t)(int fd, int events, void* context);
+
+//!	Sets up the event loop for `instance`.
+/*!	If `use_select` is true, the `select()` backend is used even
+**	if epoll is available. */
+extern smcp_status_t smcpd_event_init(smcp_t instance, bool use_select);
+
+extern void smcpd_event_finalize(void);
+
+//!	Returns "epoll" or "select".
+extern const char* smcpd_event_get_backend_name(void);
+
+//!	Returns the SMCP instance that module timers should be scheduled on.
+extern smcp_t smcpd_event_get_instance(void);
+
+//!	Registers `fd` with the event loop.
+/*!	`events` may be zero, in which case only errors are reported. */
+extern smcp_status_t smcpd_event_add_fd(
+	int fd,
+	int events,
+	smcpd_event_callback_t callback,
+	void* context
+);
+
+//!	Changes the events a registered `fd` is interested in.
+extern smcp_status_t smcpd_event_modify_fd(int fd, int events);
+
+//!	Unregisters `fd`. Must be called *before* `fd` is closed.
+extern smcp_status_t smcpd_event_remove_fd(int fd);
+
+//!	Waits up to `cms` milliseconds for events and dispatches them.
+/*!	Returns SMCP_STATUS_OK on success (including timeouts and
+**	interrupted waits) or SMCP_STATUS_ERRNO on failure. */
+extern smcp_status_t smcpd_event_wait(smcp_cms_t cms);
+
+//!	Adds the descriptors the event loop needs to wait on to the given sets.
+/*!	This is used when the event loop has to be nested inside of an
+**	external `select()` call. With epoll, only the epoll descriptor
+**	itself is added. */
+extern void smcpd_event_update_fdset(
+	fd_set *read_fd_set,
+	fd_set *write_fd_set,
+	fd_set *error_fd_set,
+	int *fd_count
+);
+
+//!	Dispatches events after an external `select()` call has returned.
+extern smcp_status_t smcpd_event_process_fdset(
+	fd_set *read_fd_set,
+	fd_set *write_fd_set,
+	fd_set *error_fd_set
+);
+
+#endif /* smcpd_event_h */
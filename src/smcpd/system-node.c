@@ -242,23 +242,6 @@ bail:
 
 
 
-smcp_status_t
-SMCPD_module__system_node_process(system_node_t self) {
-	return SMCP_STATUS_OK;
-}
-
-smcp_status_t
-SMCPD_module__system_node_update_fdset(
-	system_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-) {
-	return SMCP_STATUS_OK;
-}
-
 system_node_t
 SMCPD_module__system_node_init(
 	system_node_t	self,
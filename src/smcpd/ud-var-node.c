@@ -52,10 +52,10 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include "smcpd-event.h"
 #include "ud-var-node.h"
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <smcp/fasthash.h>
 
 #ifndef UD_VAR_NODE_MAX_REQUESTS
@@ -65,12 +65,14 @@
 struct ud_var_node_s {
 	struct smcp_node_s node;
 	struct smcp_observable_s observable;
+	struct smcp_timer_s poll_timer;
+	smcp_t interface;
 	int fd;
+	bool fd_registered;
 	const char* path;
 	uint32_t last_etag;
 	smcp_timestamp_t next_refresh;
 	smcp_cms_t refresh_period;
-	smcp_timestamp_t next_poll;
 	smcp_cms_t poll_period;
 };
 
@@ -218,6 +220,16 @@ ud_var_node_request_handler(
 
 	check_noerr_string(ret, smcp_status_to_cstr(ret));
 
+	if ( smcp_observable_observer_count(&self->observable, 0)
+	  && !smcp_timer_is_scheduled(smcp_get_current_instance(), &self->poll_timer)
+	) {
+		// We have our first observer, start keeping an eye on the value.
+		self->interface = smcp_get_current_instance();
+		self->last_etag = value_etag;
+		self->next_refresh = smcp_plat_cms_to_timestamp(self->refresh_period);
+		smcp_schedule_timer(self->interface, &self->poll_timer, self->poll_period);
+	}
+
 	ret = smcp_outbound_add_option_uint(COAP_OPTION_MAX_AGE, (self->refresh_period)/MSEC_PER_SEC + 1);
 
 	require_noerr(ret, bail);
@@ -255,6 +267,12 @@ bail:
 
 void
 ud_var_node_dealloc(ud_var_node_t x) {
+	if (x->interface && smcp_timer_is_scheduled(x->interface, &x->poll_timer)) {
+		smcp_invalidate_timer(x->interface, &x->poll_timer);
+	}
+	if (x->fd_registered) {
+		smcpd_event_remove_fd(x->fd);
+	}
 	close(x->fd);
 	free((void*)x->path);
 	free(x);
@@ -268,6 +286,62 @@ ud_var_node_alloc() {
 	return ret;
 }
 
+static void
+ud_var_node_check_value(ud_var_node_t self, bool trigger_it)
+{
+	uint8_t buffer[256];
+	coap_ssize_t buffer_len = 0;
+	uint32_t etag;
+
+	// Reading the value also acknowledges any pending POLLPRI.
+	buffer_len = ud_var_node_get_content(self, (char*)buffer, sizeof(buffer));
+
+	check_string(buffer_len >= 0, strerror(errno));
+
+	if (buffer_len >= 0) {
+		etag = ud_var_node_calc_etag((const char*)buffer, buffer_len);
+
+		if (etag != self->last_etag) {
+			self->last_etag = etag;
+			trigger_it = true;
+		}
+	}
+
+	if (smcp_plat_timestamp_to_cms(self->next_refresh) <= 0) {
+		trigger_it = true;
+	}
+
+	if (trigger_it && smcp_observable_observer_count(&self->observable, 0)) {
+		self->next_refresh = smcp_plat_cms_to_timestamp(self->refresh_period);
+		smcp_observable_trigger(
+			&self->observable,
+			SMCP_OBSERVABLE_BROADCAST_KEY,
+			0
+		);
+	}
+}
+
+static void
+ud_var_node_poll_timer(smcp_t smcp, ud_var_node_t self)
+{
+	syslog(LOG_DEBUG, "ud_var_node_poll_timer: %d observers", smcp_observable_observer_count(&self->observable, 0));
+
+	// Once the last observer is gone we stop polling until
+	// the next one shows up in ud_var_node_request_handler().
+	if (smcp_observable_observer_count(&self->observable, 0)) {
+		ud_var_node_check_value(self, false);
+		smcp_schedule_timer(smcp, &self->poll_timer, self->poll_period);
+	}
+}
+
+static void
+ud_var_node_fd_event(int fd, int events, void* context)
+{
+	ud_var_node_t self = context;
+
+	ud_var_node_check_value(self, true);
+}
+
 ud_var_node_t
 ud_var_node_init(
 	ud_var_node_t self,
@@ -302,6 +376,12 @@ ud_var_node_init(
 	self->refresh_period = 30*MSEC_PER_SEC;
 	self->poll_period = 1*MSEC_PER_SEC;
 
+	smcp_timer_init(&self->poll_timer, (smcp_timer_callback_t)&ud_var_node_poll_timer, NULL, self);
+
+	// Files that support it (like sysfs attributes) tell us when they
+	// change with POLLPRI. Anything else is only caught by polling.
+	self->fd_registered = (smcpd_event_add_fd(fd, SMCPD_EVENT_PRI, &ud_var_node_fd_event, self) == SMCP_STATUS_OK);
+
 	fd = -1;
 
 bail:
@@ -311,132 +391,6 @@ bail:
 	return self;
 }
 
-smcp_status_t
-ud_var_node_update_fdset(
-	ud_var_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-) {
-	int i;
-
-	syslog(LOG_DEBUG, "ud_var_node_update_fdset: %d observers", smcp_observable_observer_count(&self->observable, 0));
-
-	if (smcp_observable_observer_count(&self->observable, 0)) {
-
-		if (error_fd_set) {
-			FD_SET(self->fd, error_fd_set);
-		}
-
-		if (fd_count) {
-			*fd_count = MAX(*fd_count, self->fd + 1);
-		}
-
-		if (timeout) {
-			smcp_cms_t next_refresh = smcp_plat_timestamp_to_cms(self->next_refresh);
-			smcp_cms_t next_poll = smcp_plat_timestamp_to_cms(self->next_poll);
-
-			if (next_refresh > self->refresh_period) {
-				next_refresh = self->refresh_period;
-				self->next_refresh = smcp_plat_cms_to_timestamp(next_refresh);
-			}
-
-			if (next_poll > self->poll_period) {
-				next_poll = self->poll_period;
-				self->next_poll = smcp_plat_cms_to_timestamp(next_poll);
-			}
-
-			*timeout = MIN(*timeout, next_refresh);
-			*timeout = MIN(*timeout, next_poll);
-		}
-	}
-
-	return SMCP_STATUS_OK;
-}
-
-smcp_status_t
-ud_var_node_process(ud_var_node_t self) {
-	int i;
-	bool trigger_it = false;
-	struct timeval tv = {0,0};
-
-	syslog(LOG_DEBUG, "ud_var_node_process: %d observers", smcp_observable_observer_count(&self->observable, 0));
-
-	if (smcp_observable_observer_count(&self->observable, 0)) {
-		smcp_cms_t next_refresh = smcp_plat_timestamp_to_cms(self->next_refresh);
-		smcp_cms_t next_poll = smcp_plat_timestamp_to_cms(self->next_poll);
-
-		struct pollfd fdset[1];
-
-		if (next_refresh <= 0 || next_refresh > self->refresh_period) {
-			self->next_refresh = smcp_plat_cms_to_timestamp(self->refresh_period);
-			trigger_it = true;
-		}
-
-		fdset[0].fd = self->fd;
-		fdset[0].events = POLLPRI|POLLERR;
-
-		if (poll(fdset, 1, 0) >= 0) {
-			if ( ((fdset[0].revents & POLLPRI) == POLLPRI)
-			  || ((fdset[0].revents & POLLIN)  == POLLERR)
-			) {
-				trigger_it = true;
-			}
-		}
-
-		if (next_poll <= 0 || next_poll > self->poll_period) {
-			uint8_t buffer[256];
-			coap_ssize_t buffer_len = 0;
-			uint32_t etag;
-
-			self->next_poll = smcp_plat_cms_to_timestamp(self->poll_period);
-
-			buffer_len = ud_var_node_get_content(self, (char*)buffer, sizeof(buffer));
-
-			check_string(buffer_len >= 0, strerror(errno));
-
-			if (buffer_len >= 0) {
-				etag = ud_var_node_calc_etag((const char*)buffer, buffer_len);
-
-				if (etag != self->last_etag) {
-					self->last_etag = etag;
-					trigger_it = true;
-				}
-			}
-		}
-
-		if (trigger_it) {
-			smcp_observable_trigger(
-				&self->observable,
-				SMCP_OBSERVABLE_BROADCAST_KEY,
-				0
-			);
-		}
-	}
-	return SMCP_STATUS_OK;
-}
-
-
-
-smcp_status_t
-SMCPD_module__ud_var_node_process(ud_var_node_t self) {
-	return ud_var_node_process(self);
-}
-
-smcp_status_t
-SMCPD_module__ud_var_node_update_fdset(
-	ud_var_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-) {
-	return ud_var_node_update_fdset(self, read_fd_set, write_fd_set, error_fd_set, fd_count, timeout);
-}
-
 ud_var_node_t
 SMCPD_module__ud_var_node_init(
 	ud_var_node_t	self,
@@ -37,19 +37,6 @@ struct ud_var_node_s;
 
 typedef struct ud_var_node_s* ud_var_node_t;
 
-extern smcp_status_t
-SMCPD_module__ud_var_node_process(ud_var_node_t self);
-
-extern smcp_status_t
-SMCPD_module__ud_var_node_update_fdset(
-	ud_var_node_t self,
-    fd_set *read_fd_set,
-    fd_set *write_fd_set,
-    fd_set *error_fd_set,
-    int *fd_count,
-	smcp_cms_t *timeout
-);
-
 extern ud_var_node_t
 SMCPD_module__ud_var_node_init(
 	ud_var_node_t	self,
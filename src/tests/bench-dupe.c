@@ -0,0 +1,132 @@
+/*!	@page bench-dupe bench-dupe.c: Duplicate detection benchmark.
+**
+**	This benchmark feeds non-confirmable requests from many different
+**	peers directly into `smcp_inbound_packet_process()`, followed by a
+**	retransmission of every one of them. For each duplicate detection
+**	capacity it reports the time spent per packet and how many of the
+**	retransmissions were recognized as duplicates. Each pass uses half
+**	as many peers as the capacity. Since earlier passes are still within
+**	their exchange lifetime, the table is full from the second pass on
+**	and the oldest entries have to make room for the new ones.
+**
+**	@include bench-dupe.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include "fake-inbound.h"
+
+#define PASSES					(8)
+
+static int gDupesDetected;
+
+static smcp_status_t
+request_handler(void* context) {
+	if (smcp_inbound_is_dupe()) {
+		gDupesDetected++;
+	}
+	return SMCP_STATUS_OK;
+}
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void
+process_packet(smcp_t instance, uint32_t peer, uint16_t msg_id) {
+	smcp_sockaddr_t saddr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+	};
+	char packet[] = {
+		0x50, COAP_METHOD_POST, 0x00, 0x00,		// NON POST, msg_id
+		0xB6, 's', 'e', 'n', 's', 'o', 'r',		// Uri-Path: sensor
+		0xFF, '2', '3', '.', '5',				// Payload
+	};
+
+	// Every peer gets its own address and port.
+	saddr.sin6_addr.s6_addr[12] = (uint8_t)(peer >> 16);
+	saddr.sin6_addr.s6_addr[13] = (uint8_t)(peer >> 8);
+	saddr.sin6_port = htons((uint16_t)(1024 + (peer & 0x3FFF)));
+
+	packet[2] = (char)(msg_id >> 8);
+	packet[3] = (char)msg_id;
+
+	fake_inbound_packet(instance, &saddr, packet, sizeof(packet));
+}
+
+static void
+run_benchmark(uint32_t entries) {
+	smcp_t instance;
+	const uint32_t peers = entries / 2;
+	uint32_t pass, peer;
+	double start, elapsed;
+	int packets = 0;
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	if (smcp_set_dupe_capacity(instance, entries) != SMCP_STATUS_OK) {
+		fprintf(stderr, "Unable to set capacity to %u\n", entries);
+		exit(EXIT_FAILURE);
+	}
+
+	gDupesDetected = 0;
+	start = get_time_sec();
+
+	for (pass = 0; pass < PASSES; pass++) {
+		for (peer = 0; peer < peers; peer++) {
+			process_packet(instance, peer, (uint16_t)pass);
+			packets++;
+		}
+
+		// Now retransmit everything from this pass.
+		for (peer = 0; peer < peers; peer++) {
+			process_packet(instance, peer, (uint16_t)pass);
+			packets++;
+		}
+	}
+
+	elapsed = get_time_sec() - start;
+
+	printf("%6u entries: %8.1f ns/packet, %5.1f%% of retransmissions detected\n",
+		entries,
+		elapsed * 1e9 / packets,
+		100.0 * gDupesDetected / (PASSES * peers)
+	);
+
+	smcp_release(instance);
+}
+
+int
+main(void) {
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	run_benchmark(16);
+	run_benchmark(1024);
+	run_benchmark(65536);
+
+	return EXIT_SUCCESS;
+}
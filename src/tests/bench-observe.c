@@ -0,0 +1,148 @@
+/*!	@page bench-observe bench-observe.c: Observe notification fan-out benchmark.
+**
+**	This benchmark registers many observers of the same resource by
+**	feeding observe requests with different tokens directly into
+**	`smcp_inbound_packet_process()`. The requests all come from a
+**	socket that is never read from, so the notifications just pile up
+**	and get dropped by the kernel. It then triggers the resource a
+**	number of times, fires the timers that send out the notifications,
+**	and reports the time spent per notification along with how many
+**	times the request handler had to be called per trigger.
+**
+**	@include bench-observe.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-observable.h>
+#include "fake-inbound.h"
+
+#define TRIGGERS				(16)
+
+static struct smcp_observable_s gObservable;
+static int gHandlerCalls;
+static int gValue;
+static smcp_sockaddr_t gSink;
+
+static smcp_status_t
+request_handler(void* context) {
+	gHandlerCalls++;
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	smcp_observable_update(&gObservable, 0);
+	smcp_outbound_add_option_uint(COAP_OPTION_CONTENT_TYPE, COAP_CONTENT_TYPE_TEXT_PLAIN);
+	smcp_outbound_add_option_uint(COAP_OPTION_MAX_AGE, 60);
+	smcp_outbound_set_content_formatted(
+		"temperature=%d.%d&humidity=%d&battery=%d",
+		20 + gValue / 10, gValue % 10, 40 + gValue % 20, 100 - gValue % 50
+	);
+
+	return smcp_outbound_send();
+}
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void
+register_observer(smcp_t instance, uint32_t peer) {
+	// Every peer gets its own token.
+	fake_inbound_observe(instance, &gSink, (uint16_t)peer, peer, true, NULL);
+}
+
+static void
+run_benchmark(uint32_t observers) {
+	smcp_t instance;
+	uint32_t peer;
+	int trigger;
+	double start, elapsed;
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	if (smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0) != SMCP_STATUS_OK) {
+		perror("Unable to bind");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	gObservable.share_notifications = true;
+
+	for (peer = 0; peer < observers; peer++) {
+		register_observer(instance, peer);
+	}
+
+	if (smcp_observable_observer_count(&gObservable, 0) != (int)observers) {
+		fprintf(stderr, "Only %d of %u observers registered\n",
+			smcp_observable_observer_count(&gObservable, 0), observers);
+		exit(EXIT_FAILURE);
+	}
+
+	gHandlerCalls = 0;
+	start = get_time_sec();
+
+	for (trigger = 0; trigger < TRIGGERS; trigger++) {
+		gValue++;
+		smcp_observable_trigger(&gObservable, 0, 0);
+
+		// Send out every notification.
+		while (smcp_get_timeout(instance) == 0) {
+			smcp_handle_timers(instance);
+		}
+	}
+
+	elapsed = get_time_sec() - start;
+
+	printf("%6u observers: %8.1f ns/notification, %8.1f handler calls/trigger\n",
+		observers,
+		elapsed * 1e9 / (TRIGGERS * observers),
+		(double)gHandlerCalls / TRIGGERS
+	);
+
+	smcp_release(instance);
+	memset(&gObservable, 0, sizeof(gObservable));
+}
+
+int
+main(void) {
+	int sink;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	sink = fake_inbound_open_socket(&gSink);
+
+	if (sink < 0) {
+		perror("Unable to open sink socket");
+		return EXIT_FAILURE;
+	}
+
+	run_benchmark(1);
+	run_benchmark(100);
+	run_benchmark(1000);
+
+	close(sink);
+
+	return EXIT_SUCCESS;
+}
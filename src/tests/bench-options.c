@@ -0,0 +1,116 @@
+/*!	@page bench-options bench-options.c: Inbound option parsing benchmark.
+**
+**	This benchmark feeds a non-confirmable request with a typical
+**	set of options directly into `smcp_inbound_packet_process()`. The
+**	request handler then repeatedly looks up the Uri-Host option and
+**	walks all of the options, the way the virtual host router, the
+**	node router and the handlers do between them. It reports the time
+**	spent per pass, not counting the rest of the packet processing.
+**
+**	@include bench-options.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include "fake-inbound.h"
+
+#define REQUESTS				(10000)
+#define PASSES					(100)
+
+static int gOptionCount;
+static double gElapsed;
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static smcp_status_t
+request_handler(void* context) {
+	const uint8_t* value;
+	coap_size_t value_len;
+	int pass;
+	double start = get_time_sec();
+
+	for (pass = 0; pass < PASSES; pass++) {
+		if (smcp_inbound_find_option(COAP_OPTION_URI_HOST, &value, &value_len)) {
+			gOptionCount++;
+		}
+
+		smcp_inbound_reset_next_option();
+
+		while (smcp_inbound_next_option(&value, &value_len) != COAP_OPTION_INVALID) {
+			gOptionCount++;
+		}
+	}
+
+	gElapsed += get_time_sec() - start;
+
+	return SMCP_STATUS_OK;
+}
+
+int
+main(void) {
+	smcp_sockaddr_t saddr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+		.sin6_port = htons(1024),
+	};
+	const char packet[] = {
+		0x50, COAP_METHOD_GET, 0x00, 0x00,				// NON GET, msg_id
+		0x3B, 'e','x','a','m','p','l','e','.','c','o','m',	// Uri-Host
+		0x86, 's','e','n','s','o','r',					// Uri-Path
+		0x07, 'k','i','t','c','h','e','n',				// Uri-Path
+		0x0B, 't','e','m','p','e','r','a','t','u','r','e',	// Uri-Path
+		0x10,											// Content-Format: 0
+		0x37, 'u','n','i','t','=','C','&',				// Uri-Query
+		0x0A, 'p','r','e','c','i','s','i','o','n','=',	// Uri-Query
+		0x21, 0x28,										// Accept: 40
+	};
+	char buffer[sizeof(packet)];
+	smcp_t instance;
+	uint32_t i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		return EXIT_FAILURE;
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	for (i = 0; i < REQUESTS; i++) {
+		memcpy(buffer, packet, sizeof(packet));
+		buffer[2] = (char)(i >> 8);
+		buffer[3] = (char)i;
+
+		fake_inbound_packet(instance, &saddr, buffer, sizeof(buffer));
+	}
+
+	printf("%8.1f ns/pass (%d options seen)\n",
+		gElapsed * 1e9 / (REQUESTS * PASSES),
+		gOptionCount
+	);
+
+	smcp_release(instance);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/*!	@page bench-outbound bench-outbound.c: Outbound option composition benchmark.
+**
+**	This benchmark composes outbound messages with
+**	`smcp_outbound_add_option()` and `smcp_outbound_get_content_ptr()`,
+**	without sending them. The same set of options is added in key
+**	order, in reverse key order, and in a shuffled order, which is
+**	what a handler that adds its own options after
+**	`smcp_outbound_set_uri()` ends up doing. For each order it reports
+**	the time spent per message.
+**
+**	@include bench-outbound.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-internal.h>
+
+#define ITERATIONS				(1000000)
+
+static const struct {
+	coap_option_key_t key;
+	const char* value;
+} gOptions[] = {
+	{ COAP_OPTION_IF_MATCH, "\x12\x34" },
+	{ COAP_OPTION_URI_HOST, "example.com" },
+	{ COAP_OPTION_ETAG, "\xDE\xAD\xBE\xEF" },
+	{ COAP_OPTION_OBSERVE, "\x01" },
+	{ COAP_OPTION_URI_PORT, "\x16\x34" },
+	{ COAP_OPTION_URI_PATH, "dev" },
+	{ COAP_OPTION_URI_PATH, "kitchen" },
+	{ COAP_OPTION_URI_PATH, "sensor" },
+	{ COAP_OPTION_CONTENT_TYPE, "\x28" },
+	{ COAP_OPTION_MAX_AGE, "\x3C" },
+	{ COAP_OPTION_URI_QUERY, "units=C" },
+	{ COAP_OPTION_ACCEPT, "\x28" },
+	{ COAP_OPTION_BLOCK2, "\x1E" },
+	{ COAP_OPTION_SIZE, "\x04\x10" },
+};
+
+#define OPTION_COUNT			(sizeof(gOptions) / sizeof(gOptions[0]))
+
+static const struct {
+	const char* name;
+	uint8_t order[OPTION_COUNT];
+} gOrders[] = {
+	{ "In order", { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 } },
+	{ "Reverse order", { 13, 12, 11, 10, 9, 8, 5, 6, 7, 4, 3, 2, 1, 0 } },
+	{ "Shuffled", { 8, 5, 6, 13, 1, 9, 7, 0, 12, 3, 10, 2, 11, 4 } },
+};
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static coap_size_t
+compose(const uint8_t* order) {
+	coap_size_t max_len = 0;
+	unsigned i;
+
+	smcp_outbound_begin(smcp_get_current_instance(), COAP_RESULT_205_CONTENT, COAP_TRANS_TYPE_NONCONFIRMABLE);
+
+	for (i = 0; i < OPTION_COUNT; i++) {
+		smcp_outbound_add_option(
+			gOptions[order[i]].key,
+			gOptions[order[i]].value,
+			SMCP_CSTR_LEN
+		);
+	}
+
+	smcp_outbound_get_content_ptr(&max_len);
+
+	return max_len;
+}
+
+int
+main(void) {
+	smcp_t smcp;
+	coap_size_t expected;
+	unsigned i;
+	uint32_t j;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	smcp = smcp_create();
+
+	if (!smcp) {
+		fprintf(stderr, "Unable to create SMCP instance\n");
+		return EXIT_FAILURE;
+	}
+
+	smcp_set_current_instance(smcp);
+
+	expected = compose(gOrders[0].order);
+
+	for (i = 0; i < sizeof(gOrders) / sizeof(gOrders[0]); i++) {
+		volatile coap_size_t sink = 0;
+		double start, elapsed;
+
+		if (compose(gOrders[i].order) != expected) {
+			fprintf(stderr, "%s: Unexpected message size\n", gOrders[i].name);
+			return EXIT_FAILURE;
+		}
+
+		start = get_time_sec();
+
+		for (j = 0; j < ITERATIONS; j++) {
+			sink += compose(gOrders[i].order);
+		}
+
+		elapsed = get_time_sec() - start;
+
+		printf("%14s: %6.1f ns/message\n", gOrders[i].name, elapsed * 1e9 / ITERATIONS);
+	}
+
+	smcp_release(smcp);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+/*!	@page bench-recv bench-recv.c: Inbound throughput benchmark.
+**
+**	This benchmark floods an SMCP instance with non-confirmable POST
+**	requests over the loopback interface and measures how many packets
+**	per second `smcp_plat_process()` is able to handle, first reading a
+**	single datagram per call and then using batched reads. If SMCP was
+**	configured with `--enable-io-uring`, the io_uring backend is measured
+**	last.
+**
+**	@include bench-recv.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <smcp/smcp.h>
+
+#define PACKETS_PER_BURST		(64)
+#define TOTAL_PACKETS			(200000)
+
+static int gPacketsHandled;
+
+static smcp_status_t
+request_handler(void* context) {
+	gPacketsHandled++;
+	return SMCP_STATUS_OK;
+}
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static double
+run_benchmark(smcp_t instance, int batch_size) {
+	struct sockaddr_in6 saddr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+		.sin6_port = htons(smcp_plat_get_port(instance)),
+	};
+	uint8_t packet[] = {
+		0x50, COAP_METHOD_POST, 0x00, 0x00,		// NON POST, msg_id
+		0xB6, 's', 'e', 'n', 's', 'o', 'r',		// Uri-Path: sensor
+		0xFF, '2', '3', '.', '5',				// Payload
+	};
+	uint16_t msg_id = 0;
+	int sent = 0;
+	int fd;
+	double start, elapsed;
+
+	fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	if (fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_plat_set_recv_batch_size(instance, batch_size);
+
+	gPacketsHandled = 0;
+	elapsed = 0;
+
+	while (sent < TOTAL_PACKETS) {
+		int i;
+
+		for (i = 0; i < PACKETS_PER_BURST; i++, sent++) {
+			msg_id++;
+			packet[2] = (uint8_t)(msg_id >> 8);
+			packet[3] = (uint8_t)msg_id;
+			sendto(fd, packet, sizeof(packet), 0, (struct sockaddr*)&saddr, sizeof(saddr));
+		}
+
+		start = get_time_sec();
+
+		while (gPacketsHandled < sent) {
+			if (smcp_plat_wait(instance, 1000) == SMCP_STATUS_TIMEOUT) {
+				// Some packets were dropped by the kernel.
+				gPacketsHandled = sent;
+				break;
+			}
+			smcp_plat_process(instance);
+		}
+
+		elapsed += get_time_sec() - start;
+	}
+
+	close(fd);
+
+	return (double)sent / elapsed;
+}
+
+int
+main(void) {
+	smcp_t instance;
+	double single_rate, batch_rate, uring_rate;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	// Start out with the poll() based receive path.
+	smcp_plat_set_io_uring(instance, false);
+
+	smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0);
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	single_rate = run_benchmark(instance, 1);
+	printf("batch size %3d: %10.0f packets/sec\n", 1, single_rate);
+
+	batch_rate = run_benchmark(instance, SMCP_CONF_RECV_BATCH_SIZE);
+	printf("batch size %3d: %10.0f packets/sec (%.2fx)\n",
+		SMCP_CONF_RECV_BATCH_SIZE,
+		batch_rate,
+		batch_rate / single_rate
+	);
+
+	if (smcp_plat_set_io_uring(instance, true) == SMCP_STATUS_OK) {
+		uring_rate = run_benchmark(instance, 1);
+		printf("io_uring:       %10.0f packets/sec (%.2fx)\n",
+			uring_rate,
+			uring_rate / single_rate
+		);
+	}
+
+	smcp_release(instance);
+
+	return EXIT_SUCCESS;
+}
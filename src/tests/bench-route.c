@@ -0,0 +1,148 @@
+/*!	@page bench-route bench-route.c: Node router benchmark.
+**
+**	This benchmark builds a node tree with a number of device nodes
+**	below the root, each of which has a few variable nodes, and feeds
+**	non-confirmable requests for random variables directly into
+**	`smcp_inbound_packet_process()` with the node router as the
+**	request handler. For each tree size it reports the time spent
+**	per request.
+**
+**	@include bench-route.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-node-router.h>
+#include "fake-inbound.h"
+
+#define VARIABLES_PER_DEVICE	(8)
+#define REQUESTS				(200000)
+#define NAME_LEN				(16)
+
+static int gHandled;
+
+static smcp_status_t
+variable_request_handler(void* context) {
+	gHandled++;
+	return SMCP_STATUS_OK;
+}
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void
+process_packet(smcp_t instance, uint32_t device, uint32_t variable, uint16_t msg_id) {
+	smcp_sockaddr_t saddr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+		.sin6_port = htons(1024),
+	};
+	char packet[64] = {
+		0x50, COAP_METHOD_GET, 0x00, 0x00,		// NON GET, msg_id
+	};
+	int len = 4;
+
+	packet[2] = (char)(msg_id >> 8);
+	packet[3] = (char)msg_id;
+
+	// Uri-Path: devN
+	len += sprintf(packet + len + 1, "dev%u", device);
+	packet[4] = (char)(0xB0 | (len - 4));
+	len++;
+
+	// Uri-Path: varN
+	packet[len] = (char)(0x00 | sprintf(packet + len + 1, "var%u", variable));
+	len += 1 + (packet[len] & 0x0F);
+
+	fake_inbound_packet(instance, &saddr, packet, (coap_size_t)len);
+}
+
+static void
+run_benchmark(uint32_t devices) {
+	const uint32_t node_count = devices * (1 + VARIABLES_PER_DEVICE);
+	struct smcp_node_s root_node = { };
+	struct smcp_node_s* nodes = calloc(node_count, sizeof(*nodes));
+	char (*names)[NAME_LEN] = calloc(node_count, NAME_LEN);
+	smcp_t instance;
+	uint32_t i, j, n = 0;
+	double start, elapsed;
+
+	if (!nodes || !names) {
+		perror("Unable to allocate nodes");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_node_init(&root_node, NULL, NULL);
+
+	for (i = 0; i < devices; i++) {
+		smcp_node_t device = &nodes[n];
+
+		snprintf(names[n], NAME_LEN, "dev%u", i);
+		smcp_node_init(device, &root_node, names[n++]);
+
+		for (j = 0; j < VARIABLES_PER_DEVICE; j++) {
+			snprintf(names[n], NAME_LEN, "var%u", j);
+			smcp_node_init(&nodes[n], device, names[n]);
+			nodes[n++].request_handler = &variable_request_handler;
+		}
+	}
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &smcp_node_router_handler, &root_node);
+
+	srandom(devices);
+	gHandled = 0;
+	start = get_time_sec();
+
+	for (i = 0; i < REQUESTS; i++) {
+		process_packet(instance, (uint32_t)random() % devices, (uint32_t)random() % VARIABLES_PER_DEVICE, (uint16_t)i);
+	}
+
+	elapsed = get_time_sec() - start;
+
+	printf("%7u nodes: %8.1f ns/request (%d of %d routed)\n",
+		node_count,
+		elapsed * 1e9 / REQUESTS,
+		gHandled,
+		REQUESTS
+	);
+
+	smcp_release(instance);
+	smcp_node_delete(&root_node);
+	free(nodes);
+	free(names);
+}
+
+int
+main(void) {
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	run_benchmark(10);
+	run_benchmark(1000);
+	run_benchmark(100000);
+
+	return EXIT_SUCCESS;
+}
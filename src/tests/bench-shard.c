@@ -0,0 +1,194 @@
+/*!	@page bench-shard bench-shard.c: Sharded server throughput benchmark.
+**
+**	This benchmark runs a group of SMCP instances, one per thread, that
+**	all share the same port using smcp_plat_set_shard(). Every shard
+**	routes requests through the same node tree. A set of client threads
+**	floods the port with non-confirmable POST requests over the loopback
+**	interface and the benchmark reports how many requests per second
+**	were handled for increasing numbers of shards.
+**
+**	Usage: `bench-shard [max-shards]`. Defaults to the number of CPUs.
+**
+**	@include bench-shard.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-node-router.h>
+
+#define MAX_SHARDS				(64)
+#define CLIENT_THREADS			(2)
+#define CLIENT_SOCKETS			(16)
+#define RUN_TIME_MSEC			(1000)
+
+struct bench_shard_s {
+	pthread_t pt;
+	smcp_t instance;
+	unsigned long handled;
+};
+
+static volatile bool gShouldStop;
+static uint16_t gPort;
+static __thread unsigned long gHandled;
+
+static smcp_status_t
+sensor_request_handler(void* context) {
+	gHandled++;
+	return SMCP_STATUS_OK;
+}
+
+static void*
+shard_main(void* context) {
+	struct bench_shard_s* shard = (struct bench_shard_s*)context;
+
+	gHandled = 0;
+
+	while (!gShouldStop) {
+		smcp_plat_wait(shard->instance, 50);
+		smcp_plat_process(shard->instance);
+	}
+
+	shard->handled = gHandled;
+
+	return NULL;
+}
+
+static void*
+client_main(void* context) {
+	struct sockaddr_in6 saddr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+		.sin6_port = htons(gPort),
+	};
+	uint8_t packet[] = {
+		0x50, COAP_METHOD_POST, 0x00, 0x00,		// NON POST, msg_id
+		0xB6, 's', 'e', 'n', 's', 'o', 'r',		// Uri-Path: sensor
+		0xFF, '2', '3', '.', '5',				// Payload
+	};
+	int fds[CLIENT_SOCKETS];
+	uint16_t msg_id = (uint16_t)(uintptr_t)context << 12;
+	int i;
+
+	// Each socket has its own source port, which is what
+	// the kernel uses to spread the load between shards.
+	for (i = 0; i < CLIENT_SOCKETS; i++) {
+		fds[i] = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	}
+
+	while (!gShouldStop) {
+		for (i = 0; i < CLIENT_SOCKETS; i++) {
+			msg_id++;
+			packet[2] = (uint8_t)(msg_id >> 8);
+			packet[3] = (uint8_t)msg_id;
+			sendto(fds[i], packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr*)&saddr, sizeof(saddr));
+		}
+	}
+
+	for (i = 0; i < CLIENT_SOCKETS; i++) {
+		close(fds[i]);
+	}
+
+	return NULL;
+}
+
+static double
+run_benchmark(smcp_node_t root, int shard_count) {
+	struct bench_shard_s shards[MAX_SHARDS] = { };
+	pthread_t clients[CLIENT_THREADS];
+	unsigned long total = 0;
+	int i;
+
+	// Shards must be bound in order so that their index
+	// matches their position in the kernel's socket group.
+	for (i = 0; i < shard_count; i++) {
+		shards[i].instance = smcp_create();
+
+		if (!shards[i].instance) {
+			perror("Unable to create SMCP instance");
+			exit(EXIT_FAILURE);
+		}
+
+		smcp_plat_set_shard(shards[i].instance, i, shard_count, SMCP_PLAT_SHARD_STEER_BY_CPU);
+
+		if (smcp_plat_bind_to_port(shards[i].instance, SMCP_SESSION_TYPE_UDP, gPort) != SMCP_STATUS_OK) {
+			perror("Unable to bind shard");
+			exit(EXIT_FAILURE);
+		}
+
+		gPort = smcp_plat_get_port(shards[i].instance);
+
+		smcp_set_default_request_handler(shards[i].instance, &smcp_node_router_handler, root);
+	}
+
+	gShouldStop = false;
+
+	for (i = 0; i < shard_count; i++) {
+		pthread_create(&shards[i].pt, NULL, &shard_main, &shards[i]);
+	}
+
+	for (i = 0; i < CLIENT_THREADS; i++) {
+		pthread_create(&clients[i], NULL, &client_main, (void*)(uintptr_t)i);
+	}
+
+	usleep(RUN_TIME_MSEC * 1000);
+
+	gShouldStop = true;
+
+	for (i = 0; i < CLIENT_THREADS; i++) {
+		pthread_join(clients[i], NULL);
+	}
+
+	for (i = 0; i < shard_count; i++) {
+		pthread_join(shards[i].pt, NULL);
+		total += shards[i].handled;
+		smcp_release(shards[i].instance);
+	}
+
+	gPort = 0;
+
+	return (double)total * MSEC_PER_SEC / RUN_TIME_MSEC;
+}
+
+int
+main(int argc, char* argv[]) {
+	struct smcp_node_s root_node = { };
+	struct smcp_node_s sensor_node = { };
+	int max_shards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int shard_count;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	if (argc > 1) {
+		max_shards = atoi(argv[1]);
+	}
+
+	if (max_shards < 1) {
+		max_shards = 1;
+	} else if (max_shards > MAX_SHARDS) {
+		max_shards = MAX_SHARDS;
+	}
+
+	smcp_node_init(&root_node, NULL, NULL);
+	smcp_node_init(&sensor_node, &root_node, "sensor");
+	sensor_node.request_handler = &sensor_request_handler;
+
+	for (shard_count = 1; shard_count <= max_shards; shard_count *= 2) {
+		printf("%3d shard(s): %10.0f requests/sec\n", shard_count, run_benchmark(&root_node, shard_count));
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+/*!	@page bench-timer bench-timer.c: Timer queue benchmark.
+**
+**	This benchmark schedules a number of timers at random times within
+**	the next minute, invalidates half of them in random order and then
+**	fires the rest with `smcp_process_timers_until()`. It reports the
+**	average time each of those operations took for queues of 100, 10k
+**	and 1M timers.
+**
+**	@include bench-timer.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <smcp/smcp.h>
+
+#define SPREAD_MSEC				(60 * MSEC_PER_SEC)
+
+static int gFired;
+
+static void
+timer_callback(smcp_t self, void* context) {
+	gFired++;
+}
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void
+run_benchmark(int count) {
+	smcp_t instance;
+	struct smcp_timer_s* timers;
+	int* order;
+	double start, schedule_elapsed, invalidate_elapsed, fire_elapsed;
+	int i;
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	timers = calloc(count, sizeof(*timers));
+	order = calloc(count, sizeof(*order));
+
+	// Shuffle the order the timers get invalidated in.
+	for (i = 0; i < count; i++) {
+		int j = (int)(random() % (i + 1));
+		order[i] = order[j];
+		order[j] = i;
+	}
+
+	start = get_time_sec();
+
+	for (i = 0; i < count; i++) {
+		smcp_timer_init(&timers[i], &timer_callback, NULL, NULL);
+
+		if (smcp_schedule_timer(instance, &timers[i], (smcp_cms_t)(random() % SPREAD_MSEC)) != SMCP_STATUS_OK) {
+			fprintf(stderr, "Unable to schedule timer %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	schedule_elapsed = get_time_sec() - start;
+	start = get_time_sec();
+
+	for (i = 0; i < count / 2; i++) {
+		smcp_invalidate_timer(instance, &timers[order[i]]);
+	}
+
+	invalidate_elapsed = get_time_sec() - start;
+
+	gFired = 0;
+	start = get_time_sec();
+
+	smcp_process_timers_until(instance, smcp_plat_cms_to_timestamp(SPREAD_MSEC));
+
+	fire_elapsed = get_time_sec() - start;
+
+	printf("%8d timers: %7.1f ns/schedule, %7.1f ns/invalidate, %7.1f ns/fire\n",
+		count,
+		schedule_elapsed * 1e9 / count,
+		invalidate_elapsed * 1e9 / (count / 2),
+		fire_elapsed * 1e9 / gFired
+	);
+
+	if (gFired != count - count / 2) {
+		fprintf(stderr, "Fired %d timers, expected %d!\n", gFired, count - count / 2);
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_release(instance);
+	free(order);
+	free(timers);
+}
+
+int
+main(void) {
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	run_benchmark(100);
+	run_benchmark(10000);
+	run_benchmark(1000000);
+
+	return EXIT_SUCCESS;
+}
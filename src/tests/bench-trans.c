@@ -0,0 +1,114 @@
+/*!	@page bench-trans bench-trans.c: Transaction lookup benchmark.
+**
+**	This benchmark begins a number of transactions on a single
+**	instance and then measures how long it takes to look them up by
+**	token, which is what happens for every separate or non-confirmable
+**	response, and by message id, which is what happens for every
+**	piggy-backed response. The lookup times should stay flat as the
+**	number of live transactions grows.
+**
+**	@include bench-trans.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <smcp/smcp.h>
+
+#define LOOKUPS					(1000000)
+
+static smcp_status_t
+response_handler(int statuscode, void* context) {
+	return SMCP_STATUS_OK;
+}
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void
+run_benchmark(int count) {
+	smcp_t instance;
+	struct smcp_transaction_s* transactions;
+	double start, token_elapsed, msg_id_elapsed;
+	int i, misses = 0;
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	transactions = calloc(count, sizeof(*transactions));
+
+	for (i = 0; i < count; i++) {
+		smcp_transaction_init(&transactions[i], SMCP_TRANSACTION_OBSERVE, NULL, &response_handler, NULL);
+
+		if (smcp_transaction_begin(instance, &transactions[i], CMS_DISTANT_FUTURE) != SMCP_STATUS_OK) {
+			fprintf(stderr, "Unable to begin transaction %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	start = get_time_sec();
+
+	for (i = 0; i < LOOKUPS; i++) {
+		const smcp_transaction_t transaction = &transactions[(uint32_t)i * 7919u % (uint32_t)count];
+
+		if (smcp_transaction_find_via_token(instance, transaction->token, transaction->token_len) != transaction) {
+			misses++;
+		}
+	}
+
+	token_elapsed = get_time_sec() - start;
+	start = get_time_sec();
+
+	for (i = 0; i < LOOKUPS; i++) {
+		const smcp_transaction_t transaction = &transactions[(uint32_t)i * 7919u % (uint32_t)count];
+
+		if (smcp_transaction_find_via_msg_id(instance, transaction->msg_id) != transaction) {
+			misses++;
+		}
+	}
+
+	msg_id_elapsed = get_time_sec() - start;
+
+	printf("%6d transactions: %6.1f ns/token lookup, %6.1f ns/msg-id lookup\n",
+		count,
+		token_elapsed * 1e9 / LOOKUPS,
+		msg_id_elapsed * 1e9 / LOOKUPS
+	);
+
+	if (misses) {
+		fprintf(stderr, "%d lookups failed!\n", misses);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < count; i++) {
+		smcp_transaction_end(instance, &transactions[i]);
+	}
+
+	smcp_release(instance);
+	free(transactions);
+}
+
+int
+main(void) {
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	run_benchmark(100);
+	run_benchmark(1000);
+	run_benchmark(10000);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*!	@page bench-verify bench-verify.c: Packet verification benchmark.
+**
+**	This benchmark runs `coap_verify_packet()` over a few realistic
+**	packets, followed by a walk over their options with
+**	`coap_decode_option()`, which is what every inbound datagram goes
+**	through before it reaches a handler. For each packet it reports
+**	the time spent per packet, and the number of cycles on x86.
+**
+**	@include bench-verify.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <smcp/smcp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_RDTSC				1
+#endif
+
+#define ITERATIONS				(10000000)
+
+static const uint8_t get_request[] = {
+	0x44, COAP_METHOD_GET, 0x12, 0x34,			// CON GET
+	0xDE, 0xAD, 0xBE, 0xEF,						// Token
+	0xB3, 'd', 'e', 'v',						// Uri-Path
+	0x07, 'k', 'i', 't', 'c', 'h', 'e', 'n',	// Uri-Path
+	0x06, 's', 'e', 'n', 's', 'o', 'r',			// Uri-Path
+	0x04, 't', 'e', 'm', 'p',					// Uri-Path
+	0x61, 0x28,									// Accept: 40
+};
+
+static const uint8_t observe_notification[] = {
+	0x52, COAP_RESULT_205_CONTENT, 0x43, 0x21,	// NON 2.05
+	0x01, 0x02,									// Token
+	0x62, 0x01, 0x7F,							// Observe
+	0x60,										// Content-Format: 0
+	0x21, 0x3C,									// Max-Age: 60
+	0xFF, '2', '1', '.', '5', ' ', 'C',			// Payload
+};
+
+static const uint8_t block2_response[] = {
+	0x64, COAP_RESULT_205_CONTENT, 0x55, 0x66,	// ACK 2.05
+	0x11, 0x22, 0x33, 0x44,						// Token
+	0xC1, 0x28,									// Content-Format: 40
+	0xB1, 0x1E,									// Block2: 1/more/64
+	0x52, 0x04, 0x00,							// Size2: 1024
+	0xFF, '<', '/', 'a', '>', ';', 'r', 't', '=', '"', 't', '"', ',',
+	'<', '/', 'b', '>', ';', 'r', 't', '=', '"', 't', '"', ',',
+	'<', '/', 'c', '>', ';', 'r', 't', '=', '"', 't', '"', ',',
+	'<', '/', 'd', '>', ';', 'r', 't', '=', '"', 't', '"', ',',
+	'<', '/', 'e', '>',
+};
+
+static const struct {
+	const char* name;
+	const uint8_t* bytes;
+	coap_size_t len;
+} gCorpus[] = {
+	{ "GET with 4 path segments", get_request, sizeof(get_request) },
+	{ "Observe notification", observe_notification, sizeof(observe_notification) },
+	{ "Block2 response", block2_response, sizeof(block2_response) },
+};
+
+static double
+get_time_sec(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static int
+verify_and_decode(const uint8_t* packet, coap_size_t len) {
+	const struct coap_header_s* const header = (const void*)packet;
+	const uint8_t* iter = header->token + header->token_len;
+	const uint8_t* const end = packet + len;
+	coap_option_key_t key = 0;
+	int options = 0;
+
+	if (!coap_verify_packet((const char*)packet, len)) {
+		return -1;
+	}
+
+	while (iter < end && iter[0] != 0xFF) {
+		const uint8_t* value;
+		coap_size_t value_len;
+
+		iter = coap_decode_option(iter, &key, &value, &value_len);
+		options += key;
+	}
+
+	return options;
+}
+
+int
+main(void) {
+	unsigned i;
+	uint32_t j;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	for (i = 0; i < sizeof(gCorpus) / sizeof(gCorpus[0]); i++) {
+		// Copy the packet, so that the compiler can't see its contents.
+		uint8_t* const packet = malloc(gCorpus[i].len);
+		volatile int sink = 0;
+		double start, elapsed;
+#if HAVE_RDTSC
+		unsigned long long cycles;
+#endif
+
+		memcpy(packet, gCorpus[i].bytes, gCorpus[i].len);
+
+		if (verify_and_decode(packet, gCorpus[i].len) < 0) {
+			fprintf(stderr, "%s: Packet was rejected\n", gCorpus[i].name);
+			return EXIT_FAILURE;
+		}
+
+		start = get_time_sec();
+#if HAVE_RDTSC
+		cycles = __builtin_ia32_rdtsc();
+#endif
+
+		for (j = 0; j < ITERATIONS; j++) {
+			sink += verify_and_decode(packet, gCorpus[i].len);
+		}
+
+#if HAVE_RDTSC
+		cycles = __builtin_ia32_rdtsc() - cycles;
+#endif
+		elapsed = get_time_sec() - start;
+
+		printf("%26s: %6.1f ns/packet", gCorpus[i].name, elapsed * 1e9 / ITERATIONS);
+#if HAVE_RDTSC
+		printf(", %6.1f cycles/packet", (double)cycles / ITERATIONS);
+#endif
+		printf("\n");
+
+		free(packet);
+	}
+
+	return EXIT_SUCCESS;
+}
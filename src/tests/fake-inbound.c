@@ -0,0 +1,100 @@
+/*	@file fake-inbound.c
+**	@brief Feeding packets to an instance as if they had been received
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-internal.h>
+#include "fake-inbound.h"
+
+int
+fake_inbound_open_socket(smcp_sockaddr_t* saddr) {
+	socklen_t saddr_len = sizeof(*saddr);
+	int fd;
+
+	memset(saddr, 0, sizeof(*saddr));
+	saddr->sin6_family = AF_INET6;
+	saddr->sin6_addr = in6addr_loopback;
+
+	fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	if ((fd >= 0)
+		&& ((bind(fd, (struct sockaddr*)saddr, sizeof(*saddr)) != 0)
+			|| (getsockname(fd, (struct sockaddr*)saddr, &saddr_len) != 0))
+	) {
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+smcp_status_t
+fake_inbound_packet(
+	smcp_t instance,
+	const smcp_sockaddr_t* remote,
+	const void* packet,
+	coap_size_t len
+) {
+	char buffer[SMCP_MAX_PACKET_LENGTH + 1];
+
+	require(len <= SMCP_MAX_PACKET_LENGTH, bail);
+
+	memcpy(buffer, packet, len);
+
+	// Pretend that the packet was just received.
+	smcp_set_current_instance(instance);
+	smcp_plat_set_remote_sockaddr(remote);
+	smcp_plat_set_local_sockaddr(remote);
+	smcp_plat_set_session_type(SMCP_SESSION_TYPE_UDP);
+
+	return smcp_inbound_packet_process(instance, buffer, len, 0);
+
+bail:
+	return SMCP_STATUS_MESSAGE_TOO_BIG;
+}
+
+smcp_status_t
+fake_inbound_observe(
+	smcp_t instance,
+	const smcp_sockaddr_t* remote,
+	uint16_t msg_id,
+	uint32_t token,
+	bool observe,
+	const char* query
+) {
+	uint8_t packet[64] = {
+		0x44, COAP_METHOD_GET, 0x00, 0x00,		// CON GET, msg_id
+	};
+	uint8_t* ptr = packet + 4;
+	coap_option_key_t prev_key = 0;
+
+	packet[2] = (uint8_t)(msg_id >> 8);
+	packet[3] = (uint8_t)msg_id;
+	memcpy(ptr, &token, sizeof(token));
+	ptr += sizeof(token);
+
+	if (observe) {
+		ptr = coap_encode_option(ptr, prev_key, COAP_OPTION_OBSERVE, NULL, 0);
+		prev_key = COAP_OPTION_OBSERVE;
+	}
+
+	ptr = coap_encode_option(ptr, prev_key, COAP_OPTION_URI_PATH, (const uint8_t*)"sensor", 6);
+	prev_key = COAP_OPTION_URI_PATH;
+
+	if (query != NULL) {
+		ptr = coap_encode_option(ptr, prev_key, COAP_OPTION_URI_QUERY, (const uint8_t*)query, (coap_size_t)strlen(query));
+	}
+
+	return fake_inbound_packet(instance, remote, packet, (coap_size_t)(ptr - packet));
+}
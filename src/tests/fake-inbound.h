@@ -0,0 +1,44 @@
+/*	@file fake-inbound.h
+**	@brief Feeding packets to an instance as if they had been received
+**
+**	Tests and benchmarks use these to hand requests straight to
+**	`smcp_inbound_packet_process()`, without a peer on the other end.
+**	Whatever the instance sends back goes to the remote address the
+**	packet claims to have come from, which is usually a socket opened
+**	with fake_inbound_open_socket().
+*/
+
+#ifndef SMCP_fake_inbound_h
+#define SMCP_fake_inbound_h
+
+#include <smcp/smcp.h>
+
+//!	Opens a UDP socket on an unused loopback port.
+/*!	Its address is stored in `saddr`. Returns the socket, or -1. */
+int fake_inbound_open_socket(smcp_sockaddr_t* saddr);
+
+//!	Processes `packet` as if `instance` had just received it from `remote`.
+/*!	The packet is copied first, so it can be const and doesn't need
+**	room for the zero that `smcp_inbound_packet_process()` adds. */
+smcp_status_t fake_inbound_packet(
+	smcp_t instance,
+	const smcp_sockaddr_t* remote,
+	const void* packet,
+	coap_size_t len
+);
+
+//!	Processes a confirmable GET for "sensor" from `remote`.
+/*!	With `observe` it has an Observe option of zero, and registers
+**	an observer. Without it, it deregisters one. The token is the
+**	four bytes of `token` in host byte order. If `query` isn't NULL,
+**	it is added as a Uri-Query option. */
+smcp_status_t fake_inbound_observe(
+	smcp_t instance,
+	const smcp_sockaddr_t* remote,
+	uint16_t msg_id,
+	uint32_t token,
+	bool observe,
+	const char* query
+);
+
+#endif
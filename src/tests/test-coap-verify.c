@@ -0,0 +1,368 @@
+/*!	@page test-coap-verify test-coap-verify.c: Packet verification test.
+**
+**	This test checks `coap_verify_packet()` and `coap_decode_option()`
+**	against the original byte-at-a-time implementations, which are kept
+**	below as the reference. It runs both over every short option
+**	sequence, and then over a large number of randomly mutated copies
+**	of a few realistic packets, making sure that they accept the same
+**	packets and decode the same options from them.
+**
+**	@include test-coap-verify.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <smcp/smcp.h>
+
+#define MUTATIONS			(2000000)
+#define MAX_PACKET_SIZE		(128)
+
+// Room for the reference decoder to read past the end of the packet.
+#define PACKET_SLACK		(8)
+
+// MARK: -
+// MARK: Reference Implementation
+
+static uint8_t*
+reference_decode_option(const uint8_t* buffer, coap_option_key_t* key, const uint8_t** value, coap_size_t* lenP) {
+	coap_size_t len;
+
+	len = (*buffer & 0x0F);
+
+	switch((*buffer >> 4)) {
+		default:
+			if(key) *key += (*buffer >> 4);
+			buffer += 1;
+			break;
+
+		case 13:
+			buffer += 1;
+			if(key)*key += 13+*buffer;
+			buffer += 1;
+			break;
+
+		case 14:
+			buffer += 1;
+			if(key)*key += 269+buffer[1]+(buffer[0]<<8);
+
+			buffer += 2;
+			break;
+
+		case 15:
+			if (key) *key = COAP_OPTION_INVALID;
+			if (value) *value = NULL;
+			if (lenP) *lenP = 0;
+			return NULL;
+			break;
+	}
+
+	switch(len) {
+		default:
+			break;
+
+		case 13:
+			len = 13 + *buffer;
+			buffer += 1;
+			break;
+
+		case 14:
+			len = 269+buffer[1]+(coap_size_t)(buffer[0]<<8);
+			buffer += 2;
+			break;
+
+		case 15:
+			if(key)*key = COAP_OPTION_INVALID;
+			if(value)*value = NULL;
+			if(lenP)*lenP = 0;
+			return NULL;
+			break;
+	}
+
+	if(lenP) *lenP = len;
+	if(value) *value = buffer;
+
+	return (uint8_t*)buffer + len;
+}
+
+static bool
+reference_verify_packet(const char* packet,coap_size_t packet_size) {
+	const struct coap_header_s* const header = (const void*)packet;
+	coap_option_key_t key = 0;
+	const uint8_t* option_ptr = header->token + header->token_len;
+
+	if (packet_size < 4) {
+		return false;
+	}
+
+	if (header->version != COAP_VERSION) {
+		return false;
+	}
+
+	if (packet_size > COAP_MAX_MESSAGE_SIZE) {
+		return false;
+	}
+
+	if (header->token_len > 8) {
+		return false;
+	}
+
+	if (header->code == COAP_CODE_EMPTY && packet_size != 4) {
+		return false;
+	}
+
+	for(;option_ptr && (unsigned)(option_ptr-(uint8_t*)header)<packet_size && option_ptr[0]!=0xFF;) {
+		option_ptr = reference_decode_option(option_ptr, &key, NULL, NULL);
+		if(!option_ptr) {
+			return false;
+		}
+		if((unsigned)(option_ptr-(uint8_t*)header)>packet_size) {
+			return false;
+		}
+	}
+
+	if((unsigned)(option_ptr-(uint8_t*)header)>packet_size) {
+		return false;
+	}
+
+	if((unsigned)(option_ptr-(uint8_t*)header)<packet_size) {
+		if(option_ptr && option_ptr[0]==0xFF) {
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// MARK: -
+// MARK: Corpus
+
+static const uint8_t get_request[] = {
+	0x44, COAP_METHOD_GET, 0x12, 0x34,			// CON GET
+	0xDE, 0xAD, 0xBE, 0xEF,						// Token
+	0xB3, 'd', 'e', 'v',						// Uri-Path
+	0x07, 'k', 'i', 't', 'c', 'h', 'e', 'n',	// Uri-Path
+	0x06, 's', 'e', 'n', 's', 'o', 'r',			// Uri-Path
+	0x04, 't', 'e', 'm', 'p',					// Uri-Path
+	0x61, 0x28,									// Accept: 40
+};
+
+static const uint8_t observe_notification[] = {
+	0x52, COAP_RESULT_205_CONTENT, 0x43, 0x21,	// NON 2.05
+	0x01, 0x02,									// Token
+	0x62, 0x01, 0x7F,							// Observe
+	0x60,										// Content-Format: 0
+	0x21, 0x3C,									// Max-Age: 60
+	0xFF, '2', '1', '.', '5', ' ', 'C',			// Payload
+};
+
+static const uint8_t block2_response[] = {
+	0x64, COAP_RESULT_205_CONTENT, 0x55, 0x66,	// ACK 2.05
+	0x11, 0x22, 0x33, 0x44,						// Token
+	0xC1, 0x28,									// Content-Format: 40
+	0xD1, 0x0A, 0x1E,							// Block2: 1/more/64
+	0x52, 0x04, 0x00,							// Size2: 1024
+	0xFF, '<', '/', 'a', '>', ',', '<', '/', 'b', '>',
+};
+
+static const uint8_t extended_options[] = {
+	0x41, COAP_METHOD_POST, 0x00, 0x01,			// CON POST
+	0x99,										// Token
+	0xED, 0x00, 0x10, 0x02, 'a', 'b', 'c', 'd',	// Option 285, length 15
+	'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+	0x0D, 0x00, '0', '1', '2', '3', '4', '5',	// Option 285, length 13
+	'6', '7', '8', '9', 'A', 'B', 'C',
+};
+
+static const struct {
+	const uint8_t* bytes;
+	coap_size_t len;
+} gCorpus[] = {
+	{ get_request, sizeof(get_request) },
+	{ observe_notification, sizeof(observe_notification) },
+	{ block2_response, sizeof(block2_response) },
+	{ extended_options, sizeof(extended_options) },
+};
+
+#define CORPUS_COUNT		(sizeof(gCorpus) / sizeof(gCorpus[0]))
+
+// MARK: -
+// MARK: Differential Checks
+
+static uint32_t gRandomState = 0x12345678;
+static int gFailures;
+static int gAccepted;
+static int gChecked;
+
+static uint32_t
+next_random(void) {
+	// xorshift32
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+	return gRandomState;
+}
+
+static void
+report_failure(const char* what, const uint8_t* packet, coap_size_t len) {
+	coap_size_t i;
+
+	if (gFailures++ < 10) {
+		fprintf(stderr, "MISMATCH (%s):", what);
+		for (i = 0; i < len; i++) {
+			fprintf(stderr, " %02X", packet[i]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+static void
+check_packet(const uint8_t* packet, coap_size_t len) {
+	const bool expected = reference_verify_packet((const char*)packet, len);
+	const bool actual = coap_verify_packet((const char*)packet, len);
+
+	gChecked++;
+
+	if (expected != actual) {
+		report_failure("verify", packet, len);
+		return;
+	}
+
+	if (actual) {
+		const struct coap_header_s* const header = (const void*)packet;
+		const uint8_t* expected_iter = header->token + header->token_len;
+		const uint8_t* actual_iter = expected_iter;
+		const uint8_t* const end = packet + len;
+		coap_option_key_t expected_key = 0;
+		coap_option_key_t actual_key = 0;
+
+		gAccepted++;
+
+		while (expected_iter < end && expected_iter[0] != 0xFF) {
+			const uint8_t* expected_value;
+			const uint8_t* actual_value;
+			coap_size_t expected_len;
+			coap_size_t actual_len;
+
+			expected_iter = reference_decode_option(expected_iter, &expected_key, &expected_value, &expected_len);
+			actual_iter = coap_decode_option(actual_iter, &actual_key, &actual_value, &actual_len);
+
+			if ( expected_iter != actual_iter
+			  || expected_key != actual_key
+			  || expected_value != actual_value
+			  || expected_len != actual_len
+			) {
+				report_failure("decode", packet, len);
+				return;
+			}
+		}
+	}
+}
+
+static void
+check_short_options(void) {
+	// Every option sequence of up to three bytes after a
+	// tokenless request header.
+	uint8_t packet[4 + 3 + PACKET_SLACK] = { 0x40, COAP_METHOD_GET, 0x00, 0x00 };
+	uint32_t i;
+
+	for (i = 0; i < 0x1000000; i++) {
+		packet[4] = (uint8_t)i;
+		packet[5] = (uint8_t)(i >> 8);
+		packet[6] = (uint8_t)(i >> 16);
+
+		if (i < 0x100) {
+			check_packet(packet, 5);
+		}
+		if (i < 0x10000) {
+			check_packet(packet, 6);
+		}
+		check_packet(packet, 7);
+	}
+}
+
+static void
+check_mutations(void) {
+	uint8_t packet[MAX_PACKET_SIZE + PACKET_SLACK];
+	uint32_t i;
+
+	for (i = 0; i < MUTATIONS; i++) {
+		const uint32_t which = next_random() % CORPUS_COUNT;
+		coap_size_t len = gCorpus[which].len;
+		uint32_t edits = 1 + next_random() % 4;
+
+		memset(packet, 0, sizeof(packet));
+		memcpy(packet, gCorpus[which].bytes, len);
+
+		while (edits--) {
+			const uint32_t r = next_random();
+			const coap_size_t at = (coap_size_t)((r >> 8) % len);
+
+			switch (r & 3) {
+			case 0:
+				// Replace a byte.
+				packet[at] = (uint8_t)(r >> 24);
+				break;
+
+			case 1:
+				// Flip a bit in one of the option headers.
+				packet[at] ^= (uint8_t)(1 << ((r >> 24) & 7));
+				break;
+
+			case 2:
+				// Truncate.
+				len = at + 1;
+				break;
+
+			case 3:
+				// Grow by a few random bytes.
+				while ((len < MAX_PACKET_SIZE) && (r & (1 << (24 + (len & 7))))) {
+					packet[len++] = (uint8_t)next_random();
+				}
+				break;
+			}
+		}
+
+		// Keep the version intact most of the time, so that
+		// the option parsing actually gets exercised.
+		if ((next_random() & 7) != 0) {
+			packet[0] = (uint8_t)((packet[0] & 0x3F) | (COAP_VERSION << 6));
+		}
+
+		check_packet(packet, len);
+	}
+}
+
+int
+main(void) {
+	uint32_t i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	for (i = 0; i < CORPUS_COUNT; i++) {
+		if (!coap_verify_packet((const char*)gCorpus[i].bytes, gCorpus[i].len)) {
+			fprintf(stderr, "Corpus packet %u was rejected\n", i);
+			gFailures++;
+		}
+	}
+
+	check_short_options();
+	check_mutations();
+
+	printf("%d packets checked, %d accepted, %d mismatches\n",
+		gChecked,
+		gAccepted,
+		gFailures
+	);
+
+	return gFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
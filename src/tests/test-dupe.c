@@ -0,0 +1,183 @@
+/*!	@page test-dupe test-dupe.c: Duplicate request test.
+**
+**	This test sends a confirmable request to an instance from a plain
+**	UDP socket, and then sends exactly the same bytes again, the way
+**	a peer that never saw the response would. The second response
+**	must be the same bytes as the first, replayed from the response
+**	cache, without the request handler being called again. A request
+**	with a new message id must still reach the handler.
+**
+**	@include test-dupe.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE
+
+static int gHandlerCalls;
+
+static smcp_status_t
+request_handler(void* context) {
+	gHandlerCalls++;
+
+	if (smcp_inbound_is_dupe()) {
+		fprintf(stderr, "Handler called for a duplicate\n");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	smcp_outbound_add_option_uint(COAP_OPTION_CONTENT_TYPE, COAP_CONTENT_TYPE_TEXT_PLAIN);
+
+	// Different every time, so a second call would show.
+	smcp_outbound_set_content_formatted("call=%d", gHandlerCalls);
+
+	return smcp_outbound_send();
+}
+
+//! Sends `request` to the instance and returns the response it sends back.
+static ssize_t
+exchange(smcp_t instance, int fd, const struct sockaddr_in6* to, const uint8_t* request, size_t request_len, uint8_t* response, size_t response_size) {
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	ssize_t len;
+	int tries;
+
+	if (sendto(fd, request, request_len, 0, (const struct sockaddr*)to, sizeof(*to)) != (ssize_t)request_len) {
+		perror("sendto");
+		exit(EXIT_FAILURE);
+	}
+
+	for (tries = 0; tries < 100; tries++) {
+		smcp_plat_wait(instance, 10);
+		smcp_plat_process(instance);
+
+		if (poll(&pfd, 1, 0) > 0) {
+			break;
+		}
+	}
+
+	len = recv(fd, response, response_size, MSG_DONTWAIT);
+
+	if (len <= 0) {
+		fprintf(stderr, "No response\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return len;
+}
+
+int
+main(void) {
+	static const uint8_t request[] = {
+		0x42, COAP_METHOD_GET, 0x12, 0x34,		// CON GET, msg_id
+		0xAB, 0xCD,								// Token
+		0xB4, 't', 'e', 's', 't',				// Uri-Path: test
+	};
+	uint8_t next_request[sizeof(request)];
+	uint8_t first[SMCP_MAX_PACKET_LENGTH];
+	uint8_t second[SMCP_MAX_PACKET_LENGTH];
+	struct sockaddr_in6 saddr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+	};
+	ssize_t first_len;
+	ssize_t second_len;
+	smcp_t instance;
+	int fd;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	if (smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0) != SMCP_STATUS_OK) {
+		perror("Unable to bind");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	if ((fd < 0) || (bind(fd, (struct sockaddr*)&saddr, sizeof(saddr)) != 0)) {
+		perror("Unable to open client socket");
+		return EXIT_FAILURE;
+	}
+
+	saddr.sin6_port = htons(smcp_plat_get_port(instance));
+
+	first_len = exchange(instance, fd, &saddr, request, sizeof(request), first, sizeof(first));
+
+	if ((first_len < 4) || (first[0] & 0x30) != 0x20 || first[1] != COAP_RESULT_205_CONTENT) {
+		fprintf(stderr, "Expected a piggy-backed 2.05 response\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// The peer never saw that, so it sends the request again.
+	second_len = exchange(instance, fd, &saddr, request, sizeof(request), second, sizeof(second));
+
+	printf("Responses of %d and %d bytes, %d handler calls\n", (int)first_len, (int)second_len, gHandlerCalls);
+
+	if (gHandlerCalls != 1) {
+		fprintf(stderr, "Handler called %d times for one request\n", gHandlerCalls);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((first_len != second_len) || (memcmp(first, second, (size_t)first_len) != 0)) {
+		fprintf(stderr, "Duplicate got a different response\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// A new message id is a new request.
+	memcpy(next_request, request, sizeof(request));
+	next_request[3]++;
+
+	second_len = exchange(instance, fd, &saddr, next_request, sizeof(next_request), second, sizeof(second));
+
+	if (gHandlerCalls != 2) {
+		fprintf(stderr, "New request didn't reach the handler\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((first_len == second_len) && (memcmp(first, second, (size_t)first_len) == 0)) {
+		fprintf(stderr, "New request got the cached response\n");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+	smcp_release(instance);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_CONF_DUPE_RESPONSE_CACHE_SIZE
@@ -0,0 +1,352 @@
+/*!	@page test-inbound test-inbound.c: Inbound option and vhost test.
+**
+**	This test sends requests with a variety of options to an instance
+**	that has a virtual host, and checks that each one is routed to the
+**	right handler and that `smcp_inbound_find_option()` and
+**	`smcp_inbound_next_option()` see exactly the options that were
+**	sent. Some of the requests have more options than fit into the
+**	inbound option index, so that the options past the end of the
+**	index are decoded from the packet instead.
+**
+**	@include test-inbound.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <smcp/smcp.h>
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+// Even, so that the server won't reject it as an unknown critical option.
+#define FAR_OPTION					((coap_option_key_t)1000)
+
+#define PATH_SEGMENTS_MANY			(SMCP_CONF_INBOUND_OPTION_INDEX_SIZE + 4)
+
+#if SMCP_CONF_ENABLE_VHOSTS
+
+struct test_case_s {
+	const char* name;
+
+	//! Uri-Host to send, or NULL for none.
+	const char* host;
+
+	//! Which handler should get the request.
+	bool expect_vhost;
+
+	int path_segments;
+	bool extra_options;
+};
+
+static const struct test_case_s gCases[] = {
+	{ "vhost",           "alpha", true,  1,                  false },
+	{ "same-length",     "bravo", false, 1,                  false },
+	{ "prefix",          "alph",  false, 1,                  false },
+	{ "longer",          "alphas", false, 1,                 false },
+	{ "no-host",         NULL,    false, 1,                  false },
+	{ "few-options",     "alpha", true,  2,                  true  },
+	{ "many-options",    "alpha", true,  PATH_SEGMENTS_MANY, true  },
+	{ "many-no-host",    NULL,    false, PATH_SEGMENTS_MANY, true  },
+};
+
+#define NUMBER_OF_CASES		((int)(sizeof(gCases) / sizeof(gCases[0])))
+
+static int gCase;
+static int gHandled;
+static bool gFinished;
+static uint16_t gPort;
+
+static void
+fail(const char* what)
+{
+	fprintf(stderr, "%s: %s\n", gCases[gCase].name, what);
+	exit(EXIT_FAILURE);
+}
+
+static bool
+option_equals(coap_option_key_t key, const char* expected)
+{
+	const uint8_t* value = NULL;
+	coap_size_t len = 0;
+
+	if (!smcp_inbound_find_option(key, &value, &len)) {
+		return false;
+	}
+
+	return len == strlen(expected) && memcmp(value, expected, len) == 0;
+}
+
+static void
+check_options(void)
+{
+	const struct test_case_s* const test = &gCases[gCase];
+	const uint8_t* value;
+	coap_size_t len;
+	coap_option_key_t key;
+	coap_option_key_t last_key = 0;
+	int count = 0;
+	int segment = 0;
+	int expected_count;
+
+	if (test->host) {
+		if (!option_equals(COAP_OPTION_URI_HOST, test->host)) {
+			fail("Uri-Host not found");
+		}
+	} else if (smcp_inbound_find_option(COAP_OPTION_URI_HOST, NULL, NULL)) {
+		fail("Found a Uri-Host that wasn't sent");
+	}
+
+	if (!option_equals(COAP_OPTION_URI_PATH, "p0")) {
+		fail("First Uri-Path not found");
+	}
+
+	if (smcp_inbound_find_option(COAP_OPTION_ETAG, NULL, NULL)) {
+		fail("Found an ETag that wasn't sent");
+	}
+
+	if (smcp_inbound_find_option(COAP_OPTION_SIZE, NULL, NULL)) {
+		fail("Found a Size that wasn't sent");
+	}
+
+	if (smcp_inbound_find_option((coap_option_key_t)2000, NULL, NULL)) {
+		fail("Found an option past the last one");
+	}
+
+	if (test->extra_options) {
+		if (!option_equals(COAP_OPTION_URI_QUERY, "q=1")) {
+			fail("First Uri-Query not found");
+		}
+
+		if (!smcp_inbound_find_option(COAP_OPTION_ACCEPT, &value, &len)
+		  || len != 1
+		  || value[0] != COAP_CONTENT_TYPE_APPLICATION_JSON
+		) {
+			fail("Accept not found");
+		}
+
+		if (!option_equals(FAR_OPTION, "far")) {
+			fail("Option 1000 not found");
+		}
+	} else {
+		if (smcp_inbound_find_option(COAP_OPTION_URI_QUERY, NULL, NULL)) {
+			fail("Found a Uri-Query that wasn't sent");
+		}
+		if (smcp_inbound_find_option(FAR_OPTION, NULL, NULL)) {
+			fail("Found option 1000 when it wasn't sent");
+		}
+	}
+
+	// Walking the options must give back all of them, in order.
+	smcp_inbound_reset_next_option();
+
+	while ((key = smcp_inbound_next_option(&value, &len)) != COAP_OPTION_INVALID) {
+		if (key < last_key) {
+			fail("Options out of order");
+		}
+		last_key = key;
+		count++;
+
+		if (key == COAP_OPTION_URI_PATH) {
+			char expected[16];
+			snprintf(expected, sizeof(expected), "p%d", segment++);
+			if (len != strlen(expected) || memcmp(value, expected, len) != 0) {
+				fail("Wrong Uri-Path");
+			}
+		}
+	}
+
+	expected_count = (test->host != NULL) + test->path_segments;
+
+	if (test->extra_options) {
+		expected_count += 2 + 1 + 1;
+	}
+
+	if (count != expected_count || segment != test->path_segments) {
+		fail("Wrong number of options");
+	}
+
+	// Doing it again must not depend on where the walk left off.
+	if (test->extra_options && !option_equals(COAP_OPTION_URI_QUERY, "q=1")) {
+		fail("Uri-Query not found after walking the options");
+	}
+}
+
+static smcp_status_t
+respond(bool is_vhost)
+{
+	if (is_vhost != gCases[gCase].expect_vhost) {
+		fail(is_vhost ? "Routed to the vhost" : "Not routed to the vhost");
+	}
+
+	check_options();
+
+	gHandled++;
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+
+	return smcp_outbound_send();
+}
+
+static smcp_status_t
+default_handler(void* context)
+{
+	return respond(false);
+}
+
+static smcp_status_t
+vhost_handler(void* context)
+{
+	return respond(true);
+}
+
+static smcp_status_t
+resend_request(void* context)
+{
+	const struct test_case_s* const test = &gCases[gCase];
+	smcp_status_t status;
+	char uri[64];
+	int i;
+
+	status = smcp_outbound_begin(smcp_get_current_instance(), COAP_METHOD_GET, COAP_TRANS_TYPE_CONFIRMABLE);
+	require_noerr(status, bail);
+
+	snprintf(uri, sizeof(uri), "coap://localhost:%d/", gPort);
+
+	status = smcp_outbound_set_uri(uri, SMCP_MSG_SKIP_AUTHORITY | SMCP_MSG_SKIP_PATH);
+	require_noerr(status, bail);
+
+	// Added out of order on purpose.
+	if (test->extra_options) {
+		status = smcp_outbound_add_option(FAR_OPTION, "far", SMCP_CSTR_LEN);
+		require_noerr(status, bail);
+
+		status = smcp_outbound_add_option_uint(COAP_OPTION_ACCEPT, COAP_CONTENT_TYPE_APPLICATION_JSON);
+		require_noerr(status, bail);
+
+		status = smcp_outbound_add_option(COAP_OPTION_URI_QUERY, "q=1", SMCP_CSTR_LEN);
+		require_noerr(status, bail);
+
+		status = smcp_outbound_add_option(COAP_OPTION_URI_QUERY, "r=2", SMCP_CSTR_LEN);
+		require_noerr(status, bail);
+	}
+
+	for (i = 0; i < test->path_segments; i++) {
+		char segment[16];
+		snprintf(segment, sizeof(segment), "p%d", i);
+		status = smcp_outbound_add_option(COAP_OPTION_URI_PATH, segment, SMCP_CSTR_LEN);
+		require_noerr(status, bail);
+	}
+
+	if (test->host) {
+		status = smcp_outbound_add_option(COAP_OPTION_URI_HOST, test->host, SMCP_CSTR_LEN);
+		require_noerr(status, bail);
+	}
+
+	status = smcp_outbound_send();
+
+bail:
+	return status;
+}
+
+static smcp_status_t
+response_handler(int statuscode, void* context)
+{
+	if (statuscode == SMCP_STATUS_TRANSACTION_INVALIDATED) {
+		gFinished = true;
+	} else if (statuscode != COAP_RESULT_205_CONTENT) {
+		fprintf(stderr, "%s: Got status %d (%s)\n", gCases[gCase].name, statuscode, smcp_status_to_cstr(statuscode));
+		exit(EXIT_FAILURE);
+	}
+	return SMCP_STATUS_OK;
+}
+
+int
+main(void) {
+	smcp_t instance;
+	smcp_t client;
+	smcp_timestamp_t start_time;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+	client = smcp_create();
+
+	if (!instance || !client) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0);
+	smcp_plat_bind_to_port(client, SMCP_SESSION_TYPE_UDP, 0);
+
+	gPort = smcp_plat_get_port(instance);
+
+	smcp_set_default_request_handler(instance, &default_handler, NULL);
+
+	if (smcp_vhost_add(instance, "alpha", &vhost_handler, NULL) != SMCP_STATUS_OK) {
+		fprintf(stderr, "smcp_vhost_add() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (gCase = 0; gCase < NUMBER_OF_CASES; gCase++) {
+		smcp_transaction_t transaction;
+
+		printf("Case %s\n", gCases[gCase].name);
+
+		gFinished = false;
+
+		transaction = smcp_transaction_init(
+			NULL,
+			SMCP_TRANSACTION_ALWAYS_INVALIDATE,
+			&resend_request,
+			&response_handler,
+			NULL
+		);
+
+		if (!transaction
+		  || smcp_transaction_begin(client, transaction, 3*MSEC_PER_SEC) != SMCP_STATUS_OK
+		) {
+			fail("Unable to begin transaction");
+		}
+
+		start_time = smcp_plat_cms_to_timestamp(0);
+
+		while (!gFinished) {
+			if (-smcp_plat_timestamp_to_cms(start_time) > MSEC_PER_SEC*5) {
+				fail("TIMEOUT");
+			}
+			smcp_plat_wait(instance, 10);
+			smcp_plat_process(instance);
+			smcp_plat_process(client);
+		}
+
+		if (gHandled != gCase + 1) {
+			fail("Request was never handled");
+		}
+	}
+
+	smcp_release(client);
+	smcp_release(instance);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_CONF_ENABLE_VHOSTS
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_CONF_ENABLE_VHOSTS
@@ -0,0 +1,249 @@
+/*!	@page test-observe-periods test-observe-periods.c: Observe rate limiting test.
+**
+**	This test registers a few observers of a resource whose observable
+**	has a minimum and a maximum period, and then triggers it several
+**	times in a row. Each observer must get exactly one notification
+**	for all of those triggers, no sooner than the minimum period after
+**	its registration, with the latest value. With nothing else
+**	triggering it, each observer must then get a keepalive
+**	notification once its maximum period is up.
+**
+**	One observer asks for a shorter maximum period than the
+**	observable's, which must be ignored, and another asks for a longer
+**	one, which must be honored.
+**
+**	The registrations are fed straight into the instance with
+**	fake_inbound_observe(), as if they had come from sockets that the
+**	test reads the notifications from.
+**
+**	@include test-observe-periods.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-observable.h>
+#include "fake-inbound.h"
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#define PMIN					(300)
+#define PMAX					(1500)
+#define TRIGGERS				(5)
+
+// For differences between the clock the timers use and ours.
+#define SLOP					(20)
+
+struct observer_s {
+	const char* name;
+
+	//! Uri-Query to register with, or NULL for none.
+	const char* query;
+
+	//! Keepalive period this observer should end up with.
+	smcp_cms_t pmax;
+
+	int fd;
+	smcp_sockaddr_t saddr;
+	int64_t registered;
+	int64_t received[2];
+	int count;
+};
+
+static struct observer_s gObservers[] = {
+	{ .name = "plain",   .query = NULL,     .pmax = PMAX },
+	{ .name = "shorter", .query = "pmax=1", .pmax = PMAX },
+	{ .name = "longer",  .query = "pmax=2", .pmax = 2 * MSEC_PER_SEC },
+};
+
+#define OBSERVER_COUNT			((int)(sizeof(gObservers) / sizeof(gObservers[0])))
+
+static struct smcp_observable_s gObservable;
+static int gValue;
+
+static int64_t
+now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * MSEC_PER_SEC + ts.tv_nsec / 1000000;
+}
+
+static void
+fail(const struct observer_s* observer, const char* what) {
+	fprintf(stderr, "%s: %s\n", observer->name, what);
+	exit(EXIT_FAILURE);
+}
+
+static smcp_status_t
+request_handler(void* context) {
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	smcp_observable_update(&gObservable, 0);
+	smcp_outbound_set_content_formatted("value=%d", gValue);
+
+	return smcp_outbound_send();
+}
+
+static void
+register_observer(smcp_t instance, struct observer_s* observer, uint16_t msg_id) {
+	observer->registered = now_ms();
+
+	fake_inbound_observe(instance, &observer->saddr, msg_id, msg_id, true, observer->query);
+}
+
+//! Reads everything the instance sent to this observer.
+static void
+receive(smcp_t instance, struct observer_s* observer, bool expect_registration) {
+	uint8_t packet[SMCP_MAX_PACKET_LENGTH];
+	char expected[16];
+	ssize_t len;
+
+	snprintf(expected, sizeof(expected), "value=%d", gValue);
+
+	while ((len = recv(observer->fd, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+		const int64_t now = now_ms();
+
+		if ((len < 4) || (packet[1] != COAP_RESULT_205_CONTENT)) {
+			fail(observer, "Unexpected packet");
+		}
+
+		// Acknowledge confirmable notifications, so they aren't retransmitted.
+		if (((packet[0] >> 4) & 3) == COAP_TRANS_TYPE_CONFIRMABLE) {
+			const uint8_t ack[4] = { 0x60, 0x00, packet[2], packet[3] };
+			smcp_sockaddr_t to = observer->saddr;
+
+			to.sin6_port = htons(smcp_plat_get_port(instance));
+			sendto(observer->fd, ack, sizeof(ack), 0, (struct sockaddr*)&to, sizeof(to));
+		}
+
+		if (expect_registration) {
+			expect_registration = false;
+			continue;
+		}
+
+		if (observer->count >= 2) {
+			fail(observer, "Too many notifications");
+		}
+
+		if (((size_t)len < strlen(expected))
+		  || (memcmp(packet + len - strlen(expected), expected, strlen(expected)) != 0)
+		) {
+			fail(observer, "Notification doesn't have the latest value");
+		}
+
+		observer->received[observer->count++] = now;
+
+		printf("%s: Notification %d after %d ms\n",
+			observer->name,
+			observer->count,
+			(int)(now - observer->registered)
+		);
+	}
+
+	if (expect_registration) {
+		fail(observer, "No response to the registration");
+	}
+}
+
+int
+main(void) {
+	smcp_t instance;
+	int64_t start;
+	int done;
+	int i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	if (smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0) != SMCP_STATUS_OK) {
+		perror("Unable to bind");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	gObservable.pmin = PMIN;
+	gObservable.pmax = PMAX;
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		struct observer_s* const observer = &gObservers[i];
+
+		observer->fd = fake_inbound_open_socket(&observer->saddr);
+
+		if (observer->fd < 0) {
+			perror("Unable to open observer socket");
+			return EXIT_FAILURE;
+		}
+
+		register_observer(instance, observer, (uint16_t)(i + 1));
+	}
+
+	// The response to the registration counts as a notification,
+	// so all of these fall within the minimum period.
+	for (i = 0; i < TRIGGERS; i++) {
+		gValue++;
+		smcp_observable_trigger(&gObservable, 0, 0);
+	}
+
+	usleep(50 * 1000);
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		receive(instance, &gObservers[i], true);
+	}
+
+	start = now_ms();
+
+	do {
+		if (now_ms() - start > 10 * MSEC_PER_SEC) {
+			fprintf(stderr, "TIMEOUT\n");
+			exit(EXIT_FAILURE);
+		}
+
+		smcp_plat_wait(instance, 10);
+		smcp_plat_process(instance);
+
+		for (i = 0, done = 0; i < OBSERVER_COUNT; i++) {
+			receive(instance, &gObservers[i], false);
+			done += (gObservers[i].count == 2);
+		}
+	} while (done != OBSERVER_COUNT);
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		const struct observer_s* const observer = &gObservers[i];
+
+		if (observer->received[0] - observer->registered < PMIN - SLOP) {
+			fail(observer, "Notification sent before the minimum period was up");
+		}
+
+		if (observer->received[1] - observer->received[0] < observer->pmax - SLOP) {
+			fail(observer, "Keepalive sent before the maximum period was up");
+		}
+
+		close(observer->fd);
+	}
+
+	smcp_release(instance);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,342 @@
+/*!	@page test-observe-share test-observe-share.c: Shared notification test.
+**
+**	When an observable that shares notifications is triggered, only
+**	the first observer's notification is rendered by the request
+**	handler, and the other observers that registered with the same
+**	request are sent copies of it. This test checks that every copy
+**	is the same as the rendered notification, except for the message
+**	id, the token and the value of the Observe option, which must be
+**	the observer's own.
+**
+**	Half of the observers are put through a few hundred notifications
+**	before the other half registers, so that the Observe values differ
+**	in length between them. The request handler adds options on both
+**	sides of the Observe option, some of them out of order.
+**
+**	Finally, sharing is turned off, after which every observer's
+**	notification must be rendered by the request handler.
+**
+**	@include test-observe-share.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-observable.h>
+#include "fake-inbound.h"
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+
+#define OBSERVERS				(8)
+
+// Enough for the Observe values of the first half to take two bytes.
+#define WARMUP_TRIGGERS			(300)
+
+#define FAR_OPTION				((coap_option_key_t)1000)
+
+struct observer_s {
+	int fd;
+	smcp_sockaddr_t saddr;
+	uint32_t last_seq;
+	uint16_t last_msg_id;
+	bool received;
+	uint8_t packet[SMCP_MAX_PACKET_LENGTH];
+	coap_size_t len;
+};
+
+static struct observer_s gObservers[OBSERVERS];
+static struct smcp_observable_s gObservable;
+static int gHandlerCalls;
+static int gValue;
+
+static smcp_status_t
+request_handler(void* context) {
+	static const char far_value[] = "a value that is long enough to need an extended length";
+
+	gHandlerCalls++;
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	smcp_observable_update(&gObservable, 0);
+	smcp_outbound_add_option(FAR_OPTION, far_value, SMCP_CSTR_LEN);
+	smcp_outbound_add_option_uint(COAP_OPTION_MAX_AGE, 30);
+	smcp_outbound_add_option_uint(COAP_OPTION_CONTENT_TYPE, COAP_CONTENT_TYPE_TEXT_PLAIN);
+	smcp_outbound_add_option_uint(COAP_OPTION_ETAG, (uint32_t)gValue);
+	smcp_outbound_set_content_formatted("value=%d", gValue);
+
+	return smcp_outbound_send();
+}
+
+static void
+register_observer(smcp_t instance, int i) {
+	fake_inbound_observe(instance, &gObservers[i].saddr, (uint16_t)(i + 1), (uint32_t)(i + 1), true, NULL);
+}
+
+//! Returns the value of the Observe option in `packet`, or -1 if it has none.
+static int64_t
+get_observe_value(const uint8_t* packet, coap_size_t len) {
+	const struct coap_header_s* const header = (const struct coap_header_s*)packet;
+	const uint8_t* iter = header->token + header->token_len;
+	const uint8_t* const end = packet + len;
+	coap_option_key_t key = 0;
+	const uint8_t* value;
+	coap_size_t value_len;
+
+	while ((iter < end) && (*iter != 0xFF)) {
+		iter = coap_decode_option(iter, &key, &value, &value_len);
+		if (iter == NULL) {
+			break;
+		}
+		if (key == COAP_OPTION_OBSERVE) {
+			return coap_decode_uint32(value, (uint8_t)value_len);
+		}
+	}
+
+	return -1;
+}
+
+//! Waits for one packet to each of the given observers, acknowledging them.
+static void
+receive_round(smcp_t instance, int first, int end) {
+	int remaining = end - first;
+	int tries;
+	int i;
+
+	for (i = first; i < end; i++) {
+		gObservers[i].received = false;
+	}
+
+	for (tries = 0; (remaining > 0) && (tries < 1000); tries++) {
+		smcp_plat_process(instance);
+
+		for (i = first; i < end; i++) {
+			struct observer_s* const observer = &gObservers[i];
+			uint8_t packet[SMCP_MAX_PACKET_LENGTH];
+			ssize_t len;
+
+			while ((len = recv(observer->fd, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+				const uint16_t msg_id = (uint16_t)((packet[2] << 8) | packet[3]);
+
+				if (((packet[0] >> 4) & 3) == COAP_TRANS_TYPE_CONFIRMABLE) {
+					const uint8_t ack[4] = { 0x60, 0x00, packet[2], packet[3] };
+					smcp_sockaddr_t to = observer->saddr;
+
+					to.sin6_port = htons(smcp_plat_get_port(instance));
+					sendto(observer->fd, ack, sizeof(ack), 0, (struct sockaddr*)&to, sizeof(to));
+				}
+
+				// Notifications may be retransmitted, which is fine.
+				if ((observer->len != 0) && (observer->last_msg_id == msg_id)) {
+					continue;
+				}
+
+				if (observer->received) {
+					fprintf(stderr, "Observer %d: More than one notification\n", i);
+					exit(EXIT_FAILURE);
+				}
+
+				memcpy(observer->packet, packet, (size_t)len);
+				observer->last_msg_id = msg_id;
+				observer->len = (coap_size_t)len;
+				observer->received = true;
+				remaining--;
+			}
+		}
+
+		if (remaining > 0) {
+			smcp_plat_wait(instance, 1);
+		}
+	}
+
+	if (remaining > 0) {
+		fprintf(stderr, "%d observers didn't get a notification\n", remaining);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//! Checks that `observer` got what `reference` got, apart from what has to differ.
+static void
+check_same(int i, const struct observer_s* reference) {
+	const struct observer_s* const observer = &gObservers[i];
+	const struct coap_header_s* const header = (const struct coap_header_s*)observer->packet;
+	const struct coap_header_s* const ref_header = (const struct coap_header_s*)reference->packet;
+	const uint8_t* iter = header->token + header->token_len;
+	const uint8_t* ref_iter = ref_header->token + ref_header->token_len;
+	const uint8_t* const end = observer->packet + observer->len;
+	const uint8_t* const ref_end = reference->packet + reference->len;
+	coap_option_key_t key = 0;
+	coap_option_key_t ref_key = 0;
+	uint32_t token = 0;
+	int64_t seq;
+
+	if (header->token_len == sizeof(token)) {
+		memcpy(&token, header->token, sizeof(token));
+	}
+
+	if ( (header->code != ref_header->code)
+	  || (token != (uint32_t)(i + 1))
+	) {
+		fprintf(stderr, "Observer %d: Wrong code or token\n", i);
+		exit(EXIT_FAILURE);
+	}
+
+	seq = get_observe_value(observer->packet, observer->len);
+
+	if (seq <= (int64_t)observer->last_seq) {
+		fprintf(stderr, "Observer %d: Observe value didn't go up\n", i);
+		exit(EXIT_FAILURE);
+	}
+
+	// Every option but Observe must be the same, and so must the payload.
+	for (;;) {
+		const uint8_t* value = NULL;
+		const uint8_t* ref_value = NULL;
+		coap_size_t value_len = 0;
+		coap_size_t ref_value_len = 0;
+
+		if ((iter < end) && (*iter != 0xFF)) {
+			iter = coap_decode_option(iter, &key, &value, &value_len);
+		} else {
+			key = COAP_OPTION_INVALID;
+		}
+
+		if ((ref_iter < ref_end) && (*ref_iter != 0xFF)) {
+			ref_iter = coap_decode_option(ref_iter, &ref_key, &ref_value, &ref_value_len);
+		} else {
+			ref_key = COAP_OPTION_INVALID;
+		}
+
+		if ((iter == NULL) || (ref_iter == NULL) || (key != ref_key)) {
+			fprintf(stderr, "Observer %d: Different options\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		if (key == COAP_OPTION_INVALID) {
+			break;
+		}
+
+		if ( (key != COAP_OPTION_OBSERVE)
+		  && ((value_len != ref_value_len) || (memcmp(value, ref_value, value_len) != 0))
+		) {
+			fprintf(stderr, "Observer %d: Different value for option %d\n", i, key);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((end - iter != ref_end - ref_iter) || (memcmp(iter, ref_iter, (size_t)(end - iter)) != 0)) {
+		fprintf(stderr, "Observer %d: Different payload\n", i);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+trigger(smcp_t instance, int registered, int expected_calls) {
+	int i;
+
+	gValue++;
+	gHandlerCalls = 0;
+
+	smcp_observable_trigger(&gObservable, 0, 0);
+	receive_round(instance, 0, registered);
+
+	if (gHandlerCalls != expected_calls) {
+		fprintf(stderr, "Handler called %d times for one trigger, expected %d\n", gHandlerCalls, expected_calls);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < registered; i++) {
+		check_same(i, &gObservers[0]);
+		gObservers[i].last_seq = (uint32_t)get_observe_value(gObservers[i].packet, gObservers[i].len);
+	}
+}
+
+int
+main(void) {
+	smcp_t instance;
+	int i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	if (smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0) != SMCP_STATUS_OK) {
+		perror("Unable to bind");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	gObservable.share_notifications = true;
+
+	for (i = 0; i < OBSERVERS; i++) {
+		gObservers[i].fd = fake_inbound_open_socket(&gObservers[i].saddr);
+
+		if (gObservers[i].fd < 0) {
+			perror("Unable to open observer socket");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < OBSERVERS / 2; i++) {
+		register_observer(instance, i);
+	}
+
+	receive_round(instance, 0, OBSERVERS / 2);
+
+	for (i = 0; i < WARMUP_TRIGGERS; i++) {
+		trigger(instance, OBSERVERS / 2, 1);
+	}
+
+	for (i = OBSERVERS / 2; i < OBSERVERS; i++) {
+		register_observer(instance, i);
+	}
+
+	receive_round(instance, OBSERVERS / 2, OBSERVERS);
+
+	for (i = 0; i < 3; i++) {
+		trigger(instance, OBSERVERS, 1);
+	}
+
+	gObservable.share_notifications = false;
+	trigger(instance, OBSERVERS, OBSERVERS);
+
+	printf("Observe values %u and %u\n", gObservers[0].last_seq, gObservers[OBSERVERS - 1].last_seq);
+
+	for (i = 0; i < OBSERVERS; i++) {
+		close(gObservers[i].fd);
+	}
+
+	smcp_release(instance);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_OBSERVABLE_SHARE_NOTIFICATIONS
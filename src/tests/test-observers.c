@@ -0,0 +1,155 @@
+/*!	@page test-observers test-observers.c: Observer registration test.
+**
+**	This test registers a large number of observers of the same
+**	resource by feeding observe requests straight into
+**	`smcp_inbound_packet_process()`. It then checks that registering
+**	all of them again leaves the count unchanged, that deregistering
+**	them with a plain GET removes every one, and that `smcp_release()`
+**	leaves the observable empty.
+**
+**	The requests come from a few sockets that are never read from,
+**	so the responses just pile up and get dropped by the kernel.
+**	Each socket gets its own run of message ids, so that none of the
+**	requests look like a duplicate of an earlier one.
+**
+**	@include test-observers.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-observable.h>
+#include "fake-inbound.h"
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_MAX_OBSERVERS >= 50000
+#define OBSERVERS				(50000)
+#else
+#define OBSERVERS				(SMCP_MAX_OBSERVERS)
+#endif
+
+#define SINKS					(4)
+
+static struct smcp_observable_s gObservable;
+static smcp_sockaddr_t gSinks[SINKS];
+static int gHandlerCalls;
+
+static smcp_status_t
+request_handler(void* context) {
+	gHandlerCalls++;
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	smcp_observable_update(&gObservable, 0);
+	smcp_outbound_set_content_formatted("value=%d", gHandlerCalls);
+
+	return smcp_outbound_send();
+}
+
+static void
+send_request(smcp_t instance, uint32_t peer, int pass, bool observe) {
+	const uint16_t msg_id = (uint16_t)(pass * (OBSERVERS / SINKS + 1) + peer / SINKS);
+
+	// Every peer gets its own token.
+	fake_inbound_observe(instance, &gSinks[peer % SINKS], msg_id, peer, observe, NULL);
+}
+
+static void
+run_pass(smcp_t instance, int pass, bool observe, int expected) {
+	uint32_t peer;
+	int count;
+
+	gHandlerCalls = 0;
+
+	for (peer = 0; peer < OBSERVERS; peer++) {
+		send_request(instance, peer, pass, observe);
+	}
+
+	count = smcp_observable_observer_count(&gObservable, 0);
+
+	printf("Pass %d: %d handler calls, %d observers\n", pass, gHandlerCalls, count);
+
+	if (gHandlerCalls != OBSERVERS) {
+		fprintf(stderr, "Pass %d: Handler called %d times, expected %d\n", pass, gHandlerCalls, OBSERVERS);
+		exit(EXIT_FAILURE);
+	}
+
+	if (count != expected) {
+		fprintf(stderr, "Pass %d: %d observers, expected %d\n", pass, count, expected);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int
+main(void) {
+	smcp_t instance;
+	int sinks[SINKS];
+	int i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	for (i = 0; i < SINKS; i++) {
+		sinks[i] = fake_inbound_open_socket(&gSinks[i]);
+
+		if (sinks[i] < 0) {
+			perror("Unable to open sink socket");
+			return EXIT_FAILURE;
+		}
+	}
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	if (smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0) != SMCP_STATUS_OK) {
+		perror("Unable to bind");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	// Register, register again, then deregister.
+	run_pass(instance, 0, true, OBSERVERS);
+	run_pass(instance, 1, true, OBSERVERS);
+	run_pass(instance, 2, false, 0);
+
+	if (gObservable.first_observer != NULL || gObservable.last_observer != NULL) {
+		fprintf(stderr, "Observable not empty after deregistering\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Releasing the instance must take its observers with it.
+	send_request(instance, 0, 3, true);
+
+	if (smcp_observable_observer_count(&gObservable, 0) != 1) {
+		fprintf(stderr, "Unable to register after deregistering\n");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_release(instance);
+
+	if (gObservable.first_observer != NULL || gObservable.last_observer != NULL) {
+		fprintf(stderr, "Observable not empty after smcp_release()\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < SINKS; i++) {
+		close(sinks[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
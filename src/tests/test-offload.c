@@ -0,0 +1,195 @@
+/*!	@page test-offload test-offload.c: Offloaded node test.
+**
+**	This test sends a burst of requests to a node whose handler takes
+**	a long time, and checks that the responses all come back, and
+**	that they were handled in parallel instead of one at a time on
+**	the event loop.
+**
+**	@include test-offload.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-node-router.h>
+#include <smcp/smcp-offload.h>
+
+#define NUMBER_OF_WORKERS			(8)
+#define NUMBER_OF_REQUESTS			(16)
+#define HANDLER_DELAY_MSEC			(200)
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_CONF_OFFLOAD_NODE
+
+static int gRemaining = NUMBER_OF_REQUESTS;
+
+static smcp_status_t
+slow_handler(smcp_offload_node_t node, struct smcp_offload_request_s* request)
+{
+	// Stand-in for a database query or a CGI script.
+	usleep(HANDLER_DELAY_MSEC * 1000);
+
+	request->response_content_type = COAP_CONTENT_TYPE_TEXT_PLAIN;
+	request->response_len = snprintf(
+		request->response,
+		request->response_max_len,
+		"Hello world!"
+	);
+
+	return SMCP_STATUS_OK;
+}
+
+static void
+submission_callback(struct smcp_submission_s* submission)
+{
+	if ( submission->status != SMCP_STATUS_OK
+	  || submission->response_code != COAP_RESULT_205_CONTENT
+	  || submission->response_len != sizeof("Hello world!") - 1
+	  || memcmp(submission->response, "Hello world!", submission->response_len) != 0
+	) {
+		fprintf(
+			stderr,
+			"Request failed: %d (%s), code %d\n",
+			submission->status,
+			smcp_status_to_cstr(submission->status),
+			submission->response_code
+		);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("Got response %d\n", NUMBER_OF_REQUESTS - gRemaining);
+
+	gRemaining--;
+}
+
+int
+main(void) {
+	smcp_t instance;
+	smcp_t client;
+	smcp_node_t root_node;
+	smcp_worker_pool_t pool;
+	struct smcp_submission_s submissions[NUMBER_OF_REQUESTS];
+	char responses[NUMBER_OF_REQUESTS][32];
+	char* url = NULL;
+	char* long_url = NULL;
+	smcp_timestamp_t start_time;
+	smcp_cms_t elapsed;
+	int i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0);
+
+	// Separate responses get matched by message id, so the requests
+	// can't come from the same instance that serves them.
+	client = smcp_create();
+
+	if (!client) {
+		perror("Unable to create client SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_plat_bind_to_port(client, SMCP_SESSION_TYPE_UDP, 0);
+
+	root_node = smcp_node_init(NULL, NULL, NULL);
+
+	smcp_set_default_request_handler(instance, &smcp_node_router_handler, (void*)root_node);
+
+	pool = smcp_worker_pool_create(NUMBER_OF_WORKERS);
+
+	if (!pool) {
+		perror("Unable to create worker pool");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!smcp_offload_node_init(NULL, root_node, "slow", pool, &slow_handler)) {
+		fprintf(stderr, "Unable to create offload node\n");
+		exit(EXIT_FAILURE);
+	}
+
+	asprintf(&url, "coap://localhost:%d/slow", smcp_plat_get_port(instance));
+
+	// Too long to be kept inline for the async response.
+	asprintf(
+		&long_url,
+		"coap://localhost:%d/slow?%s",
+		smcp_plat_get_port(instance),
+		"q=0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+	);
+
+	for (i = 0; i < NUMBER_OF_REQUESTS; i++) {
+		memset(&submissions[i], 0, sizeof(submissions[i]));
+		submissions[i].method = COAP_METHOD_GET;
+		submissions[i].uri = (i & 1) ? long_url : url;
+		submissions[i].timeout = 5 * MSEC_PER_SEC;
+		submissions[i].response = responses[i];
+		submissions[i].response_max_len = sizeof(responses[i]);
+		submissions[i].callback = &submission_callback;
+
+		if (smcp_submit(client, &submissions[i]) != SMCP_STATUS_OK) {
+			fprintf(stderr, "smcp_submit() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	start_time = smcp_plat_cms_to_timestamp(0);
+
+	while (gRemaining > 0) {
+		if (-smcp_plat_timestamp_to_cms(start_time) > MSEC_PER_SEC*10) {
+			fprintf(stderr,"TIMEOUT\n");
+			return EXIT_FAILURE;
+		}
+		smcp_plat_wait(instance, 10);
+		smcp_plat_process(instance);
+		smcp_plat_process(client);
+	}
+
+	elapsed = -smcp_plat_timestamp_to_cms(start_time);
+
+	printf("Took %dms\n", (int)elapsed);
+
+	// Handled one after the other, this would take 3.2 seconds.
+	if (elapsed >= NUMBER_OF_REQUESTS * HANDLER_DELAY_MSEC / 2) {
+		fprintf(stderr, "Requests weren't handled in parallel (%dms)\n", (int)elapsed);
+		return EXIT_FAILURE;
+	}
+
+	smcp_worker_pool_release(pool);
+	smcp_release(client);
+	smcp_release(instance);
+	smcp_node_delete(root_node);
+	free(url);
+	free(long_url);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_CONF_OFFLOAD_NODE
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_CONF_OFFLOAD_NODE
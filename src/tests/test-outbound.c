@@ -0,0 +1,248 @@
+/*!	@page test-outbound test-outbound.c: Outbound option order test.
+**
+**	This test composes messages from random sets of options, adding
+**	them with `smcp_outbound_add_option()` in a random order and then
+**	again in key order, and checks that both give byte-identical
+**	packets. Options with the same key are added in the same relative
+**	order both times, since that order is significant.
+**
+**	Out-of-order options are held in a staging table until the content
+**	is started. The messages are checked several times, with the table
+**	limited to different sizes, including sizes that overflow on
+**	almost every message.
+**
+**	@include test-outbound.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-internal.h>
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#define MESSAGES				(20000)
+#define MAX_OPTIONS				(40)
+
+// Leaves room for the header and end-of-options marker, and
+// for the slack that smcp_outbound_add_option() insists on.
+#define MAX_OPTIONS_SIZE		(SMCP_MAX_PACKET_LENGTH - 32)
+
+static const coap_option_key_t gKeys[] = {
+	COAP_OPTION_IF_MATCH,
+	COAP_OPTION_URI_HOST,
+	COAP_OPTION_ETAG,
+	COAP_OPTION_IF_NONE_MATCH,
+	COAP_OPTION_URI_PORT,
+	COAP_OPTION_LOCATION_PATH,
+	COAP_OPTION_URI_PATH,
+	COAP_OPTION_CONTENT_TYPE,
+	COAP_OPTION_MAX_AGE,
+	COAP_OPTION_URI_QUERY,
+	COAP_OPTION_ACCEPT,
+	COAP_OPTION_LOCATION_QUERY,
+	COAP_OPTION_BLOCK1,
+	COAP_OPTION_SIZE,
+	COAP_OPTION_PROXY_URI,
+	300,
+	1000,
+	65000,
+};
+
+#define KEY_COUNT				(sizeof(gKeys) / sizeof(gKeys[0]))
+
+struct option_s {
+	coap_option_key_t key;
+	coap_size_t len;
+	uint8_t value[300];
+};
+
+static struct option_s gOptions[MAX_OPTIONS];
+static int gOptionCount;
+
+static uint8_t gExpected[SMCP_MAX_PACKET_LENGTH];
+static coap_size_t gExpectedLen;
+
+static uint32_t gRandomState = 0x12345678;
+
+static uint32_t
+next_random(void) {
+	// xorshift32
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+	return gRandomState;
+}
+
+//! Makes up a set of options whose encoded size fits in the packet.
+static void
+make_options(void) {
+	const coap_size_t budget = next_random() % MAX_OPTIONS_SIZE;
+	const int count = (int)(next_random() % (MAX_OPTIONS + 1));
+	coap_size_t size = 0;
+	coap_size_t i;
+
+	for (gOptionCount = 0; gOptionCount < count; gOptionCount++) {
+		struct option_s* const option = &gOptions[gOptionCount];
+
+		option->key = gKeys[next_random() % KEY_COUNT];
+
+		// Mostly short values, with the occasional long one so
+		// that every length encoding gets used.
+		if ((next_random() & 15) == 0) {
+			option->len = (coap_size_t)(next_random() % sizeof(option->value));
+		} else {
+			option->len = (coap_size_t)(next_random() % 20);
+		}
+
+		// Worst case for the option header.
+		if (size + option->len + 5 > budget) {
+			break;
+		}
+		size += option->len + 5;
+
+		for (i = 0; i < option->len; i++) {
+			option->value[i] = (uint8_t)next_random();
+		}
+	}
+}
+
+static void
+compose(const int* order, uint8_t* packet, coap_size_t* len) {
+	smcp_t const self = smcp_get_current_instance();
+	coap_size_t max_len = 0;
+	const char* content;
+	int i;
+
+	require_noerr(smcp_outbound_begin(self, COAP_RESULT_205_CONTENT, COAP_TRANS_TYPE_NONCONFIRMABLE), fail);
+
+	for (i = 0; i < gOptionCount; i++) {
+		const struct option_s* const option = &gOptions[order[i]];
+
+		require_noerr(smcp_outbound_add_option(option->key, (const char*)option->value, option->len), fail);
+	}
+
+	content = smcp_outbound_get_content_ptr(&max_len);
+	require(content != NULL, fail);
+
+	*len = (coap_size_t)(content - (const char*)self->outbound.packet);
+	memcpy(packet, self->outbound.packet, *len);
+
+	return;
+
+fail:
+	fprintf(stderr, "Unable to compose a message with %d options\n", gOptionCount);
+	exit(EXIT_FAILURE);
+}
+
+static void
+check_message(uint32_t message) {
+	int sorted[MAX_OPTIONS];
+	int shuffled[MAX_OPTIONS];
+	uint8_t packet[SMCP_MAX_PACKET_LENGTH];
+	coap_size_t len;
+	int i, j;
+
+	make_options();
+
+	// Stable sort by key, so options with the same key stay in order.
+	for (i = 0; i < gOptionCount; i++) {
+		for (j = i; (j > 0) && (gOptions[sorted[j - 1]].key > gOptions[i].key); j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = i;
+	}
+
+	compose(sorted, gExpected, &gExpectedLen);
+
+	// Shuffle the options, but keep the ones with the same
+	// key in the same relative order.
+	for (i = 0; i < gOptionCount; i++) {
+		shuffled[i] = i;
+	}
+
+	for (i = gOptionCount - 1; i > 0; i--) {
+		const int k = (int)(next_random() % (uint32_t)(i + 1));
+		const int tmp = shuffled[i];
+		shuffled[i] = shuffled[k];
+		shuffled[k] = tmp;
+	}
+
+	for (i = 0; i < gOptionCount; i++) {
+		for (j = i + 1; j < gOptionCount; j++) {
+			if ( gOptions[shuffled[i]].key == gOptions[shuffled[j]].key
+			  && shuffled[i] > shuffled[j]
+			) {
+				const int tmp = shuffled[i];
+				shuffled[i] = shuffled[j];
+				shuffled[j] = tmp;
+			}
+		}
+	}
+
+	compose(shuffled, packet, &len);
+
+	// The message ids are different, so skip them.
+	if ( (len != gExpectedLen)
+	  || (memcmp(packet, gExpected, 2) != 0)
+	  || (memcmp(packet + 4, gExpected + 4, len - 4) != 0)
+	) {
+		fprintf(stderr, "Message %u with %d options: MISMATCH (%u bytes, expected %u)\n",
+			message,
+			gOptionCount,
+			len,
+			gExpectedLen
+		);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int
+main(void) {
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+	static const int limits[] = { 0, 1, 2, SMCP_CONF_OUTBOUND_STAGED_OPTIONS };
+#else
+	static const int limits[] = { 0 };
+#endif
+	smcp_t smcp;
+	uint32_t message;
+	size_t i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	smcp = smcp_create();
+
+	if (!smcp) {
+		fprintf(stderr, "Unable to create SMCP instance\n");
+		return EXIT_FAILURE;
+	}
+
+	smcp_set_current_instance(smcp);
+
+	for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+#if SMCP_CONF_OUTBOUND_STAGED_OPTIONS
+		smcp_outbound_set_staged_limit(smcp, limits[i]);
+#endif
+
+		for (message = 0; message < MESSAGES; message++) {
+			check_message(message);
+		}
+
+		printf("%u messages checked with %d staged options\n", MESSAGES, limits[i]);
+	}
+
+	smcp_release(smcp);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,320 @@
+/*!	@page test-route test-route.c: Node router test.
+**
+**	This test builds a random node tree and routes requests for random
+**	paths through it with `smcp_node_route()`, checking each one
+**	against a walk of the same path with `smcp_node_find()`. Both must
+**	end up at the same node, and leave the same Uri-Path options for
+**	the handler to read.
+**
+**	It then adds nodes with `smcp_node_init()` and deletes subtrees
+**	with `smcp_node_delete()`, and checks again after each change, so
+**	that routes compiled before the change are never used after it.
+**
+**	@include test-route.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <smcp/smcp.h>
+#include <smcp/smcp-node-router.h>
+#include "fake-inbound.h"
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_CONF_NODE_ROUTER
+
+#define INITIAL_NODES			(2000)
+
+// Attempts, some of which pick a name that is already taken.
+#define ADDED_NODES				(200)
+#define DELETIONS				(20)
+// Small enough that the message ids don't wrap around.
+#define LOOKUPS					(1000)
+#define MAX_DEPTH				(6)
+
+static const char* const gNames[] = {
+	"a", "b", "c", "d", "e", "f", "g", "h",
+	"dev", "var", "sensor", "temperature", "x1", "x2", "x10", "",
+};
+
+#define NAME_COUNT				(sizeof(gNames) / sizeof(gNames[0]))
+
+static struct smcp_node_s gRoot;
+static smcp_node_t gNodes[INITIAL_NODES + ADDED_NODES];
+static int gNodeCount;
+
+static const char* gPath[MAX_DEPTH];
+static int gPathLen;
+
+//! How many segments of the path smcp_node_find() resolved.
+static int gFound;
+
+static smcp_node_t gRouted;
+static bool gRemainingMatches;
+
+static uint32_t gRandomState = 0x12345678;
+
+static uint32_t
+next_random(void) {
+	// xorshift32
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+	return gRandomState;
+}
+
+static int
+get_depth(smcp_node_t node) {
+	int depth = 0;
+
+	for (; node != &gRoot; node = node->parent) {
+		depth++;
+	}
+
+	return depth;
+}
+
+//! Adds a node with a random name below a random node.
+static void
+add_random_node(void) {
+	smcp_node_t parent = &gRoot;
+	const char* name;
+	smcp_node_t node;
+
+	if (gNodeCount && (next_random() % 8)) {
+		parent = gNodes[next_random() % gNodeCount];
+	}
+
+	if (get_depth(parent) >= MAX_DEPTH - 1) {
+		parent = &gRoot;
+	}
+
+	name = gNames[next_random() % NAME_COUNT];
+
+	// Sibling names must be unique for the path to mean anything.
+	if (smcp_node_find(parent, name, (int)strlen(name)) != NULL) {
+		return;
+	}
+
+	node = smcp_node_init(NULL, parent, name);
+
+	if (node == NULL) {
+		fprintf(stderr, "Unable to allocate a node\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gNodes[gNodeCount++] = node;
+}
+
+//! Deletes a random node along with everything below it.
+static void
+delete_random_subtree(void) {
+	smcp_node_t const victim = gNodes[next_random() % gNodeCount];
+	int i, j;
+
+	// Forget about everything that is about to be freed.
+	for (i = 0, j = 0; i < gNodeCount; i++) {
+		smcp_node_t node;
+
+		for (node = gNodes[i]; (node != &gRoot) && (node != victim); node = node->parent) {
+		}
+
+		if (node != victim) {
+			gNodes[j++] = gNodes[i];
+		}
+	}
+
+	gNodeCount = j;
+
+	smcp_node_delete(victim);
+}
+
+//! Makes up a path that mostly, but not always, leads somewhere.
+static void
+make_path(void) {
+	gPathLen = 0;
+
+	if (gNodeCount && (next_random() % 4)) {
+		smcp_node_t node = gNodes[next_random() % gNodeCount];
+		int depth = get_depth(node);
+
+		gPathLen = depth;
+
+		for (; node != &gRoot; node = node->parent) {
+			gPath[--depth] = node->name;
+		}
+	}
+
+	// Sometimes go further than any node.
+	while ((gPathLen < MAX_DEPTH) && ((gPathLen == 0) || (next_random() % 3 == 0))) {
+		gPath[gPathLen++] = gNames[next_random() % NAME_COUNT];
+	}
+}
+
+static smcp_status_t
+route_handler(void* context) {
+	smcp_request_handler_func func = NULL;
+	void* node = NULL;
+	coap_option_key_t key;
+	const uint8_t* value;
+	coap_size_t value_len;
+	int i = gFound;
+
+	if (smcp_node_route((smcp_node_t)context, &func, &node) != SMCP_STATUS_OK) {
+		fprintf(stderr, "smcp_node_route() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gRouted = (smcp_node_t)node;
+	gRemainingMatches = true;
+
+	// What's left of the path is for the handler to read, and must
+	// be what smcp_node_find() couldn't resolve.
+	while ((key = smcp_inbound_next_option(&value, &value_len)) != COAP_OPTION_INVALID) {
+		if (key != COAP_OPTION_URI_PATH) {
+			continue;
+		}
+		if ( (i >= gPathLen)
+		  || (value_len != strlen(gPath[i]))
+		  || (memcmp(value, gPath[i], value_len) != 0)
+		) {
+			gRemainingMatches = false;
+		}
+		i++;
+	}
+
+	if (i != gPathLen) {
+		gRemainingMatches = false;
+	}
+
+	return SMCP_STATUS_OK;
+}
+
+static void
+check_lookups(smcp_t instance, const char* phase) {
+	static uint16_t msg_id;
+	int lookup;
+
+	for (lookup = 0; lookup < LOOKUPS; lookup++) {
+		smcp_sockaddr_t saddr = {
+			.sin6_family = AF_INET6,
+			.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+			.sin6_port = htons(1024),
+		};
+		uint8_t packet[128] = {
+			0x50, COAP_METHOD_GET, 0x00, 0x00,		// NON GET, msg_id
+		};
+		uint8_t* ptr = packet + 4;
+		coap_option_key_t prev_key = 0;
+		smcp_node_t expected = &gRoot;
+		int i;
+
+		make_path();
+
+		for (i = 0; i < gPathLen; i++) {
+			ptr = coap_encode_option(ptr, prev_key, COAP_OPTION_URI_PATH, (const uint8_t*)gPath[i], (coap_size_t)strlen(gPath[i]));
+			prev_key = COAP_OPTION_URI_PATH;
+		}
+
+		for (gFound = 0; gFound < gPathLen; gFound++) {
+			smcp_node_t next = smcp_node_find(expected, gPath[gFound], (int)strlen(gPath[gFound]));
+
+			if (next == NULL) {
+				break;
+			}
+			expected = next;
+		}
+
+		msg_id++;
+		packet[2] = (uint8_t)(msg_id >> 8);
+		packet[3] = (uint8_t)msg_id;
+
+		gRouted = NULL;
+		gRemainingMatches = false;
+
+		fake_inbound_packet(instance, &saddr, packet, (coap_size_t)(ptr - packet));
+
+		if ((gRouted != expected) || !gRemainingMatches) {
+			fprintf(stderr, "%s: Lookup %d of a path with %d segments went to %p, expected %p after %d segments%s\n",
+				phase,
+				lookup,
+				gPathLen,
+				(void*)gRouted,
+				(void*)expected,
+				gFound,
+				gRemainingMatches ? "" : ", with the wrong segments left over"
+			);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("%s: %d lookups of %d nodes\n", phase, LOOKUPS, gNodeCount);
+}
+
+int
+main(void) {
+	smcp_t instance;
+	int i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+
+	if (!instance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_node_init(&gRoot, NULL, NULL);
+	smcp_set_default_request_handler(instance, &route_handler, &gRoot);
+
+	while (gNodeCount < INITIAL_NODES) {
+		add_random_node();
+	}
+
+	check_lookups(instance, "Initial");
+
+	// Routes compiled so far must not hide new nodes.
+	for (i = 0; i < ADDED_NODES; i++) {
+		add_random_node();
+
+		if (i % 20 == 0) {
+			check_lookups(instance, "Added");
+		}
+	}
+
+	check_lookups(instance, "Added");
+
+	// Nor lead to deleted ones.
+	for (i = 0; i < DELETIONS; i++) {
+		delete_random_subtree();
+		check_lookups(instance, "Deleted");
+	}
+
+	smcp_release(instance);
+	smcp_node_delete(&gRoot);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_CONF_NODE_ROUTER
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_CONF_NODE_ROUTER
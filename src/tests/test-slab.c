@@ -0,0 +1,194 @@
+/*!	@page test-slab test-slab.c: Slab allocator test.
+**
+**	This test makes a long series of requests, starting each one
+**	from the callback of the one before it, and checks that the
+**	transactions were all recycled through the slab of the instance
+**	instead of it reserving more and more memory.
+**
+**	@include test-slab.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <smcp/smcp.h>
+
+#define NUMBER_OF_REQUESTS			(256)
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_CONF_SLAB
+
+static char* gURL;
+static int gRemaining = NUMBER_OF_REQUESTS;
+static int gStarted;
+
+static smcp_status_t
+request_handler(void* context) {
+	if(smcp_inbound_get_code() != COAP_METHOD_GET)
+		return SMCP_STATUS_NOT_IMPLEMENTED;
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+
+	smcp_outbound_append_content("Hello world!", SMCP_CSTR_LEN);
+
+	return smcp_outbound_send();
+}
+
+static smcp_status_t
+resend_request(void* context)
+{
+	smcp_status_t status;
+
+	status = smcp_outbound_begin(
+		smcp_get_current_instance(),
+		COAP_METHOD_GET,
+		COAP_TRANS_TYPE_CONFIRMABLE
+	);
+	require_noerr(status, bail);
+
+	status = smcp_outbound_set_uri(gURL, 0);
+	require_noerr(status, bail);
+
+	status = smcp_outbound_send();
+
+bail:
+	return status;
+}
+
+static void start_request(smcp_t instance);
+
+static smcp_status_t
+response_handler(int statuscode, void* context)
+{
+	smcp_t const instance = (smcp_t)context;
+
+	if (statuscode == SMCP_STATUS_TRANSACTION_INVALIDATED) {
+		printf("Request %d finished\n", NUMBER_OF_REQUESTS - gRemaining);
+		if (--gRemaining > 0) {
+			// Called from the event loop, so this one comes from the slab.
+			start_request(instance);
+		}
+	} else if (statuscode != COAP_RESULT_205_CONTENT) {
+		fprintf(stderr, "Got unexpected status code %d (%s)\n", statuscode, smcp_status_to_cstr(statuscode));
+		exit(EXIT_FAILURE);
+	}
+
+	return SMCP_STATUS_OK;
+}
+
+static void
+start_request(smcp_t instance)
+{
+	smcp_transaction_t transaction;
+
+	transaction = smcp_transaction_init(
+		NULL,
+		SMCP_TRANSACTION_ALWAYS_INVALIDATE,
+		&resend_request,
+		&response_handler,
+		(void*)instance
+	);
+
+	if (!transaction) {
+		fprintf(stderr, "Unable to allocate transaction %d\n", gStarted);
+		exit(EXIT_FAILURE);
+	}
+
+	if (smcp_transaction_begin(instance, transaction, 3*MSEC_PER_SEC) != SMCP_STATUS_OK) {
+		fprintf(stderr, "Unable to begin transaction %d\n", gStarted);
+		exit(EXIT_FAILURE);
+	}
+
+	gStarted++;
+}
+
+int
+main(void) {
+	smcp_t instance;
+	smcp_t client;
+	struct smcp_slab_stats_s stats;
+	smcp_timestamp_t start_time;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	instance = smcp_create();
+	client = smcp_create();
+
+	if (!instance || !client) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_plat_bind_to_port(instance, SMCP_SESSION_TYPE_UDP, 0);
+	smcp_plat_bind_to_port(client, SMCP_SESSION_TYPE_UDP, 0);
+
+	smcp_set_default_request_handler(instance, &request_handler, NULL);
+
+	asprintf(&gURL, "coap://localhost:%d/", smcp_plat_get_port(instance));
+
+	start_request(client);
+
+	start_time = smcp_plat_cms_to_timestamp(0);
+
+	while (gRemaining > 0) {
+		if (-smcp_plat_timestamp_to_cms(start_time) > MSEC_PER_SEC*10) {
+			fprintf(stderr,"TIMEOUT\n");
+			return EXIT_FAILURE;
+		}
+		smcp_plat_wait(instance, 10);
+		smcp_plat_process(instance);
+		smcp_plat_process(client);
+	}
+
+	if (smcp_slab_get_stats(client, &stats) != SMCP_STATUS_OK) {
+		fprintf(stderr, "smcp_slab_get_stats() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf(
+		"live:%d peak:%d failed:%d reserved:%d\n",
+		(int)stats.live,
+		(int)stats.peak,
+		(int)stats.failed,
+		(int)stats.reserved
+	);
+
+	// Every transaction but the first came from the slab, and they
+	// only ever overlapped with the one that started them.
+	if ( stats.live != 0
+	  || stats.peak == 0
+	  || stats.peak > 2
+	  || stats.failed != 0
+	  || stats.reserved != SMCP_CONF_SLAB_CHUNK_SIZE
+	) {
+		fprintf(stderr, "Transactions weren't recycled\n");
+		return EXIT_FAILURE;
+	}
+
+	smcp_release(client);
+	smcp_release(instance);
+	free(gURL);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_CONF_SLAB
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_CONF_SLAB
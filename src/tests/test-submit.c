@@ -0,0 +1,212 @@
+/*!	@page test-submit test-submit.c: Cross-thread submission test.
+**
+**	This test has several threads submit requests to an SMCP
+**	instance that is running on the main thread, and checks the
+**	responses that are delivered back to them through their
+**	completion queues.
+**
+**	@include test-submit.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+
+#include <smcp/assert-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <smcp/smcp.h>
+
+#define NUMBER_OF_THREADS			(8)
+#define SUBMISSIONS_PER_THREAD		(16)
+
+#if !VERBOSE_DEBUG
+#define printf(...)		do { } while(0)
+#endif
+
+#if SMCP_CONF_SUBMIT_QUEUE
+
+static smcp_status_t
+request_handler(void* context) {
+	if(smcp_inbound_get_code() != COAP_METHOD_GET)
+		return SMCP_STATUS_NOT_IMPLEMENTED;
+
+	smcp_outbound_begin_response(COAP_RESULT_205_CONTENT);
+
+	smcp_outbound_add_option_uint(
+		COAP_OPTION_CONTENT_TYPE,
+		COAP_CONTENT_TYPE_TEXT_PLAIN
+	);
+
+	smcp_outbound_append_content("Hello world!", SMCP_CSTR_LEN);
+
+	return smcp_outbound_send();
+}
+
+static smcp_t gInstance;
+static char* gURL;
+static int gThreadsRemaining = NUMBER_OF_THREADS;
+
+struct test_submit_thread_s {
+	pthread_t pt;
+	int index;
+	int remaining;
+	pthread_t self;
+	struct smcp_submission_s submissions[SUBMISSIONS_PER_THREAD];
+	char responses[SUBMISSIONS_PER_THREAD][32];
+};
+
+static void
+test_submit_callback(struct smcp_submission_s* submission)
+{
+	struct test_submit_thread_s* obj = (struct test_submit_thread_s*)submission->context;
+	const int i = (int)(submission - obj->submissions);
+
+	if (!pthread_equal(pthread_self(), obj->self)) {
+		fprintf(stderr, "%d: Callback called on the wrong thread\n", obj->index);
+		exit(EXIT_FAILURE);
+	}
+
+	if ( submission->status != SMCP_STATUS_OK
+	  || submission->response_code != COAP_RESULT_205_CONTENT
+	  || submission->response_len != sizeof("Hello world!") - 1
+	  || memcmp(obj->responses[i], "Hello world!", submission->response_len) != 0
+	) {
+		fprintf(
+			stderr,
+			"%d: Submission %d failed: %d (%s), code %d\n",
+			obj->index,
+			i,
+			submission->status,
+			smcp_status_to_cstr(submission->status),
+			submission->response_code
+		);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d: Submission %d finished\n", obj->index, i);
+
+	obj->remaining--;
+}
+
+static void*
+thread_main(void* context) {
+	struct test_submit_thread_s* obj = (struct test_submit_thread_s*)context;
+	smcp_completion_queue_t queue;
+	int i;
+
+	obj->self = pthread_self();
+
+	queue = smcp_completion_queue_create();
+
+	if (!queue) {
+		perror("Unable to create completion queue");
+		exit(EXIT_FAILURE);
+	}
+
+	obj->remaining = SUBMISSIONS_PER_THREAD;
+
+	for (i = 0; i < SUBMISSIONS_PER_THREAD; i++) {
+		struct smcp_submission_s* const submission = &obj->submissions[i];
+
+		memset(submission, 0, sizeof(*submission));
+		submission->method = COAP_METHOD_GET;
+		submission->uri = gURL;
+		submission->timeout = 5 * MSEC_PER_SEC;
+		submission->response = obj->responses[i];
+		submission->response_max_len = sizeof(obj->responses[i]);
+		submission->callback = &test_submit_callback;
+		submission->context = obj;
+		submission->completion_queue = queue;
+
+		if (smcp_submit(gInstance, submission) != SMCP_STATUS_OK) {
+			fprintf(stderr, "%d: smcp_submit() failed\n", obj->index);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	while (obj->remaining > 0) {
+		if (smcp_completion_queue_wait(queue, 10 * MSEC_PER_SEC) == SMCP_STATUS_TIMEOUT) {
+			fprintf(stderr, "%d: TIMEOUT\n", obj->index);
+			exit(EXIT_FAILURE);
+		}
+		smcp_completion_queue_process(queue);
+	}
+
+	smcp_completion_queue_release(queue);
+
+	__atomic_sub_fetch(&gThreadsRemaining, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+int
+main(void) {
+	struct test_submit_thread_s* threads;
+	smcp_timestamp_t start_time = smcp_plat_cms_to_timestamp(0);
+	int i;
+
+	SMCP_LIBRARY_VERSION_CHECK();
+
+	gInstance = smcp_create();
+
+	if (!gInstance) {
+		perror("Unable to create SMCP instance");
+		exit(EXIT_FAILURE);
+	}
+
+	smcp_plat_bind_to_port(gInstance, SMCP_SESSION_TYPE_UDP, 0);
+
+	printf("Main Listening on port %d\n", smcp_plat_get_port(gInstance));
+
+	asprintf(&gURL, "coap://localhost:%d/", smcp_plat_get_port(gInstance));
+
+	smcp_set_default_request_handler(gInstance, &request_handler, NULL);
+
+	threads = calloc(NUMBER_OF_THREADS, sizeof(*threads));
+
+	for (i = 0; i < NUMBER_OF_THREADS; i++) {
+		threads[i].index = i;
+		pthread_create(
+			&threads[i].pt,
+			NULL,
+			&thread_main,
+			(void*)&threads[i]
+		);
+	}
+
+	// The instance itself is only ever touched from this thread.
+	while (__atomic_load_n(&gThreadsRemaining, __ATOMIC_ACQUIRE) > 0) {
+		if (-smcp_plat_timestamp_to_cms(start_time) > MSEC_PER_SEC*10) {
+			fprintf(stderr,"TIMEOUT\n");
+			return EXIT_FAILURE;
+		}
+		smcp_plat_wait(gInstance, 100);
+		smcp_plat_process(gInstance);
+	}
+
+	for (i = 0; i < NUMBER_OF_THREADS; i++) {
+		pthread_join(threads[i].pt, NULL);
+	}
+
+	smcp_release(gInstance);
+	free(threads);
+	free(gURL);
+
+	return EXIT_SUCCESS;
+}
+
+#else // SMCP_CONF_SUBMIT_QUEUE
+
+int
+main(void) {
+	// Nothing to test in this configuration.
+	return EXIT_SUCCESS;
+}
+
+#endif // SMCP_CONF_SUBMIT_QUEUE